@@ -0,0 +1,367 @@
+// Emulation speed benchmark.
+//
+// Runs each workload on each engine, reporting emulated MHz, instructions per
+// second and host nanoseconds per instruction, as a table, JSON or CSV:
+//
+//   bench [--format text|json|csv] [--reps N] [--warmup N] [--cycles N]
+//         [--workload name] [--engine name] [--functional path]
+//
+// Each run starts from a freshly loaded image, so block caches and the JIT
+// pay for their translation in every run. Every engine must end in the same
+// state as cpu_exec; if one doesn't, bench says so and exits with status 1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu.h"
+#include "cpu_bbc.h"
+#include "cpu_jit.h"
+#include "cpu_cycle.h"
+
+#ifndef BENCH_RES
+#define BENCH_RES "test/res"
+#endif
+
+// cycles the functional test takes to reach its success trap
+#define FUNCTIONAL_CYCLES 84024376
+
+typedef struct {
+    u8 mem[0x10000];
+    cpu_state_t cpu;
+    u64 touched; // what the bus log engine's consumer adds up
+} machine_t;
+
+static u8 bus_read_fn(void *user, u16 addr) { return ((machine_t *)user)->mem[addr]; }
+static void bus_write_fn(void *user, u8 val, u16 addr) { ((machine_t *)user)->mem[addr] = val; }
+
+static void bus_log_fn(void *user, const cpu_bus_rec_t *recs, u32 n) {
+    machine_t *m = user;
+    for (u32 i = 0; i < n; i++) m->touched += recs[i].addr;
+}
+
+// synthetic kernels, all loaded at $0400 and looping forever
+
+// copies $1000-$10FF to $2000-$20FF with absolute,Y
+static const u8 k_memcpy[] = {
+    0xA0, 0x00,             // 0400 ldy #0
+    0xB9, 0x00, 0x10,       // 0402 lda $1000,y
+    0x99, 0x00, 0x20,       // 0405 sta $2000,y
+    0xC8,                   // 0408 iny
+    0xD0, 0xF7,             // 0409 bne $0402
+    0x4C, 0x00, 0x04,       // 040b jmp $0400
+};
+
+// 8x8 shift-and-add multiply, called through JSR with changing operands
+static const u8 k_multiply[] = {
+    0xE6, 0x10,             // 0400 inc $10
+    0xA5, 0x10,             // 0402 lda $10
+    0x85, 0x20,             // 0404 sta $20
+    0x49, 0x5A,             // 0406 eor #$5a
+    0x85, 0x21,             // 0408 sta $21
+    0x20, 0x10, 0x04,       // 040a jsr $0410
+    0x4C, 0x00, 0x04,       // 040d jmp $0400
+    0xA9, 0x00,             // 0410 lda #0
+    0xA2, 0x08,             // 0412 ldx #8
+    0x46, 0x20,             // 0414 lsr $20
+    0x90, 0x03,             // 0416 bcc $041b
+    0x18,                   // 0418 clc
+    0x65, 0x21,             // 0419 adc $21
+    0x6A,                   // 041b ror a
+    0x66, 0x22,             // 041c ror $22
+    0xCA,                   // 041e dex
+    0xD0, 0xF3,             // 041f bne $0414
+    0x85, 0x23,             // 0421 sta $23
+    0x60,                   // 0423 rts
+};
+
+// branches on the bits of an 8-bit LFSR at $30, so they are hard to predict
+static const u8 k_branchy[] = {
+    0xA5, 0x30,             // 0400 lda $30
+    0x0A,                   // 0402 asl a
+    0x90, 0x02,             // 0403 bcc $0407
+    0x49, 0x1D,             // 0405 eor #$1d
+    0x85, 0x30,             // 0407 sta $30
+    0x30, 0x04,             // 0409 bmi $040f
+    0xE6, 0x31,             // 040b inc $31
+    0xD0, 0x02,             // 040d bne $0411
+    0xC6, 0x32,             // 040f dec $32
+    0x29, 0x03,             // 0411 and #3
+    0xF0, 0x04,             // 0413 beq $0419
+    0xC9, 0x02,             // 0415 cmp #2
+    0xB0, 0x02,             // 0417 bcs $041b
+    0xE6, 0x33,             // 0419 inc $33
+    0x4C, 0x00, 0x04,       // 041b jmp $0400
+};
+
+// sums 16 pages through ($40),y, starting mid-page so half the reads cross
+static const u8 k_tablewalk[] = {
+    0xA9, 0x80,             // 0400 lda #$80
+    0x85, 0x40,             // 0402 sta $40
+    0xA9, 0x10,             // 0404 lda #$10
+    0x85, 0x41,             // 0406 sta $41
+    0xA2, 0x10,             // 0408 ldx #16
+    0xA0, 0x00,             // 040a ldy #0
+    0x18,                   // 040c clc
+    0x71, 0x40,             // 040d adc ($40),y
+    0xC8,                   // 040f iny
+    0xD0, 0xFA,             // 0410 bne $040c
+    0xE6, 0x41,             // 0412 inc $41
+    0xCA,                   // 0414 dex
+    0xD0, 0xF3,             // 0415 bne $040a
+    0x85, 0x42,             // 0417 sta $42
+    0x4C, 0x00, 0x04,       // 0419 jmp $0400
+};
+
+// counts in a loop while the driver raises IRQ every slice and NMI every
+// tenth; the handler at $0410 serves both
+static const u8 k_interrupts[] = {
+    0x58,                   // 0400 cli
+    0xE6, 0x50,             // 0401 inc $50
+    0x4C, 0x01, 0x04,       // 0403 jmp $0401
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x48,                   // 0410 pha
+    0xE6, 0x51,             // 0411 inc $51
+    0xA5, 0x51,             // 0413 lda $51
+    0x68,                   // 0415 pla
+    0x40,                   // 0416 rti
+};
+
+// waits for the interrupt handler at $0410 to set a flag, like a game loop
+// waiting for vblank, then counts the frame and waits again
+static const u8 k_idle[] = {
+    0x58,                   // 0400 cli
+    0xA5, 0x60,             // 0401 lda $60
+    0xF0, 0xFC,             // 0403 beq $0401
+    0xC6, 0x60,             // 0405 dec $60
+    0xE6, 0x61,             // 0407 inc $61
+    0x4C, 0x01, 0x04,       // 0409 jmp $0401
+    0, 0, 0, 0,
+    0xE6, 0x60,             // 0410 inc $60
+    0x40,                   // 0412 rti
+};
+
+typedef struct {
+    const char *name;
+    const u8 *code;     // NULL for the functional test image
+    u32 len;
+    u32 slice;          // cycles between returns to the driver
+    u8 interrupts;      // raise IRQ after every slice, NMI after every tenth
+} workload_t;
+
+static const workload_t workloads[] = {
+    { "functional", NULL, 0, 10000, 0 },
+    { "memcpy", k_memcpy, sizeof(k_memcpy), 10000, 0 },
+    { "multiply", k_multiply, sizeof(k_multiply), 10000, 0 },
+    { "branchy", k_branchy, sizeof(k_branchy), 10000, 0 },
+    { "tablewalk", k_tablewalk, sizeof(k_tablewalk), 10000, 0 },
+    { "interrupts", k_interrupts, sizeof(k_interrupts), 100, 1 },
+    { "idle", k_idle, sizeof(k_idle), 10000, 1 },
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+enum { ENGINE_EXEC, ENGINE_CYCLE, ENGINE_CALLBACKS, ENGINE_BUSLOG, ENGINE_RUN, ENGINE_BBC, ENGINE_JIT,
+    ENGINE_IDLE, NENGINES };
+static const char *const engines[NENGINES] = {
+    "exec",         // cpu_exec per instruction, mapped memory
+    "cycle",        // cpu_step_cycle per cycle, mapped memory
+    "callbacks",    // cpu_run, every access through the bus callbacks
+    "buslog",       // cpu_run, mapped memory, every access in the bus log
+    "run",          // cpu_run, mapped memory
+    "bbc",          // cpu_run with the block cache
+    "jit",          // cpu_run with the JIT
+    "idle",         // cpu_run, mapped memory, idle loops fast-forwarded
+};
+
+static u8 functional_image[0x10000];
+static cpu_bbc_t bbc;
+
+static double now(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void setup(machine_t *m, const workload_t *w, int engine, cpu_jit_t *jit) {
+    memset(m, 0, sizeof(*m));
+    if (w->code) {
+        memcpy(m->mem + 0x400, w->code, w->len);
+        for (int i = 0; i < 0x1000; i++) m->mem[0x1000 + i] = i * 7;
+        m->mem[0x30] = 1; // LFSR seed
+        m->mem[0xFFFA] = m->mem[0xFFFE] = 0x10;
+        m->mem[0xFFFB] = m->mem[0xFFFF] = 0x04;
+    } else {
+        memcpy(m->mem, functional_image, sizeof(m->mem));
+    }
+    cpu_state_t *st = &m->cpu;
+    st->user = m;
+    st->bus_read = &bus_read_fn;
+    st->bus_write = &bus_write_fn;
+    st->PC = 0x400;
+    st->S = 0xFF;
+    cpu_set_p(st, 0x30);
+    if (engine != ENGINE_CALLBACKS) cpu_map(st, 0, 0x10000, m->mem, 0);
+    if (engine == ENGINE_BUSLOG) st->bus_log = &bus_log_fn;
+    if (engine == ENGINE_BBC) cpu_bbc_attach(st, &bbc);
+    if (engine == ENGINE_JIT) cpu_jit_attach(st, jit);
+    if (engine == ENGINE_IDLE) st->next_event = ~0ull;
+}
+
+// runs the workload for at least cycles cycles. returns the instructions
+// executed when counting (exec only), or -1 on an illegal opcode
+static int64_t drive(machine_t *m, const workload_t *w, int engine, u64 cycles) {
+    cpu_state_t *st = &m->cpu;
+    int64_t instrs = 0;
+    for (u32 n = 1; st->cycles < cycles; n++) {
+        u64 left = cycles - st->cycles;
+        u32 slice = left < w->slice ? (u32)left : w->slice;
+        if (engine == ENGINE_EXEC) {
+            u64 target = st->cycles + slice;
+            while (st->cycles < target) {
+                if (cpu_exec(st) < 0) return -1;
+                instrs++;
+            }
+        } else if (engine == ENGINE_CYCLE) {
+            // up to the end of an instruction, like cpu_run
+            u64 target = st->cycles + slice;
+            while (st->cycles < target || st->cyc_step) {
+                if (cpu_step_cycle(st) < 0) return -1;
+            }
+        } else if (cpu_run(st, slice) < 0) {
+            return -1;
+        }
+        if (w->interrupts) {
+            st->IRQ = 1;
+            if (n % 10 == 0) st->NMI = 1;
+        }
+    }
+    return instrs;
+}
+
+// a digest of everything an engine could get wrong
+static u64 state_hash(machine_t *m) {
+    cpu_state_t *st = &m->cpu;
+    u64 h = 1469598103934665603ull;
+    for (int i = 0; i < 0x10000; i++) h = (h ^ m->mem[i]) * 1099511628211ull;
+    u8 regs[] = { st->A, st->X, st->Y, st->S, cpu_get_p(st), st->PC & 0xFF, st->PC >> 8 };
+    for (u32 i = 0; i < sizeof(regs); i++) h = (h ^ regs[i]) * 1099511628211ull;
+    return (h ^ st->cycles) * 1099511628211ull;
+}
+
+typedef struct {
+    const char *workload, *engine;
+    u64 cycles;
+    int64_t instrs;
+    int reps;
+    double best, median; // seconds
+    int ok;
+} result_t;
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_result(const result_t *r, const char *format, int first) {
+    double mhz = r->cycles / r->best / 1e6, mips = r->instrs / r->best / 1e6;
+    double ns = r->best * 1e9 / r->instrs;
+    if (strcmp(format, "json") == 0) {
+        printf("%s  {\"workload\": \"%s\", \"engine\": \"%s\", \"cycles\": %llu, "
+                "\"instructions\": %lld, \"reps\": %d, \"best_s\": %.6f, \"median_s\": %.6f, "
+                "\"mhz\": %.2f, \"mips\": %.2f, \"ns_per_instr\": %.3f, \"matches_exec\": %s}",
+                first ? "" : ",\n", r->workload, r->engine, (unsigned long long)r->cycles,
+                (long long)r->instrs, r->reps, r->best, r->median, mhz, mips, ns,
+                r->ok ? "true" : "false");
+    } else if (strcmp(format, "csv") == 0) {
+        if (first)
+            printf("workload,engine,cycles,instructions,reps,best_s,median_s,mhz,mips,ns_per_instr,matches_exec\n");
+        printf("%s,%s,%llu,%lld,%d,%.6f,%.6f,%.2f,%.2f,%.3f,%d\n", r->workload, r->engine,
+                (unsigned long long)r->cycles, (long long)r->instrs, r->reps, r->best, r->median,
+                mhz, mips, ns, r->ok);
+    } else {
+        if (first)
+            printf("%-12s %-10s %12s %10s %10s %10s %8s\n", "workload", "engine", "cycles",
+                    "best ms", "MHz", "MIPS", "ns/inst");
+        printf("%-12s %-10s %12llu %10.2f %10.1f %10.1f %8.2f%s\n", r->workload, r->engine,
+                (unsigned long long)r->cycles, r->best * 1e3, mhz, mips, ns,
+                r->ok ? "" : "  MISMATCH");
+    }
+}
+
+static const char *arg_value(int argc, char **argv, const char *name, const char *def) {
+    for (int i = 1; i + 1 < argc; i++)
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    return def;
+}
+
+int main(int argc, char **argv) {
+    const char *format = arg_value(argc, argv, "--format", "text");
+    int reps = atoi(arg_value(argc, argv, "--reps", "5"));
+    int warmup = atoi(arg_value(argc, argv, "--warmup", "1"));
+    u64 cycles = strtoull(arg_value(argc, argv, "--cycles", "20000000"), NULL, 10);
+    const char *only_workload = arg_value(argc, argv, "--workload", NULL);
+    const char *only_engine = arg_value(argc, argv, "--engine", NULL);
+    const char *functional = arg_value(argc, argv, "--functional",
+            BENCH_RES "/6502_functional_test.bin");
+    if (reps < 1) reps = 1;
+
+    FILE *f = fopen(functional, "rb");
+    if (!f || fread(functional_image, 1, sizeof(functional_image), f) != sizeof(functional_image)) {
+        fprintf(stderr, "can't read %s\n", functional);
+        return 2;
+    }
+    fclose(f);
+
+    machine_t *m = malloc(sizeof(*m));
+    cpu_jit_t *jit = cpu_jit_create(16 << 20, 8);
+    double *times = malloc(reps * sizeof(*times));
+    int first = 1, failed = 0;
+    if (strcmp(format, "json") == 0) printf("[\n");
+
+    for (u32 wi = 0; wi < NWORKLOADS; wi++) {
+        const workload_t *w = &workloads[wi];
+        if (only_workload && strcmp(only_workload, w->name) != 0) continue;
+        u64 wcycles = !w->code && cycles > FUNCTIONAL_CYCLES ? FUNCTIONAL_CYCLES : cycles;
+
+        // the reference run counts instructions, untimed
+        setup(m, w, ENGINE_EXEC, NULL);
+        int64_t instrs = drive(m, w, ENGINE_EXEC, wcycles);
+        if (instrs < 0) {
+            fprintf(stderr, "%s: illegal opcode at %04x\n", w->name, m->cpu.PC);
+            return 2;
+        }
+        u64 expect = state_hash(m);
+
+        for (int e = 0; e < NENGINES; e++) {
+            if (only_engine && strcmp(only_engine, engines[e]) != 0) continue;
+            if (e == ENGINE_JIT && !jit) continue;
+            result_t r = { w->name, engines[e], wcycles, instrs, reps, 0, 0, 1 };
+            for (int i = -warmup; i < reps; i++) {
+                setup(m, w, e, jit);
+                double start = now();
+                int64_t res = drive(m, w, e, wcycles);
+                double t = now() - start;
+                if (res < 0 || state_hash(m) != expect) r.ok = 0;
+                if (i >= 0) times[i] = t;
+            }
+            qsort(times, reps, sizeof(*times), cmp_double);
+            r.best = times[0];
+            r.median = times[reps / 2];
+            failed |= !r.ok;
+            print_result(&r, format, first);
+            first = 0;
+            fflush(stdout);
+        }
+    }
+
+    if (strcmp(format, "json") == 0) printf("\n]\n");
+    if (failed) fprintf(stderr, "an engine diverged from cpu_exec\n");
+    cpu_jit_destroy(jit);
+    free(times);
+    free(m);
+    return failed;
+}
@@ -0,0 +1,538 @@
+// Differential fuzzer.
+//
+// Runs random cases on cpu_exec and on every other engine, on all host cores,
+// and checks that they end in the same registers, cycles, interrupt lines and
+// memory. The engines going through the bus callbacks (run, tick, cycle) and
+// the bus log (buslog) must also make the same bus accesses, in the same
+// order, on the same cycles. The mapped ones (map, bbc, jit) leave some pages,
+// picked from the case's seed, to the callbacks, wholly or for writes only,
+// and must make the accesses to those the same way:
+//
+//   fuzz [--seconds N] [--cases N] [--seed N] [--threads N] [--engine name]
+//        [--out dir]
+//   fuzz --replay file...
+//
+// A case is a random 64 KiB image with a legal opcode at a random PC, random
+// registers, sometimes a raised IRQ or NMI line, and a budget of 1 to 48
+// cycles: a single instruction or a short run of them, through whatever the
+// random bytes after it decode to. Each case's content follows from its
+// seed alone, so a run with the same --seed checks the same cases.
+//
+// A diverging case is minimized, shrinking the budget and zeroing the lines,
+// registers and as much of memory as still leaves it diverging, and saved to
+// the --out directory. fuzz --replay reruns saved cases; those copied into
+// fuzz/cases are replayed by the fuzz_replay test. Prints "Success" and
+// exits with status 0 if nothing diverged.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "cpu_opcodes.h"
+#include "cpu_bbc.h"
+#include "cpu_jit.h"
+#include "cpu_cycle.h"
+#include "cpu_batch.h"
+
+#define FUZZ_LOG 512      // bus accesses kept per run
+#define FUZZ_MAX_BUDGET 48
+#define FUZZ_SAVED 8      // diverging cases minimized and saved per run
+
+// how a page of the mapped engines reaches the bus callbacks
+#define FUZZ_IO_NONE 0
+#define FUZZ_IO_WRITES 1  // mapped read-only
+#define FUZZ_IO_ALL 2     // not mapped
+
+enum { FUZZ_RUN, FUZZ_TICK, FUZZ_CYCLE, FUZZ_BUSLOG, FUZZ_MAP, FUZZ_BBC, FUZZ_JIT, FUZZ_BATCH,
+    FUZZ_NENGINES };
+static const char *const engines[FUZZ_NENGINES] = {
+    "run", "tick", "cycle", "buslog", "map", "bbc", "jit", "batch",
+};
+
+static const u8 legal[] = {
+#define OP(opc, instr, kind, mode, idx, cyc) opc,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+typedef struct {
+    u64 seed;
+    u32 budget;
+    u16 PC;
+    u8 A, X, Y, S, P;
+    u8 IRQ, NMI;
+    u8 mem[0x10000];
+} fuzz_case_t;
+
+typedef struct {
+    u64 cycle;
+    u16 addr;
+    u8 val;
+    u8 write;
+} fuzz_access_t;
+
+typedef struct {
+    int res; // 0, or -1 on an illegal opcode
+    u16 PC;
+    u8 A, X, Y, S, P;
+    u8 IRQ, NMI;
+    u64 cycles;
+    u64 ticks;
+    u32 nlog;
+    fuzz_access_t log[FUZZ_LOG];
+    u8 mem[0x10000];
+    u8 io[0x100];
+} fuzz_result_t;
+
+// one per thread: a machine for the engines and the results to compare
+typedef struct {
+    cpu_state_t cpu;
+    u8 mem[0x10000];
+    u32 nlog;
+    fuzz_access_t log[FUZZ_LOG];
+    u64 ticks;
+    cpu_bbc_t bbc;
+    cpu_jit_t *jit;
+    cpu_batch_t batch;
+    fuzz_case_t c;
+    fuzz_case_t min;
+    u8 saved[0x8000];
+    fuzz_result_t ref;
+    fuzz_result_t alt;
+    u8 io[0x100]; // FUZZ_IO_* of each page
+} fuzz_worker_t;
+
+// shared by the threads
+static struct {
+    u64 seed;
+    u64 cases;
+    double deadline;
+    int only;
+    const char *out;
+    pthread_mutex_t lock;
+    u64 next;
+    u64 done;
+    u64 diverged;
+    u64 runs[FUZZ_NENGINES];
+} fuzz;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// splitmix64, so that neighbouring seeds give unrelated cases
+static u64 fuzz_rand(u64 *state) {
+    u64 z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static void fuzz_generate(fuzz_case_t *c, u64 seed) {
+    u64 r = seed;
+    c->seed = seed;
+    for (u32 i = 0; i < sizeof(c->mem); i += 8) {
+        u64 v = fuzz_rand(&r);
+        memcpy(c->mem + i, &v, 8);
+    }
+    u64 v = fuzz_rand(&r);
+    c->PC = (u16)v;
+    c->A = v >> 16;
+    c->X = v >> 24;
+    c->Y = v >> 32;
+    c->S = v >> 40;
+    c->P = v >> 48;
+    v = fuzz_rand(&r);
+    c->mem[c->PC] = legal[v % sizeof(legal)];
+    c->budget = 1 + (v >> 16) % FUZZ_MAX_BUDGET;
+    c->IRQ = (v >> 32) % 8 == 0;
+    c->NMI = (v >> 40) % 16 == 0;
+}
+
+static u8 fuzz_read(void *user, u16 addr) {
+    fuzz_worker_t *w = user;
+    u8 val = w->mem[addr];
+    if (w->nlog < FUZZ_LOG) w->log[w->nlog++] = (fuzz_access_t){ w->cpu.cycles, addr, val, 0 };
+    return val;
+}
+
+static void fuzz_write(void *user, u8 val, u16 addr) {
+    fuzz_worker_t *w = user;
+    w->mem[addr] = val;
+    if (w->nlog < FUZZ_LOG) w->log[w->nlog++] = (fuzz_access_t){ w->cpu.cycles, addr, val, 1 };
+}
+
+// the same accesses, in batches, from mapped memory
+static void fuzz_bus_log(void *user, const cpu_bus_rec_t *recs, u32 n) {
+    fuzz_worker_t *w = user;
+    for (u32 i = 0; i < n && w->nlog < FUZZ_LOG; i++)
+        w->log[w->nlog++] = (fuzz_access_t){ w->cpu.log_cycles + recs[i].cycle, recs[i].addr,
+            recs[i].val, recs[i].write };
+}
+
+static void fuzz_tick(void *user) {
+    ((fuzz_worker_t *)user)->ticks++;
+}
+
+static void fuzz_setup(fuzz_worker_t *w, const fuzz_case_t *c, int engine) {
+    cpu_state_t *st = &w->cpu;
+    memset(st, 0, sizeof(*st));
+    memcpy(w->mem, c->mem, sizeof(w->mem));
+    w->nlog = 0;
+    w->ticks = 0;
+    st->user = w;
+    st->bus_read = &fuzz_read;
+    st->bus_write = &fuzz_write;
+    st->A = c->A;
+    st->X = c->X;
+    st->Y = c->Y;
+    st->S = c->S;
+    st->PC = c->PC;
+    cpu_set_p(st, c->P);
+    st->IRQ = c->IRQ;
+    st->NMI = c->NMI;
+    if (engine == FUZZ_TICK) st->tick = &fuzz_tick;
+    memset(w->io, engine < FUZZ_MAP ? FUZZ_IO_ALL : FUZZ_IO_NONE, sizeof(w->io));
+    if (engine >= FUZZ_BUSLOG) cpu_map(st, 0, 0x10000, w->mem, 0);
+    if (engine >= FUZZ_MAP && engine <= FUZZ_JIT) {
+        // an eighth of the pages each way, the same ones for a case on every engine
+        u64 r = c->seed;
+        for (u32 pg = 0; pg < 0x100; pg++) {
+            u32 v = fuzz_rand(&r) % 8;
+            w->io[pg] = v == 0 ? FUZZ_IO_WRITES : v == 1 ? FUZZ_IO_ALL : FUZZ_IO_NONE;
+            if (w->io[pg] == FUZZ_IO_WRITES) cpu_map(st, pg << 8, 0x100, w->mem + (pg << 8), CPU_PAGE_READONLY);
+            if (w->io[pg] == FUZZ_IO_ALL) cpu_map(st, pg << 8, 0x100, NULL, CPU_PAGE_MMIO);
+        }
+    }
+    if (engine == FUZZ_BUSLOG) st->bus_log = &fuzz_bus_log;
+    if (engine == FUZZ_BBC) cpu_bbc_attach(st, &w->bbc);
+    if (engine == FUZZ_JIT) cpu_jit_attach(st, w->jit);
+}
+
+// runs c on engine, -1 being cpu_exec itself, into r
+static void fuzz_exec(fuzz_worker_t *w, const fuzz_case_t *c, int engine, fuzz_result_t *r) {
+    cpu_state_t *st = &w->cpu;
+    fuzz_setup(w, c, engine);
+    u64 target = st->cycles + c->budget;
+    int res = 0;
+    if (engine < 0) {
+        while (st->cycles < target)
+            if ((res = cpu_exec(st)) < 0) break;
+    } else if (engine == FUZZ_CYCLE) {
+        while (st->cycles < target || st->cyc_step)
+            if ((res = cpu_step_cycle(st)) < 0) break;
+    } else if (engine == FUZZ_BATCH) {
+        cpu_batch_init(&w->batch);
+        cpu_batch_add(&w->batch, st, w->mem);
+        res = cpu_batch_run(&w->batch, c->budget) ? -1 : 0;
+        cpu_batch_get(&w->batch, 0, st);
+    } else {
+        res = cpu_run(st, c->budget);
+    }
+    r->res = res < 0 ? -1 : 0;
+    r->PC = st->PC;
+    r->A = st->A;
+    r->X = st->X;
+    r->Y = st->Y;
+    r->S = st->S;
+    r->P = cpu_get_p(st);
+    r->IRQ = st->IRQ;
+    r->NMI = st->NMI;
+    r->cycles = st->cycles;
+    r->ticks = engine == FUZZ_TICK ? w->ticks : st->cycles;
+    r->nlog = w->nlog;
+    memcpy(r->log, w->log, w->nlog * sizeof(*w->log));
+    memcpy(r->io, w->io, sizeof(r->io));
+    memcpy(r->mem, w->mem, sizeof(r->mem));
+    if (engine == FUZZ_JIT) cpu_jit_attach(st, NULL);
+}
+
+// the batch engine has no interrupts
+static int fuzz_applies(const fuzz_case_t *c, int engine) {
+    return engine != FUZZ_BATCH || (!c->IRQ && !c->NMI);
+}
+
+// whether an access of cpu_exec's, all through the callbacks, reaches them
+// on the pages of a. the bus log counts as a callback
+static int fuzz_seen(const fuzz_result_t *a, const fuzz_access_t *x) {
+    u8 io = a->io[x->addr >> 8];
+    return io == FUZZ_IO_ALL || (io == FUZZ_IO_WRITES && x->write);
+}
+
+// describes how a differs from the reference, or returns 0 if it doesn't
+static int fuzz_differs(const fuzz_result_t *ref, const fuzz_result_t *a, int engine, char *why, size_t n) {
+    if (a->res != ref->res || a->PC != ref->PC || a->A != ref->A || a->X != ref->X
+            || a->Y != ref->Y || a->S != ref->S || a->P != ref->P || a->IRQ != ref->IRQ
+            || a->NMI != ref->NMI || a->cycles != ref->cycles) {
+        snprintf(why, n, "res %d PC %04x A %02x X %02x Y %02x S %02x P %02x lines %d%d cycles %llu, "
+                "expected res %d PC %04x A %02x X %02x Y %02x S %02x P %02x lines %d%d cycles %llu",
+                a->res, a->PC, a->A, a->X, a->Y, a->S, a->P, a->IRQ, a->NMI, (unsigned long long)a->cycles,
+                ref->res, ref->PC, ref->A, ref->X, ref->Y, ref->S, ref->P, ref->IRQ, ref->NMI,
+                (unsigned long long)ref->cycles);
+        return 1;
+    }
+    if (a->ticks != a->cycles) {
+        snprintf(why, n, "%llu ticks in %llu cycles", (unsigned long long)a->ticks,
+                (unsigned long long)a->cycles);
+        return 1;
+    }
+    if (memcmp(a->mem, ref->mem, sizeof(a->mem)) != 0) {
+        for (u32 i = 0; i < 0x10000; i++) {
+            if (a->mem[i] != ref->mem[i]) {
+                snprintf(why, n, "memory at %04x is %02x, expected %02x", i, a->mem[i], ref->mem[i]);
+                return 1;
+            }
+        }
+    }
+    for (u32 i = 0, j = 0;; i++, j++) {
+        while (j < ref->nlog && !fuzz_seen(a, &ref->log[j])) j++;
+        if (i >= a->nlog && j >= ref->nlog) return 0;
+        const fuzz_access_t *x = &a->log[i], *y = &ref->log[j];
+        if (i >= a->nlog || j >= ref->nlog || x->cycle != y->cycle || x->addr != y->addr
+                || x->val != y->val || x->write != y->write) {
+            if (i >= a->nlog) snprintf(why, n, "bus access %u missing", i);
+            else if (j >= ref->nlog) snprintf(why, n, "extra bus access %u", i);
+            else snprintf(why, n, "bus access %u is %s %04x=%02x at cycle %llu, expected %s %04x=%02x at cycle %llu",
+                    i, x->write ? "write" : "read", x->addr, x->val, (unsigned long long)x->cycle,
+                    y->write ? "write" : "read", y->addr, y->val, (unsigned long long)y->cycle);
+            return 1;
+        }
+    }
+}
+
+static int fuzz_check(fuzz_worker_t *w, const fuzz_case_t *c, int engine, char *why, size_t n) {
+    fuzz_exec(w, c, -1, &w->ref);
+    fuzz_exec(w, c, engine, &w->alt);
+    return fuzz_differs(&w->ref, &w->alt, engine, why, n);
+}
+
+// shrinks w->min while engine still diverges on it
+static void fuzz_minimize(fuzz_worker_t *w, int engine) {
+    fuzz_case_t *m = &w->min;
+    char why[256];
+    for (u32 budget = 1; budget < m->budget; budget++) {
+        u32 was = m->budget;
+        m->budget = budget;
+        if (fuzz_check(w, m, engine, why, sizeof(why))) break;
+        m->budget = was;
+    }
+    u8 *fields[] = { &m->IRQ, &m->NMI, &m->A, &m->X, &m->Y, &m->S, &m->P };
+    for (u32 i = 0; i < sizeof(fields) / sizeof(*fields); i++) {
+        u8 was = *fields[i];
+        if (!was) continue;
+        *fields[i] = 0;
+        if (!fuzz_check(w, m, engine, why, sizeof(why))) *fields[i] = was;
+    }
+    // zero halves, then quarters, down to single bytes
+    u8 *saved = w->saved;
+    for (u32 len = 0x8000; len; len >>= 1) {
+        for (u32 at = 0; at < 0x10000; at += len) {
+            u32 nz = 0;
+            for (u32 i = 0; i < len && !nz; i++) nz = m->mem[at + i];
+            if (!nz) continue;
+            memcpy(saved, m->mem + at, len);
+            memset(m->mem + at, 0, len);
+            if (!fuzz_check(w, m, engine, why, sizeof(why))) memcpy(m->mem + at, saved, len);
+        }
+    }
+}
+
+static int fuzz_save(const fuzz_case_t *c, int engine, const char *why, char *path, size_t n) {
+    snprintf(path, n, "%s/%s-%016llx.case", fuzz.out, engines[engine], (unsigned long long)c->seed);
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fprintf(f, "# %s diverged from cpu_exec: %s\n", engines[engine], why);
+    fprintf(f, "engine %s\nseed %016llx\nbudget %u\nlines %u %u\n", engines[engine],
+            (unsigned long long)c->seed, c->budget, c->IRQ, c->NMI);
+    fprintf(f, "regs %02x %02x %02x %02x %02x %04x\n", c->A, c->X, c->Y, c->S, c->P, c->PC);
+    for (u32 at = 0; at < 0x10000; at += 16) {
+        u32 nz = 0;
+        for (u32 i = 0; i < 16; i++) nz |= c->mem[at + i];
+        if (!nz) continue;
+        fprintf(f, "mem %04x", at);
+        for (u32 i = 0; i < 16; i++) fprintf(f, " %02x", c->mem[at + i]);
+        fprintf(f, "\n");
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+// reads a case saved by fuzz_save. returns its engine, or -1
+static int fuzz_load(fuzz_case_t *c, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    memset(c, 0, sizeof(*c));
+    char line[256], name[32];
+    int engine = -1;
+    unsigned long long seed;
+    unsigned a, x, y, s, p, pc, irq, nmi, at, v[16];
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "engine %31s", name) == 1) {
+            for (int e = 0; e < FUZZ_NENGINES; e++)
+                if (strcmp(name, engines[e]) == 0) engine = e;
+        } else if (sscanf(line, "seed %llx", &seed) == 1) {
+            c->seed = seed;
+        } else if (sscanf(line, "budget %u", &c->budget) == 1) {
+        } else if (sscanf(line, "lines %u %u", &irq, &nmi) == 2) {
+            c->IRQ = irq;
+            c->NMI = nmi;
+        } else if (sscanf(line, "regs %x %x %x %x %x %x", &a, &x, &y, &s, &p, &pc) == 6) {
+            c->A = a; c->X = x; c->Y = y; c->S = s; c->P = p; c->PC = pc;
+        } else if (sscanf(line, "mem %x %x %x %x %x %x %x %x %x %x %x %x %x %x %x %x %x", &at,
+                    &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9],
+                    &v[10], &v[11], &v[12], &v[13], &v[14], &v[15]) == 17) {
+            for (int i = 0; i < 16; i++) c->mem[(at + i) & 0xFFFF] = v[i];
+        }
+    }
+    fclose(f);
+    return engine;
+}
+
+static void fuzz_report(fuzz_worker_t *w, int engine, const char *why) {
+    pthread_mutex_lock(&fuzz.lock);
+    int save = fuzz.diverged++ < FUZZ_SAVED;
+    pthread_mutex_unlock(&fuzz.lock);
+    char path[512] = "", min_why[256];
+    if (save) {
+        w->min = w->c;
+        fuzz_minimize(w, engine);
+        if (!fuzz_check(w, &w->min, engine, min_why, sizeof(min_why))) snprintf(min_why, sizeof(min_why), "%s", why);
+        if (fuzz_save(&w->min, engine, min_why, path, sizeof(path)) != 0) snprintf(path, sizeof(path), "(not saved)");
+    }
+    pthread_mutex_lock(&fuzz.lock);
+    printf("%s diverged on seed %016llx: %s%s%s\n", engines[engine], (unsigned long long)w->c.seed,
+            why, save ? ", minimized to " : "", path);
+    fflush(stdout);
+    pthread_mutex_unlock(&fuzz.lock);
+}
+
+static void *fuzz_thread(void *arg) {
+    fuzz_worker_t *w = arg;
+    u64 runs[FUZZ_NENGINES] = { 0 };
+    char why[256];
+    for (;;) {
+        pthread_mutex_lock(&fuzz.lock);
+        u64 i = fuzz.next;
+        int stop = (fuzz.cases && i >= fuzz.cases) || fuzz.diverged >= FUZZ_SAVED;
+        if (!stop) fuzz.next += 64;
+        pthread_mutex_unlock(&fuzz.lock);
+        if (stop || (fuzz.deadline && now() >= fuzz.deadline)) break;
+        u64 start = i, end = fuzz.cases && i + 64 > fuzz.cases ? fuzz.cases : i + 64;
+        for (; i < end; i++) {
+            u64 seed = fuzz.seed + i;
+            fuzz_generate(&w->c, fuzz_rand(&seed));
+            fuzz_exec(w, &w->c, -1, &w->ref);
+            for (int e = 0; e < FUZZ_NENGINES; e++) {
+                if ((fuzz.only >= 0 && e != fuzz.only) || !fuzz_applies(&w->c, e)) continue;
+                if (e == FUZZ_JIT && !w->jit) continue;
+                fuzz_exec(w, &w->c, e, &w->alt);
+                runs[e]++;
+                if (fuzz_differs(&w->ref, &w->alt, e, why, sizeof(why))) {
+                    fuzz_report(w, e, why);
+                    fuzz_exec(w, &w->c, -1, &w->ref);
+                }
+            }
+        }
+        pthread_mutex_lock(&fuzz.lock);
+        fuzz.done += end - start;
+        pthread_mutex_unlock(&fuzz.lock);
+    }
+    pthread_mutex_lock(&fuzz.lock);
+    for (int e = 0; e < FUZZ_NENGINES; e++) fuzz.runs[e] += runs[e];
+    pthread_mutex_unlock(&fuzz.lock);
+    return NULL;
+}
+
+static fuzz_worker_t *fuzz_worker_create(void) {
+    fuzz_worker_t *w = calloc(1, sizeof(*w));
+    if (w) w->jit = cpu_jit_create(1 << 20, 1);
+    return w;
+}
+
+static void fuzz_worker_destroy(fuzz_worker_t *w) {
+    cpu_jit_destroy(w->jit);
+    free(w);
+}
+
+static int replay(int argc, char **argv, int from) {
+    fuzz_worker_t *w = fuzz_worker_create();
+    int failed = 0;
+    char why[256];
+    for (int i = from; i < argc; i++) {
+        int engine = fuzz_load(&w->c, argv[i]);
+        if (engine < 0) {
+            printf("%s: can't read the case\n", argv[i]);
+            failed = 1;
+            continue;
+        }
+        if (engine == FUZZ_JIT && !w->jit) continue;
+        if (fuzz_check(w, &w->c, engine, why, sizeof(why))) {
+            printf("%s: %s diverged: %s\n", argv[i], engines[engine], why);
+            failed = 1;
+        }
+    }
+    fuzz_worker_destroy(w);
+    printf("replayed %d cases\n", argc - from);
+    if (!failed) printf("Success\n");
+    return failed;
+}
+
+static const char *arg_value(int argc, char **argv, const char *name, const char *def) {
+    for (int i = 1; i + 1 < argc; i++)
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    return def;
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], "--replay") == 0) return replay(argc, argv, i + 1);
+
+    double seconds = atof(arg_value(argc, argv, "--seconds", "10"));
+    fuzz.cases = strtoull(arg_value(argc, argv, "--cases", "0"), NULL, 10);
+    fuzz.seed = strtoull(arg_value(argc, argv, "--seed", "0"), NULL, 0);
+    fuzz.out = arg_value(argc, argv, "--out", ".");
+    int threads = atoi(arg_value(argc, argv, "--threads", "0"));
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    const char *only = arg_value(argc, argv, "--engine", NULL);
+    fuzz.only = -1;
+    for (int e = 0; only && e < FUZZ_NENGINES; e++)
+        if (strcmp(only, engines[e]) == 0) fuzz.only = e;
+    if (only && fuzz.only < 0) {
+        fprintf(stderr, "unknown engine %s\n", only);
+        return 2;
+    }
+    if (!fuzz.cases && seconds <= 0) seconds = 10;
+    if (seconds > 0) fuzz.deadline = now() + seconds;
+    pthread_mutex_init(&fuzz.lock, NULL);
+
+    pthread_t *tids = calloc(threads, sizeof(*tids));
+    fuzz_worker_t **workers = calloc(threads, sizeof(*workers));
+    for (int i = 0; i < threads; i++) {
+        workers[i] = fuzz_worker_create();
+        if (!workers[i] || pthread_create(&tids[i], NULL, &fuzz_thread, workers[i]) != 0) {
+            fprintf(stderr, "can't start thread %d\n", i);
+            return 2;
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        fuzz_worker_destroy(workers[i]);
+    }
+
+    printf("%llu cases from seed %llu on %d threads:", (unsigned long long)fuzz.done,
+            (unsigned long long)fuzz.seed, threads);
+    for (int e = 0; e < FUZZ_NENGINES; e++)
+        if (fuzz.runs[e]) printf(" %s %llu", engines[e], (unsigned long long)fuzz.runs[e]);
+    printf("\n");
+    if (fuzz.diverged) {
+        printf("%llu divergences\n", (unsigned long long)fuzz.diverged);
+        return 1;
+    }
+    printf("Success\n");
+    return 0;
+}
@@ -8,6 +8,7 @@ typedef int16_t s16;
 typedef uint8_t u8;
 typedef int8_t s8;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 typedef union {
     struct {
@@ -23,27 +24,167 @@ typedef union {
     u8 data;
 } cpu_sr_t;
 
+// page flags
+#define CPU_PAGE_READONLY 0x01 // reads are direct, writes go to bus_write
+#define CPU_PAGE_MMIO     0x02 // all accesses go to bus_read/bus_write
+#define CPU_PAGE_CODE     0x04 // holds cached or translated code, writes invalidate it
+#define CPU_PAGE_TRACK    0x08 // next write is reported to the rewind buffer
+#define CPU_PAGE_POLL     0x10 // bus_read has no side effects and its values only
+                               // change at next_event, so idle loops may poll it
+#define CPU_PAGE_WATCH    0x20 // a watchpoint covers it, see cpu_debug.h
+
+// one 256-byte page of the 6502 address space. accesses to a page with a host
+// pointer load/store it directly, a NULL pointer falls back to the callbacks
+typedef struct {
+    u8 *read;
+    u8 *write;
+    u8 flags;
+} cpu_page_t;
+
+// one access to a mapped page, as recorded in the bus log
+typedef struct {
+    u32 cycle; // cycle the access started on, counted from log_cycles
+    u16 addr;
+    u8 val;
+    u8 write;
+} cpu_bus_rec_t;
+
+#define CPU_BUS_LOG_MAX 32
+
+struct cpu_bbc;
+struct cpu_jit;
+struct cpu_aot;
+struct cpu_rewind;
+struct cpu_trace;
+struct cpu_prof;
+struct cpu_debug;
+
 typedef struct {
     u8 A;
     u8 Y;
     u8 X;
     u16 PC;
     u8 S;
-    cpu_sr_t P;
+
+    // status register, kept unpacked. the packed P byte is only built when it
+    // is observed (PHP, BRK, interrupts, cpu_get_p)
+    u8 N_res; // N is bit 7 of the last result
+    u8 Z_res; // Z is set when the last result is 0
+    u8 C;
+    u8 V;
+    u8 I;
+    u8 D;
 
     u8 IRQ;
     u8 NMI;
     u8 RST;
+    // a stall or DMA request is pending, see cpu_dma.h
+    u8 DMA;
+    // RDY held low, only honoured by cpu_step_cycle, see cpu_cycle.h
+    u8 HALT;
+
+    // passed as the first argument of every callback, so embedders can keep
+    // their machine state per instance instead of in globals
+    void *user;
 
-    u8 (*bus_read)(u16);
-    void (*bus_write)(u8, u16);
+    u8 (*bus_read)(void *user, u16 addr);
+    void (*bus_write)(void *user, u8 val, u16 addr);
 
-    void (*tick)(void); 
+    // fast memory map, indexed by the high byte of the address. a zeroed
+    // table sends every access to the callbacks
+    cpu_page_t pages[256];
+
+    // optional bus log. while set, accesses to mapped pages are recorded in
+    // log and handed over in batches: when it is full, before any access
+    // that goes to the callbacks (so the embedder sees every access in
+    // order) and by cpu_bus_log_flush, which cpu_run calls before returning.
+    // cpu_run doesn't use the block cache, the JIT or idle skipping then
+    void (*bus_log)(void *user, const cpu_bus_rec_t *recs, u32 n);
+    // cycle count at the last flush, which the batch's offsets count from
+    // (modulo 2^32). flush once after setting bus_log on a running state
+    u64 log_cycles;
+    u32 log_n;
+    cpu_bus_rec_t log[CPU_BUS_LOG_MAX];
+
+    // optional basic-block cache used by cpu_run, see cpu_bbc.h
+    struct cpu_bbc *bbc;
+    // optional x86-64 JIT used by cpu_run, see cpu_jit.h
+    struct cpu_jit *jit;
+    // optional code translated ahead of time, used by cpu_run, see cpu_aot.h
+    struct cpu_aot *aot;
+    // optional rewind buffer tracking written pages, see cpu_rewind.h
+    struct cpu_rewind *rewind;
+    // optional execution trace recorder, see cpu_trace.h
+    struct cpu_trace *trace;
+    // optional cycle profiler, only used in CPU_PROFILE builds, see cpu_prof.h
+    struct cpu_prof *prof;
+    // breakpoints and watchpoints, set only while armed, see cpu_debug.h
+    struct cpu_debug *debug;
+
+    // total cycles executed, advanced once per cycle
+    u64 cycles;
+    // optional, called once per cycle for per-cycle co-simulation. may be NULL
+    void (*tick)(void *user);
+
+    // cycle of the next change the CPU could observe: a timer expiring, an
+    // interrupt line or memory changing. idle loops are fast-forwarded up to
+    // it, see cpu_idle.c. 0 disables idle skipping, ~0 lets cpu_run skip to
+    // the end of its budget
+    u64 next_event;
+    // idle loop detection, see cpu_idle.c
+    u64 idle_cycles;
+    u64 idle_regs;
+    u64 idle_event;
+    u16 idle_head;
+    u16 idle_end;
+    u8 idle_state;
+
+    // the instruction cpu_step_cycle is in the middle of, see cpu_cycle.c:
+    // its opcode, next step (0 between instructions), what it latched so far
+    // and, for an interrupt entry, which interrupt
+    u16 cyc_addr;
+    u8 cyc_opc;
+    u8 cyc_step;
+    u8 cyc_val;
+    u8 cyc_irq;
+
+    // the pending stall or DMA request, see cpu_dma.c: read cycles left to
+    // stall, then the copy and, within cpu_step_cycle, whether the byte in
+    // dma_val is read but not yet written
+    u32 dma_stall;
+    u16 dma_src;
+    u16 dma_dst;
+    u16 dma_len;
+    u8 dma_flags;
+    u8 dma_val;
+    u8 dma_put;
 
 } cpu_state_t;
 
+// all emulator state lives in cpu_state_t: the core has no mutable globals,
+// so independent instances can run concurrently on different threads
+
+// returned by cpu_exec and cpu_run when a breakpoint or watchpoint stops them
+#define CPU_BREAK -2
+
 int cpu_exec(cpu_state_t *st);
+// runs instructions until at least cycle_budget cycles have elapsed. returns
+// the number of cycles the budget was overshot by, -1 on an illegal opcode
+// or CPU_BREAK
+int cpu_run(cpu_state_t *st, u32 cycle_budget);
 void cpu_reset(cpu_state_t *st);
+// packed status register (NV-BDIZC), read with B and u set
+u8 cpu_get_p(cpu_state_t *st);
+void cpu_set_p(cpu_state_t *st, u8 p);
+// maps [addr, addr+len) to host memory at host. addr and len must be multiples
+// of 256. CPU_PAGE_READONLY maps reads only, CPU_PAGE_MMIO (or a NULL host)
+// sends the range back to the bus callbacks
+void cpu_map(cpu_state_t *st, u16 addr, u32 len, u8 *host, u8 flags);
+// drops cached blocks and translated code on the pages covering
+// [addr, addr+len). needed when mapped memory is changed behind the core's back
+void cpu_invalidate(cpu_state_t *st, u16 addr, u32 len);
+// hands the accesses recorded so far to bus_log
+void cpu_bus_log_flush(cpu_state_t *st);
 void cpu_state_to_str(cpu_state_t *st, char buf[64]);
 
 #endif
@@ -0,0 +1,78 @@
+#include "cpu_internal.h"
+#include "cpu_aot.h"
+#include <string.h>
+
+void cpu_aot_attach(cpu_state_t *st, cpu_aot_t *aot, const cpu_aot_prog_t *prog) {
+    for (int page = 0; page < 256; page++)
+        st->pages[page].flags &= ~CPU_PAGE_CODE;
+    if (aot) {
+        memset(aot, 0, sizeof(*aot));
+        aot->prog = prog;
+        for (u32 i = 0; i < prog->nblocks && i < 0xFFFF; i++)
+            aot->index[prog->blocks[i].pc] = i + 1;
+    }
+    st->aot = aot;
+}
+
+void cpu_aot_invalidate_page(cpu_state_t *st, u8 page) {
+    cpu_aot_t *aot = st->aot;
+    aot->state[page] = CPU_AOT_UNCHECKED;
+    aot->stale = 1;
+}
+
+// only a write to a translated byte has the page checked again
+void cpu_aot_code_write(cpu_state_t *st, u16 addr) {
+    cpu_aot_t *aot = st->aot;
+    if (aot->prog->mask[addr >> 3] & (1 << (addr & 7))) cpu_aot_invalidate_page(st, addr >> 8);
+    else if (aot->state[addr >> 8] != CPU_AOT_UNCHECKED) st->pages[addr >> 8].flags |= CPU_PAGE_CODE;
+}
+
+// compares the translated bytes of a page with the image. only mapped pages
+// can be checked without side effects; they are flagged either way, so that
+// a write has them checked again
+static u8 cpu_aot_check(cpu_state_t *st, cpu_aot_t *aot, u8 page) {
+    const cpu_aot_prog_t *prog = aot->prog;
+    const u8 *mem = st->pages[page].read;
+    aot->checks++;
+    if (!mem) return CPU_AOT_DIFF;
+    st->pages[page].flags |= CPU_PAGE_CODE;
+    for (u32 i = 0; i < 0x100; i++) {
+        u32 addr = hi(page) | i;
+        if (!(prog->mask[addr >> 3] & (1 << (addr & 7)))) continue;
+        if (mem[i] != prog->image[addr - prog->base]) return CPU_AOT_DIFF;
+    }
+    return CPU_AOT_MATCH;
+}
+
+static bool cpu_aot_page_ok(cpu_state_t *st, cpu_aot_t *aot, u8 page) {
+    if (aot->state[page] == CPU_AOT_UNCHECKED) aot->state[page] = cpu_aot_check(st, aot, page);
+    return aot->state[page] == CPU_AOT_MATCH;
+}
+
+int cpu_aot_run(cpu_state_t *st, u32 cycle_budget) {
+    cpu_aot_t *aot = st->aot;
+    u64 target = st->cycles + cycle_budget;
+    while (st->cycles < target) {
+        u16 i = aot->index[st->PC];
+        if (i && !cpu_irq_pending(st)) {
+            const cpu_aot_block_t *b = &aot->prog->blocks[i - 1];
+            // like the block cache, only run blocks that fit the budget in
+            // the worst case
+            if (st->cycles + b->max_cycles <= target && cpu_aot_page_ok(st, aot, b->pages[0])
+                    && cpu_aot_page_ok(st, aot, b->pages[1])) {
+                u64 start = st->cycles;
+                aot->stale = 0;
+                b->fn(st);
+                // no progress means it stopped before its first instruction,
+                // which is left to the interpreter
+                if (st->cycles != start) {
+                    aot->hits++;
+                    continue;
+                }
+            }
+        }
+        aot->misses++;
+        if (cpu_exec(st) < 0) return -1;
+    }
+    return (int)(st->cycles - target);
+}
@@ -0,0 +1,66 @@
+#ifndef __CPU_AOT_H__
+#define __CPU_AOT_H__
+
+#include "cpu.h"
+
+// Code translated ahead of time.
+//
+// tools/cpu_recomp.c traces the code reachable from a ROM image's entry
+// points (its vectors, plus any given on the command line) with the opcode
+// table, and writes a C file with one function per basic block and a
+// cpu_aot_prog_t describing them. Linked into the embedder and attached with
+// cpu_aot_attach, cpu_run runs those blocks whenever the PC is at the start
+// of one, and interprets everything else. The C file must be built for the
+// CPU variant it was translated for.
+//
+// Blocks use the same resolved helpers as the block cache, so cycle totals
+// are those of the interpreter. Like the cache, they are only used on mapped
+// pages and while there is no tick callback or bus log, and leave
+// instructions with accesses that reach a bus callback to cpu_exec.
+//
+// A page holding translated code is checked against the image before its
+// blocks run, and flagged CPU_PAGE_CODE; a write to one of its translated
+// bytes has it checked again. While any translated byte on a page differs
+// from the image (another image, self-modifying code), the page's blocks are
+// interpreted instead.
+
+#define CPU_AOT_BLOCK_MAX 64 // instructions per block, at most two pages
+
+typedef void (*cpu_aot_fn)(cpu_state_t *st);
+
+typedef struct {
+    u16 pc;
+    u8 pages[2];    // pages the block's bytes live on
+    u16 max_cycles; // worst-case cycles of the whole block
+    cpu_aot_fn fn;
+} cpu_aot_block_t;
+
+// written by cpu_recomp
+typedef struct {
+    const u8 *image; // the image translated, at base
+    u32 base;
+    u32 len;
+    const u8 *mask;  // a bit per address, set for translated bytes
+    const cpu_aot_block_t *blocks;
+    u32 nblocks;     // at most 0xFFFF
+} cpu_aot_prog_t;
+
+// page states
+#define CPU_AOT_UNCHECKED 0
+#define CPU_AOT_MATCH     1
+#define CPU_AOT_DIFF      2
+
+typedef struct cpu_aot {
+    const cpu_aot_prog_t *prog;
+    u16 index[0x10000]; // 1 + the block starting at each address, 0 for none
+    u8 state[256];      // CPU_AOT_* per page
+    u8 stale;           // set when the running block may have been modified
+    u64 hits;           // blocks run
+    u64 misses;         // instructions interpreted
+    u64 checks;         // pages checked against the image
+} cpu_aot_t;
+
+// clears aot and attaches it to st with prog's blocks. a NULL aot detaches
+void cpu_aot_attach(cpu_state_t *st, cpu_aot_t *aot, const cpu_aot_prog_t *prog);
+
+#endif
@@ -0,0 +1,426 @@
+#include "cpu_internal.h"
+#include "cpu_batch.h"
+#include <string.h>
+
+// Each step splits the running lanes in two. Opcodes with a vector kernel
+// are bucketed by opcode; the others run right away through cpu_exec on
+// scalar_cpu, with the lane's registers copied in and out. Then, for each
+// opcode, the group's lanes are gathered into the packed slot arrays by a
+// per-lane front end that decodes the addressing mode, fetches the operand
+// and accounts the cycles, the kernel runs over the slots, and a back end
+// scatters the registers and the stored value, branch or jump back.
+
+// kernels, by instruction. instructions that aren't listed alias
+// CPU_VK_SCALAR and run through cpu_exec
+#define CPU_BATCH_KERNELS(X) \
+    X(lda) X(ldx) X(ldy) X(lax) X(and) X(ora) X(eor) X(adc) X(sbc) X(cmp) \
+    X(cpx) X(cpy) X(bit) X(biti) X(anc) X(alr) X(sbx) X(ign) X(nop) \
+    X(tax) X(tay) X(tsx) X(txa) X(txs) X(tya) X(inx) X(iny) X(dex) X(dey) \
+    X(clc) X(cld) X(cli) X(clv) X(sec) X(sed) X(sei) \
+    X(asl) X(lsr) X(rol) X(ror) X(inc) X(dec) X(slo) X(rla) X(sre) X(rra) \
+    X(dcp) X(isc) X(tsb) X(trb) \
+    X(sta) X(stx) X(sty) X(sax) X(stz) \
+    X(bcc) X(bcs) X(beq) X(bmi) X(bne) X(bpl) X(bvc) X(bvs) X(bra)
+
+#define CPU_BATCH_SCALAR(X) \
+    X(arr) X(brk) X(pha) X(php) X(phx) X(phy) X(pla) X(plp) X(plx) X(ply) \
+    X(rti) X(rts) \
+    X(rmb0) X(rmb1) X(rmb2) X(rmb3) X(rmb4) X(rmb5) X(rmb6) X(rmb7) \
+    X(smb0) X(smb1) X(smb2) X(smb3) X(smb4) X(smb5) X(smb6) X(smb7) \
+    X(bbr0) X(bbr1) X(bbr2) X(bbr3) X(bbr4) X(bbr5) X(bbr6) X(bbr7) \
+    X(bbs0) X(bbs1) X(bbs2) X(bbs3) X(bbs4) X(bbs5) X(bbs6) X(bbs7)
+
+enum {
+    CPU_VK_SCALAR, CPU_VK_JMP,
+#define X(instr) CPU_VK_##instr,
+    CPU_BATCH_KERNELS(X)
+#undef X
+#define X(instr) CPU_VK_##instr = CPU_VK_SCALAR,
+    CPU_BATCH_SCALAR(X)
+#undef X
+};
+
+// JMP abs is the only jump without a stack access or an indirection
+#define CPU_BATCH_VK_all(instr) CPU_VK_##instr
+#define CPU_BATCH_VK_read(instr) CPU_VK_##instr
+#define CPU_BATCH_VK_rmw(instr) CPU_VK_##instr
+#define CPU_BATCH_VK_write(instr) CPU_VK_##instr
+#define CPU_BATCH_VK_branch(instr) CPU_VK_##instr
+#define CPU_BATCH_VK_jmp(instr) CPU_VK_SCALAR
+#define CPU_BATCH_VK_jsr(instr) CPU_VK_SCALAR
+#define CPU_BATCH_VK_wait(instr) CPU_VK_SCALAR
+
+static const u8 cpu_batch_vk[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_BATCH_VK_##kind(instr),
+    CPU_OPCODES(OP)
+#undef OP
+    [0x4C] = CPU_VK_JMP,
+};
+
+// addressing modes the front end decodes. the ones from ZPG on go through
+// memory
+enum {
+    CPU_BM_imp, CPU_BM_one, CPU_BM_acc, CPU_BM_imm, CPU_BM_rel, CPU_BM_zpr,
+    CPU_BM_ind, CPU_BM_iax, CPU_BM_zpg, CPU_BM_zpi, CPU_BM_abs, CPU_BM_abi,
+    CPU_BM_abp, CPU_BM_zpx, CPU_BM_zpy, CPU_BM_izp
+};
+
+static const u8 cpu_batch_mode[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_BM_##mode,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+// what the front end reads and the back end stores, by helper kind.
+// all_imm is the only all_ helper with an operand, all_acc gets its own
+enum { CPU_BATCH_NONE, CPU_BATCH_READ, CPU_BATCH_RMW, CPU_BATCH_WRITE,
+       CPU_BATCH_ACC, CPU_BATCH_BRANCH, CPU_BATCH_JUMP };
+#define CPU_BATCH_KIND_all CPU_BATCH_READ
+#define CPU_BATCH_KIND_read CPU_BATCH_READ
+#define CPU_BATCH_KIND_rmw CPU_BATCH_RMW
+#define CPU_BATCH_KIND_write CPU_BATCH_WRITE
+#define CPU_BATCH_KIND_branch CPU_BATCH_BRANCH
+#define CPU_BATCH_KIND_jmp CPU_BATCH_JUMP
+#define CPU_BATCH_KIND_jsr CPU_BATCH_NONE
+#define CPU_BATCH_KIND_wait CPU_BATCH_NONE
+
+static const u8 cpu_batch_kind[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) \
+    [opc] = CPU_BM_##mode == CPU_BM_acc ? CPU_BATCH_ACC : CPU_BATCH_KIND_##kind,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+// base cycles, and whether indexing across a page costs one more: reads and
+// the 65C02 indexed shifts
+static const u8 cpu_batch_cyc[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = cyc,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+static const u8 cpu_batch_cross[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_BM_##mode == CPU_BM_abp \
+    || (CPU_BATCH_KIND_##kind == CPU_BATCH_READ && (CPU_BM_##mode == CPU_BM_abi || CPU_BM_##mode == CPU_BM_zpy)),
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+#define CPU_BATCH_IDX_X 0
+#define CPU_BATCH_IDX_Y 1
+#define CPU_BATCH_IDX__ 0
+
+static const u8 cpu_batch_idx_y[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_BATCH_IDX_##idx,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+// ADC and SBC, alone or after an rmw, in decimal mode are left to cpu_exec
+#ifdef CPU_VARIANT_2A03
+#define cpu_batch_decimal(b, l, vk) false
+#else
+#define cpu_batch_decimal(b, l, vk) ((b)->D[l] && ((vk) == CPU_VK_adc || (vk) == CPU_VK_sbc \
+    || (vk) == CPU_VK_rra || (vk) == CPU_VK_isc))
+#endif
+
+// the kernels work on CPU_BATCH_VEC lanes at a time. GCC and Clang lower
+// the 32-byte vectors to AVX2, or to pairs of SSE2 (or NEON) registers.
+// comparisons give all ones for true, so they are masked down to 1; other
+// compilers get one lane at a time, where they give 1 already
+#if defined(__GNUC__)
+#define CPU_BATCH_VEC 32
+typedef u8 cpu_vec_t __attribute__((vector_size(CPU_BATCH_VEC)));
+#else
+#define CPU_BATCH_VEC 1
+typedef u8 cpu_vec_t;
+#endif
+
+#define CPU_VEC_TRUE(e) ((cpu_vec_t)(e) & 1)
+#define CPU_VEC_LOAD(v, p) memcpy(&(v), (p), sizeof(cpu_vec_t))
+#define CPU_VEC_STORE(p, v) memcpy((p), &(v), sizeof(cpu_vec_t))
+
+// A + op + C, with the binary ADC flags
+#define CPU_VEC_ADC(op) do { \
+        cpu_vec_t sum = a + (op); \
+        cpu_vec_t res = sum + c; \
+        c = CPU_VEC_TRUE(sum < a) | CPU_VEC_TRUE(res < sum); \
+        v = (((op) ^ res) & (a ^ res)) >> 7; \
+        a = n_res = z_res = res; \
+    } while (0)
+
+#define CPU_VEC_CMP(reg) do { \
+        n_res = z_res = (reg) - op; \
+        c = CPU_VEC_TRUE(op <= (reg)); \
+    } while (0)
+
+CPU_INLINE void cpu_batch_kernel_body(cpu_batch_t *b, u8 vk, u32 n) {
+    for (u32 j = 0; j < n; j += CPU_BATCH_VEC) {
+        cpu_vec_t a, x, y, s, n_res, z_res, c, v, i, d, op, t;
+        CPU_VEC_LOAD(a, b->a + j); CPU_VEC_LOAD(x, b->x + j);
+        CPU_VEC_LOAD(y, b->y + j); CPU_VEC_LOAD(s, b->s + j);
+        CPU_VEC_LOAD(n_res, b->n_res + j); CPU_VEC_LOAD(z_res, b->z_res + j);
+        CPU_VEC_LOAD(c, b->c + j); CPU_VEC_LOAD(v, b->v + j);
+        CPU_VEC_LOAD(i, b->i + j); CPU_VEC_LOAD(d, b->d + j);
+        CPU_VEC_LOAD(op, b->op + j);
+        switch (vk) {
+            // reads
+            case CPU_VK_lda: a = n_res = z_res = op; break;
+            case CPU_VK_ldx: x = n_res = z_res = op; break;
+            case CPU_VK_ldy: y = n_res = z_res = op; break;
+            case CPU_VK_lax: a = x = n_res = z_res = op; break;
+            case CPU_VK_and: a = n_res = z_res = a & op; break;
+            case CPU_VK_ora: a = n_res = z_res = a | op; break;
+            case CPU_VK_eor: a = n_res = z_res = a ^ op; break;
+            case CPU_VK_adc: CPU_VEC_ADC(op); break;
+            case CPU_VK_sbc: t = ~op; CPU_VEC_ADC(t); break;
+            case CPU_VK_cmp: CPU_VEC_CMP(a); break;
+            case CPU_VK_cpx: CPU_VEC_CMP(x); break;
+            case CPU_VK_cpy: CPU_VEC_CMP(y); break;
+            case CPU_VK_bit: n_res = op; v = (op >> 6) & 1; z_res = op & a; break;
+            case CPU_VK_biti: z_res = op & a; break;
+            case CPU_VK_anc: a = n_res = z_res = a & op; c = a >> 7; break;
+            case CPU_VK_alr: t = a & op; c = t & 1; a = n_res = z_res = t >> 1; break;
+            case CPU_VK_sbx: t = a & x; c = CPU_VEC_TRUE(op <= t); x = n_res = z_res = t - op; break;
+            case CPU_VK_ign: case CPU_VK_nop: case CPU_VK_JMP: break;
+            // implied
+            case CPU_VK_tax: x = n_res = z_res = a; break;
+            case CPU_VK_tay: y = n_res = z_res = a; break;
+            case CPU_VK_tsx: x = n_res = z_res = s; break;
+            case CPU_VK_txa: a = n_res = z_res = x; break;
+            case CPU_VK_tya: a = n_res = z_res = y; break;
+            case CPU_VK_txs: s = x; break;
+            case CPU_VK_inx: x = n_res = z_res = x + 1; break;
+            case CPU_VK_iny: y = n_res = z_res = y + 1; break;
+            case CPU_VK_dex: x = n_res = z_res = x - 1; break;
+            case CPU_VK_dey: y = n_res = z_res = y - 1; break;
+            case CPU_VK_clc: c &= 0; break;
+            case CPU_VK_cld: d &= 0; break;
+            case CPU_VK_cli: i &= 0; break;
+            case CPU_VK_clv: v &= 0; break;
+            case CPU_VK_sec: c |= 1; break;
+            case CPU_VK_sed: d |= 1; break;
+            case CPU_VK_sei: i |= 1; break;
+            // rmw and accumulator, op is the value to modify
+            case CPU_VK_asl: c = op >> 7; op = n_res = z_res = op << 1; break;
+            case CPU_VK_lsr: c = op & 1; op = n_res = z_res = op >> 1; break;
+            case CPU_VK_rol: t = op >> 7; op = n_res = z_res = (op << 1) | c; c = t; break;
+            case CPU_VK_ror: t = op & 1; op = n_res = z_res = (op >> 1) | (c << 7); c = t; break;
+            case CPU_VK_inc: op = n_res = z_res = op + 1; break;
+            case CPU_VK_dec: op = n_res = z_res = op - 1; break;
+            case CPU_VK_slo: c = op >> 7; op = op << 1; a = n_res = z_res = a | op; break;
+            case CPU_VK_rla: t = op >> 7; op = (op << 1) | c; c = t; a = n_res = z_res = a & op; break;
+            case CPU_VK_sre: c = op & 1; op = op >> 1; a = n_res = z_res = a ^ op; break;
+            case CPU_VK_rra: t = op & 1; op = (op >> 1) | (c << 7); c = t; CPU_VEC_ADC(op); break;
+            case CPU_VK_dcp: op = op - 1; CPU_VEC_CMP(a); break;
+            case CPU_VK_isc: op = op + 1; t = ~op; CPU_VEC_ADC(t); break;
+            case CPU_VK_tsb: z_res = op & a; op = op | a; break;
+            case CPU_VK_trb: z_res = op & a; op = op & ~a; break;
+            // writes, op is the value to store
+            case CPU_VK_sta: op = a; break;
+            case CPU_VK_stx: op = x; break;
+            case CPU_VK_sty: op = y; break;
+            case CPU_VK_sax: op = a & x; break;
+            case CPU_VK_stz: op &= 0; break;
+            // branches, op is whether they are taken
+            case CPU_VK_bcc: op = c ^ 1; break;
+            case CPU_VK_bcs: op = c; break;
+            case CPU_VK_beq: op = CPU_VEC_TRUE(z_res == 0); break;
+            case CPU_VK_bne: op = CPU_VEC_TRUE(z_res != 0); break;
+            case CPU_VK_bpl: op = (n_res >> 7) ^ 1; break;
+            case CPU_VK_bmi: op = n_res >> 7; break;
+            case CPU_VK_bvc: op = v ^ 1; break;
+            case CPU_VK_bvs: op = v; break;
+            case CPU_VK_bra: op = (op & 0) | 1; break;
+        }
+        CPU_VEC_STORE(b->a + j, a); CPU_VEC_STORE(b->x + j, x);
+        CPU_VEC_STORE(b->y + j, y); CPU_VEC_STORE(b->s + j, s);
+        CPU_VEC_STORE(b->n_res + j, n_res); CPU_VEC_STORE(b->z_res + j, z_res);
+        CPU_VEC_STORE(b->c + j, c); CPU_VEC_STORE(b->v + j, v);
+        CPU_VEC_STORE(b->i + j, i); CPU_VEC_STORE(b->d + j, d);
+        CPU_VEC_STORE(b->op + j, op);
+    }
+}
+
+static void cpu_batch_kernel(cpu_batch_t *b, u8 opc, u32 n) {
+    cpu_batch_kernel_body(b, cpu_batch_vk[opc], n);
+}
+
+// the same kernels built for AVX2, used when the host has it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_BATCH_AVX2
+__attribute__((target("avx2")))
+static void cpu_batch_kernel_avx2(cpu_batch_t *b, u8 opc, u32 n) {
+    cpu_batch_kernel_body(b, cpu_batch_vk[opc], n);
+}
+#endif
+
+static u8 cpu_batch_read(void *user, u16 addr) { return ((u8*)user)[addr]; }
+static void cpu_batch_write(void *user, u8 val, u16 addr) { ((u8*)user)[addr] = val; }
+
+// the 16-bit word at addr, and at a zero page pointer, which wraps
+static u16 cpu_batch_word(const u8 *mem, u16 addr) {
+    return mem[addr] | hi(mem[(u16)(addr + 1)]);
+}
+
+static u16 cpu_batch_ptr(const u8 *mem, u8 ptr) {
+    return mem[ptr] | hi(mem[lo(ptr + 1)]);
+}
+
+// runs one instruction of lane l through cpu_exec
+static void cpu_batch_exec(cpu_batch_t *b, u32 l) {
+    cpu_state_t *st = &b->scalar_cpu;
+    st->user = b->mem[l];
+    st->A = b->A[l]; st->X = b->X[l]; st->Y = b->Y[l]; st->S = b->S[l]; st->PC = b->PC[l];
+    st->N_res = b->N_res[l]; st->Z_res = b->Z_res[l];
+    st->C = b->C[l]; st->V = b->V[l]; st->I = b->I[l]; st->D = b->D[l];
+    st->cycles = b->cycles[l];
+    if (cpu_exec(st) < 0) b->stopped[l] = 1;
+    b->A[l] = st->A; b->X[l] = st->X; b->Y[l] = st->Y; b->S[l] = st->S; b->PC[l] = st->PC;
+    b->N_res[l] = st->N_res; b->Z_res[l] = st->Z_res;
+    b->C[l] = st->C; b->V[l] = st->V; b->I[l] = st->I; b->D[l] = st->D;
+    b->cycles[l] = st->cycles;
+    b->scalar++;
+}
+
+// front end: decodes lane l's instruction into slot j, advancing its PC and
+// cycles. leaves the effective address (a branch's target) in addr and the
+// value read, or A, in op
+static void cpu_batch_gather(cpu_batch_t *b, u8 opc, u32 j, u32 l) {
+    const u8 *mem = b->mem[l];
+    u16 pc = b->PC[l] + 1, addr = 0, base;
+    u8 idx = cpu_batch_idx_y[opc] ? b->Y[l] : b->X[l], kind = cpu_batch_kind[opc];
+    u8 op = 0, cyc = cpu_batch_cyc[opc];
+    switch (cpu_batch_mode[opc]) {
+        case CPU_BM_acc: op = b->A[l]; break;
+        case CPU_BM_imm: op = mem[pc++]; break;
+        case CPU_BM_rel: op = mem[pc++]; addr = pc + (s8)op; break;
+        case CPU_BM_zpg: addr = mem[pc++]; break;
+        case CPU_BM_zpi: addr = lo(mem[pc++] + idx); break;
+        case CPU_BM_abs: addr = cpu_batch_word(mem, pc); pc += 2; break;
+        case CPU_BM_abi:
+        case CPU_BM_abp:
+            base = cpu_batch_word(mem, pc);
+            pc += 2;
+            addr = base + idx;
+            cyc += cpu_batch_cross[opc] && (base & 0xFF) + idx > 0xFF;
+            break;
+        case CPU_BM_zpx: addr = cpu_batch_ptr(mem, lo(mem[pc++] + b->X[l])); break;
+        case CPU_BM_zpy:
+            base = cpu_batch_ptr(mem, mem[pc++]);
+            addr = base + b->Y[l];
+            cyc += cpu_batch_cross[opc] && (base & 0xFF) + b->Y[l] > 0xFF;
+            break;
+        case CPU_BM_izp: addr = cpu_batch_ptr(mem, mem[pc++]); break;
+    }
+    if (cpu_batch_mode[opc] >= CPU_BM_zpg && (kind == CPU_BATCH_READ || kind == CPU_BATCH_RMW))
+        op = mem[addr];
+    b->PC[l] = pc;
+    b->cycles[l] += cyc;
+
+    b->lane[j] = l;
+    b->a[j] = b->A[l]; b->x[j] = b->X[l]; b->y[j] = b->Y[l]; b->s[j] = b->S[l];
+    b->n_res[j] = b->N_res[l]; b->z_res[j] = b->Z_res[l];
+    b->c[j] = b->C[l]; b->v[j] = b->V[l]; b->i[j] = b->I[l]; b->d[j] = b->D[l];
+    b->op[j] = op;
+    b->addr[j] = addr;
+}
+
+// back end: writes slot j back to its lane
+static void cpu_batch_scatter(cpu_batch_t *b, u8 opc, u32 j) {
+    u32 l = b->lane[j];
+    b->A[l] = b->a[j]; b->X[l] = b->x[j]; b->Y[l] = b->y[j]; b->S[l] = b->s[j];
+    b->N_res[l] = b->n_res[j]; b->Z_res[l] = b->z_res[j];
+    b->C[l] = b->c[j]; b->V[l] = b->v[j]; b->I[l] = b->i[j]; b->D[l] = b->d[j];
+    switch (cpu_batch_kind[opc]) {
+        case CPU_BATCH_RMW:
+        case CPU_BATCH_WRITE: b->mem[l][b->addr[j]] = b->op[j]; break;
+        case CPU_BATCH_ACC: b->A[l] = b->op[j]; break;
+        case CPU_BATCH_JUMP: b->PC[l] = b->addr[j]; break;
+        case CPU_BATCH_BRANCH:
+            if (!b->op[j]) break;
+            b->cycles[l] += 1 + ((b->PC[l] ^ b->addr[j]) > 0xFF); // taken, page change
+            b->PC[l] = b->addr[j];
+            break;
+    }
+}
+
+void cpu_batch_init(cpu_batch_t *b) {
+    memset(b, 0, sizeof(*b));
+    b->scalar_cpu.bus_read = &cpu_batch_read;
+    b->scalar_cpu.bus_write = &cpu_batch_write;
+    b->kernel = &cpu_batch_kernel;
+#ifdef CPU_BATCH_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) b->kernel = &cpu_batch_kernel_avx2;
+#endif
+}
+
+int cpu_batch_add(cpu_batch_t *b, const cpu_state_t *st, u8 *mem) {
+    if (b->n == CPU_BATCH_MAX) return -1;
+    u32 l = b->n++;
+    b->mem[l] = mem;
+    b->A[l] = st->A; b->X[l] = st->X; b->Y[l] = st->Y; b->S[l] = st->S; b->PC[l] = st->PC;
+    b->N_res[l] = st->N_res; b->Z_res[l] = st->Z_res;
+    b->C[l] = st->C; b->V[l] = st->V; b->I[l] = st->I; b->D[l] = st->D;
+    b->cycles[l] = st->cycles;
+    b->stopped[l] = 0;
+    return (int)l;
+}
+
+void cpu_batch_get(const cpu_batch_t *b, u32 l, cpu_state_t *st) {
+    st->A = b->A[l]; st->X = b->X[l]; st->Y = b->Y[l]; st->S = b->S[l]; st->PC = b->PC[l];
+    st->N_res = b->N_res[l]; st->Z_res = b->Z_res[l];
+    st->C = b->C[l]; st->V = b->V[l]; st->I = b->I[l]; st->D = b->D[l];
+    st->cycles = b->cycles[l];
+}
+
+int cpu_batch_run(cpu_batch_t *b, u32 cycle_budget) {
+    for (u32 l = 0; l < b->n; l++) b->target[l] = b->cycles[l] + cycle_budget;
+    for (;;) {
+        // fetch, running the scalar lanes on the way
+        u32 live = 0, nfetched = 0, ngroups = 0;
+        for (u32 l = 0; l < b->n; l++) {
+            if (b->stopped[l] || b->cycles[l] >= b->target[l]) continue;
+            live++;
+            u8 opc = b->mem[l][b->PC[l]], vk = cpu_batch_vk[opc];
+            if (vk == CPU_VK_SCALAR || cpu_batch_decimal(b, l, vk)) {
+                cpu_batch_exec(b, l);
+                continue;
+            }
+            b->opc[l] = opc;
+            b->fetched[nfetched++] = l;
+            if (b->count[opc]++ == 0) b->groups[ngroups++] = opc;
+        }
+        if (!live) break;
+
+        // sort the fetched lanes by opcode
+        u32 pos = 0;
+        for (u32 g = 0; g < ngroups; g++) {
+            u8 opc = b->groups[g];
+            b->start[opc] = pos;
+            pos += b->count[opc];
+        }
+        for (u32 k = 0; k < nfetched; k++) {
+            u32 l = b->fetched[k];
+            b->order[b->start[b->opc[l]]++] = l;
+        }
+
+        // one kernel run per opcode
+        pos = 0;
+        for (u32 g = 0; g < ngroups; g++) {
+            u8 opc = b->groups[g];
+            u32 n = b->count[opc];
+            for (u32 j = 0; j < n; j++) cpu_batch_gather(b, opc, j, b->order[pos + j]);
+            b->kernel(b, opc, n);
+            for (u32 j = 0; j < n; j++) cpu_batch_scatter(b, opc, j);
+            b->count[opc] = 0;
+            b->vector += n;
+            pos += n;
+        }
+    }
+
+    int stopped = 0;
+    for (u32 l = 0; l < b->n; l++) stopped += b->stopped[l];
+    return stopped;
+}
@@ -0,0 +1,99 @@
+#ifndef __CPU_BATCH_H__
+#define __CPU_BATCH_H__
+
+#include "cpu.h"
+
+// Lockstep batch engine.
+//
+// Runs up to CPU_BATCH_MAX independent CPUs ("lanes") side by side, for
+// fuzzing, search or test farms that need many machines at once. Registers
+// and flags are kept as structure-of-arrays, one array per register, and
+// each lane has a flat 64 KiB image of its own as memory: no page table, no
+// bus callbacks, no tick, no interrupts. Lanes must not share images.
+//
+// Each step fetches every lane's next opcode and groups the lanes by it.
+// Operands and effective addresses are gathered from each lane's image, then
+// the ALU operation runs over the whole group with vector code (GCC vector
+// extensions, AVX2 when the host has it), and the results are scattered
+// back. Opcodes without a vector kernel (stack, BRK and returns, JSR,
+// indirect JMP, most undocumented and 65C02 bit opcodes) and ADC/SBC in
+// decimal mode fall back to cpu_exec, one lane at a time.
+//
+// Each lane ends in the state, memory and cycle count cpu_exec would have
+// left it in after the same instructions.
+
+#define CPU_BATCH_MAX 256
+
+typedef struct cpu_batch cpu_batch_t;
+typedef void (*cpu_batch_kernel_fn)(cpu_batch_t *b, u8 opc, u32 n);
+
+struct cpu_batch {
+    u32 n; // lanes in use
+
+    // per-lane state
+    u8 *mem[CPU_BATCH_MAX];
+    u8 A[CPU_BATCH_MAX];
+    u8 X[CPU_BATCH_MAX];
+    u8 Y[CPU_BATCH_MAX];
+    u8 S[CPU_BATCH_MAX];
+    u8 N_res[CPU_BATCH_MAX];
+    u8 Z_res[CPU_BATCH_MAX];
+    u8 C[CPU_BATCH_MAX];
+    u8 V[CPU_BATCH_MAX];
+    u8 I[CPU_BATCH_MAX];
+    u8 D[CPU_BATCH_MAX];
+    u16 PC[CPU_BATCH_MAX];
+    u64 cycles[CPU_BATCH_MAX];
+    u64 target[CPU_BATCH_MAX];
+    u8 stopped[CPU_BATCH_MAX]; // fetched an illegal opcode
+
+    // instructions run by the vector kernels and by cpu_exec
+    u64 vector;
+    u64 scalar;
+
+    // the group of lanes the current kernel runs on, packed: lane[j] is the
+    // lane in slot j, the other arrays its gathered registers, operand and
+    // effective address. kernels run over whole vectors, past the group's end
+    u8 lane[CPU_BATCH_MAX];
+    u8 a[CPU_BATCH_MAX];
+    u8 x[CPU_BATCH_MAX];
+    u8 y[CPU_BATCH_MAX];
+    u8 s[CPU_BATCH_MAX];
+    u8 n_res[CPU_BATCH_MAX];
+    u8 z_res[CPU_BATCH_MAX];
+    u8 c[CPU_BATCH_MAX];
+    u8 v[CPU_BATCH_MAX];
+    u8 i[CPU_BATCH_MAX];
+    u8 d[CPU_BATCH_MAX];
+    u8 op[CPU_BATCH_MAX];
+    u16 addr[CPU_BATCH_MAX];
+
+    // lanes by opcode, rebuilt each step: opc is each lane's fetched opcode,
+    // fetched the lanes going to the kernels, groups their distinct opcodes
+    // and order those lanes sorted by opcode
+    u8 opc[CPU_BATCH_MAX];
+    u8 fetched[CPU_BATCH_MAX];
+    u8 groups[256];
+    u16 count[256];
+    u16 start[256];
+    u8 order[CPU_BATCH_MAX];
+
+    // runs the vector kernel, picked for the host by cpu_batch_init
+    cpu_batch_kernel_fn kernel;
+    // runs the instructions without a vector kernel
+    cpu_state_t scalar_cpu;
+};
+
+// clears b and picks the vector kernels for the host
+void cpu_batch_init(cpu_batch_t *b);
+// adds a lane with the registers of st, running on the 64 KiB image mem.
+// returns the lane index, or -1 when the batch is full
+int cpu_batch_add(cpu_batch_t *b, const cpu_state_t *st, u8 *mem);
+// copies the registers, flags and cycles of lane i back into st
+void cpu_batch_get(const cpu_batch_t *b, u32 i, cpu_state_t *st);
+// runs every lane until it has run at least cycle_budget more cycles. lanes
+// that fetch an illegal opcode stop there for good. returns the number of
+// stopped lanes
+int cpu_batch_run(cpu_batch_t *b, u32 cycle_budget);
+
+#endif
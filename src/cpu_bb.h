@@ -0,0 +1,189 @@
+#ifndef __CPU_BB_H__
+#define __CPU_BB_H__
+
+// Instruction helpers for straight-line code whose operands are already
+// known, shared by the block cache (cpu_bbc.c) and code translated ahead of
+// time by tools/cpu_recomp.c. CPU_BB_<kind>_<mode>(instr, idx) runs one
+// instruction with its operand bytes in op, after the caller has set st->PC
+// past it and added its base cycles (1 for one-byte instructions).
+//
+// The base cycles are added before the accesses happen, which only host
+// memory can't tell. CPU_BB_DIRECT_<kind>_<mode>(idx) says whether all of
+// an instruction's accesses go straight to host memory; if not, the caller
+// stops before it with st->PC on it, and leaves it to cpu_exec so that bus
+// callbacks see st->cycles as they would there.
+
+#include "cpu_internal.h"
+
+// resolved addressing modes: the operand bytes were fetched at decode time
+// and st->PC already points past the instruction. the memory accesses are
+// the same, in the same order, as in the cpu_icl_* helpers
+CPU_INLINE void cpu_bb_read(cpu_state_t *st, u16 addr, void (*instr)(cpu_state_t*, u8)) {
+    instr(st, cpu_read(st, addr));
+}
+
+CPU_INLINE void cpu_bb_rmw(cpu_state_t *st, u16 addr, u8 (*instr)(cpu_state_t*, u8)) {
+    u8 op = cpu_read(st, addr);
+    cpu_write(st, instr(st, op), addr);
+}
+
+CPU_INLINE void cpu_bb_write(cpu_state_t *st, u16 addr, u8 (*instr)(cpu_state_t*)) {
+    cpu_write(st, instr(st), addr);
+}
+
+CPU_INLINE void cpu_bb_read_abi(cpu_state_t *st, u16 addr, u8 idx, void (*instr)(cpu_state_t*, u8)) {
+    if ((addr & 0xFF) + idx > 0xFF) st->cycles++; // fixup
+    instr(st, cpu_read(st, addr + idx));
+}
+
+CPU_INLINE void cpu_bb_rmw_abp(cpu_state_t *st, u16 addr, u8 idx, u8 (*instr)(cpu_state_t*, u8)) {
+    if ((addr & 0xFF) + idx > 0xFF) st->cycles++; // fixup
+    cpu_bb_rmw(st, addr + idx, instr);
+}
+
+CPU_INLINE u16 cpu_bb_zp_ptr(cpu_state_t *st, u8 ptr) {
+    u16 addr = cpu_read(st, ptr);
+    addr |= hi(cpu_read(st, lo(ptr+1)));
+    return addr;
+}
+
+CPU_INLINE void cpu_bb_read_zpy(cpu_state_t *st, u8 ptr, void (*instr)(cpu_state_t*, u8)) {
+    u16 addr = cpu_bb_zp_ptr(st, ptr);
+    if ((addr & 0xFF) + st->Y > 0xFF) st->cycles++; // fixup
+    instr(st, cpu_read(st, addr + st->Y));
+}
+
+CPU_INLINE void cpu_bb_jsr(cpu_state_t *st, u16 addr) {
+    u16 ret = st->PC - 1;
+    cpu_write(st, lo(ret >> 8), 0x100 + (st->S--));
+    cpu_write(st, lo(ret), 0x100 + (st->S--));
+    st->PC = addr;
+}
+
+CPU_INLINE void cpu_bb_jmp_ind(cpu_state_t *st, u16 ptr) {
+    u8 latch = cpu_read(st, ptr);
+    st->PC = hi(cpu_read(st, cpu_ind_next(ptr))) | latch;
+}
+
+CPU_INLINE void cpu_bb_jmp_iax(cpu_state_t *st, u16 ptr) {
+    ptr += st->X;
+    u8 latch = cpu_read(st, ptr);
+    st->PC = hi(cpu_read(st, ptr + 1)) | latch;
+}
+
+CPU_INLINE void cpu_bb_jmp(cpu_state_t *st, u16 op) {
+    u16 end = st->PC;
+    st->PC = op;
+    cpu_idle_jump(st, end);
+}
+
+CPU_INLINE void cpu_bb_branch(cpu_state_t *st, s8 op, bool (*branch)(cpu_state_t*)) {
+    if (!branch(st)) {
+        cpu_idle_exit(st, st->PC);
+        return;
+    }
+    st->cycles++; // taken
+    u16 old_pc = st->PC;
+    st->PC = old_pc + op;
+    if ((u16)((s16)(old_pc&0xFF) + op) > 0xFF) st->cycles++; // page changes
+    cpu_idle_jump(st, old_pc);
+}
+
+// BBRn/BBSn: the low operand byte is the zero page address, the high one
+// the branch offset
+CPU_INLINE void cpu_bb_branch_zpr(cpu_state_t *st, u16 op, bool (*branch)(cpu_state_t*, u8)) {
+    if (!branch(st, cpu_read(st, lo(op)))) {
+        cpu_idle_exit(st, st->PC);
+        return;
+    }
+    st->cycles++; // taken
+    u16 old_pc = st->PC;
+    st->PC = old_pc + (s8)(op >> 8);
+    if ((u16)((s16)(old_pc&0xFF) + (s8)(op >> 8)) > 0xFF) st->cycles++; // page changes
+    cpu_idle_jump(st, old_pc);
+}
+
+CPU_INLINE bool cpu_bb_direct(cpu_state_t *st, u16 addr, bool rd, bool wr) {
+    const cpu_page_t *pg = &st->pages[addr >> 8];
+    return (!rd || pg->read) && (!wr || pg->write);
+}
+
+// through a zero page pointer, itself read from host memory
+CPU_INLINE bool cpu_bb_direct_ptr(cpu_state_t *st, u8 ptr, u8 idx, bool rd, bool wr) {
+    const u8 *zp = st->pages[0].read;
+    if (!zp) return false;
+    return cpu_bb_direct(st, (u16)((zp[ptr] | hi(zp[lo(ptr+1)])) + idx), rd, wr);
+}
+
+#define CPU_BB_DIRECT_all_imp(idx)     true // the helpers tick their own cycles
+#define CPU_BB_DIRECT_all_one(idx)     true
+#define CPU_BB_DIRECT_all_acc(idx)     true
+#define CPU_BB_DIRECT_all_imm(idx)     true
+#define CPU_BB_DIRECT_read_abs(idx)    cpu_bb_direct(st, op, true, false)
+#define CPU_BB_DIRECT_rmw_abs(idx)     cpu_bb_direct(st, op, true, true)
+#define CPU_BB_DIRECT_write_abs(idx)   cpu_bb_direct(st, op, false, true)
+#define CPU_BB_DIRECT_jmp_abs(idx)     true
+#define CPU_BB_DIRECT_jsr_abs(idx)     cpu_bb_direct(st, 0x100, false, true)
+#define CPU_BB_DIRECT_wait_abs(idx)    true
+#define CPU_BB_DIRECT_read_abi(idx)    cpu_bb_direct(st, op + st->idx, true, false)
+#define CPU_BB_DIRECT_rmw_abi(idx)     cpu_bb_direct(st, op + st->idx, true, true)
+#define CPU_BB_DIRECT_write_abi(idx)   cpu_bb_direct(st, op + st->idx, false, true)
+#define CPU_BB_DIRECT_rmw_abp(idx)     cpu_bb_direct(st, op + st->idx, true, true)
+#define CPU_BB_DIRECT_jmp_ind(idx)     (cpu_bb_direct(st, op, true, false) \
+                                        && cpu_bb_direct(st, cpu_ind_next(op), true, false))
+#define CPU_BB_DIRECT_jmp_iax(idx)     (cpu_bb_direct(st, op + st->X, true, false) \
+                                        && cpu_bb_direct(st, op + st->X + 1, true, false))
+#define CPU_BB_DIRECT_read_zpg(idx)    cpu_bb_direct(st, 0, true, false)
+#define CPU_BB_DIRECT_rmw_zpg(idx)     cpu_bb_direct(st, 0, true, true)
+#define CPU_BB_DIRECT_write_zpg(idx)   cpu_bb_direct(st, 0, false, true)
+#define CPU_BB_DIRECT_read_zpi(idx)    cpu_bb_direct(st, 0, true, false)
+#define CPU_BB_DIRECT_rmw_zpi(idx)     cpu_bb_direct(st, 0, true, true)
+#define CPU_BB_DIRECT_write_zpi(idx)   cpu_bb_direct(st, 0, false, true)
+#define CPU_BB_DIRECT_read_zpx(idx)    cpu_bb_direct_ptr(st, lo(op + st->X), 0, true, false)
+#define CPU_BB_DIRECT_rmw_zpx(idx)     cpu_bb_direct_ptr(st, lo(op + st->X), 0, true, true)
+#define CPU_BB_DIRECT_write_zpx(idx)   cpu_bb_direct_ptr(st, lo(op + st->X), 0, false, true)
+#define CPU_BB_DIRECT_read_zpy(idx)    cpu_bb_direct_ptr(st, op, st->Y, true, false)
+#define CPU_BB_DIRECT_rmw_zpy(idx)     cpu_bb_direct_ptr(st, op, st->Y, true, true)
+#define CPU_BB_DIRECT_write_zpy(idx)   cpu_bb_direct_ptr(st, op, st->Y, false, true)
+#define CPU_BB_DIRECT_read_izp(idx)    cpu_bb_direct_ptr(st, op, 0, true, false)
+#define CPU_BB_DIRECT_write_izp(idx)   cpu_bb_direct_ptr(st, op, 0, false, true)
+#define CPU_BB_DIRECT_branch_rel(idx)  true
+#define CPU_BB_DIRECT_branch_zpr(idx)  cpu_bb_direct(st, 0, true, false)
+
+// maps an opcode table entry to its resolved helper. implied and accumulator
+// ops have no operand and reuse the interpreter helpers, which tick their own
+// cycles after the opcode fetch
+#define CPU_BB_all_imp(instr, idx)     CPU_ICL_all_imp(instr, idx)
+#define CPU_BB_all_one(instr, idx)     CPU_ICL_all_one(instr, idx)
+#define CPU_BB_all_acc(instr, idx)     CPU_ICL_all_acc(instr, idx)
+#define CPU_BB_all_imm(instr, idx)     cpu_instr_##instr(st, (u8)op)
+#define CPU_BB_read_abs(instr, idx)    cpu_bb_read(st, op, &cpu_instr_##instr)
+#define CPU_BB_rmw_abs(instr, idx)     cpu_bb_rmw(st, op, &cpu_instr_##instr)
+#define CPU_BB_write_abs(instr, idx)   cpu_bb_write(st, op, &cpu_instr_##instr)
+#define CPU_BB_jmp_abs(instr, idx)     cpu_bb_jmp(st, op)
+#define CPU_BB_jsr_abs(instr, idx)     cpu_bb_jsr(st, op)
+#define CPU_BB_wait_abs(instr, idx)    (void)0
+#define CPU_BB_read_abi(instr, idx)    cpu_bb_read_abi(st, op, st->idx, &cpu_instr_##instr)
+#define CPU_BB_rmw_abi(instr, idx)     cpu_bb_rmw(st, op + st->idx, &cpu_instr_##instr)
+#define CPU_BB_write_abi(instr, idx)   cpu_bb_write(st, op + st->idx, &cpu_instr_##instr)
+#define CPU_BB_rmw_abp(instr, idx)     cpu_bb_rmw_abp(st, op, st->idx, &cpu_instr_##instr)
+#define CPU_BB_jmp_ind(instr, idx)     cpu_bb_jmp_ind(st, op)
+#define CPU_BB_jmp_iax(instr, idx)     cpu_bb_jmp_iax(st, op)
+#define CPU_BB_read_zpg(instr, idx)    cpu_bb_read(st, op, &cpu_instr_##instr)
+#define CPU_BB_rmw_zpg(instr, idx)     cpu_bb_rmw(st, op, &cpu_instr_##instr)
+#define CPU_BB_write_zpg(instr, idx)   cpu_bb_write(st, op, &cpu_instr_##instr)
+#define CPU_BB_read_zpi(instr, idx)    cpu_bb_read(st, lo(op + st->idx), &cpu_instr_##instr)
+#define CPU_BB_rmw_zpi(instr, idx)     cpu_bb_rmw(st, lo(op + st->idx), &cpu_instr_##instr)
+#define CPU_BB_write_zpi(instr, idx)   cpu_bb_write(st, lo(op + st->idx), &cpu_instr_##instr)
+#define CPU_BB_read_zpx(instr, idx)    cpu_bb_read(st, cpu_bb_zp_ptr(st, lo(op + st->X)), &cpu_instr_##instr)
+#define CPU_BB_rmw_zpx(instr, idx)     cpu_bb_rmw(st, cpu_bb_zp_ptr(st, lo(op + st->X)), &cpu_instr_##instr)
+#define CPU_BB_write_zpx(instr, idx)   cpu_bb_write(st, cpu_bb_zp_ptr(st, lo(op + st->X)), &cpu_instr_##instr)
+#define CPU_BB_read_zpy(instr, idx)    cpu_bb_read_zpy(st, op, &cpu_instr_##instr)
+#define CPU_BB_rmw_zpy(instr, idx)     cpu_bb_rmw(st, cpu_bb_zp_ptr(st, op) + st->Y, &cpu_instr_##instr)
+#define CPU_BB_write_zpy(instr, idx)   cpu_bb_write(st, cpu_bb_zp_ptr(st, op) + st->Y, &cpu_instr_##instr)
+#define CPU_BB_read_izp(instr, idx)    cpu_bb_read(st, cpu_bb_zp_ptr(st, op), &cpu_instr_##instr)
+#define CPU_BB_write_izp(instr, idx)   cpu_bb_write(st, cpu_bb_zp_ptr(st, op), &cpu_instr_##instr)
+#define CPU_BB_branch_rel(instr, idx)  cpu_bb_branch(st, (s8)op, &cpu_instr_##instr)
+#define CPU_BB_branch_zpr(instr, idx)  cpu_bb_branch_zpr(st, op, &cpu_instr_##instr)
+
+#endif
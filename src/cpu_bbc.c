@@ -0,0 +1,236 @@
+#include "cpu_internal.h"
+#include "cpu_bbc.h"
+#include "cpu_bb.h"
+#include <string.h>
+
+// per-opcode decode tables, generated from the opcode table. a length of 0
+// marks an illegal opcode
+static const u8 cpu_bbc_len[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_OPLEN_##mode,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+static const u8 cpu_bbc_cycles[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = cyc,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+static const u8 cpu_bbc_max_cycles[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = cyc + CPU_PENALTY_##kind##_##mode,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+// branches, jumps, BRK, RTI and RTS end a block
+#define CPU_BBC_ENDS_all 0
+#define CPU_BBC_ENDS_read 0
+#define CPU_BBC_ENDS_rmw 0
+#define CPU_BBC_ENDS_write 0
+#define CPU_BBC_ENDS_wait 0
+#define CPU_BBC_ENDS_jmp 1
+#define CPU_BBC_ENDS_jsr 1
+#define CPU_BBC_ENDS_branch 1
+
+static const u8 cpu_bbc_ends[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_BBC_ENDS_##kind,
+    CPU_OPCODES(OP)
+#undef OP
+    [0x00] = 1, [0x40] = 1, [0x60] = 1, // brk, rti, rts
+};
+
+// whether an operand's address is known at decode time. accesses through
+// those are checked there, the others as the block runs
+#define CPU_BBC_STATIC_imp 1
+#define CPU_BBC_STATIC_one 1
+#define CPU_BBC_STATIC_acc 1
+#define CPU_BBC_STATIC_imm 1
+#define CPU_BBC_STATIC_abs 1
+#define CPU_BBC_STATIC_abi 0
+#define CPU_BBC_STATIC_abp 0
+#define CPU_BBC_STATIC_ind 1
+#define CPU_BBC_STATIC_iax 0
+#define CPU_BBC_STATIC_zpg 1
+#define CPU_BBC_STATIC_zpi 1
+#define CPU_BBC_STATIC_zpx 0
+#define CPU_BBC_STATIC_zpy 0
+#define CPU_BBC_STATIC_izp 0
+#define CPU_BBC_STATIC_rel 1
+#define CPU_BBC_STATIC_zpr 1
+
+// false if the instruction has a known address that reaches a bus callback
+static bool cpu_bbc_direct(cpu_state_t *st, u8 opc, u16 op) {
+    switch (opc) {
+#define OP(opc, instr, kind, mode, idx, cyc) \
+        case opc: return !CPU_BBC_STATIC_##mode || CPU_BB_DIRECT_##kind##_##mode(idx);
+        CPU_OPCODES(OP)
+#undef OP
+    }
+    return true;
+}
+
+void cpu_bbc_attach(cpu_state_t *st, cpu_bbc_t *bbc) {
+    for (int page = 0; page < 256; page++)
+        st->pages[page].flags &= ~CPU_PAGE_CODE;
+    if (bbc) memset(bbc, 0, sizeof(*bbc));
+    st->bbc = bbc;
+}
+
+void cpu_bbc_remap(cpu_state_t *st) {
+    st->bbc->map_gen++;
+    st->bbc->stale = 1;
+}
+
+void cpu_bbc_invalidate_page(cpu_state_t *st, u8 page) {
+    cpu_bbc_t *bbc = st->bbc;
+    bbc->page_gen[page]++;
+    bbc->stale = 1;
+    bbc->invalidations++;
+}
+
+// a code byte can only be cached if it is read straight from host memory
+static bool cpu_bbc_fetch(cpu_state_t *st, u16 addr, u8 *out) {
+    u8 *page = st->pages[addr >> 8].read;
+    if (!page) return false;
+    *out = page[lo(addr)];
+    return true;
+}
+
+static void cpu_bbc_decode(cpu_state_t *st, cpu_bbc_t *bbc, cpu_block_t *b, u16 pc) {
+    b->pc = pc;
+    b->valid = 1;
+    b->map_gen = bbc->map_gen;
+    b->n = 0;
+    b->max_cycles = 0;
+    b->pages[0] = b->pages[1] = pc >> 8;
+
+    while (b->n < CPU_BBC_UOPS) {
+        u8 opc, bytes[2] = {0, 0};
+        if (!cpu_bbc_fetch(st, pc, &opc)) break;
+        u8 len = cpu_bbc_len[opc];
+        if (len == 0) break; // illegal, left to cpu_exec
+
+        // a block may span at most two pages
+        u8 last = (u16)(pc + len - 1) >> 8;
+        if (last != b->pages[0] && last != b->pages[1]) {
+            if (b->pages[1] != b->pages[0]) break;
+            b->pages[1] = last;
+        }
+        bool ok = true;
+        for (u8 i = 1; i < len && ok; i++) ok = cpu_bbc_fetch(st, pc + i, &bytes[i-1]);
+        if (!ok) break;
+        // left to cpu_exec, from the start of the next block
+        if (!cpu_bbc_direct(st, opc, bytes[0] | hi(bytes[1]))) break;
+
+        cpu_uop_t *u = &b->uops[b->n++];
+        u->opc = opc;
+        u->cycles = len == 1 ? 1 : cpu_bbc_cycles[opc];
+        u->operand = bytes[0] | hi(bytes[1]);
+        u->next_pc = pc + len;
+        b->max_cycles += cpu_bbc_max_cycles[opc];
+        pc += len;
+        if (cpu_bbc_ends[opc]) break;
+    }
+
+    // flag the pages even for an empty block, so that new code written
+    // there replaces it
+    for (int i = 0; i < 2; i++) {
+        b->gens[i] = bbc->page_gen[b->pages[i]];
+        if (st->pages[b->pages[i]].read) st->pages[b->pages[i]].flags |= CPU_PAGE_CODE;
+    }
+}
+
+static cpu_block_t *cpu_bbc_lookup(cpu_state_t *st, cpu_bbc_t *bbc, u16 pc) {
+    cpu_block_t *b = &bbc->blocks[(pc ^ (pc >> 10)) & (CPU_BBC_BLOCKS - 1)];
+    if (b->valid && b->pc == pc && b->map_gen == bbc->map_gen
+            && b->gens[0] == bbc->page_gen[b->pages[0]]
+            && b->gens[1] == bbc->page_gen[b->pages[1]]) {
+        bbc->hits++;
+        return b;
+    }
+    bbc->misses++;
+    cpu_bbc_decode(st, bbc, b, pc);
+    return b;
+}
+
+#ifdef CPU_THREADED_DISPATCH
+
+// threaded like cpu_run: each uop handler jumps straight to the next one
+static void cpu_bbc_exec(cpu_state_t *st, cpu_bbc_t *bbc, const cpu_block_t *b) {
+    static void *const dispatch[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = &&op_##opc,
+        CPU_OPCODES(OP)
+#undef OP
+    };
+    const cpu_uop_t *u = b->uops, *end = b->uops + b->n;
+    u16 op;
+
+    // the rest of the block may have been overwritten, or an interrupt may
+    // have to be taken before the next instruction
+#define CPU_BB_NEXT() do { \
+        if (unlikely(bbc->stale | st->NMI | st->IRQ | st->RST | st->DMA)) return; \
+        if (++u == end) return; \
+        op = u->operand; \
+        goto *dispatch[u->opc]; \
+    } while (0)
+
+    bbc->stale = 0;
+    op = u->operand;
+    goto *dispatch[u->opc];
+
+    // st->PC is still on an instruction that is left to cpu_exec
+#define OP(opc, instr, kind, mode, idx, cyc) \
+    op_##opc: \
+        if (!CPU_BBC_STATIC_##mode && unlikely(!CPU_BB_DIRECT_##kind##_##mode(idx))) return; \
+        st->PC = u->next_pc; st->cycles += u->cycles; \
+        CPU_BB_##kind##_##mode(instr, idx); CPU_BB_NEXT();
+    CPU_OPCODES(OP)
+#undef OP
+#undef CPU_BB_NEXT
+}
+
+#else
+
+static void cpu_bbc_exec(cpu_state_t *st, cpu_bbc_t *bbc, const cpu_block_t *b) {
+    bbc->stale = 0;
+    for (const cpu_uop_t *u = b->uops, *end = b->uops + b->n; u < end; u++) {
+        u16 op = u->operand;
+        // st->PC is still on an instruction that is left to cpu_exec
+        switch (u->opc) {
+#define OP(opc, instr, kind, mode, idx, cyc) \
+            case opc: \
+                if (!CPU_BBC_STATIC_##mode && unlikely(!CPU_BB_DIRECT_##kind##_##mode(idx))) return; \
+                st->PC = u->next_pc; st->cycles += u->cycles; \
+                CPU_BB_##kind##_##mode(instr, idx); break;
+            CPU_OPCODES(OP)
+#undef OP
+        }
+        // the rest of the block may have been overwritten, or an interrupt
+        // may have to be taken before the next instruction
+        if (unlikely(bbc->stale | st->NMI | st->IRQ | st->RST | st->DMA)) return;
+    }
+}
+
+#endif
+
+int cpu_bbc_run(cpu_state_t *st, u32 cycle_budget) {
+    cpu_bbc_t *bbc = st->bbc;
+    u64 target = st->cycles + cycle_budget;
+    while (st->cycles < target) {
+        if (!cpu_irq_pending(st)) {
+            cpu_block_t *b = cpu_bbc_lookup(st, bbc, st->PC);
+            // blocks only run when they fit the budget in the worst case, so
+            // every instruction still starts before the budget is used up
+            if (b->n && st->cycles + b->max_cycles <= target) {
+                u64 start = st->cycles;
+                cpu_bbc_exec(st, bbc, b);
+                // no progress means it stopped before its first instruction,
+                // which is left to the interpreter
+                if (st->cycles != start) continue;
+            }
+        }
+        if (cpu_exec(st) < 0) return -1;
+    }
+    return (int)(st->cycles - target);
+}
@@ -0,0 +1,61 @@
+#ifndef __CPU_BBC_H__
+#define __CPU_BBC_H__
+
+#include "cpu.h"
+
+// Basic-block cache for cpu_run.
+//
+// Straight-line code is decoded once, up to and including the next branch,
+// JMP, JSR, RTS, RTI or BRK, into an array of micro-ops with their operand
+// bytes already fetched. cpu_run then executes whole blocks without opcode
+// fetch, decode or per-instruction budget checks.
+//
+// Only code on pages mapped with cpu_map is cached, and a page holding a
+// block is flagged CPU_PAGE_CODE so that any write to it from the core
+// invalidates its blocks (self-modifying code). Embedders that change mapped
+// memory behind the core's back must call cpu_invalidate.
+//
+// The cache is only used while nothing watches single cycles: no tick
+// callback and no bus log. Cycle totals are identical to the interpreter,
+// including page-cross and branch penalties; st->cycles is advanced once per
+// instruction instead of once per cycle. An instruction with an access that
+// reaches a bus callback (a page without a host pointer for it) ends the
+// block before it and is run by cpu_exec, so the callback sees st->cycles
+// as it would there.
+
+#define CPU_BBC_BLOCKS 1024 // must be a power of 2
+#define CPU_BBC_UOPS 32
+
+typedef struct {
+    u8 opc;
+    u8 cycles;  // cycles accounted up front, implied ops tick the rest
+    u16 operand;
+    u16 next_pc;
+} cpu_uop_t;
+
+typedef struct {
+    u16 pc;
+    u8 valid;
+    u8 n;           // number of uops, 0 if PC can't start a block
+    u8 pages[2];    // pages the block's bytes live on
+    u16 max_cycles; // pre-summed worst-case cycles of the whole block
+    u32 gens[2];    // generation of pages[] at decode time
+    u32 map_gen;    // and of the page table
+    cpu_uop_t uops[CPU_BBC_UOPS];
+} cpu_block_t;
+
+typedef struct cpu_bbc {
+    u32 page_gen[256]; // bumped on every write to a CPU_PAGE_CODE page
+    u32 map_gen;       // bumped by cpu_map: blocks end where it was decided
+                       // an access would reach a bus callback
+    u8 stale;          // set when the running block may have been modified
+    u64 hits;
+    u64 misses;
+    u64 invalidations;
+    cpu_block_t blocks[CPU_BBC_BLOCKS];
+} cpu_bbc_t;
+
+// clears bbc and attaches it to st. a NULL bbc detaches the cache
+void cpu_bbc_attach(cpu_state_t *st, cpu_bbc_t *bbc);
+
+#endif
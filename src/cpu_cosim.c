@@ -0,0 +1,381 @@
+#include "cpu_internal.h"
+#include "cpu_cosim.h"
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#define CPU_COSIM_THREADS
+#endif
+
+#define load(x)      atomic_load_explicit(&(x), memory_order_acquire)
+#define load_own(x)  atomic_load_explicit(&(x), memory_order_relaxed)
+#define store(x, v)  atomic_store_explicit(&(x), (v), memory_order_release)
+
+static bool cpu_cosim_inline(const cpu_cosim_t *cs) {
+#ifdef CPU_COSIM_THREADS
+    return cs->flags & CPU_COSIM_INLINE;
+#else
+    (void)cs;
+    return true;
+#endif
+}
+
+#ifdef CPU_COSIM_THREADS
+typedef struct {
+    pthread_t ids[CPU_COSIM_DEVICES];
+    pthread_mutex_t lock;
+    pthread_cond_t devs_wake; // the CPU published a cycle or posted a write
+    pthread_cond_t cpu_wake;  // a device has run
+} cpu_cosim_threads_t;
+#endif
+
+// between checks of what another thread is to store, giving it the core if
+// they share one
+static void cpu_cosim_relax(void) {
+#ifdef CPU_COSIM_THREADS
+    sched_yield();
+#endif
+}
+
+// wakes the threads asleep on wake after a store they may wait for. the
+// fence orders the store before the check, as cpu_cosim_sleep orders its
+// count before its own check, so one of the two sees the other
+static void cpu_cosim_wake(cpu_cosim_t *cs, _Atomic u32 *asleep, bool cpu) {
+#ifdef CPU_COSIM_THREADS
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(asleep, memory_order_relaxed)) return;
+    cpu_cosim_threads_t *t = cs->threads;
+    pthread_mutex_lock(&t->lock);
+    pthread_cond_broadcast(cpu ? &t->cpu_wake : &t->devs_wake);
+    pthread_mutex_unlock(&t->lock);
+#else
+    (void)cs;
+    (void)asleep;
+    (void)cpu;
+#endif
+}
+
+// publishes the device's line as it stands
+static void cpu_cosim_publish_line(cpu_cosim_chip_t *c) {
+    cpu_cosim_dev_t *d = &c->dev;
+    if (d->line == CPU_COSIM_NONE) return;
+    store(c->level, d->level(d->user));
+    store(c->horizon, d->next_change(d->user));
+}
+
+// runs the device up to target, applying the writes posted for cycles up to
+// it on the way. device side
+static void cpu_cosim_pump(cpu_cosim_chip_t *c, u64 target) {
+    cpu_cosim_dev_t *d = &c->dev;
+    u64 time = load_own(c->time);
+    u64 tail = load_own(c->tail), head = load(c->head);
+    for (; tail != head; tail++) {
+        cpu_cosim_write_t *w = &c->queue[tail & (CPU_COSIM_QUEUE - 1)];
+        if (w->cycle > target) break;
+        if (w->cycle > time) d->run(d->user, time = w->cycle);
+        d->write(d->user, w->addr, w->val);
+    }
+    if (target > time) d->run(d->user, target);
+    cpu_cosim_publish_line(c);
+    store(c->tail, tail);
+    store(c->time, target > time ? target : time);
+    if (!cpu_cosim_inline(c->cs)) cpu_cosim_wake(c->cs, &c->cs->cpu_asleep, true);
+}
+
+#ifdef CPU_COSIM_THREADS
+// whether the device has cycles to run or a write to apply. device side
+static bool cpu_cosim_due(cpu_cosim_chip_t *c, u64 now) {
+    u64 tail = load_own(c->tail);
+    return now > load_own(c->time) || (tail != load(c->head)
+        && c->queue[tail & (CPU_COSIM_QUEUE - 1)].cycle <= now);
+}
+
+static void *cpu_cosim_thread(void *arg) {
+    cpu_cosim_chip_t *c = arg;
+    cpu_cosim_t *cs = c->cs;
+    cpu_cosim_threads_t *t = cs->threads;
+    for (u32 idle = 0;; idle++) {
+        u64 now = load(cs->now);
+        if (cpu_cosim_due(c, now)) {
+            cpu_cosim_pump(c, now);
+            idle = 0;
+        } else if (load(cs->stop)) {
+            return NULL;
+        } else if (idle < CPU_COSIM_SPINS) {
+            cpu_cosim_relax();
+        } else {
+            pthread_mutex_lock(&t->lock);
+            atomic_fetch_add(&cs->devs_asleep, 1);
+            atomic_thread_fence(memory_order_seq_cst);
+            while (!cpu_cosim_due(c, load(cs->now)) && !load(cs->stop))
+                pthread_cond_wait(&t->devs_wake, &t->lock);
+            atomic_fetch_sub(&cs->devs_asleep, 1);
+            pthread_mutex_unlock(&t->lock);
+            idle = 0;
+        }
+    }
+}
+#endif
+
+// waits for the device's thread to have applied the writes before tail and
+// run to time. CPU side
+static void cpu_cosim_await(cpu_cosim_t *cs, cpu_cosim_chip_t *c, u64 tail, u64 time) {
+    for (u32 i = 0; i < CPU_COSIM_SPINS; i++) {
+        if (load(c->tail) >= tail && load(c->time) >= time) return;
+        cpu_cosim_relax();
+    }
+#ifdef CPU_COSIM_THREADS
+    cpu_cosim_threads_t *t = cs->threads;
+    pthread_mutex_lock(&t->lock);
+    atomic_fetch_add(&cs->cpu_asleep, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (load(c->tail) < tail || load(c->time) < time)
+        pthread_cond_wait(&t->cpu_wake, &t->lock);
+    atomic_fetch_sub(&cs->cpu_asleep, 1);
+    pthread_mutex_unlock(&t->lock);
+#else
+    (void)cs;
+#endif
+}
+
+// lets the devices run up to cycle. CPU side, cycle never goes back
+static void cpu_cosim_publish(cpu_cosim_t *cs, u64 cycle) {
+    if (cycle <= load_own(cs->now)) return;
+    store(cs->now, cycle);
+    if (!cpu_cosim_inline(cs)) cpu_cosim_wake(cs, &cs->devs_asleep, false);
+}
+
+// brings the device to cycle with every posted write applied, and takes its
+// line there
+static void cpu_cosim_sync(cpu_cosim_t *cs, cpu_cosim_chip_t *c, u64 cycle) {
+    cpu_cosim_publish(cs, cycle);
+    if (cpu_cosim_inline(cs)) {
+        cpu_cosim_pump(c, cycle);
+    } else {
+        cpu_cosim_await(cs, c, load_own(c->head), cycle);
+    }
+    if (c->dev.line == CPU_COSIM_NONE) return;
+    c->cpu_level = load(c->level);
+    u64 horizon = load(c->horizon);
+    c->bound = horizon > cycle ? horizon : cycle + 1;
+}
+
+// drives the CPU's lines from the devices'. the core latches NMI, so it is
+// raised on the rising edge only
+static void cpu_cosim_lines(cpu_cosim_t *cs) {
+    u8 irq = 0, nmi = 0, driven = 0;
+    for (u8 i = 0; i < cs->n; i++) {
+        cpu_cosim_chip_t *c = &cs->chips[i];
+        driven |= c->dev.line;
+        if (c->dev.line == CPU_COSIM_IRQ) irq |= c->cpu_level;
+        if (c->dev.line == CPU_COSIM_NMI) nmi |= c->cpu_level;
+    }
+    if (driven & CPU_COSIM_IRQ) cs->st->IRQ = irq;
+    if (nmi && !cs->nmi) cs->st->NMI = 1;
+    cs->nmi = nmi;
+}
+
+static cpu_cosim_chip_t *cpu_cosim_decode(cpu_cosim_t *cs, u16 addr) {
+    if (!cs->dev_of[addr >> 8]) return NULL;
+    for (u8 i = cs->dev_of[addr >> 8] - 1; i < cs->n; i++) {
+        cpu_cosim_chip_t *c = &cs->chips[i];
+        if (addr >= c->dev.first && addr <= c->dev.last) return c;
+    }
+    return NULL;
+}
+
+static u8 cpu_cosim_bus_read(void *user, u16 addr) {
+    cpu_cosim_t *cs = user;
+    cpu_cosim_chip_t *c = cpu_cosim_decode(cs, addr);
+    if (!c) return cs->bus_read(cs->user, addr);
+    cs->reads++;
+    cpu_cosim_sync(cs, c, cs->st->cycles);
+    // the device thread has nothing to do until the CPU publishes again
+    u8 val = c->dev.read(c->dev.user, addr);
+    if (c->dev.line != CPU_COSIM_NONE) {
+        cpu_cosim_publish_line(c);
+        c->cpu_level = load_own(c->level);
+        u64 horizon = load_own(c->horizon);
+        c->bound = horizon > cs->st->cycles ? horizon : cs->st->cycles + 1;
+        cpu_cosim_lines(cs);
+    }
+    return val;
+}
+
+static void cpu_cosim_bus_write(void *user, u8 val, u16 addr) {
+    cpu_cosim_t *cs = user;
+    cpu_cosim_chip_t *c = cpu_cosim_decode(cs, addr);
+    if (!c) {
+        cs->bus_write(cs->user, val, addr);
+        return;
+    }
+    u64 cycle = cs->st->cycles, head = load_own(c->head);
+    if (head - load(c->tail) == CPU_COSIM_QUEUE) {
+        // full: let the device drain what is posted
+        cs->stalls++;
+        cpu_cosim_publish(cs, cycle);
+        if (cpu_cosim_inline(cs)) cpu_cosim_pump(c, cycle);
+        else cpu_cosim_await(cs, c, head - CPU_COSIM_QUEUE + 1, 0);
+    }
+    c->queue[head & (CPU_COSIM_QUEUE - 1)] = (cpu_cosim_write_t){ cycle, addr, val };
+    store(c->head, head + 1);
+    if (!cpu_cosim_inline(cs)) cpu_cosim_wake(cs, &cs->devs_asleep, false);
+    cs->writes++;
+    if (c->dev.line != CPU_COSIM_NONE && cycle + c->dev.lookahead < c->bound)
+        c->bound = cycle + c->dev.lookahead;
+}
+
+void cpu_cosim_init(cpu_cosim_t *cs, cpu_state_t *st, u32 window, u32 flags) {
+    memset(cs, 0, sizeof(*cs));
+    cs->st = st;
+    cs->window = window ? window : 1;
+    cs->flags = flags;
+    cs->now = st->cycles;
+}
+
+int cpu_cosim_add(cpu_cosim_t *cs, const cpu_cosim_dev_t *dev) {
+    if (cs->n == CPU_COSIM_DEVICES || cs->started) return CPU_COSIM_ENOSPC;
+    cpu_cosim_chip_t *c = &cs->chips[cs->n];
+    memset(c, 0, sizeof(*c));
+    c->dev = *dev;
+    c->cs = cs;
+    c->time = cs->st->cycles;
+    c->bound = cs->st->cycles;
+    for (u32 page = dev->first >> 8; page <= (u32)(dev->last >> 8); page++) {
+        if (!cs->dev_of[page]) cs->dev_of[page] = cs->n + 1;
+        cpu_map(cs->st, page << 8, 0x100, NULL, CPU_PAGE_MMIO);
+    }
+    return cs->n++;
+}
+
+int cpu_cosim_start(cpu_cosim_t *cs) {
+#ifdef CPU_BUS_READ
+    // the bound bus functions would get cs as their machine
+    return CPU_COSIM_EBUS;
+#endif
+    cpu_state_t *st = cs->st;
+    cs->user = st->user;
+    cs->bus_read = st->bus_read;
+    cs->bus_write = st->bus_write;
+    st->user = cs;
+    st->bus_read = cpu_cosim_bus_read;
+    st->bus_write = cpu_cosim_bus_write;
+    cs->started = 1;
+    store(cs->stop, 0);
+#ifdef CPU_COSIM_THREADS
+    if (cpu_cosim_inline(cs)) return 0;
+    cpu_cosim_threads_t *t = calloc(1, sizeof(*t));
+    if (!t) {
+        cpu_cosim_stop(cs);
+        return CPU_COSIM_ETHREAD;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->devs_wake, NULL);
+    pthread_cond_init(&t->cpu_wake, NULL);
+    cs->threads = t;
+    for (u8 i = 0; i < cs->n; i++) {
+        if (pthread_create(&t->ids[i], NULL, cpu_cosim_thread, &cs->chips[i]) != 0) {
+            cs->nthreads = i;
+            cpu_cosim_stop(cs);
+            return CPU_COSIM_ETHREAD;
+        }
+    }
+    cs->nthreads = cs->n;
+#endif
+    return 0;
+}
+
+void cpu_cosim_stop(cpu_cosim_t *cs) {
+    if (!cs->started) return;
+    store(cs->stop, 1);
+#ifdef CPU_COSIM_THREADS
+    cpu_cosim_threads_t *t = cs->threads;
+    if (t) {
+        cpu_cosim_wake(cs, &cs->devs_asleep, false);
+        for (u8 i = 0; i < cs->nthreads; i++) pthread_join(t->ids[i], NULL);
+        pthread_cond_destroy(&t->cpu_wake);
+        pthread_cond_destroy(&t->devs_wake);
+        pthread_mutex_destroy(&t->lock);
+        free(t);
+    }
+    cs->threads = NULL;
+    cs->nthreads = 0;
+#endif
+    cpu_state_t *st = cs->st;
+    st->user = cs->user;
+    st->bus_read = cs->bus_read;
+    st->bus_write = cs->bus_write;
+    cs->started = 0;
+}
+
+// takes the lines of the devices whose line may have changed by now
+static void cpu_cosim_sync_lines(cpu_cosim_t *cs) {
+    u64 now = cs->st->cycles;
+    bool synced = false;
+    for (u8 i = 0; i < cs->n; i++) {
+        cpu_cosim_chip_t *c = &cs->chips[i];
+        if (c->dev.line == CPU_COSIM_NONE || c->bound > now) continue;
+        cpu_cosim_sync(cs, c, now);
+        synced = true;
+    }
+    if (!synced) return;
+    cs->syncs++;
+    cpu_cosim_lines(cs);
+}
+
+// how far the CPU may run from here: to the next possible line change, and
+// no further than a write now could move it, or than window ahead of the
+// slowest device
+static u64 cpu_cosim_limit(cpu_cosim_t *cs, u64 until) {
+    u64 now = cs->st->cycles, limit = until;
+    for (u8 i = 0; i < cs->n; i++) {
+        cpu_cosim_chip_t *c = &cs->chips[i];
+        u64 slowest = load(c->time) + cs->window;
+        if (slowest < limit) limit = slowest;
+        if (c->dev.line == CPU_COSIM_NONE) continue;
+        if (c->bound < limit) limit = c->bound;
+        u64 ahead = now + (c->dev.lookahead ? c->dev.lookahead : 1);
+        if (ahead < limit) limit = ahead;
+    }
+    return limit;
+}
+
+int cpu_cosim_run(cpu_cosim_t *cs, u64 until) {
+    cpu_state_t *st = cs->st;
+    u64 next_event = st->next_event;
+    int res = 0;
+    cpu_cosim_sync_lines(cs);
+    while (st->cycles < until) {
+        u64 limit = cpu_cosim_limit(cs, until);
+        if (limit <= st->cycles) {
+            // too far ahead of a device: let it catch up
+            cs->stalls++;
+            cpu_cosim_publish(cs, st->cycles);
+            for (u8 i = 0; i < cs->n; i++) {
+                cpu_cosim_chip_t *c = &cs->chips[i];
+                if (load(c->time) + cs->window > st->cycles) continue;
+                if (cpu_cosim_inline(cs)) cpu_cosim_pump(c, st->cycles);
+                else cpu_cosim_await(cs, c, 0, st->cycles - cs->window + 1);
+            }
+            continue;
+        }
+        u64 left = limit - st->cycles;
+        st->next_event = limit;
+        res = cpu_run(st, left > 0xFFFFFFFF ? 0xFFFFFFFF : (u32)left);
+        cpu_cosim_publish(cs, st->cycles);
+        if (res < 0) break;
+        cpu_cosim_sync_lines(cs);
+    }
+    st->next_event = next_event;
+    // leave every device where the CPU is
+    for (u8 i = 0; i < cs->n; i++) cpu_cosim_sync(cs, &cs->chips[i], st->cycles);
+    cpu_cosim_lines(cs);
+    if (res < 0) return res == CPU_BREAK ? CPU_BREAK : CPU_COSIM_EEXEC;
+    return (int)(st->cycles - until);
+}
+
+#undef load
+#undef load_own
+#undef store
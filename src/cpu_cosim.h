@@ -0,0 +1,142 @@
+#ifndef __CPU_COSIM_H__
+#define __CPU_COSIM_H__
+
+#include "cpu.h"
+#include <stdatomic.h>
+
+// Multi-threaded co-simulation.
+//
+// Devices (a PPU, an APU, a disk controller) each run on a thread of their
+// own while the CPU runs on the caller's. A device claims an address range
+// and is driven through its callbacks: run advances it to an absolute cycle,
+// write and read are register accesses at the cycle it has run to, and
+// level and next_change describe the interrupt line it drives.
+//
+// CPU writes to a device don't wait for it: they are posted, stamped with
+// st->cycles, to a single-producer single-consumer queue, and the device
+// thread applies them in order after running up to their stamp. Devices run
+// up to the cycle the CPU has published, never past it, and the CPU stays at
+// most window cycles ahead of the slowest one. They only synchronize:
+//   - when the CPU reads a device register: the CPU waits for the device to
+//     reach that cycle with every posted write applied, then calls read
+//   - when a device's interrupt line may change: the CPU runs up to the
+//     device's next_change (or the stamp of a posted write plus lookahead),
+//     waits for the device to get there, and takes its level
+// An access can only move a change closer by lookahead, so the CPU runs at
+// most the smallest lookahead between syncs; it is the price of a line that
+// can react quickly.
+// Line changes take effect at the first instruction boundary at or after
+// them, as with cpu_sched.h, and nothing the CPU sees depends on how far the
+// threads got: a run with CPU_COSIM_INLINE, where the CPU's thread runs the
+// devices at the same points instead, ends in the same state.
+//
+// Devices must give the same result whether run reaches a cycle in one call
+// or in several, and must not change their line earlier than next_change
+// said, except lookahead cycles or more after an access, or at once by a
+// read (level is taken right after it). Their callbacks are called from one
+// thread at a time, but not always the same one.
+//
+// The cosim drives st->IRQ and st->NMI from the devices' lines and takes over
+// the bus callbacks while started: accesses outside the devices' ranges go to
+// the ones the state had. The pages the ranges touch are mapped MMIO.
+// Without POSIX threads, everything runs inline. A thread left waiting on
+// the other side yields CPU_COSIM_SPINS times, then sleeps until it is woken:
+// device threads when the CPU publishes a cycle or posts a write, the CPU
+// when a device has run.
+
+#define CPU_COSIM_DEVICES 8
+#define CPU_COSIM_QUEUE   1024 // writes in flight per device, a power of two
+#define CPU_COSIM_SPINS   256  // yields before a waiting thread sleeps
+
+// flags
+#define CPU_COSIM_INLINE 0x01 // run the devices on the CPU's thread
+
+// interrupt lines
+#define CPU_COSIM_NONE 0
+#define CPU_COSIM_IRQ  1
+#define CPU_COSIM_NMI  2
+
+// error codes
+#define CPU_COSIM_ENOSPC -1 // CPU_COSIM_DEVICES devices already added
+#define CPU_COSIM_ETHREAD -2 // can't start a device thread
+#define CPU_COSIM_EEXEC  -3 // the CPU hit an illegal opcode
+#define CPU_COSIM_EBUS   -4 // the header-only build, see cpu_inline.h
+
+typedef struct {
+    void *user;
+    u16 first, last;  // inclusive address range of its registers
+    u8 line;          // CPU_COSIM_*, the line it drives
+    u32 lookahead;    // least cycles from an access to a line change it causes, 0 acts as 1
+    void (*run)(void *user, u64 until);
+    void (*write)(void *user, u16 addr, u8 val);
+    u8 (*read)(void *user, u16 addr);
+    u8 (*level)(void *user);
+    // the earliest cycle after the one it has run to where its line could
+    // change without further accesses, ~0 for never
+    u64 (*next_change)(void *user);
+} cpu_cosim_dev_t;
+
+typedef struct {
+    u64 cycle;
+    u16 addr;
+    u8 val;
+} cpu_cosim_write_t;
+
+typedef struct {
+    cpu_cosim_dev_t dev;
+    struct cpu_cosim *cs;
+    cpu_cosim_write_t queue[CPU_COSIM_QUEUE];
+    _Atomic u64 head;      // writes posted, by the CPU thread
+    _Atomic u64 tail;      // writes applied, by the device thread
+    _Atomic u64 time;      // cycle the device has run to
+    _Atomic u64 horizon;   // next_change there
+    _Atomic u8 level;
+    // the CPU thread's view: the line as of the last sync and the earliest
+    // cycle it may change
+    u8 cpu_level;
+    u64 bound;
+} cpu_cosim_chip_t;
+
+typedef struct cpu_cosim {
+    cpu_state_t *st;
+    u32 window;
+    u32 flags;
+    u8 n;
+    u8 started;
+    u8 dev_of[256];        // 1 + the first device whose range touches each page
+    cpu_cosim_chip_t chips[CPU_COSIM_DEVICES];
+    _Atomic u64 now;       // cycle the CPU has published, devices run up to it
+    _Atomic u8 stop;
+    void *threads;         // pthread_t per device, and the lock they sleep on
+    u8 nthreads;
+    _Atomic u32 devs_asleep; // device threads waiting for the CPU
+    _Atomic u32 cpu_asleep;  // the CPU waiting for a device
+    u8 nmi;                // the devices' NMI lines, ORed, as last taken
+
+    // what the state had before the cosim started
+    void *user;
+    u8 (*bus_read)(void *user, u16 addr);
+    void (*bus_write)(void *user, u8 val, u16 addr);
+
+    u64 reads;             // device register reads
+    u64 writes;            // writes posted
+    u64 syncs;             // waits for a line that may have changed
+    u64 stalls;            // waits for the slowest device to catch up
+} cpu_cosim_t;
+
+// clears cs and binds it to st. window is the most cycles the CPU runs ahead
+// of the slowest device, flags CPU_COSIM_*
+void cpu_cosim_init(cpu_cosim_t *cs, cpu_state_t *st, u32 window, u32 flags);
+// adds a device at the cycle the CPU is at, before cpu_cosim_start.
+// returns its index or CPU_COSIM_ENOSPC
+int cpu_cosim_add(cpu_cosim_t *cs, const cpu_cosim_dev_t *dev);
+// takes over the bus callbacks and starts the device threads. returns 0,
+// CPU_COSIM_ETHREAD or CPU_COSIM_EBUS
+int cpu_cosim_start(cpu_cosim_t *cs);
+// runs the CPU and the devices until st->cycles >= until, all of them ending
+// at st->cycles. returns the overshoot, CPU_COSIM_EEXEC or CPU_BREAK
+int cpu_cosim_run(cpu_cosim_t *cs, u64 until);
+// stops the device threads and gives the state its bus callbacks back
+void cpu_cosim_stop(cpu_cosim_t *cs);
+
+#endif
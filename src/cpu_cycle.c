@@ -0,0 +1,512 @@
+// the ALU flags the 65C02's extra decimal mode cycle in cyc_val instead of
+// ticking, and the read step then takes one more step. in the header-only
+// build (cpu_inline.h) the ALU was compiled ticking before this file, so ADC
+// and SBC are replaced here by copies that flag it
+#ifdef __CPU_INTERNAL_H__
+#define CPU_CYCLE_OWN_DECIMAL
+#else
+#define CPU_DECIMAL_TICK(st) ((st)->cyc_val = 1)
+#endif
+#include "cpu_internal.h"
+#include "cpu_cycle.h"
+
+#if defined(CPU_CYCLE_OWN_DECIMAL) && defined(CPU_VARIANT_65C02)
+static void cpu_cycle_adc(cpu_state_t *st, u8 op) {
+    if (unlikely(st->D)) {
+        cpu_adc_decimal(st, op);
+        st->cyc_val = 1;
+        return;
+    }
+    cpu_adc_binary(st, op);
+}
+
+static void cpu_cycle_sbc(cpu_state_t *st, u8 op) {
+    if (unlikely(st->D)) {
+        cpu_sbc_decimal(st, op);
+        st->cyc_val = 1;
+        return;
+    }
+    cpu_adc_binary(st, ~op);
+}
+
+#define cpu_instr_adc cpu_cycle_adc
+#define cpu_instr_sbc cpu_cycle_sbc
+#endif
+
+// Each instruction runs as numbered steps, step n being its nth cycle, with
+// step 1 the opcode fetch. An addressing sequence leaves the effective
+// address in cyc_addr by a fixed step, the access step of its mode, and the
+// read, read-modify-write or write then follows from there. Page-cross
+// fixups are steps of their own that are skipped when the page doesn't
+// change, so a given step always does the same thing.
+//
+// The steps mirror the cpu_icl_* helpers cycle for cycle. The ALU is shared
+// with them: only the instructions that tick from inside their cpu_instr_*
+// (stack, BRK and returns) get sequences of their own here.
+
+enum {
+    CPU_CYC_ILLEGAL, CPU_CYC_IMP, CPU_CYC_ONE, CPU_CYC_ACC, CPU_CYC_IMM,
+    CPU_CYC_ABS, CPU_CYC_ABI, CPU_CYC_ABP, CPU_CYC_ZPG, CPU_CYC_ZPI, CPU_CYC_ZPX,
+    CPU_CYC_ZPY, CPU_CYC_IZP, CPU_CYC_JMP, CPU_CYC_JSR, CPU_CYC_WAIT, CPU_CYC_IND,
+    CPU_CYC_IAX, CPU_CYC_BRANCH, CPU_CYC_BBR, CPU_CYC_PUSH, CPU_CYC_PULL,
+    CPU_CYC_BRK, CPU_CYC_RTI, CPU_CYC_RTS, CPU_CYC_NSEQS
+};
+
+// the step that accesses the effective address, by addressing sequence
+static const u8 cpu_cycle_access_step[CPU_CYC_NSEQS] = {
+    [CPU_CYC_IMM] = 2, [CPU_CYC_ZPG] = 3, [CPU_CYC_ABS] = 4, [CPU_CYC_ZPI] = 4,
+    [CPU_CYC_ABI] = 5, [CPU_CYC_ABP] = 5, [CPU_CYC_IZP] = 5, [CPU_CYC_ZPX] = 6,
+    [CPU_CYC_ZPY] = 6,
+};
+
+// the step sequence, by helper
+#define CPU_CYC_all_imp CPU_CYC_IMP
+#define CPU_CYC_all_one CPU_CYC_ONE
+#define CPU_CYC_all_acc CPU_CYC_ACC
+#define CPU_CYC_all_imm CPU_CYC_IMM
+#define CPU_CYC_read_abs CPU_CYC_ABS
+#define CPU_CYC_rmw_abs CPU_CYC_ABS
+#define CPU_CYC_write_abs CPU_CYC_ABS
+#define CPU_CYC_jmp_abs CPU_CYC_JMP
+#define CPU_CYC_jsr_abs CPU_CYC_JSR
+#define CPU_CYC_wait_abs CPU_CYC_WAIT
+#define CPU_CYC_read_abi CPU_CYC_ABI
+#define CPU_CYC_rmw_abi CPU_CYC_ABI
+#define CPU_CYC_write_abi CPU_CYC_ABI
+#define CPU_CYC_rmw_abp CPU_CYC_ABP
+#define CPU_CYC_jmp_ind CPU_CYC_IND
+#define CPU_CYC_jmp_iax CPU_CYC_IAX
+#define CPU_CYC_read_zpg CPU_CYC_ZPG
+#define CPU_CYC_rmw_zpg CPU_CYC_ZPG
+#define CPU_CYC_write_zpg CPU_CYC_ZPG
+#define CPU_CYC_read_zpi CPU_CYC_ZPI
+#define CPU_CYC_rmw_zpi CPU_CYC_ZPI
+#define CPU_CYC_write_zpi CPU_CYC_ZPI
+#define CPU_CYC_read_zpx CPU_CYC_ZPX
+#define CPU_CYC_rmw_zpx CPU_CYC_ZPX
+#define CPU_CYC_write_zpx CPU_CYC_ZPX
+#define CPU_CYC_read_zpy CPU_CYC_ZPY
+#define CPU_CYC_rmw_zpy CPU_CYC_ZPY
+#define CPU_CYC_write_zpy CPU_CYC_ZPY
+#define CPU_CYC_read_izp CPU_CYC_IZP
+#define CPU_CYC_write_izp CPU_CYC_IZP
+#define CPU_CYC_branch_rel CPU_CYC_BRANCH
+#define CPU_CYC_branch_zpr CPU_CYC_BBR
+
+static const u8 cpu_cycle_seq[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_CYC_##kind##_##mode,
+    CPU_OPCODES(OP)
+#undef OP
+    [0x00] = CPU_CYC_BRK, [0x40] = CPU_CYC_RTI, [0x60] = CPU_CYC_RTS,
+    [0x08] = CPU_CYC_PUSH, [0x48] = CPU_CYC_PUSH, [0x28] = CPU_CYC_PULL, [0x68] = CPU_CYC_PULL,
+#ifdef CPU_VARIANT_65C02
+    [0xDA] = CPU_CYC_PUSH, [0x5A] = CPU_CYC_PUSH, [0xFA] = CPU_CYC_PULL, [0x7A] = CPU_CYC_PULL,
+#endif
+};
+
+// what happens at the effective address. all_imm is the only all_ helper
+// that gets there, as a read
+enum { CPU_CYC_READ, CPU_CYC_RMW, CPU_CYC_WRITE };
+#define CPU_CYC_KIND_all CPU_CYC_READ
+#define CPU_CYC_KIND_read CPU_CYC_READ
+#define CPU_CYC_KIND_rmw CPU_CYC_RMW
+#define CPU_CYC_KIND_write CPU_CYC_WRITE
+#define CPU_CYC_KIND_jmp CPU_CYC_READ
+#define CPU_CYC_KIND_jsr CPU_CYC_READ
+#define CPU_CYC_KIND_wait CPU_CYC_READ
+#define CPU_CYC_KIND_branch CPU_CYC_READ
+
+static const u8 cpu_cycle_kind[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_CYC_KIND_##kind,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+// 1 if the index register is Y
+#define CPU_CYC_IDX_X 0
+#define CPU_CYC_IDX_Y 1
+#define CPU_CYC_IDX__ 0
+
+static const u8 cpu_cycle_idx_y[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_CYC_IDX_##idx,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+// the instruction's operation. val is the operand read, or the value to
+// modify; rmw and write operations return the value to write and branches
+// whether they are taken. the stack instructions and BRK, RTI and RTS have
+// sequences of their own and never get here
+#define CPU_CYC_OP_all_imp(instr)    cpu_instr_##instr(st); return 0
+#define CPU_CYC_OP_all_one(instr)    cpu_instr_##instr(st); return 0
+#define CPU_CYC_OP_all_acc(instr)    st->A = cpu_instr_##instr(st, st->A); return 0
+#define CPU_CYC_OP_all_imm(instr)    cpu_instr_##instr(st, val); return 0
+#define CPU_CYC_OP_read_abs(instr)   cpu_instr_##instr(st, val); return 0
+#define CPU_CYC_OP_rmw_abs(instr)    return cpu_instr_##instr(st, val)
+#define CPU_CYC_OP_write_abs(instr)  return cpu_instr_##instr(st)
+#define CPU_CYC_OP_jmp_abs(instr)    return 0
+#define CPU_CYC_OP_jsr_abs(instr)    return 0
+#define CPU_CYC_OP_wait_abs(instr)   return 0
+#define CPU_CYC_OP_read_abi(instr)   cpu_instr_##instr(st, val); return 0
+#define CPU_CYC_OP_rmw_abi(instr)    return cpu_instr_##instr(st, val)
+#define CPU_CYC_OP_write_abi(instr)  return cpu_instr_##instr(st)
+#define CPU_CYC_OP_rmw_abp(instr)    return cpu_instr_##instr(st, val)
+#define CPU_CYC_OP_jmp_ind(instr)    return 0
+#define CPU_CYC_OP_jmp_iax(instr)    return 0
+#define CPU_CYC_OP_read_zpg(instr)   cpu_instr_##instr(st, val); return 0
+#define CPU_CYC_OP_rmw_zpg(instr)    return cpu_instr_##instr(st, val)
+#define CPU_CYC_OP_write_zpg(instr)  return cpu_instr_##instr(st)
+#define CPU_CYC_OP_read_zpi(instr)   cpu_instr_##instr(st, val); return 0
+#define CPU_CYC_OP_rmw_zpi(instr)    return cpu_instr_##instr(st, val)
+#define CPU_CYC_OP_write_zpi(instr)  return cpu_instr_##instr(st)
+#define CPU_CYC_OP_read_zpx(instr)   cpu_instr_##instr(st, val); return 0
+#define CPU_CYC_OP_rmw_zpx(instr)    return cpu_instr_##instr(st, val)
+#define CPU_CYC_OP_write_zpx(instr)  return cpu_instr_##instr(st)
+#define CPU_CYC_OP_read_zpy(instr)   cpu_instr_##instr(st, val); return 0
+#define CPU_CYC_OP_rmw_zpy(instr)    return cpu_instr_##instr(st, val)
+#define CPU_CYC_OP_write_zpy(instr)  return cpu_instr_##instr(st)
+#define CPU_CYC_OP_read_izp(instr)   cpu_instr_##instr(st, val); return 0
+#define CPU_CYC_OP_write_izp(instr)  return cpu_instr_##instr(st)
+#define CPU_CYC_OP_branch_rel(instr) return cpu_instr_##instr(st)
+#define CPU_CYC_OP_branch_zpr(instr) return cpu_instr_##instr(st, val)
+
+static u8 cpu_cycle_op(cpu_state_t *st, u8 opc, u8 val) {
+    switch (opc) {
+#define OP(opc, instr, kind, mode, idx, cyc) case opc: CPU_CYC_OP_##kind##_##mode(instr);
+        CPU_OPCODES(OP)
+#undef OP
+    }
+    return 0;
+}
+
+static void cpu_cycle_push(cpu_state_t *st, u8 val) {
+    cpu_write(st, val, 0x100 + (st->S--));
+}
+
+static u8 cpu_cycle_pull(cpu_state_t *st) {
+    return cpu_read(st, 0x100 + st->S);
+}
+
+// the read, read-modify-write or write at cyc_addr, from step t on
+static u8 cpu_cycle_access(cpu_state_t *st, u8 n, u8 t) {
+    u8 opc = st->cyc_opc;
+    switch (cpu_cycle_kind[opc]) {
+        case CPU_CYC_READ:
+            if (n > t) return 0; // the 65C02's decimal mode cycle
+            st->cyc_val = 0;
+            cpu_cycle_op(st, opc, cpu_read(st, st->cyc_addr));
+            return st->cyc_val ? t + 1 : 0;
+        case CPU_CYC_RMW:
+            if (n == t) {
+                st->cyc_val = cpu_read(st, st->cyc_addr);
+                return t + 1;
+            }
+            if (n == t + 1) {
+                st->cyc_val = cpu_cycle_op(st, opc, st->cyc_val);
+                return t + 2;
+            }
+            cpu_write(st, st->cyc_val, st->cyc_addr);
+            return 0;
+        default:
+            cpu_write(st, cpu_cycle_op(st, opc, 0), st->cyc_addr);
+            return 0;
+    }
+}
+
+// the address with idx added, skipping the fixup step before access step t
+// when the page doesn't change and the instruction only reads (or is a
+// 65C02 indexed shift)
+static u8 cpu_cycle_index(cpu_state_t *st, u16 base, u8 idx, u8 t, bool fixup) {
+    st->cyc_addr = base + idx;
+    return fixup || (base & 0xFF) + idx > 0xFF ? t - 1 : t;
+}
+
+// runs step n of the instruction in flight. returns the next step, or 0
+// when the instruction is done
+static u8 cpu_cycle_step(cpu_state_t *st, u8 n) {
+    u8 opc = st->cyc_opc, seq = cpu_cycle_seq[opc];
+    u8 idx = cpu_cycle_idx_y[opc] ? st->Y : st->X;
+    switch (seq) {
+        case CPU_CYC_IMP:
+        case CPU_CYC_ACC:
+            cpu_cycle_op(st, opc, 0);
+            return 0;
+
+        case CPU_CYC_IMM:
+            st->cyc_addr = st->PC;
+            if (n == 2) st->PC++;
+            break;
+
+        case CPU_CYC_ZPG:
+            if (n == 2) {
+                st->cyc_addr = cpu_read(st, st->PC++);
+                return 3;
+            }
+            break;
+
+        case CPU_CYC_ZPI:
+            switch (n) {
+                case 2: st->cyc_addr = cpu_read(st, st->PC++); return 3;
+                case 3: st->cyc_addr = lo(st->cyc_addr + idx); return 4;
+            }
+            break;
+
+        case CPU_CYC_ABS:
+        case CPU_CYC_ABI:
+        case CPU_CYC_ABP:
+            switch (n) {
+                case 2: st->cyc_addr = cpu_read(st, st->PC++); return 3;
+                case 3: {
+                    u16 base = st->cyc_addr | hi(cpu_read(st, st->PC++));
+                    if (seq == CPU_CYC_ABS) {
+                        st->cyc_addr = base;
+                        return 4;
+                    }
+                    return cpu_cycle_index(st, base, idx, 5,
+                            seq == CPU_CYC_ABI && cpu_cycle_kind[opc] != CPU_CYC_READ);
+                }
+                case 4: if (seq != CPU_CYC_ABS) return 5; // fixup
+            }
+            break;
+
+        case CPU_CYC_ZPX:
+            switch (n) {
+                case 2: st->cyc_addr = cpu_read(st, st->PC++); return 3;
+                case 3: st->cyc_addr = lo(st->cyc_addr + st->X); return 4;
+                case 4: st->cyc_val = cpu_read(st, st->cyc_addr); return 5;
+                case 5: st->cyc_addr = hi(cpu_read(st, lo(st->cyc_addr + 1))) | st->cyc_val; return 6;
+            }
+            break;
+
+        case CPU_CYC_ZPY:
+            switch (n) {
+                case 2: st->cyc_addr = cpu_read(st, st->PC++); return 3;
+                case 3: st->cyc_val = cpu_read(st, st->cyc_addr); return 4;
+                case 4: {
+                    u16 base = hi(cpu_read(st, lo(st->cyc_addr + 1))) | st->cyc_val;
+                    return cpu_cycle_index(st, base, st->Y, 6, cpu_cycle_kind[opc] != CPU_CYC_READ);
+                }
+                case 5: return 6; // fixup
+            }
+            break;
+
+        case CPU_CYC_IZP:
+            switch (n) {
+                case 2: st->cyc_addr = cpu_read(st, st->PC++); return 3;
+                case 3: st->cyc_val = cpu_read(st, st->cyc_addr); return 4;
+                case 4: st->cyc_addr = hi(cpu_read(st, lo(st->cyc_addr + 1))) | st->cyc_val; return 5;
+            }
+            break;
+
+        case CPU_CYC_JMP:
+            if (n == 2) {
+                st->cyc_addr = cpu_read(st, st->PC++);
+                return 3;
+            }
+            st->PC = st->cyc_addr | hi(cpu_read(st, st->PC));
+            return 0;
+
+        case CPU_CYC_JSR:
+            switch (n) {
+                case 2: st->cyc_addr = cpu_read(st, st->PC++); return 3;
+                case 3: return 4;
+                case 4: cpu_cycle_push(st, st->PC >> 8); return 5;
+                case 5: cpu_cycle_push(st, lo(st->PC)); return 6;
+            }
+            st->PC = st->cyc_addr | hi(cpu_read(st, st->PC));
+            return 0;
+
+        case CPU_CYC_WAIT:
+            if (n == 2) st->PC += 2;
+            return n < 8 ? n + 1 : 0;
+
+        case CPU_CYC_IND:
+        case CPU_CYC_IAX:
+            switch (n) {
+                case 2: st->cyc_addr = cpu_read(st, st->PC++); return 3;
+                case 3:
+                    st->cyc_addr |= hi(cpu_read(st, st->PC++));
+#ifdef CPU_VARIANT_65C02
+                    return 4;
+#else
+                    return seq == CPU_CYC_IAX ? 4 : 5;
+#endif
+                case 4: if (seq == CPU_CYC_IAX) st->cyc_addr += st->X; return 5;
+                case 5: st->cyc_val = cpu_read(st, st->cyc_addr); return 6;
+            }
+            st->PC = hi(cpu_read(st, seq == CPU_CYC_IAX ? st->cyc_addr + 1 : cpu_ind_next(st->cyc_addr)))
+                | st->cyc_val;
+            return 0;
+
+        case CPU_CYC_BRANCH:
+            switch (n) {
+                case 2:
+                    st->cyc_val = cpu_read(st, st->PC++);
+                    return cpu_cycle_op(st, opc, 0) ? 3 : 0;
+                case 3: {
+                    u16 old_pc = st->PC;
+                    st->PC = old_pc + (s8)st->cyc_val;
+                    return (u16)((s16)(old_pc & 0xFF) + (s8)st->cyc_val) > 0xFF ? 4 : 0;
+                }
+            }
+            return 0;
+
+        case CPU_CYC_BBR:
+            switch (n) {
+                case 2: st->cyc_addr = cpu_read(st, st->PC++); return 3;
+                case 3: st->cyc_val = cpu_read(st, st->cyc_addr); return 4;
+                case 4: st->cyc_addr = cpu_read(st, st->PC++); return 5;
+                case 5: return cpu_cycle_op(st, opc, st->cyc_val) ? 6 : 0;
+                case 6: {
+                    u16 old_pc = st->PC;
+                    st->PC = old_pc + (s8)st->cyc_addr;
+                    return (u16)((s16)(old_pc & 0xFF) + (s8)st->cyc_addr) > 0xFF ? 7 : 0;
+                }
+            }
+            return 0;
+
+        case CPU_CYC_PUSH:
+            if (n == 2) return 3;
+            switch (opc) {
+                case 0x08: cpu_cycle_push(st, cpu_pack_p(st, 1)); break; // php
+#ifdef CPU_VARIANT_65C02
+                case 0xDA: cpu_cycle_push(st, st->X); break;             // phx
+                case 0x5A: cpu_cycle_push(st, st->Y); break;             // phy
+#endif
+                default: cpu_cycle_push(st, st->A); break;               // pha
+            }
+            return 0;
+
+        case CPU_CYC_PULL:
+            switch (n) {
+                case 2: return 3;
+                case 3: st->S++; return 4;
+            }
+            switch (opc) {
+                case 0x28: cpu_unpack_p(st, cpu_cycle_pull(st)); break;  // plp
+#ifdef CPU_VARIANT_65C02
+                case 0xFA: cpu_instr_ldx(st, cpu_cycle_pull(st)); break; // plx
+                case 0x7A: cpu_instr_ldy(st, cpu_cycle_pull(st)); break; // ply
+#endif
+                default: cpu_instr_lda(st, cpu_cycle_pull(st)); break;   // pla
+            }
+            return 0;
+
+        // BRK, and interrupt entries with cyc_irq set. cyc_addr is the vector
+        case CPU_CYC_BRK:
+            switch (n) {
+                case 2: if (!st->cyc_irq) st->PC++; return 3;
+                case 3: cpu_cycle_push(st, st->PC >> 8); return 4;
+                case 4: cpu_cycle_push(st, lo(st->PC)); return 5;
+                case 5: cpu_cycle_push(st, cpu_pack_p(st, !st->cyc_irq)); return 6;
+                case 6:
+                    cpu_enter_handler(st);
+                    st->PC = cpu_read(st, st->cyc_addr);
+                    return 7;
+            }
+            st->PC |= hi(cpu_read(st, st->cyc_addr + 1));
+            return 0;
+
+        case CPU_CYC_RTI:
+            switch (n) {
+                case 2: return 3;
+                case 3: st->S++; return 4;
+                case 4: cpu_unpack_p(st, cpu_cycle_pull(st)); st->S++; return 5;
+                case 5: st->PC = cpu_cycle_pull(st); st->S++; return 6;
+            }
+            st->PC |= hi(cpu_cycle_pull(st));
+            return 0;
+
+        case CPU_CYC_RTS:
+            switch (n) {
+                case 2: return 3;
+                case 3: st->S++; return 4;
+                case 4: st->PC = cpu_cycle_pull(st); st->S++; return 5;
+                case 5: st->PC |= hi(cpu_cycle_pull(st)); return 6;
+            }
+            st->PC++;
+            return 0;
+    }
+    return cpu_cycle_access(st, n, cpu_cycle_access_step[seq]);
+}
+
+// true if the next step writes to memory. the NMOS 6502 ignores RDY on
+// writes, including the dummy write before a read-modify-write's real one
+static bool cpu_cycle_writing(cpu_state_t *st) {
+#ifdef CPU_VARIANT_65C02
+    return false;
+#else
+    u8 n = st->cyc_step, seq = cpu_cycle_seq[st->cyc_opc], t = cpu_cycle_access_step[seq];
+    if (n == 0) return false;
+    switch (seq) {
+        case CPU_CYC_JSR: return n == 4 || n == 5;
+        case CPU_CYC_BRK: return n >= 3 && n <= 5;
+        case CPU_CYC_PUSH: return n == 3;
+    }
+    if (!t) return false;
+    switch (cpu_cycle_kind[st->cyc_opc]) {
+        case CPU_CYC_RMW: return n == t + 1 || n == t + 2;
+        case CPU_CYC_WRITE: return n == t;
+    }
+    return false;
+#endif
+}
+
+// the opcode fetch, or the first cycle of an interrupt entry. interrupts
+// are polled like cpu_exec does
+static int cpu_cycle_fetch(cpu_state_t *st) {
+    if (unlikely(st->NMI | st->IRQ | st->RST) && cpu_irq_pending(st)) {
+        st->cyc_irq = st->NMI == 1 ? 1 : st->IRQ == 1 ? 2 : 3;
+        st->cyc_addr = st->cyc_irq == 1 ? 0xFFFA : st->cyc_irq == 2 ? 0xFFFE : 0xFFFC;
+        st->cyc_opc = 0x00;
+        st->cyc_step = 2;
+        st->cycles++;
+        return CPU_CYCLE_BUSY;
+    }
+
+    u8 opc = cpu_read(st, st->PC++);
+    if (unlikely(st->trace)) cpu_trace_instr(st, opc);
+    st->cycles++;
+    st->cyc_opc = opc;
+    st->cyc_irq = 0;
+    switch (cpu_cycle_seq[opc]) {
+        case CPU_CYC_ILLEGAL:
+            return CPU_CYCLE_EILLEGAL;
+        case CPU_CYC_ONE:
+            cpu_cycle_op(st, opc, 0);
+            return CPU_CYCLE_DONE;
+        case CPU_CYC_BRK:
+            st->cyc_addr = 0xFFFE;
+            break;
+    }
+    st->cyc_step = 2;
+    return CPU_CYCLE_BUSY;
+}
+
+int cpu_step_cycle(cpu_state_t *st) {
+    if (unlikely(st->HALT) && !cpu_cycle_writing(st)) {
+        st->cycles++;
+        return CPU_CYCLE_HALTED;
+    }
+    if (unlikely(st->DMA) && !cpu_cycle_writing(st)) return cpu_dma_cycle(st);
+    if (st->cyc_step == 0) return cpu_cycle_fetch(st);
+
+    st->cyc_step = cpu_cycle_step(st, st->cyc_step);
+    st->cycles++;
+    if (st->cyc_step) return CPU_CYCLE_BUSY;
+
+    // cpu_exec drops the line it took once the entry is done
+    if (st->cyc_irq) {
+        if (st->cyc_irq == 1) st->NMI = 0;
+        else st->IRQ = 0;
+        if (unlikely(st->trace)) cpu_trace_irq(st, st->cyc_irq);
+        st->cyc_irq = 0;
+    }
+    return CPU_CYCLE_DONE;
+}
+
+#ifdef CPU_CYCLE_OWN_DECIMAL
+#undef cpu_instr_adc
+#undef cpu_instr_sbc
+#undef CPU_CYCLE_OWN_DECIMAL
+#endif
@@ -0,0 +1,45 @@
+#ifndef __CPU_CYCLE_H__
+#define __CPU_CYCLE_H__
+
+#include "cpu.h"
+
+// Cycle stepping.
+//
+// cpu_step_cycle runs exactly one CPU cycle and returns, so a machine can be
+// driven from one flat loop that steps the CPU and its other chips in turn:
+//
+//   for (;;) {
+//       if (cpu_step_cycle(&st) < 0) break;
+//       ppu_step(&ppu); // may raise st.NMI, st.IRQ or st.HALT
+//   }
+//
+// Each instruction is a sequence of numbered steps, one per cycle, kept in
+// cpu_state_t (cyc_opc, cyc_step and the latched cyc_addr / cyc_val), so
+// nothing is left on the host stack between cycles and the tick callback is
+// never called. Bus accesses happen on the same cycles, in the same order,
+// as in cpu_exec, and the results are identical.
+//
+// Interrupt lines are sampled on the cycle that would fetch the next
+// opcode, like cpu_exec does between instructions: a line raised on any
+// cycle of an instruction is taken right after it.
+//
+// HALT is the RDY input held low: while it is set, each call spends the
+// cycle without doing anything if the CPU is about to read, and returns
+// CPU_CYCLE_HALTED. Write cycles go on, as they do on the NMOS 6502; the
+// 65C02 halts on writes too. Stalled cycles count in st->cycles. Stall and
+// DMA requests (see cpu_dma.h) are run the same way, a cycle per call.
+//
+// cpu_exec, cpu_run and save states must only be used between instructions,
+// after CPU_CYCLE_DONE; cpu_snapshot_save and _load return
+// CPU_SNAPSHOT_EBUSY otherwise. Idle loops are never fast-forwarded and the
+// profiler doesn't see cycle-stepped instructions; traces are recorded.
+
+#define CPU_CYCLE_BUSY    0  // the instruction goes on
+#define CPU_CYCLE_DONE    1  // the cycle ended an instruction or an interrupt entry
+#define CPU_CYCLE_HALTED  2  // HALT or a DMA held the CPU on a read cycle
+#define CPU_CYCLE_EILLEGAL -1 // the cycle fetched an illegal opcode
+
+// runs one cycle. returns one of the codes above
+int cpu_step_cycle(cpu_state_t *st);
+
+#endif
@@ -0,0 +1,168 @@
+#include "cpu_internal.h"
+#include "cpu_debug.h"
+#include <string.h>
+
+#define bit_get(map, i) ((map)[(i) >> 3] & (1 << ((i) & 7)))
+
+static bool cpu_debug_armed(cpu_debug_t *dbg) {
+    if (dbg->breaks) return true;
+    for (int i = 0; i < CPU_DEBUG_WATCHES; i++)
+        if (dbg->watches[i].flags) return true;
+    return false;
+}
+
+// traps the accesses of page that a watchpoint covers, parking its host
+// pointers, or lets them through again
+static void cpu_debug_trap_page(cpu_debug_t *dbg, u8 page, u8 watched) {
+    cpu_page_t *pg = &dbg->st->pages[page];
+    u8 old = dbg->watched[page];
+    if (old & CPU_WATCH_READ) pg->read = dbg->read[page];
+    if (old & CPU_WATCH_WRITE) pg->write = dbg->write[page];
+    pg->flags &= ~CPU_PAGE_WATCH;
+    dbg->watched[page] = watched;
+    if (!watched) return;
+    dbg->read[page] = pg->read;
+    dbg->write[page] = pg->write;
+    if (watched & CPU_WATCH_READ) pg->read = NULL;
+    if (watched & CPU_WATCH_WRITE) pg->write = NULL;
+    pg->flags |= CPU_PAGE_WATCH;
+}
+
+// recomputes the trapped pages and arms or disarms st
+static void cpu_debug_update(cpu_debug_t *dbg) {
+    u8 watched[256] = { 0 };
+    for (int i = 0; i < CPU_DEBUG_WATCHES; i++) {
+        cpu_watch_t *w = &dbg->watches[i];
+        if (!w->flags) continue;
+        for (u32 page = w->first >> 8; page <= (u32)(w->last >> 8); page++)
+            watched[page] |= w->flags;
+    }
+    for (u32 page = 0; page < 256; page++)
+        if (watched[page] != dbg->watched[page]) cpu_debug_trap_page(dbg, page, watched[page]);
+    dbg->st->debug = cpu_debug_armed(dbg) ? dbg : NULL;
+}
+
+void cpu_debug_init(cpu_debug_t *dbg, cpu_state_t *st) {
+    memset(dbg, 0, sizeof(*dbg));
+    dbg->st = st;
+}
+
+void cpu_debug_clear(cpu_debug_t *dbg) {
+    memset(dbg->pc, 0, sizeof(dbg->pc));
+    memset(dbg->opcodes, 0, sizeof(dbg->opcodes));
+    memset(dbg->watches, 0, sizeof(dbg->watches));
+    dbg->breaks = 0;
+    dbg->resume = dbg->skip = dbg->hit = 0;
+    cpu_debug_update(dbg);
+}
+
+static void cpu_debug_set(cpu_debug_t *dbg, u8 *map, u32 i, int on) {
+    u8 bit = 1 << (i & 7);
+    if (!(map[i >> 3] & bit) == !on) return;
+    map[i >> 3] ^= bit;
+    dbg->breaks += on ? 1 : -1;
+    dbg->st->debug = cpu_debug_armed(dbg) ? dbg : NULL;
+}
+
+void cpu_debug_break(cpu_debug_t *dbg, u16 pc, int on) { cpu_debug_set(dbg, dbg->pc, pc, on); }
+void cpu_debug_break_opcode(cpu_debug_t *dbg, u8 opc, int on) { cpu_debug_set(dbg, dbg->opcodes, opc, on); }
+
+int cpu_debug_watch(cpu_debug_t *dbg, u16 first, u16 last, u8 flags, u8 value, u8 mask) {
+    flags &= CPU_WATCH_READ | CPU_WATCH_WRITE;
+    if (!flags || last < first) return CPU_DEBUG_EFULL;
+    for (int i = 0; i < CPU_DEBUG_WATCHES; i++) {
+        cpu_watch_t *w = &dbg->watches[i];
+        if (w->flags) continue;
+        *w = (cpu_watch_t){ first, last, flags, value & mask, mask };
+        cpu_debug_update(dbg);
+        return i;
+    }
+    return CPU_DEBUG_EFULL;
+}
+
+void cpu_debug_unwatch(cpu_debug_t *dbg, int i) {
+    if (i < 0 || i >= CPU_DEBUG_WATCHES) return;
+    dbg->watches[i].flags = 0;
+    cpu_debug_update(dbg);
+}
+
+// checks an access to a watched page against the watchpoints. the first hit
+// of an instruction is the one reported
+static void cpu_debug_access(cpu_debug_t *dbg, u16 addr, u8 val, u8 kind) {
+    if (dbg->hit) return;
+    for (int i = 0; i < CPU_DEBUG_WATCHES; i++) {
+        cpu_watch_t *w = &dbg->watches[i];
+        if ((w->flags & kind) && addr >= w->first && addr <= w->last && (val & w->mask) == w->value) {
+            dbg->hit = 1;
+            dbg->stop = kind == CPU_WATCH_READ ? CPU_STOP_READ : CPU_STOP_WRITE;
+            dbg->stop_addr = addr;
+            dbg->stop_val = val;
+            dbg->stop_watch = i;
+            return;
+        }
+    }
+}
+
+u8 cpu_debug_read(cpu_state_t *st, u16 addr) {
+    cpu_debug_t *dbg = st->debug;
+    u8 *page = dbg->read[addr >> 8], val;
+    if (page) {
+        val = page[lo(addr)];
+        if (st->bus_log) cpu_bus_record(st, addr, val, 0);
+    } else {
+        if (st->log_n) cpu_bus_log_flush(st);
+        val = cpu_bus_read(st, addr);
+    }
+    if (dbg->watched[addr >> 8] & CPU_WATCH_READ) cpu_debug_access(dbg, addr, val, CPU_WATCH_READ);
+    return val;
+}
+
+void cpu_debug_write(cpu_state_t *st, u8 val, u16 addr) {
+    cpu_debug_t *dbg = st->debug;
+    u8 *page = dbg->write[addr >> 8];
+    if (page) {
+        page[lo(addr)] = val;
+        if (st->bus_log) cpu_bus_record(st, addr, val, 1);
+    } else {
+        if (st->log_n) cpu_bus_log_flush(st);
+        cpu_bus_write(st, val, addr);
+    }
+    if (dbg->watched[addr >> 8] & CPU_WATCH_WRITE) cpu_debug_access(dbg, addr, val, CPU_WATCH_WRITE);
+}
+
+void cpu_debug_remap(cpu_state_t *st, u8 page) {
+    cpu_debug_t *dbg = st->debug;
+    u8 watched = dbg->watched[page];
+    if (!watched) return;
+    // cpu_map has already replaced the parked pointers and dropped the flag
+    dbg->watched[page] = 0;
+    cpu_debug_trap_page(dbg, page, watched);
+}
+
+int cpu_debug_pc(cpu_state_t *st) {
+    cpu_debug_t *dbg = st->debug;
+    dbg->hit = 0;
+    dbg->skip = dbg->resume;
+    dbg->resume = 0;
+    if (dbg->skip || !bit_get(dbg->pc, st->PC)) return 0;
+    dbg->stop = CPU_STOP_PC;
+    dbg->stop_addr = st->PC;
+    dbg->resume = 1;
+    return 1;
+}
+
+int cpu_debug_opcode(cpu_state_t *st, u8 opc) {
+    cpu_debug_t *dbg = st->debug;
+    if (dbg->skip || !bit_get(dbg->opcodes, opc)) return 0;
+    st->PC--;
+    dbg->hit = 0;
+    dbg->stop = CPU_STOP_OPCODE;
+    dbg->stop_addr = st->PC;
+    dbg->stop_val = opc;
+    dbg->resume = 1;
+    return 1;
+}
+
+int cpu_debug_hit(cpu_state_t *st) {
+    return st->debug->hit;
+}
@@ -0,0 +1,89 @@
+#ifndef __CPU_DEBUG_H__
+#define __CPU_DEBUG_H__
+
+#include "cpu.h"
+
+// Breakpoints and watchpoints.
+//
+// Execute breakpoints are a bitmap with one bit per PC, opcode breakpoints
+// (BRK, say) one bit per opcode. Watchpoints cover an address range, for
+// reads, writes or both, optionally only when the value accessed matches.
+//
+// Nothing is checked unless something is armed: st->debug is only set while
+// a breakpoint or watchpoint is, and cpu_run keeps its fast paths until
+// then. While armed, cpu_run steps through cpu_exec, which checks the
+// bitmaps once per instruction. Watchpoints cost nothing on the pages they
+// don't cover: a watched page is flagged CPU_PAGE_WATCH and its host
+// pointers are parked in the debugger, so its accesses take the callback
+// path, where the flag sends them through the watch checks.
+//
+// cpu_exec and cpu_run return CPU_BREAK when the debugger stops:
+//   - on a PC or opcode breakpoint, before the instruction runs, with PC at
+//     it. running again executes it instead of stopping there again
+//   - on a watchpoint, after the instruction that made the access
+// stop, stop_addr and stop_val tell why. cpu_step_cycle doesn't check
+// breakpoints, and its watch hits are dropped.
+//
+// Arm through the functions below rather than the fields, so the page table
+// follows. cpu_map keeps watched pages watched; attach a bus trace recorder
+// before arming watchpoints, not after.
+
+#define CPU_DEBUG_WATCHES 16
+
+// watchpoint flags
+#define CPU_WATCH_READ  0x01
+#define CPU_WATCH_WRITE 0x02
+
+// why the debugger stopped
+#define CPU_STOP_NONE   0
+#define CPU_STOP_PC     1 // stop_addr is the PC
+#define CPU_STOP_OPCODE 2 // stop_addr is the PC, stop_val the opcode
+#define CPU_STOP_READ   3 // stop_addr and stop_val are the access, stop_watch the watchpoint
+#define CPU_STOP_WRITE  4
+
+#define CPU_DEBUG_EFULL -1 // all CPU_DEBUG_WATCHES watchpoints are in use
+
+typedef struct {
+    u16 first, last; // inclusive address range
+    u8 flags;        // CPU_WATCH_*, 0 when the slot is free
+    u8 value, mask;  // only accesses with (val & mask) == value hit
+} cpu_watch_t;
+
+typedef struct cpu_debug {
+    cpu_state_t *st;
+
+    u8 pc[0x10000 / 8];
+    u8 opcodes[256 / 8];
+    u32 breaks;  // bits set in pc and opcodes
+    cpu_watch_t watches[CPU_DEBUG_WATCHES];
+
+    u8 stop;     // CPU_STOP_*
+    u16 stop_addr;
+    u8 stop_val;
+    u8 stop_watch;
+
+    u8 resume;   // stopped before an instruction, don't stop there again
+    u8 skip;     // the current instruction is that one
+    u8 hit;      // a watchpoint hit during the current instruction
+    // per page: the CPU_WATCH_* accesses trapped, and the host pointers
+    // parked while they are
+    u8 watched[256];
+    u8 *read[256];
+    u8 *write[256];
+} cpu_debug_t;
+
+// clears dbg and binds it to st, with nothing armed
+void cpu_debug_init(cpu_debug_t *dbg, cpu_state_t *st);
+// disarms everything and gives the watched pages their pointers back
+void cpu_debug_clear(cpu_debug_t *dbg);
+// sets or clears the breakpoint at pc
+void cpu_debug_break(cpu_debug_t *dbg, u16 pc, int on);
+// sets or clears the breakpoint on every instruction with opcode opc
+void cpu_debug_break_opcode(cpu_debug_t *dbg, u8 opc, int on);
+// watches [first, last] for the CPU_WATCH_* accesses in flags whose value
+// matches under mask (0 for any value). returns the watchpoint's index or
+// CPU_DEBUG_EFULL
+int cpu_debug_watch(cpu_debug_t *dbg, u16 first, u16 last, u8 flags, u8 value, u8 mask);
+void cpu_debug_unwatch(cpu_debug_t *dbg, int i);
+
+#endif
@@ -0,0 +1,118 @@
+#include "cpu_internal.h"
+#include "cpu_dma.h"
+#include "cpu_cycle.h"
+#include <string.h>
+
+void cpu_stall(cpu_state_t *st, u32 cycles) {
+    st->dma_stall += cycles;
+    st->DMA = 1;
+}
+
+int cpu_dma(cpu_state_t *st, u32 cycles, u16 src, u16 dst, u16 len, u8 flags) {
+    if (st->dma_len || st->dma_put) return CPU_DMA_EBUSY;
+    st->dma_stall += cycles;
+    st->dma_src = src;
+    st->dma_dst = dst;
+    st->dma_len = len;
+    st->dma_flags = flags;
+    st->DMA = 1;
+    return 0;
+}
+
+// on the first cycle of a request, so that the copy's first read is even
+static void cpu_dma_align(cpu_state_t *st) {
+    if (!(st->dma_flags & CPU_DMA_ALIGN)) return;
+    st->dma_flags &= ~CPU_DMA_ALIGN;
+    if (st->dma_len && ((st->cycles + st->dma_stall) & 1)) st->dma_stall++;
+}
+
+static void cpu_dma_advance(cpu_state_t *st, u16 n) {
+    st->dma_src += n;
+    if (st->dma_flags & CPU_DMA_INC) st->dma_dst += n;
+}
+
+// bytes that can be copied from here without going through the accessors:
+// memory to memory, both sides on direct-mapped pages nothing traps writes
+// to, and nobody watching the cycles
+static u32 cpu_dma_direct(cpu_state_t *st) {
+    if (!(st->dma_flags & CPU_DMA_INC) || cpu_cycles_observed(st) || st->trace) return 0;
+    const cpu_page_t *src = &st->pages[st->dma_src >> 8], *dst = &st->pages[st->dma_dst >> 8];
+    if (!src->read || !dst->write || (dst->flags & (CPU_PAGE_CODE | CPU_PAGE_TRACK))) return 0;
+    u32 n = st->dma_len;
+    if (n > 0x100u - lo(st->dma_src)) n = 0x100u - lo(st->dma_src);
+    if (n > 0x100u - lo(st->dma_dst)) n = 0x100u - lo(st->dma_dst);
+    return n;
+}
+
+// the whole request at once, for cpu_exec and everything built on it
+void cpu_dma_run(cpu_state_t *st) {
+    while (st->DMA) {
+        cpu_dma_align(st);
+        u32 n = st->dma_stall;
+        st->dma_stall = 0;
+        if (cpu_has_tick(st)) {
+            while (n--) cpu_tick(st);
+        } else {
+            st->cycles += n;
+        }
+        // what cpu_step_cycle left half done
+        if (st->dma_put) {
+            u16 dst = st->dma_dst;
+            st->dma_put = 0;
+            cpu_dma_advance(st, 1);
+            cpu_write(st, st->dma_val, dst);
+            cpu_tick(st);
+        }
+        while (st->dma_len && !st->dma_stall && !(st->dma_flags & CPU_DMA_ALIGN)) {
+            u32 direct = cpu_dma_direct(st);
+            if (direct) {
+                const u8 *from = st->pages[st->dma_src >> 8].read + lo(st->dma_src);
+                u8 *to = st->pages[st->dma_dst >> 8].write + lo(st->dma_dst);
+                // overlapping ranges repeat bytes the way the byte-by-byte
+                // copy does
+                if (to > from && to < from + direct) {
+                    for (u32 i = 0; i < direct; i++) to[i] = from[i];
+                } else {
+                    memmove(to, from, direct);
+                }
+                st->cycles += 2 * direct;
+                st->dma_len -= direct;
+                cpu_dma_advance(st, direct);
+                continue;
+            }
+            // the count drops and the addresses advance before the write,
+            // whose callback may then start the next copy. that one starts
+            // over from its stall cycles
+            u16 dst = st->dma_dst;
+            u8 val = cpu_read(st, st->dma_src);
+            cpu_tick(st);
+            st->dma_len--;
+            cpu_dma_advance(st, 1);
+            cpu_write(st, val, dst);
+            cpu_tick(st);
+        }
+        st->DMA = st->dma_stall != 0 || st->dma_len != 0;
+    }
+}
+
+// one cycle of the request, for cpu_step_cycle
+int cpu_dma_cycle(cpu_state_t *st) {
+    cpu_dma_align(st);
+    if (st->dma_stall) {
+        st->dma_stall--;
+        st->cycles++;
+    } else if (st->dma_put) {
+        u16 dst = st->dma_dst;
+        st->dma_put = 0;
+        cpu_dma_advance(st, 1);
+        cpu_write(st, st->dma_val, dst);
+        st->cycles++;
+    } else if (st->dma_len) {
+        st->dma_val = cpu_read(st, st->dma_src);
+        st->cycles++;
+        st->dma_len--;
+        st->dma_put = 1;
+    }
+    st->DMA = st->dma_stall != 0 || st->dma_len != 0 || st->dma_put;
+    return CPU_CYCLE_HALTED;
+}
@@ -0,0 +1,44 @@
+#ifndef __CPU_DMA_H__
+#define __CPU_DMA_H__
+
+#include "cpu.h"
+
+// DMA and stall requests (RDY pulled low by another chip).
+//
+// A device that takes the bus (NES OAM DMA, an Apple II peripheral card)
+// asks for it from a bus or tick callback, or between runs:
+//
+//   // $4014 written: 1 halt cycle, 1 more to align, 256 get/put pairs
+//   cpu_dma(st, 1, val << 8, 0x2004, 256, CPU_DMA_ALIGN);
+//
+// The CPU gives up the bus on the next read cycle, as RDY only stops reads.
+// cpu_exec, cpu_run and its engines check for a request wherever they check
+// the interrupt lines, so a request made on the last cycle of an
+// instruction (the write that starts a DMA) is honoured before the next
+// opcode fetch, and the whole request runs in one step: stall cycles are
+// added at once, and a copy between direct-mapped pages is a memcpy. With a
+// tick callback or the bus log every cycle and access still happens in
+// order, one at a time. The JIT notices a request at the end of its block,
+// like an interrupt line. cpu_step_cycle runs one cycle of the request per
+// call, from the first read cycle after it, and returns CPU_CYCLE_HALTED.
+//
+// A copy takes a read and a write cycle per byte, after the stall cycles.
+// With CPU_DMA_ALIGN, one more stall cycle is added when the first read
+// would fall on an odd cycle. A write of the copy may request the next one
+// from its callback, which then starts with its own stall cycles. Save
+// states and rewind checkpoints keep a pending request.
+
+// flags
+#define CPU_DMA_ALIGN 0x01 // the first read of the copy is on an even cycle
+#define CPU_DMA_INC   0x02 // dst advances with src: a copy to memory, not to a register
+
+#define CPU_DMA_EBUSY -1 // a copy is already pending
+
+// holds the CPU for cycles more read cycles
+void cpu_stall(cpu_state_t *st, u32 cycles);
+// holds the CPU for cycles read cycles, then copies len bytes from src to
+// the register at dst (or to memory from dst with CPU_DMA_INC). returns 0
+// or CPU_DMA_EBUSY
+int cpu_dma(cpu_state_t *st, u32 cycles, u16 src, u16 dst, u16 len, u8 flags);
+
+#endif
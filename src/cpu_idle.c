@@ -0,0 +1,202 @@
+#include "cpu_internal.h"
+
+// Idle loop fast-forwarding.
+//
+// Guest code spends much of its time spinning: JMP * traps, BIT $2002 / BPL
+// vblank waits, LDA / BEQ polling. When next_event is set, every short
+// backward jump or branch taken by cpu_exec, cpu_run or the block cache is
+// checked for closing such a loop. A loop idles when its body
+//   - only reads memory, from mapped pages or CPU_PAGE_POLL pages, with
+//     absolute, absolute indexed, zero page or zero page indexed operands,
+//     or tests zero page bits with the 65C02's BBRn/BBSn
+//   - has no stack, JSR, JMP or interrupt instructions, and no branches
+//     other than forward ones that stay inside it
+//   - reaches its head twice in a row with the same registers
+// Nothing it does can then change from one pass to the next, so every pass
+// takes the same cycles as the last one, and the passes that would end
+// before next_event are credited in one step. The loop state and cycle
+// count afterwards are exactly what running them would have given; the
+// skipped reads aren't seen by anyone, as mapped memory doesn't go through
+// the callbacks and POLL pages promise not to care.
+//
+// Skipping stays off with a tick callback, a trace recorder or a profiler,
+// which all see every cycle or instruction. The JIT doesn't fast-forward.
+//
+// Setting next_event promises that until that cycle, nothing outside the CPU
+// changes memory it reads, POLL page values or the interrupt lines. cpu_run
+// additionally stops skipping at the end of its budget, and cpu_exec at
+// next_event itself.
+
+static const u8 cpu_idle_len[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_OPLEN_##mode,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+static const u8 cpu_idle_max_cycles[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = cyc + CPU_PENALTY_##kind##_##mode,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+// what an instruction may do inside an idle loop, by helper
+enum { CPU_IDLE_NO, CPU_IDLE_REG, CPU_IDLE_ABS, CPU_IDLE_ABI, CPU_IDLE_ZP, CPU_IDLE_BRANCH, CPU_IDLE_JMP };
+#define CPU_IDLE_all_imp CPU_IDLE_REG
+#define CPU_IDLE_all_one CPU_IDLE_REG
+#define CPU_IDLE_all_acc CPU_IDLE_REG
+#define CPU_IDLE_all_imm CPU_IDLE_REG
+#define CPU_IDLE_read_abs CPU_IDLE_ABS
+#define CPU_IDLE_rmw_abs CPU_IDLE_NO
+#define CPU_IDLE_write_abs CPU_IDLE_NO
+#define CPU_IDLE_jmp_abs CPU_IDLE_JMP
+#define CPU_IDLE_jsr_abs CPU_IDLE_NO
+#define CPU_IDLE_wait_abs CPU_IDLE_REG
+#define CPU_IDLE_read_abi CPU_IDLE_ABI
+#define CPU_IDLE_rmw_abi CPU_IDLE_NO
+#define CPU_IDLE_write_abi CPU_IDLE_NO
+#define CPU_IDLE_rmw_abp CPU_IDLE_NO
+#define CPU_IDLE_jmp_ind CPU_IDLE_NO
+#define CPU_IDLE_jmp_iax CPU_IDLE_NO
+#define CPU_IDLE_read_zpg CPU_IDLE_ZP
+#define CPU_IDLE_rmw_zpg CPU_IDLE_NO
+#define CPU_IDLE_write_zpg CPU_IDLE_NO
+#define CPU_IDLE_read_zpi CPU_IDLE_ZP
+#define CPU_IDLE_rmw_zpi CPU_IDLE_NO
+#define CPU_IDLE_write_zpi CPU_IDLE_NO
+#define CPU_IDLE_read_zpx CPU_IDLE_NO
+#define CPU_IDLE_rmw_zpx CPU_IDLE_NO
+#define CPU_IDLE_write_zpx CPU_IDLE_NO
+#define CPU_IDLE_read_zpy CPU_IDLE_NO
+#define CPU_IDLE_rmw_zpy CPU_IDLE_NO
+#define CPU_IDLE_write_zpy CPU_IDLE_NO
+#define CPU_IDLE_read_izp CPU_IDLE_NO
+#define CPU_IDLE_write_izp CPU_IDLE_NO
+#define CPU_IDLE_branch_rel CPU_IDLE_BRANCH
+#define CPU_IDLE_branch_zpr CPU_IDLE_BRANCH
+
+static const u8 cpu_idle_class[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_IDLE_##kind##_##mode,
+    CPU_OPCODES(OP)
+#undef OP
+    // implied, but touch the stack or leave the loop
+    [0x00] = CPU_IDLE_NO, [0x08] = CPU_IDLE_NO, [0x28] = CPU_IDLE_NO, [0x40] = CPU_IDLE_NO, // brk, php, plp, rti
+    [0x48] = CPU_IDLE_NO, [0x60] = CPU_IDLE_NO, [0x68] = CPU_IDLE_NO,                       // pha, rts, pla
+#ifdef CPU_VARIANT_65C02
+    [0xDA] = CPU_IDLE_NO, [0x5A] = CPU_IDLE_NO, [0xFA] = CPU_IDLE_NO, [0x7A] = CPU_IDLE_NO, // phx, phy, plx, ply
+#endif
+};
+
+// true if reading page can't be noticed and gives the same values until
+// next_event
+static bool cpu_idle_page(cpu_state_t *st, u8 page) {
+    const cpu_page_t *pg = &st->pages[page];
+    return (pg->read && !(pg->flags & CPU_PAGE_MMIO)) || (pg->flags & CPU_PAGE_POLL);
+}
+
+// code is only read from mapped pages, fetching it must not touch the bus
+static bool cpu_idle_fetch(cpu_state_t *st, u16 addr, u8 *val) {
+    const u8 *page = st->pages[addr >> 8].read;
+    if (!page) return false;
+    *val = page[lo(addr)];
+    return true;
+}
+
+// decodes the loop [head, end), which must close with a jump or branch back
+// to head. returns the most cycles one pass can take, or 0 if the body
+// can't idle
+static u32 cpu_idle_scan(cpu_state_t *st, u16 head, u16 end) {
+    u32 len = (u16)(end - head), max = 0;
+    u64 starts = 0, targets = 0; // bit n: an instruction starts / a branch lands at head+n
+    for (u32 off = 0; off < len; ) {
+        u16 pc = head + off;
+        u8 b[3] = { 0, 0, 0 };
+        if (!cpu_idle_fetch(st, pc, &b[0])) return 0;
+        u8 opc = b[0], n = cpu_idle_len[opc];
+        if (!n || off + n > len) return 0;
+        for (u8 i = 1; i < n; i++)
+            if (!cpu_idle_fetch(st, pc + i, &b[i])) return 0;
+        u16 op = b[1] | hi(b[2]);
+        bool last = off + n == len;
+
+        switch (cpu_idle_class[opc]) {
+            case CPU_IDLE_REG:
+                break;
+            case CPU_IDLE_ABS:
+                if (!cpu_idle_page(st, op >> 8)) return 0;
+                break;
+            case CPU_IDLE_ABI:
+                if (!cpu_idle_page(st, op >> 8) || !cpu_idle_page(st, (u16)(op + 0xFF) >> 8)) return 0;
+                break;
+            case CPU_IDLE_ZP:
+                if (!cpu_idle_page(st, 0)) return 0;
+                break;
+            case CPU_IDLE_BRANCH: {
+                // the offset is the last operand byte. BBRn/BBSn test a zero
+                // page byte first
+                if (n == 3 && !cpu_idle_page(st, 0)) return 0;
+                u16 target = pc + n + (s8)b[n - 1];
+                if (last) {
+                    if (target != head) return 0;
+                    break;
+                }
+                u32 toff = (u16)(target - head);
+                if (toff <= off || toff >= len) return 0;
+                targets |= 1ull << toff;
+                break;
+            }
+            case CPU_IDLE_JMP:
+                if (!last || op != head) return 0;
+                break;
+            default:
+                return 0;
+        }
+        if (last && cpu_idle_class[opc] != CPU_IDLE_BRANCH && cpu_idle_class[opc] != CPU_IDLE_JMP)
+            return 0;
+        starts |= 1ull << off;
+        max += cpu_idle_max_cycles[opc];
+        off += n;
+    }
+    return (targets & ~starts) ? 0 : max;
+}
+
+// everything an instruction in an idle loop can change
+static u64 cpu_idle_regs(cpu_state_t *st) {
+    return st->A | (u64)st->X << 8 | (u64)st->Y << 16 | (u64)st->S << 24
+        | (u64)st->N_res << 32 | (u64)st->Z_res << 40
+        | (u64)(st->C | st->V << 1 | st->I << 2 | st->D << 3) << 48;
+}
+
+// idle_state: 0 nothing watched, 1 watching the loop at idle_head, 2 that
+// loop can't idle
+void cpu_idle_loop(cpu_state_t *st, u16 end) {
+    if (cpu_cycles_observed(st) || cpu_must_step(st)) return;
+    u64 regs = cpu_idle_regs(st);
+    if (st->idle_state == 0 || st->idle_head != st->PC || st->idle_end != end
+            || st->idle_event != st->next_event) {
+        st->idle_head = st->PC;
+        st->idle_end = end;
+        st->idle_event = st->next_event;
+        st->idle_regs = regs;
+        st->idle_cycles = st->cycles;
+        st->idle_state = 1;
+        return;
+    }
+    if (st->idle_state == 2) return;
+
+    // one full pass since the last arrival: leaving the loop or taking an
+    // interrupt would have reset idle_state
+    u64 period = st->cycles - st->idle_cycles;
+    st->idle_cycles = st->cycles;
+    if (regs != st->idle_regs) {
+        st->idle_regs = regs;
+        return;
+    }
+    u32 max = cpu_idle_scan(st, st->PC, end);
+    if (!max) {
+        st->idle_state = 2;
+        return;
+    }
+    if (period == 0 || period > max || st->next_event <= st->cycles) return;
+    st->cycles += (st->next_event - st->cycles) / period * period;
+    st->idle_cycles = st->cycles;
+}
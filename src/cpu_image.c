@@ -0,0 +1,109 @@
+#include "cpu_internal.h"
+#include "cpu_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CPU_IMAGE_MMAP
+#endif
+
+#ifdef CPU_IMAGE_MMAP
+
+int cpu_image_open(cpu_image_t *img, const char *path) {
+    memset(img, 0, sizeof(*img));
+    img->fd = -1;
+    int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0 || sb.st_size == 0 || (u64)sb.st_size > 0xFFFFFFFFu) {
+        if (fd >= 0) close(fd);
+        return CPU_IMAGE_EOPEN;
+    }
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return CPU_IMAGE_EMAP;
+    }
+    img->data = map;
+    img->len = (u32)sb.st_size;
+    img->fd = fd;
+    return 0;
+}
+
+void cpu_image_close(cpu_image_t *img) {
+    if (img->data) munmap((void *)img->data, img->len);
+    if (img->fd >= 0) close(img->fd);
+    img->data = NULL;
+    img->fd = -1;
+}
+
+u8 *cpu_image_ram(const cpu_image_t *img, u32 off, u32 len) {
+    if (len == 0 || (img && (off > img->len || len > img->len - off))) return NULL;
+    void *map;
+    if (!img) {
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else if (off % (u32)sysconf(_SC_PAGESIZE) == 0) {
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, img->fd, off);
+    } else {
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map != MAP_FAILED) memcpy(map, img->data + off, len);
+    }
+    return map == MAP_FAILED ? NULL : map;
+}
+
+void cpu_image_ram_free(u8 *ram, u32 len) {
+    if (ram) munmap(ram, len);
+}
+
+#else
+
+// no mmap: the file is read into the heap and RAM views are copies
+
+int cpu_image_open(cpu_image_t *img, const char *path) {
+    memset(img, 0, sizeof(*img));
+    img->fd = -1;
+    FILE *f = fopen(path, "rb");
+    if (!f) return CPU_IMAGE_EOPEN;
+    long size = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+    u8 *data = size > 0 ? malloc(size) : NULL;
+    if (!data || fseek(f, 0, SEEK_SET) != 0 || fread(data, 1, size, f) != (size_t)size) {
+        free(data);
+        fclose(f);
+        return CPU_IMAGE_EOPEN;
+    }
+    fclose(f);
+    img->data = data;
+    img->len = (u32)size;
+    return 0;
+}
+
+void cpu_image_close(cpu_image_t *img) {
+    free((void *)img->data);
+    img->data = NULL;
+}
+
+u8 *cpu_image_ram(const cpu_image_t *img, u32 off, u32 len) {
+    if (len == 0 || (img && (off > img->len || len > img->len - off))) return NULL;
+    u8 *ram = img ? malloc(len) : calloc(1, len);
+    if (ram && img) memcpy(ram, img->data + off, len);
+    return ram;
+}
+
+void cpu_image_ram_free(u8 *ram, u32 len) {
+    (void)len;
+    free(ram);
+}
+
+#endif
+
+int cpu_image_map_rom(cpu_state_t *st, const cpu_image_t *img, u16 addr, u32 off, u32 len) {
+    if ((addr | off | len) & 0xFF || off > img->len || len > img->len - off || addr + len > 0x10000)
+        return CPU_IMAGE_ERANGE;
+    // read-only pages are never written through their host pointer
+    cpu_map(st, addr, len, (u8 *)img->data + off, CPU_PAGE_READONLY);
+    return 0;
+}
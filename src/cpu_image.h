@@ -0,0 +1,47 @@
+#ifndef __CPU_IMAGE_H__
+#define __CPU_IMAGE_H__
+
+#include "cpu.h"
+
+// ROM and RAM images loaded from files.
+//
+// cpu_image_open maps a file read-only. Its pages come from the OS page
+// cache: one copy in memory however many instances map them, in this process
+// or any other, and nothing is read until it is touched. cpu_image_map_rom
+// maps a range of it into a cpu_state_t as ROM, with no copy.
+//
+// cpu_image_ram gives an instance its own writable view of a range of the
+// image, copy-on-write: all instances share the file's pages until one
+// writes to a page, which then gets a private copy. Without an image it
+// gives zeroed RAM that is only allocated as it is touched. Either way a new
+// instance starts without copying anything, and only costs the pages it has
+// written.
+//
+// The file must not change while it is mapped. Hosts without POSIX mmap get
+// the same interface on top of stdio and malloc, copying instead of sharing.
+
+// error codes returned by cpu_image_open and cpu_image_map_rom
+#define CPU_IMAGE_EOPEN  -1 // can't open or read the file
+#define CPU_IMAGE_EMAP   -2 // can't map the file
+#define CPU_IMAGE_ERANGE -3 // the range isn't in the image, or isn't 256-byte aligned
+
+typedef struct {
+    const u8 *data;
+    u32 len;
+    int fd; // kept open for cpu_image_ram, -1 without mmap
+} cpu_image_t;
+
+// maps the file at path. returns 0 or an error code
+int cpu_image_open(cpu_image_t *img, const char *path);
+// unmaps the image. ROM mapped from it and RAM views must be dropped first
+void cpu_image_close(cpu_image_t *img);
+// maps len bytes of img from off read-only at addr: reads are direct,
+// writes go to bus_write. addr, off and len must be multiples of 256
+int cpu_image_map_rom(cpu_state_t *st, const cpu_image_t *img, u16 addr, u32 off, u32 len);
+// returns a private, writable view of len bytes of img from off, or of len
+// zero bytes if img is NULL. the view is shared copy-on-write when off is a
+// multiple of the host page size, copied otherwise. NULL on failure
+u8 *cpu_image_ram(const cpu_image_t *img, u32 off, u32 len);
+void cpu_image_ram_free(u8 *ram, u32 len);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef __CPU_INLINE_H__
+#define __CPU_INLINE_H__
+
+// Header-only build.
+//
+// Instead of linking the cpu library, define the bus functions, and the tick
+// function if there is one, and include this header in exactly one
+// translation unit:
+//
+//   #define CPU_BUS_READ(user, addr)       my_read(user, addr)
+//   #define CPU_BUS_WRITE(user, val, addr) my_write(user, val, addr)
+//   #define CPU_TICK(user)                 my_tick(user)
+//   #include "cpu_inline.h"
+//
+// where my_read and the others are static inline functions or macros. The
+// whole core is compiled into that translation unit with every access that
+// would go to bus_read or bus_write, and every tick, calling them directly,
+// so the compiler inlines them into each instruction instead of calling
+// through the pointers in cpu_state_t. The page table works as usual; other
+// translation units use the other headers as with the library.
+//
+// The bus_read, bus_write and tick fields are ignored and the bus functions
+// always get st->user, so what installs callbacks of its own by swapping
+// st->user can't work: cpu_trace_attach refuses CPU_TRACE_BUS with
+// CPU_TRACE_EBUS and cpu_cosim_start fails with CPU_COSIM_EBUS. With CPU_TICK, cpu_run never uses the block cache, the
+// JIT, translated code or idle skipping, as with a tick callback set.
+//
+// CMake's cpu_inline target has the include path and definitions.
+
+#ifndef CPU_BUS_READ
+#error "define CPU_BUS_READ and CPU_BUS_WRITE before including cpu_inline.h"
+#endif
+
+#include "cpu.c"
+#include "cpu_idle.c"
+#include "cpu_bbc.c"
+#include "cpu_jit.c"
+#include "cpu_aot.c"
+#include "cpu_dma.c"
+#include "cpu_snapshot.c"
+#include "cpu_rewind.c"
+#include "cpu_trace.c"
+#include "cpu_prof.c"
+#include "cpu_sched.c"
+#include "cpu_cycle.c"
+#include "cpu_batch.c"
+#include "cpu_image.c"
+#include "cpu_debug.c"
+#include "cpu_cosim.c"
+
+#endif
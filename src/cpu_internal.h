@@ -0,0 +1,787 @@
+#ifndef __CPU_INTERNAL_H__
+#define __CPU_INTERNAL_H__
+
+// Instruction semantics and addressing mode helpers shared by the cores.
+// Everything here is static inline: each core includes this header and gets
+// its own specialized copies.
+
+#include "cpu.h"
+#include "cpu_opcodes.h"
+#include <stdbool.h>
+
+#define hi(u) (((u16)(u))<<8)
+#define lo(u) ((u)&0xFF)
+
+// instruction and addressing mode helpers are force-inlined, so each opcode
+// handler gets its own copy with the operation inlined instead of called
+// through a function pointer
+#if defined(__GNUC__)
+#define CPU_INLINE static inline __attribute__((always_inline))
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#else
+#define CPU_INLINE static inline
+#define unlikely(x) (x)
+#endif
+
+// block cache and JIT hooks, see cpu_bbc.c and cpu_jit.c
+int cpu_bbc_run(cpu_state_t *st, u32 cycle_budget);
+void cpu_bbc_invalidate_page(cpu_state_t *st, u8 page);
+void cpu_bbc_remap(cpu_state_t *st);
+int cpu_jit_run(cpu_state_t *st, u32 cycle_budget);
+void cpu_jit_invalidate_page(cpu_state_t *st, u8 page);
+void cpu_jit_code_write(cpu_state_t *st, u16 addr);
+// ahead-of-time code hooks, see cpu_aot.c
+int cpu_aot_run(cpu_state_t *st, u32 cycle_budget);
+void cpu_aot_invalidate_page(cpu_state_t *st, u8 page);
+void cpu_aot_code_write(cpu_state_t *st, u16 addr);
+// trace hooks, see cpu_trace.c
+void cpu_trace_instr(cpu_state_t *st, u8 opc);
+void cpu_trace_irq(cpu_state_t *st, int irq);
+// profiler hooks, see cpu_prof.c
+void cpu_prof_instr(cpu_state_t *st, u8 opc, u16 pc, u64 start);
+void cpu_prof_irq(cpu_state_t *st, u64 start);
+// debugger hooks, see cpu_debug.c
+int cpu_debug_pc(cpu_state_t *st);
+int cpu_debug_opcode(cpu_state_t *st, u8 opc);
+int cpu_debug_hit(cpu_state_t *st);
+u8 cpu_debug_read(cpu_state_t *st, u16 addr);
+void cpu_debug_write(cpu_state_t *st, u8 val, u16 addr);
+void cpu_debug_remap(cpu_state_t *st, u8 page);
+// rewind hook, see cpu_rewind.c
+void cpu_rewind_dirty(cpu_state_t *st, u8 page);
+// a write hit a CPU_PAGE_CODE or CPU_PAGE_TRACK page, see cpu.c
+void cpu_write_trap(cpu_state_t *st, u16 addr);
+// stall and DMA hooks, see cpu_dma.c
+void cpu_dma_run(cpu_state_t *st);
+int cpu_dma_cycle(cpu_state_t *st);
+// a jump or branch closed a loop ending at end, see cpu_idle.c
+void cpu_idle_loop(cpu_state_t *st, u16 end);
+
+// longest loop body, in bytes, checked for idling
+#define CPU_IDLE_SPAN 32
+
+// the bus and tick callbacks, or the functions the embedder bound at
+// compile time, see cpu_inline.h
+#ifdef CPU_BUS_READ
+#define cpu_bus_read(st, addr) CPU_BUS_READ((st)->user, (addr))
+#define cpu_bus_write(st, val, addr) CPU_BUS_WRITE((st)->user, (val), (addr))
+#else
+#define cpu_bus_read(st, addr) (st)->bus_read((st)->user, (addr))
+#define cpu_bus_write(st, val, addr) (st)->bus_write((st)->user, (val), (addr))
+#endif
+#ifdef CPU_TICK
+#define cpu_has_tick(st) true
+#define cpu_tick_call(st) CPU_TICK((st)->user)
+#else
+#define cpu_has_tick(st) ((st)->tick != 0)
+#define cpu_tick_call(st) (st)->tick((st)->user)
+#endif
+
+// advance the cycle counter, calling the tick callback only if one is set
+CPU_INLINE void cpu_tick(cpu_state_t *st) {
+    st->cycles++;
+    if (cpu_has_tick(st)) cpu_tick_call(st);
+}
+
+// true if cpu_run must go through cpu_exec so every instruction is seen
+CPU_INLINE bool cpu_must_step(cpu_state_t *st) {
+#ifdef CPU_PROFILE
+    return st->trace || st->debug || st->prof;
+#else
+    return st->trace || st->debug;
+#endif
+}
+
+// a tick callback or the bus log sees when each cycle happens. the block
+// cache, the JIT, translated code and idle skipping don't keep that
+CPU_INLINE bool cpu_cycles_observed(cpu_state_t *st) {
+    return cpu_has_tick(st) || st->bus_log;
+}
+
+// called after a taken jump or branch from the instruction ending at end.
+// only short backward jumps can close an idle loop
+CPU_INLINE void cpu_idle_jump(cpu_state_t *st, u16 end) {
+    if (unlikely(st->next_event) && (u16)(end - st->PC - 1) < CPU_IDLE_SPAN)
+        cpu_idle_loop(st, end);
+}
+
+// called after a branch from the instruction ending at end fell through:
+// if it closed the loop being watched, that loop was left
+CPU_INLINE void cpu_idle_exit(cpu_state_t *st, u16 end) {
+    if (unlikely(st->idle_state) && st->idle_end == end) st->idle_state = 0;
+}
+
+// true if cpu_exec would take an interrupt, or stall, before the next
+// instruction
+CPU_INLINE bool cpu_irq_pending(cpu_state_t *st) {
+    return st->NMI == 1 || ((st->IRQ == 1 || st->RST == 1) && st->I == 0) || st->DMA;
+}
+
+// memory access through the page table, falling back to the bus callbacks
+// for unmapped and I/O pages
+// appends an access to the bus log
+CPU_INLINE void cpu_bus_record(cpu_state_t *st, u16 addr, u8 val, u8 write) {
+    u32 n = st->log_n;
+    if (unlikely(n == CPU_BUS_LOG_MAX)) {
+        cpu_bus_log_flush(st);
+        n = 0;
+    }
+    st->log[n] = (cpu_bus_rec_t){ (u32)(st->cycles - st->log_cycles), addr, val, write };
+    st->log_n = n + 1;
+}
+
+CPU_INLINE u8 cpu_read(cpu_state_t *st, u16 addr) {
+    cpu_page_t *pg = &st->pages[addr >> 8];
+    if (pg->read) {
+        u8 val = pg->read[lo(addr)];
+        if (unlikely(st->bus_log)) cpu_bus_record(st, addr, val, 0);
+        return val;
+    }
+    if (unlikely(pg->flags & CPU_PAGE_WATCH)) return cpu_debug_read(st, addr);
+    if (unlikely(st->log_n)) cpu_bus_log_flush(st);
+    return cpu_bus_read(st, addr);
+}
+
+CPU_INLINE void cpu_write(cpu_state_t *st, u8 val, u16 addr) {
+    cpu_page_t *pg = &st->pages[addr >> 8];
+    if (unlikely(pg->flags & (CPU_PAGE_CODE | CPU_PAGE_TRACK))) cpu_write_trap(st, addr);
+    if (pg->write) {
+        pg->write[lo(addr)] = val;
+        if (unlikely(st->bus_log)) cpu_bus_record(st, addr, val, 1);
+    } else if (unlikely(pg->flags & CPU_PAGE_WATCH)) {
+        cpu_debug_write(st, val, addr);
+    } else {
+        if (unlikely(st->log_n)) cpu_bus_log_flush(st);
+        cpu_bus_write(st, val, addr);
+    }
+}
+
+CPU_INLINE void cpu_set_nz(cpu_state_t* st, u8 val) {
+    st->N_res = val;
+    st->Z_res = val;
+}
+
+// builds the packed status byte from the unpacked flags. u always reads as
+// high, B is 1 when pushed by PHP/BRK and 0 when pushed by an interrupt
+CPU_INLINE u8 cpu_pack_p(cpu_state_t* st, u8 b) {
+    cpu_sr_t p = { .data = 0 };
+    p.C = st->C;
+    p.Z = (st->Z_res == 0);
+    p.I = st->I;
+    p.D = st->D;
+    p.B = b;
+    p.u = 1;
+    p.V = st->V;
+    p.N = st->N_res >> 7;
+    return p.data;
+}
+
+CPU_INLINE void cpu_unpack_p(cpu_state_t* st, u8 data) {
+    cpu_sr_t p = { .data = data };
+    st->C = p.C;
+    st->Z_res = !p.Z;
+    st->I = p.I;
+    st->D = p.D;
+    st->V = p.V;
+    st->N_res = p.N << 7;
+}
+
+// read instructions
+CPU_INLINE void cpu_instr_lda(cpu_state_t* st, u8 op) { st->A = op; cpu_set_nz(st, op); }
+CPU_INLINE void cpu_instr_ldx(cpu_state_t* st, u8 op) { st->X = op; cpu_set_nz(st, op); }
+CPU_INLINE void cpu_instr_ldy(cpu_state_t* st, u8 op) { st->Y = op; cpu_set_nz(st, op); }
+CPU_INLINE void cpu_instr_ora(cpu_state_t* st, u8 op) { cpu_instr_lda(st, st->A | op); }
+CPU_INLINE void cpu_instr_eor(cpu_state_t* st, u8 op) { cpu_instr_lda(st, st->A ^ op); }
+CPU_INLINE void cpu_instr_and(cpu_state_t* st, u8 op) { cpu_instr_lda(st, st->A & op); }
+CPU_INLINE void cpu_instr_cmp(cpu_state_t* st, u8 op) { cpu_set_nz(st, st->A - op); st->C = (op <= st->A); }
+CPU_INLINE void cpu_instr_cpx(cpu_state_t* st, u8 op) { cpu_set_nz(st, st->X - op); st->C = (op <= st->X); }
+CPU_INLINE void cpu_instr_cpy(cpu_state_t* st, u8 op) { cpu_set_nz(st, st->Y - op); st->C = (op <= st->Y); }
+CPU_INLINE void cpu_adc_binary(cpu_state_t* st, u8 op) {
+    u16 res = (u16)(op) + (u16)(st->A) + (u16)(st->C);
+    st->C = (res > (u16)(0xFF));
+    st->V = ((op^lo(res))&(st->A^lo(res))&0x80) > 0;
+    cpu_set_nz(st, (u8)(res & 0xFF));
+    st->A = (u8)res;
+}
+
+// the 65C02's extra decimal mode cycle. cpu_cycle.c makes it a step of its
+// own instead
+#ifndef CPU_DECIMAL_TICK
+#define CPU_DECIMAL_TICK(st) cpu_tick(st)
+#endif
+
+// decimal mode, after Bruce Clark's "Decimal Mode" tutorial on 6502.org. the
+// NMOS 6502 sets C and V from the BCD-adjusted sum, but N from its high
+// nibble before the final adjustment and Z from the binary sum. the 65C02
+// sets N and Z from the result, and takes an extra cycle, ticked by ADC and
+// SBC. the 2A03 has no decimal mode: D is kept but ignored
+#ifndef CPU_VARIANT_2A03
+CPU_INLINE void cpu_adc_decimal(cpu_state_t* st, u8 op) {
+    int al = (st->A & 0x0F) + (op & 0x0F) + st->C;
+    if (al >= 0x0A) al = ((al + 0x06) & 0x0F) + 0x10;
+    int sum = (st->A & 0xF0) + (op & 0xF0) + al;
+    s16 ssum = (s8)(st->A & 0xF0) + (s8)(op & 0xF0) + al;
+    st->V = ssum < -128 || ssum > 127;
+#ifdef CPU_VARIANT_65C02
+    if (sum >= 0xA0) sum += 0x60;
+    st->C = sum >= 0x100;
+    st->A = (u8)sum;
+    cpu_set_nz(st, st->A);
+#else
+    st->N_res = (u8)ssum;
+    st->Z_res = (u8)(st->A + op + st->C);
+    if (sum >= 0xA0) sum += 0x60;
+    st->C = sum >= 0x100;
+    st->A = (u8)sum;
+#endif
+}
+
+CPU_INLINE void cpu_sbc_decimal(cpu_state_t* st, u8 op) {
+    int al = (st->A & 0x0F) - (op & 0x0F) + st->C - 1;
+#ifdef CPU_VARIANT_65C02
+    int diff = st->A - op + st->C - 1;
+    if (diff < 0) diff -= 0x60;
+    if (al < 0) diff -= 0x06;
+    u8 res = (u8)diff;
+    cpu_adc_binary(st, ~op); // C and V are the binary ones
+    st->A = res;
+    cpu_set_nz(st, res);
+#else
+    if (al < 0) al = ((al - 0x06) & 0x0F) - 0x10;
+    int diff = (st->A & 0xF0) - (op & 0xF0) + al;
+    if (diff < 0) diff -= 0x60;
+    cpu_adc_binary(st, ~op); // and all the flags
+    st->A = (u8)diff;
+#endif
+}
+#endif
+
+CPU_INLINE void cpu_instr_adc(cpu_state_t* st, u8 op) {
+#ifndef CPU_VARIANT_2A03
+    if (unlikely(st->D)) {
+        cpu_adc_decimal(st, op);
+#ifdef CPU_VARIANT_65C02
+        CPU_DECIMAL_TICK(st);
+#endif
+        return;
+    }
+#endif
+    cpu_adc_binary(st, op);
+}
+// hack learnt from 6502.org: in binary mode A - op - !C is A + ~op + C
+CPU_INLINE void cpu_instr_sbc(cpu_state_t* st, u8 op) {
+#ifndef CPU_VARIANT_2A03
+    if (unlikely(st->D)) {
+        cpu_sbc_decimal(st, op);
+#ifdef CPU_VARIANT_65C02
+        CPU_DECIMAL_TICK(st);
+#endif
+        return;
+    }
+#endif
+    cpu_adc_binary(st, ~op);
+}
+CPU_INLINE void cpu_instr_bit(cpu_state_t* st, u8 op) { 
+    st->N_res = op;
+    st->V = (op & 0x40)>>6;
+    st->Z_res = op & st->A;
+}
+
+// rmw instructions
+CPU_INLINE u8 cpu_instr_dec(cpu_state_t* st, u8 op) { cpu_set_nz(st, op-1); return op-1; }
+CPU_INLINE u8 cpu_instr_inc(cpu_state_t* st, u8 op) { cpu_set_nz(st, op+1); return op+1; }
+CPU_INLINE u8 cpu_instr_asl(cpu_state_t* st, u8 op) { st->C = (op&0x80)>>7; cpu_set_nz(st, (u8)(op<<1)); return op<<1; }
+CPU_INLINE u8 cpu_instr_lsr(cpu_state_t* st, u8 op) { st->C = (op&0x01); cpu_set_nz(st, (u8)(op>>1)); return op>>1; }
+CPU_INLINE u8 cpu_instr_rol(cpu_state_t* st, u8 op) { 
+    u8 sbit = st->C;
+    st->C = (op&0x80)>>7; 
+    u8 res = (u8)(op<<1) | sbit;
+    cpu_set_nz(st, res); 
+    return res; 
+}
+CPU_INLINE u8 cpu_instr_ror(cpu_state_t* st, u8 op) { 
+    u8 sbit = st->C;
+    st->C = (op&0x01); 
+    u8 res = (u8)(op>>1) | (sbit << 7);
+    cpu_set_nz(st, res);
+    return res; 
+}
+
+// undocumented read instructions
+CPU_INLINE void cpu_instr_ign(cpu_state_t* st, u8 op) { /* reads and drops op */ }
+CPU_INLINE void cpu_instr_lax(cpu_state_t* st, u8 op) { st->X = op; cpu_instr_lda(st, op); }
+CPU_INLINE void cpu_instr_anc(cpu_state_t* st, u8 op) { cpu_instr_and(st, op); st->C = st->A >> 7; }
+CPU_INLINE void cpu_instr_alr(cpu_state_t* st, u8 op) { st->A = cpu_instr_lsr(st, st->A & op); }
+CPU_INLINE void cpu_instr_sbx(cpu_state_t* st, u8 op) {
+    u8 ax = st->A & st->X;
+    st->C = (op <= ax);
+    cpu_instr_ldx(st, ax - op);
+}
+// ROR of A & op, with C and V from bits 6 and 5 of the result. in NMOS
+// decimal mode the result is then BCD-adjusted like ADC's
+CPU_INLINE void cpu_instr_arr(cpu_state_t* st, u8 op) {
+    u8 t = st->A & op;
+    u8 res = (t >> 1) | (st->C << 7);
+#ifdef CPU_VARIANT_NMOS
+    if (unlikely(st->D)) {
+        st->N_res = res;
+        st->Z_res = res;
+        st->V = ((t ^ res) & 0x40) != 0;
+        if ((t & 0x0F) + (t & 0x01) > 0x05) res = (res & 0xF0) | ((res + 0x06) & 0x0F);
+        st->C = (t & 0xF0) + (t & 0x10) > 0x50;
+        if (st->C) res += 0x60;
+        st->A = res;
+        return;
+    }
+#endif
+    st->C = (res >> 6) & 1;
+    st->V = ((res >> 6) ^ (res >> 5)) & 1;
+    cpu_instr_lda(st, res);
+}
+
+// 65C02 BIT #imm only sets Z
+CPU_INLINE void cpu_instr_biti(cpu_state_t* st, u8 op) { st->Z_res = op & st->A; }
+
+// undocumented rmw instructions: a shift or step, then an ALU op with the
+// result
+CPU_INLINE u8 cpu_instr_slo(cpu_state_t* st, u8 op) { u8 res = cpu_instr_asl(st, op); cpu_instr_ora(st, res); return res; }
+CPU_INLINE u8 cpu_instr_rla(cpu_state_t* st, u8 op) { u8 res = cpu_instr_rol(st, op); cpu_instr_and(st, res); return res; }
+CPU_INLINE u8 cpu_instr_sre(cpu_state_t* st, u8 op) { u8 res = cpu_instr_lsr(st, op); cpu_instr_eor(st, res); return res; }
+CPU_INLINE u8 cpu_instr_rra(cpu_state_t* st, u8 op) { u8 res = cpu_instr_ror(st, op); cpu_instr_adc(st, res); return res; }
+CPU_INLINE u8 cpu_instr_dcp(cpu_state_t* st, u8 op) { u8 res = op - 1; cpu_instr_cmp(st, res); return res; }
+CPU_INLINE u8 cpu_instr_isc(cpu_state_t* st, u8 op) { u8 res = op + 1; cpu_instr_sbc(st, res); return res; }
+
+// 65C02 rmw instructions. TSB and TRB set Z from A & op, like BIT
+CPU_INLINE u8 cpu_instr_tsb(cpu_state_t* st, u8 op) { st->Z_res = op & st->A; return op | st->A; }
+CPU_INLINE u8 cpu_instr_trb(cpu_state_t* st, u8 op) { st->Z_res = op & st->A; return op & ~st->A; }
+#define CPU_INSTR_BITS(n) \
+    CPU_INLINE u8 cpu_instr_rmb##n(cpu_state_t* st, u8 op) { return op & ~(1 << n); } \
+    CPU_INLINE u8 cpu_instr_smb##n(cpu_state_t* st, u8 op) { return op | (1 << n); } \
+    CPU_INLINE bool cpu_instr_bbr##n(cpu_state_t* st, u8 op) { return !(op & (1 << n)); } \
+    CPU_INLINE bool cpu_instr_bbs##n(cpu_state_t* st, u8 op) { return (op & (1 << n)) != 0; }
+CPU_INSTR_BITS(0) CPU_INSTR_BITS(1) CPU_INSTR_BITS(2) CPU_INSTR_BITS(3)
+CPU_INSTR_BITS(4) CPU_INSTR_BITS(5) CPU_INSTR_BITS(6) CPU_INSTR_BITS(7)
+#undef CPU_INSTR_BITS
+
+// write instructions
+CPU_INLINE u8 cpu_instr_sta(cpu_state_t* st) { return st->A; }
+CPU_INLINE u8 cpu_instr_stx(cpu_state_t* st) { return st->X; }
+CPU_INLINE u8 cpu_instr_sty(cpu_state_t* st) { return st->Y; }
+CPU_INLINE u8 cpu_instr_sax(cpu_state_t* st) { return st->A & st->X; }
+CPU_INLINE u8 cpu_instr_stz(cpu_state_t* st) { return 0; }
+
+// implied instructions
+CPU_INLINE void cpu_instr_clc(cpu_state_t* st) { st->C = 0; }
+CPU_INLINE void cpu_instr_cld(cpu_state_t* st) { st->D = 0; }
+CPU_INLINE void cpu_instr_cli(cpu_state_t* st) { st->I = 0; }
+CPU_INLINE void cpu_instr_clv(cpu_state_t* st) { st->V = 0; }
+CPU_INLINE void cpu_instr_sec(cpu_state_t* st) { st->C = 1; }
+CPU_INLINE void cpu_instr_sed(cpu_state_t* st) { st->D = 1; }
+CPU_INLINE void cpu_instr_sei(cpu_state_t* st) { st->I = 1; }
+CPU_INLINE void cpu_instr_tax(cpu_state_t *st) { cpu_instr_ldx(st, st->A); }
+CPU_INLINE void cpu_instr_tay(cpu_state_t *st) { cpu_instr_ldy(st, st->A); }
+CPU_INLINE void cpu_instr_tsx(cpu_state_t *st) { cpu_instr_ldx(st, st->S); }
+CPU_INLINE void cpu_instr_txa(cpu_state_t *st) { cpu_instr_lda(st, st->X); }
+CPU_INLINE void cpu_instr_tya(cpu_state_t *st) { cpu_instr_lda(st, st->Y); }
+CPU_INLINE void cpu_instr_txs(cpu_state_t *st) { st->S = st->X; }
+CPU_INLINE void cpu_instr_dex(cpu_state_t *st) { cpu_instr_ldx(st, st->X-1); }
+CPU_INLINE void cpu_instr_dey(cpu_state_t *st) { cpu_instr_ldy(st, st->Y-1); }
+CPU_INLINE void cpu_instr_inx(cpu_state_t *st) { cpu_instr_ldx(st, st->X+1); }
+CPU_INLINE void cpu_instr_iny(cpu_state_t *st) { cpu_instr_ldy(st, st->Y+1); }
+CPU_INLINE void cpu_instr_nop(cpu_state_t *st) { /* do nothing */ }
+
+// multi-cycle implied instructions 
+CPU_INLINE void cpu_instr_pha(cpu_state_t *st) {
+    cpu_tick(st); // 2 
+    cpu_write(st, st->A, 0x100+(st->S--));
+}
+CPU_INLINE void cpu_instr_php(cpu_state_t *st) {
+    cpu_tick(st); // 2 
+    cpu_write(st, cpu_pack_p(st, 1), 0x100+(st->S--));
+}
+CPU_INLINE void cpu_instr_pla(cpu_state_t *st) {
+    cpu_tick(st); // 2
+    st->S++; cpu_tick(st); // 3
+    st->A = cpu_read(st, 0x100+st->S);
+    cpu_set_nz(st, st->A);
+}
+CPU_INLINE void cpu_instr_plp(cpu_state_t *st) {
+    cpu_tick(st); // 2
+    st->S++; cpu_tick(st); // 3
+    u8 p = cpu_read(st, 0x100+st->S);
+    cpu_unpack_p(st, p);
+}
+CPU_INLINE void cpu_instr_phx(cpu_state_t *st) {
+    cpu_tick(st); // 2
+    cpu_write(st, st->X, 0x100+(st->S--));
+}
+CPU_INLINE void cpu_instr_phy(cpu_state_t *st) {
+    cpu_tick(st); // 2
+    cpu_write(st, st->Y, 0x100+(st->S--));
+}
+CPU_INLINE void cpu_instr_plx(cpu_state_t *st) {
+    cpu_tick(st); // 2
+    st->S++; cpu_tick(st); // 3
+    cpu_instr_ldx(st, cpu_read(st, 0x100+st->S));
+}
+CPU_INLINE void cpu_instr_ply(cpu_state_t *st) {
+    cpu_tick(st); // 2
+    st->S++; cpu_tick(st); // 3
+    cpu_instr_ldy(st, cpu_read(st, 0x100+st->S));
+}
+
+// the 65C02 leaves decimal mode on reset, BRK and interrupts
+CPU_INLINE void cpu_enter_handler(cpu_state_t *st) {
+    st->I = 1;
+#ifdef CPU_VARIANT_65C02
+    st->D = 0;
+#endif
+}
+
+CPU_INLINE void cpu_instr_brk(cpu_state_t *st) {
+    st->PC++; cpu_tick(st); // 2 (yes, this is a quirk of brk)
+    cpu_write(st, lo((st->PC&0xFF00)>>8), 0x100 + (st->S--)); cpu_tick(st); // 3
+    // TODO If a hardware interrupt (NMI or IRQ) occurs before the fourth (flags
+    // saving) cycle of BRK, the BRK instruction will be skipped, and
+    // the processor will jump to the hardware interrupt vector. (64doc.txt)
+    cpu_write(st, lo(st->PC), 0x100 + (st->S--)); cpu_tick(st); // 4
+    cpu_write(st, cpu_pack_p(st, 1), 0x100 + (st->S--)); cpu_tick(st); // 5
+    st->PC = 0;
+    cpu_enter_handler(st);
+    st->PC |= lo(cpu_read(st, 0xFFFE)); cpu_tick(st); // 6
+    st->PC |= hi(cpu_read(st, 0xFFFF)); // tick 7 in wrapper
+}
+
+CPU_INLINE void cpu_instr_rti(cpu_state_t *st) {
+    cpu_tick(st); // 2
+    st->S++; cpu_tick(st); // 3
+    u8 p = cpu_read(st, 0x100+st->S++);
+    cpu_unpack_p(st, p); cpu_tick(st); // 4
+    st->PC = 0;
+    st->PC |= lo(cpu_read(st, 0x100 + (st->S++))); cpu_tick(st); // 5
+    st->PC |= ((u16)(cpu_read(st, 0x100 + st->S)) << 8); // tick 6 in wrapper
+}
+
+CPU_INLINE void cpu_instr_rts(cpu_state_t *st) {
+    cpu_tick(st); // 2
+    st->S++; cpu_tick(st); // 3
+    st->PC = 0;
+    st->PC |= lo(cpu_read(st, 0x100 + (st->S++))); cpu_tick(st); // 4
+    st->PC |= ((u16)(cpu_read(st, 0x100 + st->S)) << 8); cpu_tick(st); // 5
+    st->PC++; // tick 6 in wrapper
+}
+
+// branches
+CPU_INLINE bool cpu_instr_bcc(cpu_state_t *st) { return st->C == 0; }
+CPU_INLINE bool cpu_instr_bcs(cpu_state_t *st) { return st->C == 1; }
+CPU_INLINE bool cpu_instr_bne(cpu_state_t *st) { return st->Z_res != 0; }
+CPU_INLINE bool cpu_instr_beq(cpu_state_t *st) { return st->Z_res == 0; }
+CPU_INLINE bool cpu_instr_bpl(cpu_state_t *st) { return (st->N_res & 0x80) == 0; }
+CPU_INLINE bool cpu_instr_bmi(cpu_state_t *st) { return (st->N_res & 0x80) != 0; }
+CPU_INLINE bool cpu_instr_bvc(cpu_state_t *st) { return st->V == 0; }
+CPU_INLINE bool cpu_instr_bvs(cpu_state_t *st) { return st->V == 1; }
+CPU_INLINE bool cpu_instr_bra(cpu_state_t *st) { return true; }
+
+// implied, accumulator instructions
+
+CPU_INLINE void cpu_icl_all_imp(cpu_state_t *st, void (*instr)(cpu_state_t*)) {
+    instr(st); // 2, .., n-1
+    cpu_tick(st); // n
+}
+
+// 65C02 NOPs that end with the opcode fetch
+CPU_INLINE void cpu_icl_all_one(cpu_state_t *st, void (*instr)(cpu_state_t*)) {
+    instr(st);
+}
+
+CPU_INLINE void cpu_icl_all_acc(cpu_state_t *st, u8 (*instr)(cpu_state_t*, u8)) {
+    u8 res = instr(st, st->A); // 2, .., n-1
+    st->A = res; cpu_tick(st); // n
+}
+
+CPU_INLINE void cpu_icl_all_imm(cpu_state_t *st, void (*instr)(cpu_state_t*, u8)) {
+    instr(st, cpu_read(st, st->PC++)); cpu_tick(st); // 2 .. n-1, n
+}
+
+// Absolute addressing 
+CPU_INLINE void cpu_icl_read_abs(cpu_state_t *st, void (*instr)(cpu_state_t*, u8)) {
+    u16 addr = cpu_read(st, st->PC++);  cpu_tick(st); // 2
+    addr |= hi(cpu_read(st, st->PC++)); cpu_tick(st); // 3
+    instr(st, cpu_read(st, addr));      cpu_tick(st); // 4
+}
+
+CPU_INLINE void cpu_icl_rmw_abs(cpu_state_t *st, u8 (*instr)(cpu_state_t*, u8)) {
+    u16 addr = cpu_read(st, st->PC++);  cpu_tick(st); // 2
+    addr |= hi(cpu_read(st, st->PC++)); cpu_tick(st); // 3
+    u8 op = cpu_read(st, addr);         cpu_tick(st); // 4
+    u8 res = instr(st, op);    cpu_tick(st); // 5
+    cpu_write(st, res, addr);           cpu_tick(st); // 6
+}
+
+CPU_INLINE void cpu_icl_write_abs(cpu_state_t *st, u8 (*instr)(cpu_state_t*)) {
+    u16 addr = cpu_read(st, st->PC++);  cpu_tick(st); // 2
+    addr |= hi(cpu_read(st, st->PC++)); cpu_tick(st); // 3
+    cpu_write(st, instr(st), addr);     cpu_tick(st); // 4
+}
+
+CPU_INLINE void cpu_icl_jmp_abs(cpu_state_t *st) {
+    u16 addr = cpu_read(st, st->PC++);                 cpu_tick(st); // 2
+    addr |= hi(cpu_read(st, st->PC++));
+    u16 end = st->PC;                   st->PC = addr; cpu_tick(st); // 3
+    cpu_idle_jump(st, end);
+}
+
+CPU_INLINE void cpu_icl_jsr_abs(cpu_state_t *st) {
+    u16 addr = cpu_read(st, st->PC++);                        cpu_tick(st); // 2
+                                                     cpu_tick(st); // 3 (internal operation?)
+    cpu_write(st, lo((st->PC&0xFF00)>>8), 0x100 + (st->S--)); cpu_tick(st); // 4
+    cpu_write(st, lo(st->PC), 0x100 + (st->S--));             cpu_tick(st); // 5
+    addr |= hi(cpu_read(st, st->PC++)); st->PC = addr;        cpu_tick(st);
+}
+
+// 65C02 $5C: an 8-cycle NOP that skips a 16-bit operand
+CPU_INLINE void cpu_icl_wait_abs(cpu_state_t *st) {
+    st->PC += 2;
+    for (int i = 2; i <= 8; i++) cpu_tick(st); // 2 .. 8
+}
+
+// zero page addressing
+CPU_INLINE void cpu_icl_read_zpg(cpu_state_t *st, void (*instr)(cpu_state_t*, u8)) {
+    u8 zpa = cpu_read(st, st->PC++);   cpu_tick(st); // 2
+    instr(st, cpu_read(st, zpa));      cpu_tick(st); // 3
+}
+
+CPU_INLINE void cpu_icl_rmw_zpg(cpu_state_t *st, u8 (*instr)(cpu_state_t*, u8)) {
+    u8 zpa = cpu_read(st, st->PC++);   cpu_tick(st); // 2
+    u8 op = cpu_read(st, zpa);         cpu_tick(st); // 3
+    u8 res = instr(st, op);   cpu_tick(st); // 4
+    cpu_write(st, res, zpa);           cpu_tick(st); // 5
+}
+
+CPU_INLINE void cpu_icl_write_zpg(cpu_state_t *st, u8 (*instr)(cpu_state_t*)) {
+    u8 zpa = cpu_read(st, st->PC++);   cpu_tick(st); // 2
+    cpu_write(st, instr(st), zpa);     cpu_tick(st); // 3
+}
+
+// zero page indexed addressing
+CPU_INLINE void cpu_icl_read_zpi(cpu_state_t *st, u8 idx, void (*instr)(cpu_state_t*, u8)) {
+    u8 zpa = cpu_read(st, st->PC++);   cpu_tick(st); // 2
+    u8 addr = lo(zpa+idx);    cpu_tick(st); // 3
+    instr(st, cpu_read(st, addr));     cpu_tick(st); // 4
+}
+
+CPU_INLINE void cpu_icl_rmw_zpi(cpu_state_t *st, u8 idx, u8 (*instr)(cpu_state_t*, u8)) {
+    u8 zpa = cpu_read(st, st->PC++);   cpu_tick(st); // 2
+    u8 addr = lo(zpa+idx);    cpu_tick(st); // 3
+    u8 op = cpu_read(st, addr);        cpu_tick(st); // 4
+    u8 res = instr(st, op);   cpu_tick(st); // 5
+    cpu_write(st, res, addr);          cpu_tick(st); // 6
+}
+
+CPU_INLINE void cpu_icl_write_zpi(cpu_state_t *st, u8 idx, u8 (*instr)(cpu_state_t*)) {
+    u8 zpa = cpu_read(st, st->PC++);   cpu_tick(st); // 2
+    u8 addr = lo(zpa+idx);    cpu_tick(st); // 3
+    cpu_write(st, instr(st), addr);    cpu_tick(st); // 4
+}
+
+// absolute indexed addressing
+CPU_INLINE void cpu_icl_read_abi(cpu_state_t *st, u8 idx, void (*instr)(cpu_state_t*, u8)) {
+    u16 addr = cpu_read(st, st->PC++);        cpu_tick(st); // 2
+    addr |= hi(cpu_read(st, st->PC++));       cpu_tick(st); // 3
+    u16 newaddr = addr + idx;
+    if ((addr & 0xFF) + idx > 0xFF)  cpu_tick(st); // fixup
+    instr(st, cpu_read(st, newaddr));         cpu_tick(st); // 4/5
+}
+
+CPU_INLINE void cpu_icl_rmw_abi(cpu_state_t *st, u8 idx, u8 (*instr)(cpu_state_t*, u8)) {
+    u16 addr = cpu_read(st, st->PC++);        cpu_tick(st); // 2
+    addr |= hi(cpu_read(st, st->PC++));       cpu_tick(st); // 3
+    u16 newaddr = addr + idx;        cpu_tick(st); // 4
+    u8 op = cpu_read(st, newaddr);            cpu_tick(st); // 5
+    u8 res = instr(st, op);          cpu_tick(st); // 6
+    cpu_write(st, res, newaddr);              cpu_tick(st); // 7
+}
+
+CPU_INLINE void cpu_icl_write_abi(cpu_state_t *st, u8 idx, u8 (*instr)(cpu_state_t*)) {
+    u16 addr = cpu_read(st, st->PC++);        cpu_tick(st); // 2
+    addr |= hi(cpu_read(st, st->PC++));       cpu_tick(st); // 3
+    u16 newaddr = addr + idx;        cpu_tick(st); // 4
+    cpu_write(st, instr(st), newaddr);        cpu_tick(st); // 5
+}
+
+// 65C02 indexed shifts only take the fixup cycle when the page changes
+CPU_INLINE void cpu_icl_rmw_abp(cpu_state_t *st, u8 idx, u8 (*instr)(cpu_state_t*, u8)) {
+    u16 addr = cpu_read(st, st->PC++);        cpu_tick(st); // 2
+    addr |= hi(cpu_read(st, st->PC++));       cpu_tick(st); // 3
+    u16 newaddr = addr + idx;
+    if ((addr & 0xFF) + idx > 0xFF)  cpu_tick(st); // fixup
+    u8 op = cpu_read(st, newaddr);            cpu_tick(st); // 4/5
+    u8 res = instr(st, op);          cpu_tick(st); // 5/6
+    cpu_write(st, res, newaddr);              cpu_tick(st); // 6/7
+}
+
+CPU_INLINE void cpu_icl_branch(cpu_state_t *st, bool (*branch)(cpu_state_t*)) {
+    s8 op = cpu_read(st, st->PC++);   cpu_tick(st); // 2
+    if (!branch(st)) {
+        cpu_idle_exit(st, st->PC);
+        return;
+    }
+    cpu_tick(st); // 3 (if branch is taken)
+    u16 old_pc = st->PC;
+    st->PC = old_pc + op;
+    if ((u16)((s16)(old_pc&0xFF) + op) > 0xFF) cpu_tick(st); // 4 (if page changes)
+    cpu_idle_jump(st, old_pc);
+}
+
+// 65C02 BBRn/BBSn $nn,rel: branch on a bit of a zero page byte
+CPU_INLINE void cpu_icl_branch_zpr(cpu_state_t *st, bool (*branch)(cpu_state_t*, u8)) {
+    u8 zpa = cpu_read(st, st->PC++);  cpu_tick(st); // 2
+    u8 val = cpu_read(st, zpa);       cpu_tick(st); // 3
+    s8 op = cpu_read(st, st->PC++);   cpu_tick(st); // 4
+    bool taken = branch(st, val);     cpu_tick(st); // 5
+    if (!taken) {
+        cpu_idle_exit(st, st->PC);
+        return;
+    }
+    cpu_tick(st); // 6 (if branch is taken)
+    u16 old_pc = st->PC;
+    st->PC = old_pc + op;
+    if ((u16)((s16)(old_pc&0xFF) + op) > 0xFF) cpu_tick(st); // 7 (if page changes)
+    cpu_idle_jump(st, old_pc);
+}
+
+// zero-page indirect preindexed [($nn, X)]
+CPU_INLINE void cpu_icl_read_zpx(cpu_state_t *st, void (*instr)(cpu_state_t*, u8)) {
+    u8 ptraddr = cpu_read(st, st->PC++);        cpu_tick(st); // 2
+    u8 ptr = lo(ptraddr + st->X);      cpu_tick(st); // 3
+    u16 addr = cpu_read(st, ptr);               cpu_tick(st); // 4
+    addr |= hi(cpu_read(st, lo(ptr+1)));        cpu_tick(st); // 5
+    instr(st, cpu_read(st, addr));              cpu_tick(st); // 6
+}
+
+CPU_INLINE void cpu_icl_rmw_zpx(cpu_state_t *st, u8 (*instr)(cpu_state_t*, u8)) {
+    u8 ptraddr = cpu_read(st, st->PC++);    cpu_tick(st); // 2
+    u8 ptr = lo(ptraddr + st->X);  cpu_tick(st); // 3
+    u16 addr = cpu_read(st, ptr);           cpu_tick(st); // 4
+    addr |= hi(cpu_read(st, lo(ptr+1)));    cpu_tick(st); // 5
+    u8 op = cpu_read(st, addr);             cpu_tick(st); // 6
+    u8 result = instr(st, op);     cpu_tick(st); // 7
+    cpu_write(st, result, addr);            cpu_tick(st); // 8
+}
+
+CPU_INLINE void cpu_icl_write_zpx(cpu_state_t *st, u8 (*instr)(cpu_state_t*)) {
+    u8 ptraddr = cpu_read(st, st->PC++);    cpu_tick(st); // 2
+    u8 ptr = lo(ptraddr + st->X);  cpu_tick(st); // 3
+    u16 addr = cpu_read(st, ptr);           cpu_tick(st); // 4
+    addr |= hi(cpu_read(st, lo(ptr+1)));    cpu_tick(st); // 5
+    cpu_write(st, instr(st), addr);         cpu_tick(st); // 6
+}
+
+// zero-page preindexed indirect [($nn), Y]
+CPU_INLINE void cpu_icl_read_zpy(cpu_state_t *st, void (*instr)(cpu_state_t*, u8)) {
+    u8 ptr = cpu_read(st, st->PC++);           cpu_tick(st); // 2
+    u16 addr = cpu_read(st, ptr);              cpu_tick(st); // 3
+    addr |= hi(cpu_read(st, lo(ptr+1)));
+    u16 newaddr = addr + st->Y;       cpu_tick(st); // 4
+    if ((addr & 0xFF) + st->Y > 0xFF) cpu_tick(st); // fixup
+    instr(st, cpu_read(st, newaddr));          cpu_tick(st); // 5/6
+}
+
+CPU_INLINE void cpu_icl_rmw_zpy(cpu_state_t *st, u8 (*instr)(cpu_state_t*, u8)) {
+    u8 ptr = cpu_read(st, st->PC++);       cpu_tick(st); // 2
+    u16 addr = cpu_read(st, ptr);          cpu_tick(st); // 3
+    addr |= hi(cpu_read(st, lo(ptr+1)));   cpu_tick(st); // 4
+    u16 newaddr = addr + st->Y;   cpu_tick(st); // 5
+    u8 op = cpu_read(st, newaddr);         cpu_tick(st); // 6
+    u8 result = instr(st, op);    cpu_tick(st); // 7
+    cpu_write(st, result, newaddr);        cpu_tick(st); // 8
+}
+
+CPU_INLINE void cpu_icl_write_zpy(cpu_state_t *st, u8 (*instr)(cpu_state_t*)) {
+    u8 ptr = cpu_read(st, st->PC++);       cpu_tick(st); // 2
+    u16 addr = cpu_read(st, ptr);          cpu_tick(st); // 3
+    addr |= hi(cpu_read(st, lo(ptr+1)));   cpu_tick(st); // 4
+    u16 newaddr = addr + st->Y;   cpu_tick(st); // 5
+    cpu_write(st, instr(st), newaddr);     cpu_tick(st); // 6
+}
+
+// 65C02 zero-page indirect [($nn)]
+CPU_INLINE void cpu_icl_read_izp(cpu_state_t *st, void (*instr)(cpu_state_t*, u8)) {
+    u8 ptr = cpu_read(st, st->PC++);       cpu_tick(st); // 2
+    u16 addr = cpu_read(st, ptr);          cpu_tick(st); // 3
+    addr |= hi(cpu_read(st, lo(ptr+1)));   cpu_tick(st); // 4
+    instr(st, cpu_read(st, addr));         cpu_tick(st); // 5
+}
+
+CPU_INLINE void cpu_icl_write_izp(cpu_state_t *st, u8 (*instr)(cpu_state_t*)) {
+    u8 ptr = cpu_read(st, st->PC++);       cpu_tick(st); // 2
+    u16 addr = cpu_read(st, ptr);          cpu_tick(st); // 3
+    addr |= hi(cpu_read(st, lo(ptr+1)));   cpu_tick(st); // 4
+    cpu_write(st, instr(st), addr);        cpu_tick(st); // 5
+}
+
+// absolute indirect addressing. the NMOS 6502 doesn't carry into the high
+// byte of the pointer, so JMP ($xxFF) reads its target from $xxFF and $xx00.
+// the 65C02 fixes that with an extra cycle
+CPU_INLINE u16 cpu_ind_next(u16 ptr) {
+#ifdef CPU_VARIANT_65C02
+    return ptr + 1;
+#else
+    return (ptr & 0xFF00) | lo(ptr+1);
+#endif
+}
+
+CPU_INLINE void cpu_icl_jmp_ind(cpu_state_t *st) {
+    u16 ptr = cpu_read(st, st->PC++);        cpu_tick(st); // 2
+    ptr |= hi(cpu_read(st, st->PC++));       cpu_tick(st); // 3
+#ifdef CPU_VARIANT_65C02
+                                             cpu_tick(st); // 4
+#endif
+    u8 latch = cpu_read(st, ptr);            cpu_tick(st); // 4/5
+    st->PC = hi(cpu_read(st, cpu_ind_next(ptr))) | latch; cpu_tick(st); // 5/6
+}
+
+// 65C02 absolute indexed indirect [($nnnn,X)]
+CPU_INLINE void cpu_icl_jmp_iax(cpu_state_t *st) {
+    u16 ptr = cpu_read(st, st->PC++);        cpu_tick(st); // 2
+    ptr |= hi(cpu_read(st, st->PC++));       cpu_tick(st); // 3
+    ptr += st->X;                            cpu_tick(st); // 4
+    u8 latch = cpu_read(st, ptr);            cpu_tick(st); // 5
+    st->PC = hi(cpu_read(st, ptr + 1)) | latch; cpu_tick(st); // 6
+}
+
+// maps an opcode table entry to its addressing mode helper call
+#define CPU_ICL_all_imp(instr, idx)     cpu_icl_all_imp(st, &cpu_instr_##instr)
+#define CPU_ICL_all_one(instr, idx)     cpu_icl_all_one(st, &cpu_instr_##instr)
+#define CPU_ICL_all_acc(instr, idx)     cpu_icl_all_acc(st, &cpu_instr_##instr)
+#define CPU_ICL_all_imm(instr, idx)     cpu_icl_all_imm(st, &cpu_instr_##instr)
+#define CPU_ICL_read_abs(instr, idx)    cpu_icl_read_abs(st, &cpu_instr_##instr)
+#define CPU_ICL_rmw_abs(instr, idx)     cpu_icl_rmw_abs(st, &cpu_instr_##instr)
+#define CPU_ICL_write_abs(instr, idx)   cpu_icl_write_abs(st, &cpu_instr_##instr)
+#define CPU_ICL_jmp_abs(instr, idx)     cpu_icl_jmp_abs(st)
+#define CPU_ICL_jsr_abs(instr, idx)     cpu_icl_jsr_abs(st)
+#define CPU_ICL_wait_abs(instr, idx)    cpu_icl_wait_abs(st)
+#define CPU_ICL_read_abi(instr, idx)    cpu_icl_read_abi(st, st->idx, &cpu_instr_##instr)
+#define CPU_ICL_rmw_abi(instr, idx)     cpu_icl_rmw_abi(st, st->idx, &cpu_instr_##instr)
+#define CPU_ICL_write_abi(instr, idx)   cpu_icl_write_abi(st, st->idx, &cpu_instr_##instr)
+#define CPU_ICL_rmw_abp(instr, idx)     cpu_icl_rmw_abp(st, st->idx, &cpu_instr_##instr)
+#define CPU_ICL_jmp_ind(instr, idx)     cpu_icl_jmp_ind(st)
+#define CPU_ICL_jmp_iax(instr, idx)     cpu_icl_jmp_iax(st)
+#define CPU_ICL_read_zpg(instr, idx)    cpu_icl_read_zpg(st, &cpu_instr_##instr)
+#define CPU_ICL_rmw_zpg(instr, idx)     cpu_icl_rmw_zpg(st, &cpu_instr_##instr)
+#define CPU_ICL_write_zpg(instr, idx)   cpu_icl_write_zpg(st, &cpu_instr_##instr)
+#define CPU_ICL_read_zpi(instr, idx)    cpu_icl_read_zpi(st, st->idx, &cpu_instr_##instr)
+#define CPU_ICL_rmw_zpi(instr, idx)     cpu_icl_rmw_zpi(st, st->idx, &cpu_instr_##instr)
+#define CPU_ICL_write_zpi(instr, idx)   cpu_icl_write_zpi(st, st->idx, &cpu_instr_##instr)
+#define CPU_ICL_read_zpx(instr, idx)    cpu_icl_read_zpx(st, &cpu_instr_##instr)
+#define CPU_ICL_rmw_zpx(instr, idx)     cpu_icl_rmw_zpx(st, &cpu_instr_##instr)
+#define CPU_ICL_write_zpx(instr, idx)   cpu_icl_write_zpx(st, &cpu_instr_##instr)
+#define CPU_ICL_read_zpy(instr, idx)    cpu_icl_read_zpy(st, &cpu_instr_##instr)
+#define CPU_ICL_rmw_zpy(instr, idx)     cpu_icl_rmw_zpy(st, &cpu_instr_##instr)
+#define CPU_ICL_write_zpy(instr, idx)   cpu_icl_write_zpy(st, &cpu_instr_##instr)
+#define CPU_ICL_read_izp(instr, idx)    cpu_icl_read_izp(st, &cpu_instr_##instr)
+#define CPU_ICL_write_izp(instr, idx)   cpu_icl_write_izp(st, &cpu_instr_##instr)
+#define CPU_ICL_branch_rel(instr, idx)  cpu_icl_branch(st, &cpu_instr_##instr)
+#define CPU_ICL_branch_zpr(instr, idx)  cpu_icl_branch_zpr(st, &cpu_instr_##instr)
+
+#endif
@@ -0,0 +1,1050 @@
+#include "cpu_internal.h"
+#include "cpu_jit.h"
+#include <stddef.h>
+
+#if defined(CPU_JIT) && defined(__x86_64__) && defined(__unix__)
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CPU_JIT_BLOCKS 4096 // must be a power of 2
+#define CPU_JIT_INSNS 64    // instructions per block
+#define CPU_JIT_FIXUPS 512  // exit jumps per block
+#define CPU_JIT_PATCHES 128 // cycle counts patched in per block
+#define CPU_JIT_INSN_ROOM 256 // emitted bytes one instruction may need
+#define CPU_JIT_BLOCK_ROOM (CPU_JIT_INSNS * (CPU_JIT_INSN_ROOM + 64)) // and a whole block
+#define CPU_JIT_PAGE_BLOCKS 32 // blocks tracked per page
+
+// translated block: fn(st, limit), where limit is the cycle count a loop-back
+// may not exceed
+typedef void (*cpu_jit_fn)(cpu_state_t *st, u64 limit);
+
+typedef struct {
+    u16 pc;
+    u8 valid;
+    u8 failed;      // PC can't start a block
+    u8 pages[2];    // pages the block's bytes live on
+    u16 end;        // address just past its last byte
+    u16 max_cycles; // worst-case cycles of one pass through the block
+    u32 visits;
+    u32 gens[2];    // generation of pages[] at translation time
+    cpu_jit_fn fn;
+} cpu_jit_block_t;
+
+// instruction lengths and base cycles, generated from the opcode table
+static const u8 cpu_jit_len[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_OPLEN_##mode,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+static const u8 cpu_jit_cycles[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = cyc,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+static const u8 cpu_jit_max_cycles[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = cyc + CPU_PENALTY_##kind##_##mode,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+// the emitted code addresses cpu_state_t through rbx
+#define ST(f) ((u32)offsetof(cpu_state_t, f))
+#define PG(page, f) (ST(pages) + (u32)((page) * sizeof(cpu_page_t) + offsetof(cpu_page_t, f)))
+
+// dynamic page table lookups index pages[] as rbx + (page*3)*8
+_Static_assert(sizeof(cpu_page_t) == 24, "cpu_page_t layout");
+
+// writes to pages with these flags leave translated code
+#define CPU_JIT_WRITE_TRAPS (CPU_PAGE_CODE | CPU_PAGE_TRACK)
+
+// cycle counts only known once the whole block is translated
+enum { CPU_JIT_PATCH_MAX, CPU_JIT_PATCH_REST };
+
+// x86 condition codes
+enum { CC_O = 0, CC_C = 2, CC_NC = 3, CC_Z = 4, CC_NZ = 5, CC_A = 7 };
+// byte registers
+enum { R_AL = 0, R_CL = 1, R_DL = 2 };
+
+// per-block translation state
+typedef struct {
+    u8 *p, *end;
+    u8 *body;     // loop-back target, just after the prologue
+    u8 *total_at; // imm32 of the entry cycle add
+    struct { u8 *at; u8 ins; } fix[CPU_JIT_FIXUPS];
+    u32 nfix;
+    struct { u8 *at; u8 ins; u8 kind; } patch[CPU_JIT_PATCHES];
+    u32 npatch;
+    bool full;    // ran out of fixup or patch slots
+
+    u16 pc0;      // block start
+    u8 ins;       // index of the instruction being translated
+    u16 pc;       // its address
+    u16 next;     // address of the following instruction
+    u16 op;       // its operand bytes
+    bool done;    // it ends the block
+} cpu_jit_ctx_t;
+
+struct cpu_jit {
+    u8 *arena;
+    u32 arena_size;
+    u32 arena_used;
+    uintptr_t page_size;
+    u32 hot;
+    u32 page_gen[256]; // bumped when a whole page is invalidated
+    // blocks on each page, so a write to translated code only drops the
+    // blocks covering it. more than CPU_JIT_PAGE_BLOCKS falls back to
+    // invalidating the whole page
+    u16 page_blocks[256][CPU_JIT_PAGE_BLOCKS];
+    u8 page_nblocks[256];
+    cpu_jit_stats_t stats;
+    cpu_jit_block_t blocks[CPU_JIT_BLOCKS];
+    cpu_jit_ctx_t ctx; // translation scratch, too big for the stack
+};
+
+// addressing: an address fully known at translation time, a known page with
+// the low byte in cl, or a full address in ecx
+typedef enum { CPU_JIT_STATIC, CPU_JIT_PAGE, CPU_JIT_DYN } cpu_jit_addr_kind_t;
+
+typedef struct {
+    cpu_jit_addr_kind_t kind;
+    u16 addr;     // STATIC: the address, PAGE: page << 8
+    bool penalty; // r9 holds a page-cross cycle to add
+} cpu_jit_addr_t;
+
+// code emission
+
+static void cpu_jit_bytes(cpu_jit_ctx_t *c, const char *b, u32 n) {
+    memcpy(c->p, b, n);
+    c->p += n;
+}
+#define JIT(c, s) cpu_jit_bytes(c, s, sizeof(s) - 1)
+
+static void cpu_jit_u8(cpu_jit_ctx_t *c, u8 v) { *c->p++ = v; }
+static void cpu_jit_u16(cpu_jit_ctx_t *c, u16 v) { memcpy(c->p, &v, 2); c->p += 2; }
+static void cpu_jit_u32(cpu_jit_ctx_t *c, u32 v) { memcpy(c->p, &v, 4); c->p += 4; }
+
+// <opcode> reg, [rbx + off]
+static void cpu_jit_mem(cpu_jit_ctx_t *c, const char *opc, u32 n, u8 reg, u32 off) {
+    cpu_jit_bytes(c, opc, n);
+    cpu_jit_u8(c, 0x83 | (reg << 3));
+    cpu_jit_u32(c, off);
+}
+#define JIT_MEM(c, s, reg, off) cpu_jit_mem(c, s, sizeof(s) - 1, reg, off)
+
+// <opcode> reg, [rbx + rdx*8 + off]
+static void cpu_jit_pgmem(cpu_jit_ctx_t *c, const char *opc, u32 n, u8 reg, u32 off) {
+    cpu_jit_bytes(c, opc, n);
+    cpu_jit_u8(c, 0x84 | (reg << 3));
+    cpu_jit_u8(c, 0xD3);
+    cpu_jit_u32(c, off);
+}
+#define JIT_PGMEM(c, s, reg, off) cpu_jit_pgmem(c, s, sizeof(s) - 1, reg, off)
+
+static void cpu_jit_load8(cpu_jit_ctx_t *c, u8 reg, u32 off) { JIT_MEM(c, "\x8A", reg, off); }
+static void cpu_jit_store8(cpu_jit_ctx_t *c, u8 reg, u32 off) { JIT_MEM(c, "\x88", reg, off); }
+static void cpu_jit_store8_imm(cpu_jit_ctx_t *c, u32 off, u8 v) { JIT_MEM(c, "\xC6", 0, off); cpu_jit_u8(c, v); }
+static void cpu_jit_setcc(cpu_jit_ctx_t *c, u8 cc, u32 off) {
+    char opc[2] = { 0x0F, (char)(0x90 | cc) };
+    cpu_jit_mem(c, opc, 2, 0, off);
+}
+static void cpu_jit_add_cycles(cpu_jit_ctx_t *c, u32 n) {
+    JIT_MEM(c, "\x48\x81", 0, ST(cycles)); cpu_jit_u32(c, n);
+}
+static void cpu_jit_set_pc(cpu_jit_ctx_t *c, u16 pc) {
+    JIT_MEM(c, "\x66\xC7", 0, ST(PC)); cpu_jit_u16(c, pc);
+}
+static void cpu_jit_epilogue(cpu_jit_ctx_t *c) {
+    JIT(c, "\x41\x5C\x5B\xC3"); // pop r12; pop rbx; ret
+}
+
+// jcc rel32 to the exit of the current instruction, which leaves the block
+// with the instruction not yet executed
+static void cpu_jit_exit_if(cpu_jit_ctx_t *c, u8 cc) {
+    cpu_jit_u8(c, 0x0F);
+    cpu_jit_u8(c, 0x80 | cc);
+    if (c->nfix == CPU_JIT_FIXUPS) c->full = true;
+    else {
+        c->fix[c->nfix].at = c->p;
+        c->fix[c->nfix++].ins = c->ins;
+    }
+    cpu_jit_u32(c, 0);
+}
+
+// jcc rel32 with the target patched later by cpu_jit_here
+static u8 *cpu_jit_jcc(cpu_jit_ctx_t *c, u8 cc) {
+    cpu_jit_u8(c, 0x0F);
+    cpu_jit_u8(c, 0x80 | cc);
+    cpu_jit_u32(c, 0);
+    return c->p - 4;
+}
+
+static void cpu_jit_here(cpu_jit_ctx_t *c, u8 *at) {
+    int32_t rel = (int32_t)(c->p - (at + 4));
+    memcpy(at, &rel, 4);
+}
+
+// imm32 patched with the block's worst-case cycles (MAX) or the base cycles
+// of the instructions after the current one (REST)
+static void cpu_jit_patch(cpu_jit_ctx_t *c, u8 kind) {
+    if (c->npatch == CPU_JIT_PATCHES) c->full = true;
+    else {
+        c->patch[c->npatch].at = c->p;
+        c->patch[c->npatch].ins = c->ins;
+        c->patch[c->npatch++].kind = kind;
+    }
+    cpu_jit_u32(c, 0);
+}
+
+// N and Z come from the value in reg
+static void cpu_jit_nz(cpu_jit_ctx_t *c, u8 reg) {
+    cpu_jit_store8(c, reg, ST(N_res));
+    cpu_jit_store8(c, reg, ST(Z_res));
+}
+
+// leaves the block for pc. a side exit (a taken branch) first takes back the
+// cycles of the instructions after it, anything else ends the block. a jump
+// back to the start of the block loops natively while the next pass fits the
+// budget and no interrupt line is raised
+static void cpu_jit_jump(cpu_jit_ctx_t *c, u16 pc, bool side) {
+    if (side) {
+        JIT_MEM(c, "\x48\x81", 5, ST(cycles)); // sub [cycles], rest
+        cpu_jit_patch(c, CPU_JIT_PATCH_REST);
+    } else {
+        c->done = true;
+    }
+    if (pc == c->pc0) {
+        JIT_MEM(c, "\x48\x8B", 0, ST(cycles)); // mov rax, [cycles]
+        JIT(c, "\x48\x05");                    // add rax, max_cycles
+        cpu_jit_patch(c, CPU_JIT_PATCH_MAX);
+        JIT(c, "\x4C\x39\xE0");                // cmp rax, r12
+        u8 *over = cpu_jit_jcc(c, CC_A);
+        cpu_jit_load8(c, R_AL, ST(NMI));
+        JIT_MEM(c, "\x0A", R_AL, ST(IRQ));
+        JIT_MEM(c, "\x0A", R_AL, ST(RST));
+        JIT_MEM(c, "\x0A", R_AL, ST(DMA));
+        u8 *irq = cpu_jit_jcc(c, CC_NZ);
+        cpu_jit_u8(c, 0xE9);                   // jmp body
+        cpu_jit_u32(c, (u32)(int32_t)(c->body - (c->p + 4)));
+        cpu_jit_here(c, over);
+        cpu_jit_here(c, irq);
+    }
+    cpu_jit_set_pc(c, pc);
+    cpu_jit_epilogue(c);
+}
+
+// addressing modes. anything that may exit does so before the instruction
+// changes any state
+
+static cpu_jit_addr_t cpu_jit_addr_abs(cpu_jit_ctx_t *c) {
+    return (cpu_jit_addr_t){ CPU_JIT_STATIC, c->op, false };
+}
+
+static cpu_jit_addr_t cpu_jit_addr_zpg(cpu_jit_ctx_t *c) {
+    return (cpu_jit_addr_t){ CPU_JIT_STATIC, lo(c->op), false };
+}
+
+static cpu_jit_addr_t cpu_jit_addr_zpi(cpu_jit_ctx_t *c, u32 idx) {
+    JIT_MEM(c, "\x0F\xB6", R_CL, idx);          // movzx ecx, byte [idx]
+    JIT(c, "\x80\xC1"); cpu_jit_u8(c, lo(c->op)); // add cl, op
+    return (cpu_jit_addr_t){ CPU_JIT_PAGE, 0, false };
+}
+
+// ecx = eax & 0xFFFF, with r9 = 1 if bits 8.. of eax and base differ
+static void cpu_jit_page_cross(cpu_jit_ctx_t *c, bool penalty) {
+    if (penalty) {
+        JIT(c, "\x45\x31\xC9");                 // xor r9d, r9d
+        JIT(c, "\x89\xC2\x31\xCA");             // mov edx, eax; xor edx, ecx
+        JIT(c, "\xF7\xC2\x00\xFF\xFF\x00");     // test edx, 0xFFFF00
+        JIT(c, "\x41\x0F\x95\xC1");             // setnz r9b
+    }
+    JIT(c, "\x0F\xB7\xC8");                     // movzx ecx, ax
+}
+
+static cpu_jit_addr_t cpu_jit_addr_abi(cpu_jit_ctx_t *c, u32 idx, bool penalty) {
+    JIT_MEM(c, "\x0F\xB6", R_AL, idx);          // movzx eax, byte [idx]
+    JIT(c, "\xB9"); cpu_jit_u32(c, c->op);      // mov ecx, op
+    JIT(c, "\x01\xC8");                         // add eax, ecx
+    cpu_jit_page_cross(c, penalty);
+    return (cpu_jit_addr_t){ CPU_JIT_DYN, 0, penalty };
+}
+
+// rsi = zero page, exiting if it isn't mapped
+static void cpu_jit_zero_page(cpu_jit_ctx_t *c) {
+    JIT_MEM(c, "\x48\x8B", 6, PG(0, read));     // mov rsi, [pages[0].read]
+    JIT(c, "\x48\x85\xF6");                     // test rsi, rsi
+    cpu_jit_exit_if(c, CC_Z);
+}
+
+// ($nn,X)
+static cpu_jit_addr_t cpu_jit_addr_zpx(cpu_jit_ctx_t *c) {
+    cpu_jit_zero_page(c);
+    JIT_MEM(c, "\x0F\xB6", R_DL, ST(X));        // movzx edx, byte [X]
+    JIT(c, "\x80\xC2"); cpu_jit_u8(c, lo(c->op)); // add dl, op
+    JIT(c, "\x0F\xB6\x04\x16");                 // movzx eax, byte [rsi+rdx]
+    JIT(c, "\xFE\xC2");                         // inc dl
+    JIT(c, "\x0F\xB6\x0C\x16");                 // movzx ecx, byte [rsi+rdx]
+    JIT(c, "\xC1\xE1\x08\x09\xC1");             // shl ecx, 8; or ecx, eax
+    return (cpu_jit_addr_t){ CPU_JIT_DYN, 0, false };
+}
+
+// ($nn),Y
+static cpu_jit_addr_t cpu_jit_addr_zpy(cpu_jit_ctx_t *c, bool penalty) {
+    cpu_jit_zero_page(c);
+    JIT(c, "\x0F\xB6\x8E"); cpu_jit_u32(c, lo(c->op + 1)); // movzx ecx, byte [rsi+op+1]
+    JIT(c, "\xC1\xE1\x08");                                 // shl ecx, 8
+    JIT(c, "\x0F\xB6\x86"); cpu_jit_u32(c, lo(c->op));     // movzx eax, byte [rsi+op]
+    JIT(c, "\x09\xC1");                                     // or ecx, eax
+    JIT_MEM(c, "\x0F\xB6", R_AL, ST(Y));                    // movzx eax, byte [Y]
+    JIT(c, "\x01\xC8");                                     // add eax, ecx
+    cpu_jit_page_cross(c, penalty);
+    return (cpu_jit_addr_t){ CPU_JIT_DYN, 0, penalty };
+}
+
+#ifdef CPU_VARIANT_65C02
+// ($nn), 65C02
+static cpu_jit_addr_t cpu_jit_addr_izp(cpu_jit_ctx_t *c) {
+    cpu_jit_zero_page(c);
+    JIT(c, "\x0F\xB6\x8E"); cpu_jit_u32(c, lo(c->op + 1)); // movzx ecx, byte [rsi+op+1]
+    JIT(c, "\xC1\xE1\x08");                                 // shl ecx, 8
+    JIT(c, "\x0F\xB6\x86"); cpu_jit_u32(c, lo(c->op));     // movzx eax, byte [rsi+op]
+    JIT(c, "\x09\xC1");                                     // or ecx, eax
+    return (cpu_jit_addr_t){ CPU_JIT_DYN, 0, false };
+}
+#endif
+
+// resolves a to host pointers: rsi for reads and rdi for writes, exiting if
+// the page has none or writes to it must trap. dynamic addresses leave the
+// low byte in rdx. then charges the page-cross penalty
+static void cpu_jit_access(cpu_jit_ctx_t *c, cpu_jit_addr_t a, bool rd, bool wr) {
+    if (a.kind == CPU_JIT_DYN) {
+        JIT(c, "\x0F\xB6\xD5\x8D\x14\x52"); // movzx edx, ch; lea edx, [rdx+rdx*2]
+        if (rd) {
+            JIT_PGMEM(c, "\x48\x8B", 6, PG(0, read));
+            JIT(c, "\x48\x85\xF6");
+            cpu_jit_exit_if(c, CC_Z);
+        }
+        if (wr) {
+            JIT_PGMEM(c, "\xF6", 0, PG(0, flags)); cpu_jit_u8(c, CPU_JIT_WRITE_TRAPS);
+            cpu_jit_exit_if(c, CC_NZ);
+            JIT_PGMEM(c, "\x48\x8B", 7, PG(0, write));
+            JIT(c, "\x48\x85\xFF");
+            cpu_jit_exit_if(c, CC_Z);
+        }
+    } else {
+        u8 page = a.addr >> 8;
+        if (rd) {
+            JIT_MEM(c, "\x48\x8B", 6, PG(page, read));
+            JIT(c, "\x48\x85\xF6");
+            cpu_jit_exit_if(c, CC_Z);
+        }
+        if (wr) {
+            JIT_MEM(c, "\xF6", 0, PG(page, flags)); cpu_jit_u8(c, CPU_JIT_WRITE_TRAPS);
+            cpu_jit_exit_if(c, CC_NZ);
+            JIT_MEM(c, "\x48\x8B", 7, PG(page, write));
+            JIT(c, "\x48\x85\xFF");
+            cpu_jit_exit_if(c, CC_Z);
+        }
+    }
+    if (a.kind != CPU_JIT_STATIC) JIT(c, "\x0F\xB6\xD1"); // movzx edx, cl
+    if (a.penalty) JIT_MEM(c, "\x4C\x01", 1, ST(cycles)); // add [cycles], r9
+}
+
+// al = byte at a, after cpu_jit_access
+static void cpu_jit_load(cpu_jit_ctx_t *c, cpu_jit_addr_t a) {
+    if (a.kind == CPU_JIT_STATIC) { JIT(c, "\x0F\xB6\x86"); cpu_jit_u32(c, lo(a.addr)); }
+    else JIT(c, "\x0F\xB6\x04\x16");
+}
+
+// byte at a = al, after cpu_jit_access
+static void cpu_jit_store(cpu_jit_ctx_t *c, cpu_jit_addr_t a) {
+    if (a.kind == CPU_JIT_STATIC) { JIT(c, "\x88\x87"); cpu_jit_u32(c, lo(a.addr)); }
+    else JIT(c, "\x88\x04\x17");
+}
+
+// read instructions: the operand is in al. may clobber ecx and edx
+static bool cpu_jit_op_lda(cpu_jit_ctx_t *c) { cpu_jit_store8(c, R_AL, ST(A)); cpu_jit_nz(c, R_AL); return true; }
+static bool cpu_jit_op_ldx(cpu_jit_ctx_t *c) { cpu_jit_store8(c, R_AL, ST(X)); cpu_jit_nz(c, R_AL); return true; }
+static bool cpu_jit_op_ldy(cpu_jit_ctx_t *c) { cpu_jit_store8(c, R_AL, ST(Y)); cpu_jit_nz(c, R_AL); return true; }
+static bool cpu_jit_op_ora(cpu_jit_ctx_t *c) { JIT_MEM(c, "\x0A", R_AL, ST(A)); return cpu_jit_op_lda(c); }
+static bool cpu_jit_op_and(cpu_jit_ctx_t *c) { JIT_MEM(c, "\x22", R_AL, ST(A)); return cpu_jit_op_lda(c); }
+static bool cpu_jit_op_eor(cpu_jit_ctx_t *c) { JIT_MEM(c, "\x32", R_AL, ST(A)); return cpu_jit_op_lda(c); }
+static bool cpu_jit_op_adc(cpu_jit_ctx_t *c) {
+    cpu_jit_load8(c, R_CL, ST(C));
+    JIT(c, "\x80\xC1\xFF");               // add cl, 0xFF: host carry = C
+    JIT_MEM(c, "\x12", R_AL, ST(A));      // adc al, [A]
+    cpu_jit_setcc(c, CC_C, ST(C));
+    cpu_jit_setcc(c, CC_O, ST(V));
+    return cpu_jit_op_lda(c);
+}
+static bool cpu_jit_op_sbc(cpu_jit_ctx_t *c) { JIT(c, "\xF6\xD0"); return cpu_jit_op_adc(c); } // not al
+static bool cpu_jit_op_ign(cpu_jit_ctx_t *c) { return true; }
+static bool cpu_jit_compare(cpu_jit_ctx_t *c, u32 reg) {
+    cpu_jit_load8(c, R_CL, reg);
+    JIT(c, "\x28\xC1");                   // sub cl, al
+    cpu_jit_setcc(c, CC_NC, ST(C));
+    cpu_jit_nz(c, R_CL);
+    return true;
+}
+static bool cpu_jit_op_cmp(cpu_jit_ctx_t *c) { return cpu_jit_compare(c, ST(A)); }
+static bool cpu_jit_op_cpx(cpu_jit_ctx_t *c) { return cpu_jit_compare(c, ST(X)); }
+static bool cpu_jit_op_cpy(cpu_jit_ctx_t *c) { return cpu_jit_compare(c, ST(Y)); }
+static bool cpu_jit_op_bit(cpu_jit_ctx_t *c) {
+    cpu_jit_store8(c, R_AL, ST(N_res));
+    JIT(c, "\x88\xC1\xC0\xE9\x06\x80\xE1\x01"); // mov cl, al; shr cl, 6; and cl, 1
+    cpu_jit_store8(c, R_CL, ST(V));
+    JIT_MEM(c, "\x22", R_AL, ST(A));
+    cpu_jit_store8(c, R_AL, ST(Z_res));
+    return true;
+}
+
+#ifdef CPU_VARIANT_65C02
+static bool cpu_jit_op_biti(cpu_jit_ctx_t *c) {
+    JIT_MEM(c, "\x22", R_AL, ST(A));      // and al, [A]
+    cpu_jit_store8(c, R_AL, ST(Z_res));
+    return true;
+}
+#else
+static bool cpu_jit_op_lax(cpu_jit_ctx_t *c) { cpu_jit_store8(c, R_AL, ST(X)); return cpu_jit_op_lda(c); }
+// left to the interpreter
+static bool cpu_jit_op_anc(cpu_jit_ctx_t *c) { return false; }
+static bool cpu_jit_op_alr(cpu_jit_ctx_t *c) { return false; }
+static bool cpu_jit_op_arr(cpu_jit_ctx_t *c) { return false; }
+static bool cpu_jit_op_sbx(cpu_jit_ctx_t *c) { return false; }
+#endif
+
+// rmw instructions: al in, al out. may only clobber ecx
+static bool cpu_jit_op_asl(cpu_jit_ctx_t *c) { JIT(c, "\xD0\xE0"); cpu_jit_setcc(c, CC_C, ST(C)); cpu_jit_nz(c, R_AL); return true; }
+static bool cpu_jit_op_lsr(cpu_jit_ctx_t *c) { JIT(c, "\xD0\xE8"); cpu_jit_setcc(c, CC_C, ST(C)); cpu_jit_nz(c, R_AL); return true; }
+static bool cpu_jit_op_rol(cpu_jit_ctx_t *c) {
+    cpu_jit_load8(c, R_CL, ST(C));
+    JIT(c, "\xD0\xE9\xD0\xD0");           // shr cl, 1; rcl al, 1
+    cpu_jit_setcc(c, CC_C, ST(C));
+    cpu_jit_nz(c, R_AL);
+    return true;
+}
+static bool cpu_jit_op_ror(cpu_jit_ctx_t *c) {
+    cpu_jit_load8(c, R_CL, ST(C));
+    JIT(c, "\xD0\xE9\xD0\xD8");           // shr cl, 1; rcr al, 1
+    cpu_jit_setcc(c, CC_C, ST(C));
+    cpu_jit_nz(c, R_AL);
+    return true;
+}
+static bool cpu_jit_op_inc(cpu_jit_ctx_t *c) { JIT(c, "\xFE\xC0"); cpu_jit_nz(c, R_AL); return true; }
+static bool cpu_jit_op_dec(cpu_jit_ctx_t *c) { JIT(c, "\xFE\xC8"); cpu_jit_nz(c, R_AL); return true; }
+#ifdef CPU_VARIANT_65C02
+#define CPU_JIT_OP_BITS(n) \
+    static bool cpu_jit_op_rmb##n(cpu_jit_ctx_t *c) { JIT(c, "\x24"); cpu_jit_u8(c, (u8)~(1 << n)); return true; } \
+    static bool cpu_jit_op_smb##n(cpu_jit_ctx_t *c) { JIT(c, "\x0C"); cpu_jit_u8(c, 1 << n); return true; }
+CPU_JIT_OP_BITS(0) CPU_JIT_OP_BITS(1) CPU_JIT_OP_BITS(2) CPU_JIT_OP_BITS(3)
+CPU_JIT_OP_BITS(4) CPU_JIT_OP_BITS(5) CPU_JIT_OP_BITS(6) CPU_JIT_OP_BITS(7)
+#undef CPU_JIT_OP_BITS
+// left to the interpreter
+static bool cpu_jit_op_tsb(cpu_jit_ctx_t *c) { return false; }
+static bool cpu_jit_op_trb(cpu_jit_ctx_t *c) { return false; }
+#else
+// left to the interpreter
+static bool cpu_jit_op_slo(cpu_jit_ctx_t *c) { return false; }
+static bool cpu_jit_op_rla(cpu_jit_ctx_t *c) { return false; }
+static bool cpu_jit_op_sre(cpu_jit_ctx_t *c) { return false; }
+static bool cpu_jit_op_rra(cpu_jit_ctx_t *c) { return false; }
+static bool cpu_jit_op_dcp(cpu_jit_ctx_t *c) { return false; }
+static bool cpu_jit_op_isc(cpu_jit_ctx_t *c) { return false; }
+#endif
+
+// write instructions: load the value into al
+static bool cpu_jit_op_sta(cpu_jit_ctx_t *c) { cpu_jit_load8(c, R_AL, ST(A)); return true; }
+static bool cpu_jit_op_stx(cpu_jit_ctx_t *c) { cpu_jit_load8(c, R_AL, ST(X)); return true; }
+static bool cpu_jit_op_sty(cpu_jit_ctx_t *c) { cpu_jit_load8(c, R_AL, ST(Y)); return true; }
+#ifdef CPU_VARIANT_65C02
+static bool cpu_jit_op_stz(cpu_jit_ctx_t *c) { JIT(c, "\x31\xC0"); return true; } // xor eax, eax
+#else
+static bool cpu_jit_op_sax(cpu_jit_ctx_t *c) {
+    cpu_jit_load8(c, R_AL, ST(A));
+    JIT_MEM(c, "\x22", R_AL, ST(X));      // and al, [X]
+    return true;
+}
+#endif
+
+// implied instructions
+static bool cpu_jit_transfer(cpu_jit_ctx_t *c, u32 from, u32 to, bool nz) {
+    cpu_jit_load8(c, R_AL, from);
+    cpu_jit_store8(c, R_AL, to);
+    if (nz) cpu_jit_nz(c, R_AL);
+    return true;
+}
+static bool cpu_jit_step(cpu_jit_ctx_t *c, u32 reg, const char *op) {
+    cpu_jit_load8(c, R_AL, reg);
+    cpu_jit_bytes(c, op, 2);
+    cpu_jit_store8(c, R_AL, reg);
+    cpu_jit_nz(c, R_AL);
+    return true;
+}
+static bool cpu_jit_op_tax(cpu_jit_ctx_t *c) { return cpu_jit_transfer(c, ST(A), ST(X), true); }
+static bool cpu_jit_op_tay(cpu_jit_ctx_t *c) { return cpu_jit_transfer(c, ST(A), ST(Y), true); }
+static bool cpu_jit_op_tsx(cpu_jit_ctx_t *c) { return cpu_jit_transfer(c, ST(S), ST(X), true); }
+static bool cpu_jit_op_txa(cpu_jit_ctx_t *c) { return cpu_jit_transfer(c, ST(X), ST(A), true); }
+static bool cpu_jit_op_tya(cpu_jit_ctx_t *c) { return cpu_jit_transfer(c, ST(Y), ST(A), true); }
+static bool cpu_jit_op_txs(cpu_jit_ctx_t *c) { return cpu_jit_transfer(c, ST(X), ST(S), false); }
+static bool cpu_jit_op_inx(cpu_jit_ctx_t *c) { return cpu_jit_step(c, ST(X), "\xFE\xC0"); }
+static bool cpu_jit_op_iny(cpu_jit_ctx_t *c) { return cpu_jit_step(c, ST(Y), "\xFE\xC0"); }
+static bool cpu_jit_op_dex(cpu_jit_ctx_t *c) { return cpu_jit_step(c, ST(X), "\xFE\xC8"); }
+static bool cpu_jit_op_dey(cpu_jit_ctx_t *c) { return cpu_jit_step(c, ST(Y), "\xFE\xC8"); }
+static bool cpu_jit_op_clc(cpu_jit_ctx_t *c) { cpu_jit_store8_imm(c, ST(C), 0); return true; }
+static bool cpu_jit_op_cld(cpu_jit_ctx_t *c) { cpu_jit_store8_imm(c, ST(D), 0); return true; }
+static bool cpu_jit_op_clv(cpu_jit_ctx_t *c) { cpu_jit_store8_imm(c, ST(V), 0); return true; }
+static bool cpu_jit_op_sec(cpu_jit_ctx_t *c) { cpu_jit_store8_imm(c, ST(C), 1); return true; }
+static bool cpu_jit_op_sed(cpu_jit_ctx_t *c) { cpu_jit_store8_imm(c, ST(D), 1); return true; }
+static bool cpu_jit_op_sei(cpu_jit_ctx_t *c) { cpu_jit_store8_imm(c, ST(I), 1); return true; }
+// clearing I may let a raised IRQ (or RST) line in before the next
+// instruction, leave the block if so
+static void cpu_jit_irq_check(cpu_jit_ctx_t *c) {
+    JIT_MEM(c, "\x80", 7, ST(I)); cpu_jit_u8(c, 0);
+    u8 *masked = cpu_jit_jcc(c, CC_NZ);
+    cpu_jit_load8(c, R_AL, ST(IRQ));
+    JIT_MEM(c, "\x0A", R_AL, ST(RST));
+    u8 *none = cpu_jit_jcc(c, CC_Z);
+    cpu_jit_jump(c, c->next, true);
+    cpu_jit_here(c, masked);
+    cpu_jit_here(c, none);
+}
+static bool cpu_jit_op_cli(cpu_jit_ctx_t *c) {
+    cpu_jit_store8_imm(c, ST(I), 0);
+    cpu_jit_irq_check(c);
+    return true;
+}
+static bool cpu_jit_op_nop(cpu_jit_ctx_t *c) { return true; }
+
+// stack accesses go through page 1 with the low byte in cl
+static bool cpu_jit_push(cpu_jit_ctx_t *c, u32 reg) {
+    cpu_jit_addr_t a = { CPU_JIT_PAGE, 0x100, false };
+    JIT_MEM(c, "\x0F\xB6", R_CL, ST(S));        // movzx ecx, byte [S]
+    cpu_jit_access(c, a, false, true);
+    cpu_jit_load8(c, R_AL, reg);
+    cpu_jit_store(c, a);
+    JIT_MEM(c, "\xFE", 1, ST(S));               // dec byte [S]
+    return true;
+}
+static bool cpu_jit_pull(cpu_jit_ctx_t *c, bool (*load)(cpu_jit_ctx_t*)) {
+    cpu_jit_addr_t a = { CPU_JIT_PAGE, 0x100, false };
+    JIT_MEM(c, "\x0F\xB6", R_CL, ST(S));        // movzx ecx, byte [S]
+    JIT(c, "\xFE\xC1");                         // inc cl
+    cpu_jit_access(c, a, true, false);
+    cpu_jit_store8(c, R_CL, ST(S));
+    cpu_jit_load(c, a);
+    return load(c);
+}
+static bool cpu_jit_op_pha(cpu_jit_ctx_t *c) { return cpu_jit_push(c, ST(A)); }
+static bool cpu_jit_op_pla(cpu_jit_ctx_t *c) { return cpu_jit_pull(c, &cpu_jit_op_lda); }
+#ifdef CPU_VARIANT_65C02
+static bool cpu_jit_op_phx(cpu_jit_ctx_t *c) { return cpu_jit_push(c, ST(X)); }
+static bool cpu_jit_op_phy(cpu_jit_ctx_t *c) { return cpu_jit_push(c, ST(Y)); }
+static bool cpu_jit_op_plx(cpu_jit_ctx_t *c) { return cpu_jit_pull(c, &cpu_jit_op_ldx); }
+static bool cpu_jit_op_ply(cpu_jit_ctx_t *c) { return cpu_jit_pull(c, &cpu_jit_op_ldy); }
+#endif
+static bool cpu_jit_op_rts(cpu_jit_ctx_t *c) {
+    cpu_jit_addr_t a = { CPU_JIT_PAGE, 0x100, false };
+    JIT_MEM(c, "\x0F\xB6", R_CL, ST(S));
+    cpu_jit_access(c, a, true, false);          // rdx = S
+    JIT(c, "\xFE\xC2\x0F\xB6\x04\x16");         // inc dl; movzx eax, byte [rsi+rdx]
+    JIT(c, "\xFE\xC2\x0F\xB6\x0C\x16");         // inc dl; movzx ecx, byte [rsi+rdx]
+    cpu_jit_store8(c, R_DL, ST(S));
+    JIT(c, "\xC1\xE1\x08\x09\xC1\xFF\xC1");     // shl ecx, 8; or ecx, eax; inc ecx
+    JIT_MEM(c, "\x66\x89", R_CL, ST(PC));       // mov [PC], cx
+    cpu_jit_epilogue(c);
+    c->done = true;
+    return true;
+}
+
+// P is packed into al and unpacked from al like cpu_pack_p/cpu_unpack_p
+static bool cpu_jit_op_php(cpu_jit_ctx_t *c) {
+    cpu_jit_addr_t a = { CPU_JIT_PAGE, 0x100, false };
+    JIT_MEM(c, "\x0F\xB6", R_CL, ST(S));
+    cpu_jit_access(c, a, false, true);
+    JIT_MEM(c, "\x0F\xB6", R_AL, ST(C));           // movzx eax, byte [C]
+    JIT_MEM(c, "\x0F\xB6", R_CL, ST(I));
+    JIT(c, "\xC1\xE1\x02\x09\xC8");                 // shl ecx, 2; or eax, ecx
+    JIT_MEM(c, "\x0F\xB6", R_CL, ST(D));
+    JIT(c, "\xC1\xE1\x03\x09\xC8");
+    JIT_MEM(c, "\x0F\xB6", R_CL, ST(V));
+    JIT(c, "\xC1\xE1\x06\x09\xC8");
+    JIT_MEM(c, "\x0F\xB6", R_CL, ST(N_res));
+    JIT(c, "\x80\xE1\x80\x09\xC8");                 // and cl, 0x80; or eax, ecx
+    JIT_MEM(c, "\x80", 7, ST(Z_res)); cpu_jit_u8(c, 0);
+    JIT(c, "\x0F\x94\xC1\xD0\xE1\x08\xC8");         // sete cl; shl cl, 1; or al, cl
+    JIT(c, "\x0C\x30");                             // or al, 0x30: B and u
+    cpu_jit_store(c, a);
+    JIT_MEM(c, "\xFE", 1, ST(S));
+    return true;
+}
+static void cpu_jit_unpack_bit(cpu_jit_ctx_t *c, u8 bit, u32 off) {
+    JIT(c, "\x88\xC1\xC0\xE9"); cpu_jit_u8(c, bit); // mov cl, al; shr cl, bit
+    JIT(c, "\x80\xE1\x01");                         // and cl, 1
+    cpu_jit_store8(c, R_CL, off);
+}
+static bool cpu_jit_op_plp(cpu_jit_ctx_t *c) {
+    cpu_jit_addr_t a = { CPU_JIT_PAGE, 0x100, false };
+    JIT_MEM(c, "\x0F\xB6", R_CL, ST(S));
+    JIT(c, "\xFE\xC1");
+    cpu_jit_access(c, a, true, false);
+    cpu_jit_store8(c, R_CL, ST(S));
+    cpu_jit_load(c, a);
+    cpu_jit_unpack_bit(c, 0, ST(C));
+    cpu_jit_unpack_bit(c, 2, ST(I));
+    cpu_jit_unpack_bit(c, 3, ST(D));
+    cpu_jit_unpack_bit(c, 6, ST(V));
+    JIT(c, "\x88\xC1\x80\xE1\x80");                 // mov cl, al; and cl, 0x80
+    cpu_jit_store8(c, R_CL, ST(N_res));
+    JIT(c, "\x88\xC1\xD0\xE9\x80\xE1\x01\x80\xF1\x01"); // Z_res = !Z
+    cpu_jit_store8(c, R_CL, ST(Z_res));
+    cpu_jit_irq_check(c);
+    return true;
+}
+
+// left to the interpreter
+static bool cpu_jit_op_brk(cpu_jit_ctx_t *c) { return false; }
+static bool cpu_jit_op_rti(cpu_jit_ctx_t *c) { return false; }
+
+// branches: test the flag and return the condition code for taken
+static u8 cpu_jit_op_bcc(cpu_jit_ctx_t *c) { JIT_MEM(c, "\x80", 7, ST(C)); cpu_jit_u8(c, 0); return CC_Z; }
+static u8 cpu_jit_op_bcs(cpu_jit_ctx_t *c) { JIT_MEM(c, "\x80", 7, ST(C)); cpu_jit_u8(c, 0); return CC_NZ; }
+static u8 cpu_jit_op_bne(cpu_jit_ctx_t *c) { JIT_MEM(c, "\x80", 7, ST(Z_res)); cpu_jit_u8(c, 0); return CC_NZ; }
+static u8 cpu_jit_op_beq(cpu_jit_ctx_t *c) { JIT_MEM(c, "\x80", 7, ST(Z_res)); cpu_jit_u8(c, 0); return CC_Z; }
+static u8 cpu_jit_op_bpl(cpu_jit_ctx_t *c) { JIT_MEM(c, "\xF6", 0, ST(N_res)); cpu_jit_u8(c, 0x80); return CC_Z; }
+static u8 cpu_jit_op_bmi(cpu_jit_ctx_t *c) { JIT_MEM(c, "\xF6", 0, ST(N_res)); cpu_jit_u8(c, 0x80); return CC_NZ; }
+static u8 cpu_jit_op_bvc(cpu_jit_ctx_t *c) { JIT_MEM(c, "\x80", 7, ST(V)); cpu_jit_u8(c, 0); return CC_Z; }
+static u8 cpu_jit_op_bvs(cpu_jit_ctx_t *c) { JIT_MEM(c, "\x80", 7, ST(V)); cpu_jit_u8(c, 0); return CC_NZ; }
+#ifdef CPU_VARIANT_65C02
+static u8 cpu_jit_op_bra(cpu_jit_ctx_t *c) { JIT(c, "\x39\xC0"); return CC_Z; } // cmp eax, eax
+#endif
+
+// instruction kinds
+
+// decimal mode ADC and SBC leave the block before any other exit of the
+// instruction can charge a page-cross cycle. the 2A03 has no decimal mode
+static void cpu_jit_decimal_exit(cpu_jit_ctx_t *c, bool (*instr)(cpu_jit_ctx_t*)) {
+#ifndef CPU_VARIANT_2A03
+    if (instr != &cpu_jit_op_adc && instr != &cpu_jit_op_sbc) return;
+    JIT_MEM(c, "\x80", 7, ST(D)); cpu_jit_u8(c, 0); // cmp byte [D], 0
+    cpu_jit_exit_if(c, CC_NZ);
+#endif
+}
+
+// an instruction returning false is left to the interpreter: the whole
+// translation of it is rolled back
+static bool cpu_jit_acc(cpu_jit_ctx_t *c, bool (*instr)(cpu_jit_ctx_t*)) {
+    cpu_jit_load8(c, R_AL, ST(A));
+    if (!instr(c)) return false;
+    cpu_jit_store8(c, R_AL, ST(A));
+    return true;
+}
+
+static bool cpu_jit_imm(cpu_jit_ctx_t *c, bool (*instr)(cpu_jit_ctx_t*)) {
+    cpu_jit_decimal_exit(c, instr);
+    cpu_jit_u8(c, 0xB0); cpu_jit_u8(c, lo(c->op)); // mov al, op
+    return instr(c);
+}
+
+static bool cpu_jit_read(cpu_jit_ctx_t *c, cpu_jit_addr_t a, bool (*instr)(cpu_jit_ctx_t*)) {
+    cpu_jit_decimal_exit(c, instr);
+    cpu_jit_access(c, a, true, false);
+    cpu_jit_load(c, a);
+    return instr(c);
+}
+
+static bool cpu_jit_rmw(cpu_jit_ctx_t *c, cpu_jit_addr_t a, bool (*instr)(cpu_jit_ctx_t*)) {
+    cpu_jit_access(c, a, true, true);
+    cpu_jit_load(c, a);
+    if (!instr(c)) return false;
+    cpu_jit_store(c, a);
+    return true;
+}
+
+static bool cpu_jit_write(cpu_jit_ctx_t *c, cpu_jit_addr_t a, bool (*instr)(cpu_jit_ctx_t*)) {
+    cpu_jit_access(c, a, false, true);
+    if (!instr(c)) return false;
+    cpu_jit_store(c, a);
+    return true;
+}
+
+static bool cpu_jit_jsr(cpu_jit_ctx_t *c) {
+    cpu_jit_addr_t a = { CPU_JIT_PAGE, 0x100, false };
+    u16 ret = c->next - 1;
+    JIT_MEM(c, "\x0F\xB6", R_CL, ST(S));
+    cpu_jit_access(c, a, false, true);          // rdx = S
+    JIT(c, "\xC6\x04\x17"); cpu_jit_u8(c, ret >> 8); // mov byte [rdi+rdx], hi
+    JIT(c, "\xFE\xCA");                         // dec dl
+    JIT(c, "\xC6\x04\x17"); cpu_jit_u8(c, lo(ret));
+    JIT(c, "\xFE\xCA");
+    cpu_jit_store8(c, R_DL, ST(S));
+    cpu_jit_jump(c, c->op, false);
+    return true;
+}
+
+static bool cpu_jit_branch(cpu_jit_ctx_t *c, u8 (*branch)(cpu_jit_ctx_t*)) {
+    u16 target = c->next + (s8)c->op;
+    u8 penalty = 1 + ((u16)((s16)(c->next & 0xFF) + (s8)c->op) > 0xFF);
+    u8 *not_taken = cpu_jit_jcc(c, branch(c) ^ 1); // x86 cc ^ 1 negates it
+    cpu_jit_add_cycles(c, penalty);
+    cpu_jit_jump(c, target, true);
+    cpu_jit_here(c, not_taken);
+    return true;
+}
+
+// maps an opcode table entry to its translation
+#define CPU_JIT_all_imp(instr, idx)    cpu_jit_op_##instr(c)
+#define CPU_JIT_all_one(instr, idx)    cpu_jit_op_##instr(c)
+#define CPU_JIT_all_acc(instr, idx)    cpu_jit_acc(c, &cpu_jit_op_##instr)
+#define CPU_JIT_all_imm(instr, idx)    cpu_jit_imm(c, &cpu_jit_op_##instr)
+#define CPU_JIT_read_abs(instr, idx)   cpu_jit_read(c, cpu_jit_addr_abs(c), &cpu_jit_op_##instr)
+#define CPU_JIT_rmw_abs(instr, idx)    cpu_jit_rmw(c, cpu_jit_addr_abs(c), &cpu_jit_op_##instr)
+#define CPU_JIT_write_abs(instr, idx)  cpu_jit_write(c, cpu_jit_addr_abs(c), &cpu_jit_op_##instr)
+#define CPU_JIT_jmp_abs(instr, idx)    (cpu_jit_jump(c, c->op, false), true)
+#define CPU_JIT_jsr_abs(instr, idx)    cpu_jit_jsr(c)
+#define CPU_JIT_wait_abs(instr, idx)   true
+#define CPU_JIT_read_abi(instr, idx)   cpu_jit_read(c, cpu_jit_addr_abi(c, ST(idx), true), &cpu_jit_op_##instr)
+#define CPU_JIT_rmw_abi(instr, idx)    cpu_jit_rmw(c, cpu_jit_addr_abi(c, ST(idx), false), &cpu_jit_op_##instr)
+#define CPU_JIT_write_abi(instr, idx)  cpu_jit_write(c, cpu_jit_addr_abi(c, ST(idx), false), &cpu_jit_op_##instr)
+#define CPU_JIT_rmw_abp(instr, idx)    cpu_jit_rmw(c, cpu_jit_addr_abi(c, ST(idx), true), &cpu_jit_op_##instr)
+#define CPU_JIT_jmp_ind(instr, idx)    false
+#define CPU_JIT_jmp_iax(instr, idx)    false
+#define CPU_JIT_read_zpg(instr, idx)   cpu_jit_read(c, cpu_jit_addr_zpg(c), &cpu_jit_op_##instr)
+#define CPU_JIT_rmw_zpg(instr, idx)    cpu_jit_rmw(c, cpu_jit_addr_zpg(c), &cpu_jit_op_##instr)
+#define CPU_JIT_write_zpg(instr, idx)  cpu_jit_write(c, cpu_jit_addr_zpg(c), &cpu_jit_op_##instr)
+#define CPU_JIT_read_zpi(instr, idx)   cpu_jit_read(c, cpu_jit_addr_zpi(c, ST(idx)), &cpu_jit_op_##instr)
+#define CPU_JIT_rmw_zpi(instr, idx)    cpu_jit_rmw(c, cpu_jit_addr_zpi(c, ST(idx)), &cpu_jit_op_##instr)
+#define CPU_JIT_write_zpi(instr, idx)  cpu_jit_write(c, cpu_jit_addr_zpi(c, ST(idx)), &cpu_jit_op_##instr)
+#define CPU_JIT_read_zpx(instr, idx)   cpu_jit_read(c, cpu_jit_addr_zpx(c), &cpu_jit_op_##instr)
+#define CPU_JIT_rmw_zpx(instr, idx)    cpu_jit_rmw(c, cpu_jit_addr_zpx(c), &cpu_jit_op_##instr)
+#define CPU_JIT_write_zpx(instr, idx)  cpu_jit_write(c, cpu_jit_addr_zpx(c), &cpu_jit_op_##instr)
+#define CPU_JIT_read_zpy(instr, idx)   cpu_jit_read(c, cpu_jit_addr_zpy(c, true), &cpu_jit_op_##instr)
+#define CPU_JIT_rmw_zpy(instr, idx)    cpu_jit_rmw(c, cpu_jit_addr_zpy(c, false), &cpu_jit_op_##instr)
+#define CPU_JIT_write_zpy(instr, idx)  cpu_jit_write(c, cpu_jit_addr_zpy(c, false), &cpu_jit_op_##instr)
+#define CPU_JIT_read_izp(instr, idx)   cpu_jit_read(c, cpu_jit_addr_izp(c), &cpu_jit_op_##instr)
+#define CPU_JIT_write_izp(instr, idx)  cpu_jit_write(c, cpu_jit_addr_izp(c), &cpu_jit_op_##instr)
+#define CPU_JIT_branch_rel(instr, idx) cpu_jit_branch(c, &cpu_jit_op_##instr)
+#define CPU_JIT_branch_zpr(instr, idx) false
+
+static bool cpu_jit_insn(cpu_jit_ctx_t *c, u8 opc) {
+    switch (opc) {
+#define OP(opc, instr, kind, mode, idx, cyc) \
+        case opc: return CPU_JIT_##kind##_##mode(instr, idx);
+        CPU_OPCODES(OP)
+#undef OP
+    }
+    return false;
+}
+
+// a code byte can only be translated if it is read straight from host memory
+static bool cpu_jit_fetch(cpu_state_t *st, u16 addr, u8 *out) {
+    u8 *page = st->pages[addr >> 8].read;
+    if (!page) return false;
+    *out = page[lo(addr)];
+    return true;
+}
+
+// translates the block at b->pc into c's buffer. returns the number of
+// instructions translated
+static u32 cpu_jit_translate(cpu_state_t *st, cpu_jit_ctx_t *c, cpu_jit_block_t *b) {
+    u16 pcs[CPU_JIT_INSNS];
+    u32 rem[CPU_JIT_INSNS + 1];
+    u8 opcs[CPU_JIT_INSNS];
+    u16 pc = b->pc;
+    u32 n = 0, max_cycles = 0;
+
+    c->pc0 = pc;
+    JIT(c, "\x53\x41\x54\x48\x89\xFB\x49\x89\xF4"); // push rbx; push r12; mov rbx, rdi; mov r12, rsi
+    c->body = c->p;
+    JIT_MEM(c, "\x48\x81", 0, ST(cycles));          // add [cycles], total
+    c->total_at = c->p;
+    cpu_jit_u32(c, 0);
+
+    c->done = false;
+    while (n < CPU_JIT_INSNS && !c->done) {
+        if ((u32)(c->end - c->p) < CPU_JIT_INSN_ROOM + 32 * (n + 2)) break;
+
+        u8 opc, bytes[2] = {0, 0};
+        if (!cpu_jit_fetch(st, pc, &opc)) break;
+        u8 len = cpu_jit_len[opc];
+        if (len == 0) break; // illegal, left to cpu_exec
+
+        // a block may span at most two pages
+        u8 last = (u16)(pc + len - 1) >> 8;
+        if (last != b->pages[0] && last != b->pages[1]) {
+            if (b->pages[1] != b->pages[0]) break;
+            b->pages[1] = last;
+        }
+        bool ok = true;
+        for (u8 i = 1; i < len && ok; i++) ok = cpu_jit_fetch(st, pc + i, &bytes[i-1]);
+        if (!ok) break;
+
+        u8 *start = c->p;
+        u32 nfix = c->nfix, npatch = c->npatch;
+        c->ins = n;
+        c->pc = pc;
+        c->next = pc + len;
+        c->op = bytes[0] | hi(bytes[1]);
+        if (!cpu_jit_insn(c, opc) || c->full) {
+            // roll back, cpu_exec runs it
+            c->p = start;
+            c->nfix = nfix;
+            c->npatch = npatch;
+            c->done = false;
+            break;
+        }
+        pcs[n] = pc;
+        opcs[n] = opc;
+        max_cycles += cpu_jit_max_cycles[opc];
+        n++;
+        pc += len;
+    }
+    if (n == 0) return 0;
+
+    // falling off the end continues with the next instruction
+    if (!c->done) {
+        cpu_jit_set_pc(c, pc);
+        cpu_jit_epilogue(c);
+    }
+
+    rem[n] = 0;
+    for (u32 i = n; i-- > 0; ) rem[i] = rem[i+1] + cpu_jit_cycles[opcs[i]];
+    memcpy(c->total_at, &rem[0], 4);
+    for (u32 i = 0; i < c->npatch; i++) {
+        u32 v = c->patch[i].kind == CPU_JIT_PATCH_MAX ? max_cycles : rem[c->patch[i].ins + 1];
+        memcpy(c->patch[i].at, &v, 4);
+    }
+
+    // exits: the instruction didn't run, so take back its cycles and those
+    // of the rest of the block
+    for (u32 i = 0; i < n; i++) {
+        u8 *stub = NULL;
+        for (u32 f = 0; f < c->nfix; f++) {
+            if (c->fix[f].ins != i) continue;
+            if (!stub) {
+                stub = c->p;
+                cpu_jit_set_pc(c, pcs[i]);
+                JIT_MEM(c, "\x48\x81", 5, ST(cycles)); cpu_jit_u32(c, rem[i]);
+                cpu_jit_epilogue(c);
+            }
+            int32_t rel = (int32_t)(stub - (c->fix[f].at + 4));
+            memcpy(c->fix[f].at, &rel, 4);
+        }
+    }
+    b->max_cycles = max_cycles;
+    b->end = pc;
+    return n;
+}
+
+static void cpu_jit_flush(cpu_jit_t *jit) {
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->page_nblocks, 0, sizeof(jit->page_nblocks));
+    jit->arena_used = 0;
+    jit->stats.flushes++;
+}
+
+// the arena is never writable and executable at once, for hosts that
+// enforce W^X: only the pages a block is being emitted into are made
+// writable, and only while it is
+static bool cpu_jit_protect(cpu_jit_t *jit, const u8 *from, const u8 *to, bool writable) {
+    uintptr_t page = jit->page_size - 1;
+    uintptr_t start = (uintptr_t)from & ~page, end = ((uintptr_t)to + page) & ~page;
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+    return mprotect((void *)start, end - start, prot) == 0;
+}
+
+static void cpu_jit_compile(cpu_state_t *st, cpu_jit_t *jit, cpu_jit_block_t *b) {
+    cpu_jit_ctx_t *c = &jit->ctx;
+    u32 n = 0;
+
+    for (int attempt = 0; attempt < 2 && n == 0; attempt++) {
+        memset(c, 0, sizeof(*c));
+        c->p = jit->arena + jit->arena_used;
+        c->end = jit->arena + jit->arena_size;
+        if ((u32)(c->end - c->p) > CPU_JIT_BLOCK_ROOM) c->end = c->p + CPU_JIT_BLOCK_ROOM;
+        u8 *from = c->p, *to = c->end;
+        if (!cpu_jit_protect(jit, from, to, true)) break;
+        b->pages[0] = b->pages[1] = b->pc >> 8;
+        n = cpu_jit_translate(st, c, b);
+        // without execute permission nothing in the arena can run
+        if (!cpu_jit_protect(jit, from, to, false)) {
+            u16 pc = b->pc;
+            cpu_jit_flush(jit);
+            b->pc = pc;
+            n = 0;
+            break;
+        }
+        // no room for even one instruction: start over with an empty arena
+        if (n == 0 && jit->arena_used > 0 && (u32)(c->end - c->p) < 4 * CPU_JIT_INSN_ROOM) {
+            u16 pc = b->pc;
+            cpu_jit_flush(jit);
+            b->pc = pc;
+            continue;
+        }
+        break;
+    }
+
+    b->valid = 1;
+    b->visits = 0;
+    if (n) {
+        b->fn = (cpu_jit_fn)(void *)(jit->arena + jit->arena_used);
+        b->failed = 0;
+        jit->arena_used = (u32)(c->p - jit->arena);
+        jit->stats.compiled++;
+    } else {
+        b->fn = NULL;
+        b->failed = 1;
+        b->end = b->pc + 1;
+        jit->stats.failed++;
+    }
+
+    // flag the pages even when nothing was translated, so that new code
+    // written there gets another chance
+    u16 idx = (u16)(b - jit->blocks);
+    for (int i = 0; i < 2; i++) {
+        u8 page = b->pages[i];
+        b->gens[i] = jit->page_gen[page];
+        if (st->pages[page].read) st->pages[page].flags |= CPU_PAGE_CODE;
+        if (i == 1 && page == b->pages[0]) break;
+
+        u8 n = jit->page_nblocks[page];
+        if (n > CPU_JIT_PAGE_BLOCKS) continue; // untracked
+        bool listed = false;
+        for (u8 j = 0; j < n && !listed; j++) listed = jit->page_blocks[page][j] == idx;
+        if (listed) continue;
+        if (n < CPU_JIT_PAGE_BLOCKS) jit->page_blocks[page][jit->page_nblocks[page]++] = idx;
+        else jit->page_nblocks[page] = CPU_JIT_PAGE_BLOCKS + 1;
+    }
+}
+
+// returns the translated block at pc, or NULL if pc is still cold or can't
+// be translated
+static cpu_jit_block_t *cpu_jit_lookup(cpu_state_t *st, cpu_jit_t *jit, u16 pc) {
+    cpu_jit_block_t *b = &jit->blocks[(pc ^ (pc >> 12)) & (CPU_JIT_BLOCKS - 1)];
+    if (b->pc != pc) {
+        memset(b, 0, sizeof(*b));
+        b->pc = pc;
+    }
+    if (b->valid) {
+        if (b->gens[0] == jit->page_gen[b->pages[0]]
+                && b->gens[1] == jit->page_gen[b->pages[1]])
+            return b->fn ? b : NULL;
+        // the code changed, translate it again once it is hot again
+        b->valid = 0;
+        b->fn = NULL;
+    }
+    if (++b->visits < jit->hot) return NULL;
+    cpu_jit_compile(st, jit, b);
+    return b->fn ? b : NULL;
+}
+
+cpu_jit_t *cpu_jit_create(u32 arena_size, u32 hot_threshold) {
+    cpu_jit_t *jit = calloc(1, sizeof(*jit));
+    if (!jit) return NULL;
+    // read-execute from the start, see cpu_jit_protect
+    void *arena = mmap(NULL, arena_size, PROT_READ | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    jit->arena = arena;
+    jit->arena_size = arena_size;
+    jit->page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    jit->hot = hot_threshold ? hot_threshold : 1;
+    return jit;
+}
+
+void cpu_jit_destroy(cpu_jit_t *jit) {
+    if (!jit) return;
+    munmap(jit->arena, jit->arena_size);
+    free(jit);
+}
+
+void cpu_jit_attach(cpu_state_t *st, cpu_jit_t *jit) {
+    for (int page = 0; page < 256; page++)
+        st->pages[page].flags &= ~CPU_PAGE_CODE;
+    if (jit) {
+        memset(jit->blocks, 0, sizeof(jit->blocks));
+        memset(jit->page_gen, 0, sizeof(jit->page_gen));
+        memset(jit->page_nblocks, 0, sizeof(jit->page_nblocks));
+        memset(&jit->stats, 0, sizeof(jit->stats));
+        jit->arena_used = 0;
+    }
+    st->jit = jit;
+}
+
+cpu_jit_stats_t cpu_jit_stats(const cpu_jit_t *jit) { return jit->stats; }
+
+void cpu_jit_invalidate_page(cpu_state_t *st, u8 page) {
+    st->jit->page_gen[page]++;
+    st->jit->page_nblocks[page] = 0;
+    st->jit->stats.invalidations++;
+}
+
+void cpu_jit_code_write(cpu_state_t *st, u16 addr) {
+    cpu_jit_t *jit = st->jit;
+    u8 page = addr >> 8;
+    u8 n = jit->page_nblocks[page], kept = 0;
+    if (n > CPU_JIT_PAGE_BLOCKS) {
+        cpu_jit_invalidate_page(st, page);
+        return;
+    }
+    for (u8 i = 0; i < n; i++) {
+        u16 idx = jit->page_blocks[page][i];
+        cpu_jit_block_t *b = &jit->blocks[idx];
+        // entries go stale when their slot is reused
+        if (!b->valid || (b->pages[0] != page && b->pages[1] != page)) continue;
+        if ((u16)(addr - b->pc) < (u16)(b->end - b->pc)) {
+            // translated again once it is hot again
+            b->valid = 0;
+            b->fn = NULL;
+            jit->stats.invalidations++;
+            continue;
+        }
+        jit->page_blocks[page][kept++] = idx;
+    }
+    jit->page_nblocks[page] = kept;
+    // the write missed the remaining blocks, keep trapping writes to them
+    if (kept) st->pages[page].flags |= CPU_PAGE_CODE;
+}
+
+int cpu_jit_run(cpu_state_t *st, u32 cycle_budget) {
+    cpu_jit_t *jit = st->jit;
+    u64 target = st->cycles + cycle_budget;
+    while (st->cycles < target) {
+        if (!cpu_irq_pending(st)) {
+            cpu_jit_block_t *b = cpu_jit_lookup(st, jit, st->PC);
+            // same budget rule as the block cache: a pass through the block
+            // only starts if it fits in the worst case
+            if (b && st->cycles + b->max_cycles <= target) {
+                u64 start = st->cycles;
+                jit->stats.entries++;
+                b->fn(st, target);
+                // no progress means it exited before its first instruction,
+                // which is left to the interpreter
+                if (st->cycles != start) continue;
+            }
+        }
+        if (cpu_exec(st) < 0) return -1;
+    }
+    return (int)(st->cycles - target);
+}
+
+#else
+
+// no JIT on this host or build: cpu_jit_create always fails, so nothing can
+// be attached and the hooks below are never reached
+
+cpu_jit_t *cpu_jit_create(u32 arena_size, u32 hot_threshold) { return NULL; }
+void cpu_jit_destroy(cpu_jit_t *jit) { }
+void cpu_jit_attach(cpu_state_t *st, cpu_jit_t *jit) { st->jit = NULL; }
+cpu_jit_stats_t cpu_jit_stats(const cpu_jit_t *jit) { return (cpu_jit_stats_t){ 0 }; }
+void cpu_jit_invalidate_page(cpu_state_t *st, u8 page) { }
+void cpu_jit_code_write(cpu_state_t *st, u16 addr) { }
+int cpu_jit_run(cpu_state_t *st, u32 cycle_budget) { return -1; }
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __CPU_JIT_H__
+#define __CPU_JIT_H__
+
+#include "cpu.h"
+
+// x86-64 JIT for cpu_run.
+//
+// cpu_run counts visits to each PC and, once a PC has been seen hot_threshold
+// times, translates the code starting there into native x86-64 code in an
+// executable arena. A translated block runs through not-taken branches and
+// ends at the first JMP, JSR or RTS, or just before an instruction it can't
+// translate (BRK, RTI, JMP indirect), which is left to cpu_exec. A taken
+// branch leaves the block, and a branch or JMP back to the start of its own
+// block loops in native code.
+//
+// Translated code keeps all registers and flags in cpu_state_t, adds the
+// block's base cycles to st->cycles once on entry and only adds page-cross and
+// branch penalties as they happen. It exits back to cpu_run, with st->PC and
+// st->cycles exactly as the interpreter would have left them:
+//   - before any access to a page without a host pointer (I/O)
+//   - before any write to a page flagged CPU_PAGE_CODE
+//   - after CLI or PLP, if that lets a raised IRQ line in
+//   - on a loop-back, if an interrupt line is raised or the next pass might
+//     not fit the budget
+// Bus callbacks are therefore never called from translated code; cpu_exec
+// performs those instructions.
+//
+// Like the block cache, the JIT only translates code on pages mapped with
+// cpu_map and is only used while st->tick is NULL. A write to translated code
+// drops just the blocks covering the written byte, which are translated again
+// once they are hot again. Embedders that change mapped memory behind the
+// core's back must call cpu_invalidate.
+//
+// The arena is mapped read-write while a block is emitted into it and
+// read-execute the rest of the time, never both, so hosts that enforce W^X
+// accept it. Only x86-64 hosts with POSIX mmap are supported. cpu_jit_create
+// returns NULL elsewhere, or when the build has CPU_JIT turned off.
+
+typedef struct cpu_jit cpu_jit_t;
+
+typedef struct {
+    u64 entries;       // translated blocks entered from cpu_run
+    u64 compiled;      // blocks translated
+    u64 failed;        // hot PCs whose first instruction can't be translated
+    u64 invalidations; // writes that hit translated code
+    u64 flushes;       // times the arena filled up and was emptied
+} cpu_jit_stats_t;
+
+// creates a JIT with an arena_size byte code arena that translates a PC after
+// hot_threshold visits. returns NULL if the host isn't supported
+cpu_jit_t *cpu_jit_create(u32 arena_size, u32 hot_threshold);
+void cpu_jit_destroy(cpu_jit_t *jit);
+// attaches jit to st, dropping anything it translated before. a NULL jit
+// detaches it. a jit may only be attached to one cpu_state_t at a time
+void cpu_jit_attach(cpu_state_t *st, cpu_jit_t *jit);
+cpu_jit_stats_t cpu_jit_stats(const cpu_jit_t *jit);
+
+#endif
@@ -0,0 +1,480 @@
+#ifndef __CPU_OPCODES_H__
+#define __CPU_OPCODES_H__
+
+// The 6502 opcode table, as an X-macro. Each entry is
+//   OP(opcode, instr, kind, mode, idx, cycles)
+// where cpu_instr_<instr> is the operation, cpu_icl_<kind>_<mode> is the
+// addressing mode helper that sequences its cycles, idx is the index
+// register used by indexed modes (_ if unused) and cycles is the base cycle
+// count, without page-cross or branch-taken penalties.
+//
+// Every core is generated from this table, so adding an opcode here adds it
+// to every core.
+//
+// The CPU model is picked at compile time by defining one of
+//   CPU_VARIANT_NMOS   6502 with decimal mode and the stable undocumented
+//                      opcodes (the default)
+//   CPU_VARIANT_2A03   the NES CPU: the NMOS opcodes, without decimal mode
+//   CPU_VARIANT_65C02  WDC 65C02 with the Rockwell bit instructions. WAI and
+//                      STP are left illegal
+// CPU_OPCODES is that model's table, so each one gets its own dispatch
+// tables and doesn't test for the others' opcodes at run time.
+
+#if !defined(CPU_VARIANT_NMOS) && !defined(CPU_VARIANT_2A03) && !defined(CPU_VARIANT_65C02)
+#define CPU_VARIANT_NMOS
+#endif
+
+// instruction length in bytes, by addressing mode
+#define CPU_OPLEN_imp 1
+#define CPU_OPLEN_one 1 // implied, done in the opcode fetch cycle
+#define CPU_OPLEN_acc 1
+#define CPU_OPLEN_imm 2
+#define CPU_OPLEN_abs 3
+#define CPU_OPLEN_abi 3
+#define CPU_OPLEN_abp 3 // absolute indexed, rmw with a page-cross fixup
+#define CPU_OPLEN_ind 3
+#define CPU_OPLEN_iax 3 // ($nnnn,X)
+#define CPU_OPLEN_zpg 2
+#define CPU_OPLEN_zpi 2
+#define CPU_OPLEN_zpx 2
+#define CPU_OPLEN_zpy 2
+#define CPU_OPLEN_izp 2 // ($nn)
+#define CPU_OPLEN_rel 2
+#define CPU_OPLEN_zpr 3 // $nn,rel
+
+// the 65C02 takes a cycle more for ADC and SBC in decimal mode
+#ifdef CPU_VARIANT_65C02
+#define CPU_PENALTY_DECIMAL 1
+#else
+#define CPU_PENALTY_DECIMAL 0
+#endif
+
+// worst-case penalty cycles on top of the base count, by helper
+#define CPU_PENALTY_all_imp 0
+#define CPU_PENALTY_all_one 0
+#define CPU_PENALTY_all_acc 0
+#define CPU_PENALTY_all_imm CPU_PENALTY_DECIMAL
+#define CPU_PENALTY_read_abs CPU_PENALTY_DECIMAL
+#define CPU_PENALTY_rmw_abs 0
+#define CPU_PENALTY_write_abs 0
+#define CPU_PENALTY_jmp_abs 0
+#define CPU_PENALTY_jsr_abs 0
+#define CPU_PENALTY_wait_abs 0
+#define CPU_PENALTY_read_abi (1 + CPU_PENALTY_DECIMAL) // page cross
+#define CPU_PENALTY_rmw_abi 0
+#define CPU_PENALTY_write_abi 0
+#define CPU_PENALTY_rmw_abp 1 // page cross
+#define CPU_PENALTY_jmp_ind 0
+#define CPU_PENALTY_jmp_iax 0
+#define CPU_PENALTY_read_zpg CPU_PENALTY_DECIMAL
+#define CPU_PENALTY_rmw_zpg 0
+#define CPU_PENALTY_write_zpg 0
+#define CPU_PENALTY_read_zpi CPU_PENALTY_DECIMAL
+#define CPU_PENALTY_rmw_zpi 0
+#define CPU_PENALTY_write_zpi 0
+#define CPU_PENALTY_read_zpx CPU_PENALTY_DECIMAL
+#define CPU_PENALTY_rmw_zpx 0
+#define CPU_PENALTY_write_zpx 0
+#define CPU_PENALTY_read_zpy (1 + CPU_PENALTY_DECIMAL) // page cross
+#define CPU_PENALTY_rmw_zpy 0
+#define CPU_PENALTY_write_zpy 0
+#define CPU_PENALTY_read_izp CPU_PENALTY_DECIMAL
+#define CPU_PENALTY_write_izp 0
+#define CPU_PENALTY_branch_rel 2 // taken, page cross
+#define CPU_PENALTY_branch_zpr 2 // taken, page cross
+
+// documented opcodes every model has, with the same timing
+#define CPU_OPCODES_BASE(OP) \
+    OP(0xAA, tax, all, imp, _, 2) \
+    OP(0xA8, tay, all, imp, _, 2) \
+    OP(0xBA, tsx, all, imp, _, 2) \
+    OP(0x8A, txa, all, imp, _, 2) \
+    OP(0x9A, txs, all, imp, _, 2) \
+    OP(0x98, tya, all, imp, _, 2) \
+    OP(0x48, pha, all, imp, _, 3) \
+    OP(0x08, php, all, imp, _, 3) \
+    OP(0x68, pla, all, imp, _, 4) \
+    OP(0x28, plp, all, imp, _, 4) \
+    OP(0xCA, dex, all, imp, _, 2) \
+    OP(0x88, dey, all, imp, _, 2) \
+    OP(0xE8, inx, all, imp, _, 2) \
+    OP(0xC8, iny, all, imp, _, 2) \
+    OP(0x00, brk, all, imp, _, 7) \
+    OP(0x40, rti, all, imp, _, 6) \
+    OP(0x60, rts, all, imp, _, 6) \
+    OP(0x18, clc, all, imp, _, 2) \
+    OP(0xD8, cld, all, imp, _, 2) \
+    OP(0x58, cli, all, imp, _, 2) \
+    OP(0xB8, clv, all, imp, _, 2) \
+    OP(0x38, sec, all, imp, _, 2) \
+    OP(0xF8, sed, all, imp, _, 2) \
+    OP(0x78, sei, all, imp, _, 2) \
+    OP(0xEA, nop, all, imp, _, 2) \
+    \
+    OP(0x0A, asl, all, acc, _, 2) \
+    OP(0x4A, lsr, all, acc, _, 2) \
+    OP(0x2A, rol, all, acc, _, 2) \
+    OP(0x6A, ror, all, acc, _, 2) \
+    \
+    OP(0xA9, lda, all, imm, _, 2) \
+    OP(0xA2, ldx, all, imm, _, 2) \
+    OP(0xA0, ldy, all, imm, _, 2) \
+    OP(0x29, and, all, imm, _, 2) \
+    OP(0x49, eor, all, imm, _, 2) \
+    OP(0x09, ora, all, imm, _, 2) \
+    OP(0x69, adc, all, imm, _, 2) \
+    OP(0xC9, cmp, all, imm, _, 2) \
+    OP(0xE0, cpx, all, imm, _, 2) \
+    OP(0xC0, cpy, all, imm, _, 2) \
+    OP(0xE9, sbc, all, imm, _, 2) \
+    \
+    OP(0xAD, lda, read, abs, _, 4) \
+    OP(0xAE, ldx, read, abs, _, 4) \
+    OP(0xAC, ldy, read, abs, _, 4) \
+    OP(0x4D, eor, read, abs, _, 4) \
+    OP(0x2D, and, read, abs, _, 4) \
+    OP(0x0D, ora, read, abs, _, 4) \
+    OP(0x6D, adc, read, abs, _, 4) \
+    OP(0xED, sbc, read, abs, _, 4) \
+    OP(0xCD, cmp, read, abs, _, 4) \
+    OP(0xEC, cpx, read, abs, _, 4) \
+    OP(0xCC, cpy, read, abs, _, 4) \
+    OP(0x2C, bit, read, abs, _, 4) \
+    \
+    OP(0x0E, asl, rmw, abs, _, 6) \
+    OP(0x4E, lsr, rmw, abs, _, 6) \
+    OP(0x2E, rol, rmw, abs, _, 6) \
+    OP(0x6E, ror, rmw, abs, _, 6) \
+    OP(0xEE, inc, rmw, abs, _, 6) \
+    OP(0xCE, dec, rmw, abs, _, 6) \
+    \
+    OP(0x8D, sta, write, abs, _, 4) \
+    OP(0x8E, stx, write, abs, _, 4) \
+    OP(0x8C, sty, write, abs, _, 4) \
+    \
+    OP(0x4C, jmp, jmp, abs, _, 3) \
+    OP(0x20, jsr, jsr, abs, _, 6) \
+    \
+    OP(0xBD, lda, read, abi, X, 4) \
+    OP(0xBC, ldy, read, abi, X, 4) \
+    OP(0x3D, and, read, abi, X, 4) \
+    OP(0x5D, eor, read, abi, X, 4) \
+    OP(0x1D, ora, read, abi, X, 4) \
+    OP(0x7D, adc, read, abi, X, 4) \
+    OP(0xDD, cmp, read, abi, X, 4) \
+    OP(0xFD, sbc, read, abi, X, 4) \
+    OP(0xDE, dec, rmw, abi, X, 7) \
+    OP(0xFE, inc, rmw, abi, X, 7) \
+    OP(0x9D, sta, write, abi, X, 5) \
+    \
+    OP(0xB9, lda, read, abi, Y, 4) \
+    OP(0xBE, ldx, read, abi, Y, 4) \
+    OP(0x39, and, read, abi, Y, 4) \
+    OP(0x59, eor, read, abi, Y, 4) \
+    OP(0x19, ora, read, abi, Y, 4) \
+    OP(0x79, adc, read, abi, Y, 4) \
+    OP(0xD9, cmp, read, abi, Y, 4) \
+    OP(0xF9, sbc, read, abi, Y, 4) \
+    OP(0x99, sta, write, abi, Y, 5) \
+    \
+    OP(0xA5, lda, read, zpg, _, 3) \
+    OP(0xA6, ldx, read, zpg, _, 3) \
+    OP(0xA4, ldy, read, zpg, _, 3) \
+    OP(0x25, and, read, zpg, _, 3) \
+    OP(0x24, bit, read, zpg, _, 3) \
+    OP(0x45, eor, read, zpg, _, 3) \
+    OP(0x05, ora, read, zpg, _, 3) \
+    OP(0x65, adc, read, zpg, _, 3) \
+    OP(0xC5, cmp, read, zpg, _, 3) \
+    OP(0xE4, cpx, read, zpg, _, 3) \
+    OP(0xC4, cpy, read, zpg, _, 3) \
+    OP(0xE5, sbc, read, zpg, _, 3) \
+    OP(0xC6, dec, rmw, zpg, _, 5) \
+    OP(0xE6, inc, rmw, zpg, _, 5) \
+    OP(0x06, asl, rmw, zpg, _, 5) \
+    OP(0x46, lsr, rmw, zpg, _, 5) \
+    OP(0x26, rol, rmw, zpg, _, 5) \
+    OP(0x66, ror, rmw, zpg, _, 5) \
+    OP(0x85, sta, write, zpg, _, 3) \
+    OP(0x86, stx, write, zpg, _, 3) \
+    OP(0x84, sty, write, zpg, _, 3) \
+    \
+    OP(0xB5, lda, read, zpi, X, 4) \
+    OP(0xB4, ldy, read, zpi, X, 4) \
+    OP(0x35, and, read, zpi, X, 4) \
+    OP(0x55, eor, read, zpi, X, 4) \
+    OP(0x15, ora, read, zpi, X, 4) \
+    OP(0x75, adc, read, zpi, X, 4) \
+    OP(0xD5, cmp, read, zpi, X, 4) \
+    OP(0xF5, sbc, read, zpi, X, 4) \
+    OP(0x16, asl, rmw, zpi, X, 6) \
+    OP(0x56, lsr, rmw, zpi, X, 6) \
+    OP(0x36, rol, rmw, zpi, X, 6) \
+    OP(0x76, ror, rmw, zpi, X, 6) \
+    OP(0xD6, dec, rmw, zpi, X, 6) \
+    OP(0xF6, inc, rmw, zpi, X, 6) \
+    OP(0x95, sta, write, zpi, X, 4) \
+    OP(0x94, sty, write, zpi, X, 4) \
+    \
+    OP(0xB6, ldx, read, zpi, Y, 4) \
+    OP(0x96, stx, write, zpi, Y, 4) \
+    \
+    OP(0xA1, lda, read, zpx, _, 6) \
+    OP(0x21, and, read, zpx, _, 6) \
+    OP(0x41, eor, read, zpx, _, 6) \
+    OP(0x01, ora, read, zpx, _, 6) \
+    OP(0x61, adc, read, zpx, _, 6) \
+    OP(0xC1, cmp, read, zpx, _, 6) \
+    OP(0xE1, sbc, read, zpx, _, 6) \
+    OP(0x81, sta, write, zpx, _, 6) \
+    \
+    OP(0xB1, lda, read, zpy, _, 5) \
+    OP(0x31, and, read, zpy, _, 5) \
+    OP(0x51, eor, read, zpy, _, 5) \
+    OP(0x11, ora, read, zpy, _, 5) \
+    OP(0x71, adc, read, zpy, _, 5) \
+    OP(0xD1, cmp, read, zpy, _, 5) \
+    OP(0xF1, sbc, read, zpy, _, 5) \
+    OP(0x91, sta, write, zpy, _, 6) \
+    \
+    OP(0x90, bcc, branch, rel, _, 2) \
+    OP(0xB0, bcs, branch, rel, _, 2) \
+    OP(0xF0, beq, branch, rel, _, 2) \
+    OP(0x30, bmi, branch, rel, _, 2) \
+    OP(0xD0, bne, branch, rel, _, 2) \
+    OP(0x10, bpl, branch, rel, _, 2) \
+    OP(0x50, bvc, branch, rel, _, 2) \
+    OP(0x70, bvs, branch, rel, _, 2)
+
+// NMOS addressing quirks: JMP ($xxFF) reads the high byte from $xx00, and
+// the indexed shifts always take the page-cross cycle
+#define CPU_OPCODES_NMOS(OP) \
+    OP(0x6C, jmp, jmp, ind, _, 5) \
+    OP(0x1E, asl, rmw, abi, X, 7) \
+    OP(0x5E, lsr, rmw, abi, X, 7) \
+    OP(0x3E, rol, rmw, abi, X, 7) \
+    OP(0x7E, ror, rmw, abi, X, 7)
+
+// the undocumented NMOS opcodes that behave the same on every chip. the
+// unstable ones (ANE, LXA, SHA, SHX, SHY, TAS, LAS) and the JAMs stay
+// illegal. SLO, RLA, SRE, RRA, DCP and ISC fill columns 3, 7, B and F
+#define CPU_OPCODES_UNDOC(OP) \
+    OP(0x1A, nop, all, imp, _, 2) \
+    OP(0x3A, nop, all, imp, _, 2) \
+    OP(0x5A, nop, all, imp, _, 2) \
+    OP(0x7A, nop, all, imp, _, 2) \
+    OP(0xDA, nop, all, imp, _, 2) \
+    OP(0xFA, nop, all, imp, _, 2) \
+    OP(0x80, ign, all, imm, _, 2) \
+    OP(0x82, ign, all, imm, _, 2) \
+    OP(0x89, ign, all, imm, _, 2) \
+    OP(0xC2, ign, all, imm, _, 2) \
+    OP(0xE2, ign, all, imm, _, 2) \
+    OP(0x04, ign, read, zpg, _, 3) \
+    OP(0x44, ign, read, zpg, _, 3) \
+    OP(0x64, ign, read, zpg, _, 3) \
+    OP(0x14, ign, read, zpi, X, 4) \
+    OP(0x34, ign, read, zpi, X, 4) \
+    OP(0x54, ign, read, zpi, X, 4) \
+    OP(0x74, ign, read, zpi, X, 4) \
+    OP(0xD4, ign, read, zpi, X, 4) \
+    OP(0xF4, ign, read, zpi, X, 4) \
+    OP(0x0C, ign, read, abs, _, 4) \
+    OP(0x1C, ign, read, abi, X, 4) \
+    OP(0x3C, ign, read, abi, X, 4) \
+    OP(0x5C, ign, read, abi, X, 4) \
+    OP(0x7C, ign, read, abi, X, 4) \
+    OP(0xDC, ign, read, abi, X, 4) \
+    OP(0xFC, ign, read, abi, X, 4) \
+    \
+    OP(0x0B, anc, all, imm, _, 2) \
+    OP(0x2B, anc, all, imm, _, 2) \
+    OP(0x4B, alr, all, imm, _, 2) \
+    OP(0x6B, arr, all, imm, _, 2) \
+    OP(0xCB, sbx, all, imm, _, 2) \
+    OP(0xEB, sbc, all, imm, _, 2) \
+    \
+    OP(0xA7, lax, read, zpg, _, 3) \
+    OP(0xB7, lax, read, zpi, Y, 4) \
+    OP(0xAF, lax, read, abs, _, 4) \
+    OP(0xBF, lax, read, abi, Y, 4) \
+    OP(0xA3, lax, read, zpx, _, 6) \
+    OP(0xB3, lax, read, zpy, _, 5) \
+    OP(0x87, sax, write, zpg, _, 3) \
+    OP(0x97, sax, write, zpi, Y, 4) \
+    OP(0x8F, sax, write, abs, _, 4) \
+    OP(0x83, sax, write, zpx, _, 6) \
+    \
+    OP(0x07, slo, rmw, zpg, _, 5) \
+    OP(0x17, slo, rmw, zpi, X, 6) \
+    OP(0x0F, slo, rmw, abs, _, 6) \
+    OP(0x1F, slo, rmw, abi, X, 7) \
+    OP(0x1B, slo, rmw, abi, Y, 7) \
+    OP(0x03, slo, rmw, zpx, _, 8) \
+    OP(0x13, slo, rmw, zpy, _, 8) \
+    \
+    OP(0x27, rla, rmw, zpg, _, 5) \
+    OP(0x37, rla, rmw, zpi, X, 6) \
+    OP(0x2F, rla, rmw, abs, _, 6) \
+    OP(0x3F, rla, rmw, abi, X, 7) \
+    OP(0x3B, rla, rmw, abi, Y, 7) \
+    OP(0x23, rla, rmw, zpx, _, 8) \
+    OP(0x33, rla, rmw, zpy, _, 8) \
+    \
+    OP(0x47, sre, rmw, zpg, _, 5) \
+    OP(0x57, sre, rmw, zpi, X, 6) \
+    OP(0x4F, sre, rmw, abs, _, 6) \
+    OP(0x5F, sre, rmw, abi, X, 7) \
+    OP(0x5B, sre, rmw, abi, Y, 7) \
+    OP(0x43, sre, rmw, zpx, _, 8) \
+    OP(0x53, sre, rmw, zpy, _, 8) \
+    \
+    OP(0x67, rra, rmw, zpg, _, 5) \
+    OP(0x77, rra, rmw, zpi, X, 6) \
+    OP(0x6F, rra, rmw, abs, _, 6) \
+    OP(0x7F, rra, rmw, abi, X, 7) \
+    OP(0x7B, rra, rmw, abi, Y, 7) \
+    OP(0x63, rra, rmw, zpx, _, 8) \
+    OP(0x73, rra, rmw, zpy, _, 8) \
+    \
+    OP(0xC7, dcp, rmw, zpg, _, 5) \
+    OP(0xD7, dcp, rmw, zpi, X, 6) \
+    OP(0xCF, dcp, rmw, abs, _, 6) \
+    OP(0xDF, dcp, rmw, abi, X, 7) \
+    OP(0xDB, dcp, rmw, abi, Y, 7) \
+    OP(0xC3, dcp, rmw, zpx, _, 8) \
+    OP(0xD3, dcp, rmw, zpy, _, 8) \
+    \
+    OP(0xE7, isc, rmw, zpg, _, 5) \
+    OP(0xF7, isc, rmw, zpi, X, 6) \
+    OP(0xEF, isc, rmw, abs, _, 6) \
+    OP(0xFF, isc, rmw, abi, X, 7) \
+    OP(0xFB, isc, rmw, abi, Y, 7) \
+    OP(0xE3, isc, rmw, zpx, _, 8) \
+    OP(0xF3, isc, rmw, zpy, _, 8)
+
+// 65C02: the new instructions and addressing modes, the fixed JMP ($xxFF),
+// the indexed shifts only taking the page-cross cycle when they cross, and
+// every undefined opcode a NOP of a fixed length. RMBn/SMBn $nn and
+// BBRn/BBSn $nn,rel fill columns 7 and F
+#define CPU_OPCODES_CMOS(OP) \
+    OP(0x6C, jmp, jmp, ind, _, 6) \
+    OP(0x7C, jmp, jmp, iax, _, 6) \
+    OP(0x1E, asl, rmw, abp, X, 6) \
+    OP(0x5E, lsr, rmw, abp, X, 6) \
+    OP(0x3E, rol, rmw, abp, X, 6) \
+    OP(0x7E, ror, rmw, abp, X, 6) \
+    \
+    OP(0x80, bra, branch, rel, _, 2) \
+    OP(0xDA, phx, all, imp, _, 3) \
+    OP(0x5A, phy, all, imp, _, 3) \
+    OP(0xFA, plx, all, imp, _, 4) \
+    OP(0x7A, ply, all, imp, _, 4) \
+    OP(0x1A, inc, all, acc, _, 2) \
+    OP(0x3A, dec, all, acc, _, 2) \
+    OP(0x89, biti, all, imm, _, 2) \
+    OP(0x34, bit, read, zpi, X, 4) \
+    OP(0x3C, bit, read, abi, X, 4) \
+    OP(0x64, stz, write, zpg, _, 3) \
+    OP(0x74, stz, write, zpi, X, 4) \
+    OP(0x9C, stz, write, abs, _, 4) \
+    OP(0x9E, stz, write, abi, X, 5) \
+    OP(0x14, trb, rmw, zpg, _, 5) \
+    OP(0x1C, trb, rmw, abs, _, 6) \
+    OP(0x04, tsb, rmw, zpg, _, 5) \
+    OP(0x0C, tsb, rmw, abs, _, 6) \
+    \
+    OP(0xB2, lda, read, izp, _, 5) \
+    OP(0x32, and, read, izp, _, 5) \
+    OP(0x52, eor, read, izp, _, 5) \
+    OP(0x12, ora, read, izp, _, 5) \
+    OP(0x72, adc, read, izp, _, 5) \
+    OP(0xD2, cmp, read, izp, _, 5) \
+    OP(0xF2, sbc, read, izp, _, 5) \
+    OP(0x92, sta, write, izp, _, 5) \
+    \
+    OP(0x07, rmb0, rmw, zpg, _, 5) \
+    OP(0x17, rmb1, rmw, zpg, _, 5) \
+    OP(0x27, rmb2, rmw, zpg, _, 5) \
+    OP(0x37, rmb3, rmw, zpg, _, 5) \
+    OP(0x47, rmb4, rmw, zpg, _, 5) \
+    OP(0x57, rmb5, rmw, zpg, _, 5) \
+    OP(0x67, rmb6, rmw, zpg, _, 5) \
+    OP(0x77, rmb7, rmw, zpg, _, 5) \
+    OP(0x87, smb0, rmw, zpg, _, 5) \
+    OP(0x97, smb1, rmw, zpg, _, 5) \
+    OP(0xA7, smb2, rmw, zpg, _, 5) \
+    OP(0xB7, smb3, rmw, zpg, _, 5) \
+    OP(0xC7, smb4, rmw, zpg, _, 5) \
+    OP(0xD7, smb5, rmw, zpg, _, 5) \
+    OP(0xE7, smb6, rmw, zpg, _, 5) \
+    OP(0xF7, smb7, rmw, zpg, _, 5) \
+    OP(0x0F, bbr0, branch, zpr, _, 5) \
+    OP(0x1F, bbr1, branch, zpr, _, 5) \
+    OP(0x2F, bbr2, branch, zpr, _, 5) \
+    OP(0x3F, bbr3, branch, zpr, _, 5) \
+    OP(0x4F, bbr4, branch, zpr, _, 5) \
+    OP(0x5F, bbr5, branch, zpr, _, 5) \
+    OP(0x6F, bbr6, branch, zpr, _, 5) \
+    OP(0x7F, bbr7, branch, zpr, _, 5) \
+    OP(0x8F, bbs0, branch, zpr, _, 5) \
+    OP(0x9F, bbs1, branch, zpr, _, 5) \
+    OP(0xAF, bbs2, branch, zpr, _, 5) \
+    OP(0xBF, bbs3, branch, zpr, _, 5) \
+    OP(0xCF, bbs4, branch, zpr, _, 5) \
+    OP(0xDF, bbs5, branch, zpr, _, 5) \
+    OP(0xEF, bbs6, branch, zpr, _, 5) \
+    OP(0xFF, bbs7, branch, zpr, _, 5) \
+    \
+    OP(0x02, ign, all, imm, _, 2) \
+    OP(0x22, ign, all, imm, _, 2) \
+    OP(0x42, ign, all, imm, _, 2) \
+    OP(0x62, ign, all, imm, _, 2) \
+    OP(0x82, ign, all, imm, _, 2) \
+    OP(0xC2, ign, all, imm, _, 2) \
+    OP(0xE2, ign, all, imm, _, 2) \
+    OP(0x44, ign, read, zpg, _, 3) \
+    OP(0x54, ign, read, zpi, X, 4) \
+    OP(0xD4, ign, read, zpi, X, 4) \
+    OP(0xF4, ign, read, zpi, X, 4) \
+    OP(0xDC, ign, read, abs, _, 4) \
+    OP(0xFC, ign, read, abs, _, 4) \
+    OP(0x5C, ign, wait, abs, _, 8) \
+    OP(0x03, nop, all, one, _, 1) \
+    OP(0x0B, nop, all, one, _, 1) \
+    OP(0x13, nop, all, one, _, 1) \
+    OP(0x1B, nop, all, one, _, 1) \
+    OP(0x23, nop, all, one, _, 1) \
+    OP(0x2B, nop, all, one, _, 1) \
+    OP(0x33, nop, all, one, _, 1) \
+    OP(0x3B, nop, all, one, _, 1) \
+    OP(0x43, nop, all, one, _, 1) \
+    OP(0x4B, nop, all, one, _, 1) \
+    OP(0x53, nop, all, one, _, 1) \
+    OP(0x5B, nop, all, one, _, 1) \
+    OP(0x63, nop, all, one, _, 1) \
+    OP(0x6B, nop, all, one, _, 1) \
+    OP(0x73, nop, all, one, _, 1) \
+    OP(0x7B, nop, all, one, _, 1) \
+    OP(0x83, nop, all, one, _, 1) \
+    OP(0x8B, nop, all, one, _, 1) \
+    OP(0x93, nop, all, one, _, 1) \
+    OP(0x9B, nop, all, one, _, 1) \
+    OP(0xA3, nop, all, one, _, 1) \
+    OP(0xAB, nop, all, one, _, 1) \
+    OP(0xB3, nop, all, one, _, 1) \
+    OP(0xBB, nop, all, one, _, 1) \
+    OP(0xC3, nop, all, one, _, 1) \
+    OP(0xD3, nop, all, one, _, 1) \
+    OP(0xE3, nop, all, one, _, 1) \
+    OP(0xEB, nop, all, one, _, 1) \
+    OP(0xF3, nop, all, one, _, 1) \
+    OP(0xFB, nop, all, one, _, 1)
+
+#ifdef CPU_VARIANT_65C02
+#define CPU_OPCODES(OP) CPU_OPCODES_BASE(OP) CPU_OPCODES_CMOS(OP)
+#else
+#define CPU_OPCODES(OP) CPU_OPCODES_BASE(OP) CPU_OPCODES_NMOS(OP) CPU_OPCODES_UNDOC(OP)
+#endif
+
+#endif
@@ -0,0 +1,259 @@
+#include "cpu_internal.h"
+#include "cpu_prof.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const cpu_prof_helper_names[CPU_PROF_NHELPERS] = {
+#define H(kind, mode) "cpu_icl_" #kind "_" #mode,
+    CPU_PROF_HELPERS(H)
+#undef H
+};
+
+static const char *const cpu_prof_op_names[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = #instr " " #mode,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+#ifdef CPU_PROFILE
+
+static const u8 cpu_prof_helper[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = CPU_PROF_##kind##_##mode,
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+int cpu_prof_attach(cpu_state_t *st, cpu_prof_t *prof) {
+    st->prof = prof;
+    if (!prof) return 0;
+    memset(prof, 0, offsetof(cpu_prof_t, syms));
+    prof->nnodes = 1;
+    prof->nodes[0].addr = st->PC;
+    return 0;
+}
+
+// enters the frame for addr under the current one
+static void cpu_prof_call(cpu_prof_t *prof, u16 addr) {
+    if (prof->lost) {
+        prof->lost++;
+        return;
+    }
+    cpu_prof_node_t *cur = &prof->nodes[prof->cur];
+    u32 n;
+    for (n = cur->child; n; n = prof->nodes[n].sibling)
+        if (prof->nodes[n].addr == addr) break;
+    if (!n) {
+        if (prof->nnodes == CPU_PROF_NODES) {
+            prof->lost++;
+            return;
+        }
+        n = prof->nnodes++;
+        prof->nodes[n] = (cpu_prof_node_t){ addr, prof->cur, 0, cur->child, 0 };
+        cur->child = n;
+    }
+    prof->cur = n;
+}
+
+static void cpu_prof_ret(cpu_prof_t *prof) {
+    if (prof->lost) prof->lost--;
+    else prof->cur = prof->nodes[prof->cur].parent;
+}
+
+void cpu_prof_instr(cpu_state_t *st, u8 opc, u16 pc, u64 start) {
+    cpu_prof_t *prof = st->prof;
+    u64 cycles = st->cycles - start;
+    prof->op_count[opc]++;
+    prof->op_cycles[opc] += cycles;
+    prof->helper_count[cpu_prof_helper[opc]]++;
+    prof->helper_cycles[cpu_prof_helper[opc]] += cycles;
+    prof->pc_count[pc]++;
+    prof->pc_cycles[pc] += cycles;
+    prof->nodes[prof->cur].cycles += cycles;
+    switch (opc) {
+        case 0x00: case 0x20: cpu_prof_call(prof, st->PC); break; // BRK, JSR
+        case 0x40: case 0x60: cpu_prof_ret(prof); break;          // RTI, RTS
+    }
+}
+
+void cpu_prof_irq(cpu_state_t *st, u64 start) {
+    cpu_prof_t *prof = st->prof;
+    prof->irq_count++;
+    prof->irq_cycles += st->cycles - start;
+    prof->nodes[prof->cur].cycles += st->cycles - start;
+    cpu_prof_call(prof, st->PC);
+}
+
+#else
+
+int cpu_prof_attach(cpu_state_t *st, cpu_prof_t *prof) {
+    (void)st; (void)prof;
+    return -1;
+}
+
+#endif
+
+// AS65 listing lines that define a label look like
+//   "06a1 : 9002             brcs2   bcc brcs3"
+// with the address in columns 0-3 and the label from column 24
+int cpu_prof_load_symbols(cpu_prof_t *prof, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[512];
+    prof->nsyms = 0;
+    while (fgets(line, sizeof(line), f) && prof->nsyms < CPU_PROF_SYMS) {
+        if (strlen(line) < 25 || strncmp(line + 4, " : ", 3) != 0) continue;
+        char *name = line + 24;
+        if (!(name[0] == '_' || ((name[0] | 0x20) >= 'a' && (name[0] | 0x20) <= 'z'))) continue;
+        char *end = name;
+        while (*end == '_' || (*end >= '0' && *end <= '9') || ((*end | 0x20) >= 'a' && (*end | 0x20) <= 'z'))
+            end++;
+        char *hexend;
+        unsigned long addr = strtoul(line, &hexend, 16);
+        if (hexend != line + 4) continue;
+
+        cpu_prof_sym_t *s = &prof->syms[prof->nsyms++];
+        s->addr = addr;
+        u32 len = end - name < CPU_PROF_SYM_LEN - 1 ? end - name : CPU_PROF_SYM_LEN - 1;
+        memcpy(s->name, name, len);
+        s->name[len] = 0;
+    }
+    fclose(f);
+
+    // listings are mostly in address order already: insertion sort, keeping
+    // the first label of several at the same address
+    for (u32 i = 1; i < prof->nsyms; i++) {
+        cpu_prof_sym_t s = prof->syms[i];
+        u32 j = i;
+        for (; j > 0 && prof->syms[j - 1].addr > s.addr; j--) prof->syms[j] = prof->syms[j - 1];
+        prof->syms[j] = s;
+    }
+    return prof->nsyms;
+}
+
+// the last label at or below addr, or NULL
+static const cpu_prof_sym_t *cpu_prof_sym(const cpu_prof_t *prof, u16 addr) {
+    u32 lo = 0, hi = prof->nsyms;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (prof->syms[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return NULL;
+    // first of several labels at the same address
+    while (lo > 1 && prof->syms[lo - 2].addr == prof->syms[lo - 1].addr) lo--;
+    return &prof->syms[lo - 1];
+}
+
+void cpu_prof_symbolize(const cpu_prof_t *prof, u16 addr, char buf[CPU_PROF_SYM_LEN + 8]) {
+    const cpu_prof_sym_t *s = cpu_prof_sym(prof, addr);
+    if (!s) snprintf(buf, CPU_PROF_SYM_LEN + 8, "$%04X", addr);
+    else if (s->addr == addr) snprintf(buf, CPU_PROF_SYM_LEN + 8, "%s", s->name);
+    else snprintf(buf, CPU_PROF_SYM_LEN + 8, "%s+%u", s->name, addr - s->addr);
+}
+
+typedef struct {
+    u64 cycles;
+    u64 count;
+    u32 id;
+} cpu_prof_row_t;
+
+static int cpu_prof_row_cmp(const void *a, const void *b) {
+    const cpu_prof_row_t *x = a, *y = b;
+    if (x->cycles != y->cycles) return x->cycles < y->cycles ? 1 : -1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+// sorts the non-empty rows and returns how many there are
+static u32 cpu_prof_sort(cpu_prof_row_t *rows, u32 n) {
+    u32 kept = 0;
+    for (u32 i = 0; i < n; i++)
+        if (rows[i].count) rows[kept++] = rows[i];
+    qsort(rows, kept, sizeof(*rows), cpu_prof_row_cmp);
+    return kept;
+}
+
+static void cpu_prof_row(FILE *out, const cpu_prof_row_t *r, const char *name, u64 total) {
+    fprintf(out, "  %-32s %12llu %14llu %6.2f%% %6.2f\n", name,
+            (unsigned long long)r->count, (unsigned long long)r->cycles,
+            total ? 100.0 * r->cycles / total : 0.0, (double)r->cycles / r->count);
+}
+
+void cpu_prof_report(const cpu_prof_t *prof, FILE *out, u32 top) {
+    cpu_prof_row_t *rows = malloc(0x10000 * sizeof(*rows));
+    if (!rows) return;
+    u64 total = prof->irq_cycles;
+    for (int i = 0; i < 256; i++) total += prof->op_cycles[i];
+    char name[CPU_PROF_SYM_LEN + 16];
+    const char *head = "  %-32s %12s %14s %7s %6s\n";
+
+    fprintf(out, "%llu cycles, %llu interrupts taking %llu cycles\n",
+            (unsigned long long)total, (unsigned long long)prof->irq_count,
+            (unsigned long long)prof->irq_cycles);
+
+    fprintf(out, "\nopcodes\n");
+    fprintf(out, head, "opcode", "count", "cycles", "%", "avg");
+    for (u32 i = 0; i < 256; i++)
+        rows[i] = (cpu_prof_row_t){ prof->op_cycles[i], prof->op_count[i], i };
+    u32 n = cpu_prof_sort(rows, 256);
+    for (u32 i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "%02X %s", rows[i].id, cpu_prof_op_names[rows[i].id]);
+        cpu_prof_row(out, &rows[i], name, total);
+    }
+
+    fprintf(out, "\naddressing mode helpers\n");
+    fprintf(out, head, "helper", "count", "cycles", "%", "avg");
+    for (u32 i = 0; i < CPU_PROF_NHELPERS; i++)
+        rows[i] = (cpu_prof_row_t){ prof->helper_cycles[i], prof->helper_count[i], i };
+    n = cpu_prof_sort(rows, CPU_PROF_NHELPERS);
+    for (u32 i = 0; i < n; i++)
+        cpu_prof_row(out, &rows[i], cpu_prof_helper_names[rows[i].id], total);
+
+    if (prof->nsyms) {
+        fprintf(out, "\nlabels (top %u)\n", top);
+        fprintf(out, head, "label", "count", "cycles", "%", "avg");
+        for (u32 i = 0; i <= prof->nsyms; i++) rows[i] = (cpu_prof_row_t){ 0, 0, i };
+        // row nsyms collects the addresses below the first label
+        for (u32 pc = 0; pc < 0x10000; pc++) {
+            if (!prof->pc_count[pc]) continue;
+            const cpu_prof_sym_t *s = cpu_prof_sym(prof, pc);
+            cpu_prof_row_t *r = &rows[s ? (u32)(s - prof->syms) : prof->nsyms];
+            r->cycles += prof->pc_cycles[pc];
+            r->count += prof->pc_count[pc];
+        }
+        n = cpu_prof_sort(rows, prof->nsyms + 1);
+        for (u32 i = 0; i < n && i < top; i++)
+            cpu_prof_row(out, &rows[i],
+                    rows[i].id < prof->nsyms ? prof->syms[rows[i].id].name : "(no label)", total);
+    }
+
+    fprintf(out, "\nPCs (top %u)\n", top);
+    fprintf(out, head, "pc", "count", "cycles", "%", "avg");
+    for (u32 pc = 0; pc < 0x10000; pc++)
+        rows[pc] = (cpu_prof_row_t){ prof->pc_cycles[pc], prof->pc_count[pc], pc };
+    n = cpu_prof_sort(rows, 0x10000);
+    for (u32 i = 0; i < n && i < top; i++) {
+        int len = snprintf(name, sizeof(name), "%04X ", rows[i].id);
+        cpu_prof_symbolize(prof, rows[i].id, name + len);
+        cpu_prof_row(out, &rows[i], name, total);
+    }
+    free(rows);
+}
+
+void cpu_prof_folded(const cpu_prof_t *prof, FILE *out) {
+    char name[CPU_PROF_SYM_LEN + 8];
+    u32 path[CPU_PROF_NODES];
+    for (u32 n = 0; n < prof->nnodes; n++) {
+        if (!prof->nodes[n].cycles) continue;
+        u32 depth = 0;
+        for (u32 p = n; ; p = prof->nodes[p].parent) {
+            path[depth++] = p;
+            if (p == 0) break;
+        }
+        while (depth--) {
+            cpu_prof_symbolize(prof, prof->nodes[path[depth]].addr, name);
+            fprintf(out, "%s%c", name, depth ? ';' : ' ');
+        }
+        fprintf(out, "%llu\n", (unsigned long long)prof->nodes[n].cycles);
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef __CPU_PROF_H__
+#define __CPU_PROF_H__
+
+#include "cpu.h"
+#include <stdio.h>
+
+// Cycle profiler.
+//
+// Only available when the library is built with CPU_PROFILE; otherwise the
+// hooks are compiled out of cpu_exec and cpu_prof_attach fails. While a
+// profiler is attached, cpu_run steps through cpu_exec, which charges each
+// instruction's cycles to its opcode, its addressing mode helper
+// (cpu_icl_<kind>_<mode>), its PC and the current guest call stack.
+//
+// The call stack is rebuilt from control flow: JSR, BRK and interrupts enter
+// a frame named after their target, RTS and RTI leave it. Guest code that
+// returns through other means (stack tricks, JMP out of a subroutine) leaves
+// its frames open. Frames live in a tree of CPU_PROF_NODES nodes; calls past
+// that are charged to the deepest frame that fit.
+//
+// Reports name addresses after the closest label at or below them, from
+// AS65 listings like test/res/6502_functional_test.lst.
+
+#define CPU_PROF_NODES 16384
+#define CPU_PROF_SYMS 4096
+#define CPU_PROF_SYM_LEN 32
+
+// addressing mode helpers, as in cpu_opcodes.h
+#define CPU_PROF_HELPERS(H) \
+    H(all, imp) H(all, one) H(all, acc) H(all, imm) \
+    H(read, abs) H(rmw, abs) H(write, abs) H(jmp, abs) H(jsr, abs) H(wait, abs) \
+    H(read, abi) H(rmw, abi) H(write, abi) H(rmw, abp) H(jmp, ind) H(jmp, iax) \
+    H(read, zpg) H(rmw, zpg) H(write, zpg) \
+    H(read, zpi) H(rmw, zpi) H(write, zpi) \
+    H(read, zpx) H(rmw, zpx) H(write, zpx) \
+    H(read, zpy) H(rmw, zpy) H(write, zpy) \
+    H(read, izp) H(write, izp) \
+    H(branch, rel) H(branch, zpr)
+
+enum {
+#define H(kind, mode) CPU_PROF_##kind##_##mode,
+    CPU_PROF_HELPERS(H)
+#undef H
+    CPU_PROF_NHELPERS
+};
+
+typedef struct {
+    u16 addr;          // entry point
+    u32 parent;
+    u32 child;         // first child, 0 if none
+    u32 sibling;       // next child of parent, 0 if none
+    u64 cycles;        // spent in this frame itself
+} cpu_prof_node_t;
+
+typedef struct {
+    u16 addr;
+    char name[CPU_PROF_SYM_LEN];
+} cpu_prof_sym_t;
+
+typedef struct cpu_prof {
+    u64 op_count[256];
+    u64 op_cycles[256];
+    u64 helper_count[CPU_PROF_NHELPERS];
+    u64 helper_cycles[CPU_PROF_NHELPERS];
+    u64 pc_count[0x10000];
+    u64 pc_cycles[0x10000];
+    u64 irq_count;
+    u64 irq_cycles;    // cycles spent entering interrupts
+
+    // call tree, node 0 is the root
+    cpu_prof_node_t nodes[CPU_PROF_NODES];
+    u32 nnodes;
+    u32 cur;
+    u32 lost;          // calls that didn't fit, still open
+
+    cpu_prof_sym_t syms[CPU_PROF_SYMS]; // sorted by address
+    u32 nsyms;
+} cpu_prof_t;
+
+// clears prof's counters, keeping its symbols, and attaches it to st. a NULL
+// prof detaches it. returns -1 if the library was built without CPU_PROFILE
+int cpu_prof_attach(cpu_state_t *st, cpu_prof_t *prof);
+// loads labels from an AS65 listing. returns the number of labels, or -1 if
+// the file can't be read
+int cpu_prof_load_symbols(cpu_prof_t *prof, const char *path);
+// "label+offset", or "$addr" with no label at or below addr
+void cpu_prof_symbolize(const cpu_prof_t *prof, u16 addr, char buf[CPU_PROF_SYM_LEN + 8]);
+// writes tables of cycles per opcode, helper, label and PC (the top entries
+// only), sorted by cycles
+void cpu_prof_report(const cpu_prof_t *prof, FILE *out, u32 top);
+// writes the call tree in folded-stack format ("a;b;c cycles" per line), as
+// taken by flamegraph.pl and speedscope
+void cpu_prof_folded(const cpu_prof_t *prof, FILE *out);
+
+#endif
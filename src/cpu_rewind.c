@@ -0,0 +1,306 @@
+#include "cpu_internal.h"
+#include "cpu_rewind.h"
+#include <string.h>
+
+static cpu_rewind_entry_t *cpu_rewind_entry(cpu_rewind_t *rw, u32 index) {
+    return &rw->entries[(rw->first + index) & (CPU_REWIND_MAX - 1)];
+}
+
+// a page is encoded as (zero run, literal run, literal bytes) triples. deltas
+// are mostly zero, so a page with a few changed bytes takes a few bytes
+static u32 cpu_rewind_encode(u8 *out, const u8 *x) {
+    u8 *p = out;
+    u32 i = 0;
+    while (i < 256) {
+        u32 z = i, l;
+        while (z < 256 && z - i < 255 && x[z] == 0) z++;
+        for (l = z; l < 256 && l - z < 255 && x[l] != 0; l++);
+        *p++ = z - i;
+        *p++ = l - z;
+        memcpy(p, x + z, l - z);
+        p += l - z;
+        i = l;
+    }
+    return p - out;
+}
+
+// XORs an encoded page into dst. returns the bytes consumed
+static u32 cpu_rewind_decode(const u8 *in, u8 *dst) {
+    const u8 *p = in;
+    u32 i = 0;
+    while (i < 256) {
+        i += *p++;
+        u32 n = *p++;
+        for (u32 k = 0; k < n; k++) dst[i + k] ^= p[k];
+        p += n;
+        i += n;
+    }
+    return p - in;
+}
+
+void cpu_rewind_dirty(cpu_state_t *st, u8 page) {
+    st->rewind->dirty[page] = 1;
+}
+
+void cpu_rewind_touch(cpu_rewind_t *rw, u16 addr, u32 len) {
+    if (len == 0) return;
+    u32 first = addr >> 8, last = (addr + len - 1) >> 8;
+    for (u32 page = first; page <= last; page++)
+        rw->dirty[page & 0xFF] = 1;
+}
+
+static void cpu_rewind_arm(cpu_state_t *st) {
+    for (int page = 0; page < 256; page++)
+        st->pages[page].flags |= CPU_PAGE_TRACK;
+}
+
+int cpu_rewind_attach(cpu_state_t *st, cpu_rewind_t *rw, u8 *mem, u8 *ring, u32 cap,
+        u32 keyframe_every) {
+    for (int page = 0; page < 256; page++)
+        st->pages[page].flags &= ~CPU_PAGE_TRACK;
+    st->rewind = rw;
+    if (!rw) return 0;
+
+    memset(rw, 0, sizeof(*rw));
+    rw->st = st;
+    rw->mem = mem;
+    rw->ring = ring;
+    rw->cap = cap;
+    rw->keyframe_every = keyframe_every ? keyframe_every : 1;
+    memcpy(rw->shadow, mem, 0x10000);
+    cpu_rewind_arm(st);
+    return cpu_rewind_checkpoint(rw);
+}
+
+static void cpu_rewind_drop_oldest(cpu_rewind_t *rw) {
+    rw->first = (rw->first + 1) & (CPU_REWIND_MAX - 1);
+    rw->count--;
+    rw->base--;
+    rw->dropped++;
+}
+
+int cpu_rewind_checkpoint(cpu_rewind_t *rw) {
+    cpu_state_t *st = rw->st;
+
+    // after a seek, the checkpoints past the base belong to another timeline
+    if (rw->count && rw->base != rw->count - 1) {
+        cpu_rewind_entry_t *e = cpu_rewind_entry(rw, rw->base);
+        rw->count = rw->base + 1;
+        rw->head = e->off + e->size;
+        rw->since_keyframe = 0;
+        for (u32 i = rw->base; !cpu_rewind_entry(rw, i)->keyframe && i > 0; i--)
+            rw->since_keyframe++;
+    }
+
+    // data is the optional full image, then the number of delta pages and the
+    // delta of each page changed since the base
+    u8 keyframe = rw->count == 0 || rw->since_keyframe + 1 >= rw->keyframe_every;
+    u8 *p = rw->scratch;
+    u32 key_size = 0;
+    if (keyframe) {
+        for (int page = 0; page < 256; page++)
+            p += cpu_rewind_encode(p, rw->mem + page * 256);
+        key_size = p - rw->scratch;
+    }
+    u8 *ndirty = p;
+    u16 n = 0;
+    p += 2;
+    for (int page = 0; page < 256; page++) {
+        if (!rw->dirty[page]) continue;
+        const u8 *cur = rw->mem + page * 256, *old = rw->shadow + page * 256;
+        if (memcmp(cur, old, 256) == 0) continue;
+        u8 x[256];
+        for (int i = 0; i < 256; i++) x[i] = cur[i] ^ old[i];
+        *p++ = page;
+        p += cpu_rewind_encode(p, x);
+        n++;
+    }
+    ndirty[0] = lo(n);
+    ndirty[1] = n >> 8;
+    u32 size = p - rw->scratch;
+    if (size > rw->cap) return CPU_REWIND_ENOSPC;
+
+    // make room: data is laid out oldest to newest from head, wrapping to 0
+    // when it doesn't fit before the end
+    u32 start = rw->head;
+    u8 wrap = start + size > rw->cap;
+    if (wrap) start = 0;
+    while (rw->count) {
+        cpu_rewind_entry_t *o = cpu_rewind_entry(rw, 0);
+        if ((wrap && o->off >= rw->head)
+                || (o->off < start + size && start < o->off + o->size)
+                || rw->count == CPU_REWIND_MAX)
+            cpu_rewind_drop_oldest(rw);
+        else
+            break;
+    }
+    memcpy(rw->ring + start, rw->scratch, size);
+    rw->head = start + size;
+
+    cpu_rewind_entry_t *e = cpu_rewind_entry(rw, rw->count);
+    e->cycles = st->cycles;
+    e->off = start;
+    e->size = size;
+    e->key_size = key_size;
+    e->keyframe = keyframe;
+    e->A = st->A;
+    e->X = st->X;
+    e->Y = st->Y;
+    e->S = st->S;
+    e->P = cpu_get_p(st);
+    e->IRQ = st->IRQ;
+    e->NMI = st->NMI;
+    e->RST = st->RST;
+    e->PC = st->PC;
+    e->dma_stall = st->dma_stall;
+    e->dma_src = st->dma_src;
+    e->dma_dst = st->dma_dst;
+    e->dma_len = st->dma_len;
+    e->DMA = st->DMA;
+    e->dma_flags = st->dma_flags;
+    e->dma_val = st->dma_val;
+    e->dma_put = st->dma_put;
+    rw->base = rw->count++;
+    rw->since_keyframe = keyframe ? 0 : rw->since_keyframe + 1;
+
+    for (int page = 0; page < 256; page++) {
+        if (!rw->dirty[page]) continue;
+        memcpy(rw->shadow + page * 256, rw->mem + page * 256, 256);
+        rw->dirty[page] = 0;
+        st->pages[page].flags |= CPU_PAGE_TRACK;
+    }
+    return 0;
+}
+
+// XORs checkpoint index's delta into mem, which moves it between index - 1
+// and index in either direction
+static void cpu_rewind_apply(cpu_rewind_t *rw, u32 index, u8 changed[256]) {
+    cpu_rewind_entry_t *e = cpu_rewind_entry(rw, index);
+    const u8 *p = rw->ring + e->off + e->key_size;
+    u32 n = p[0] | hi(p[1]);
+    p += 2;
+    for (u32 i = 0; i < n; i++) {
+        u8 page = *p++;
+        p += cpu_rewind_decode(p, rw->mem + page * 256);
+        changed[page] = 1;
+    }
+}
+
+static void cpu_rewind_restore(cpu_rewind_t *rw, u32 target) {
+    cpu_state_t *st = rw->st;
+    u8 changed[256] = { 0 };
+
+    // undo the writes since the base checkpoint
+    for (int page = 0; page < 256; page++) {
+        if (!rw->dirty[page]) continue;
+        memcpy(rw->mem + page * 256, rw->shadow + page * 256, 256);
+        rw->dirty[page] = 0;
+        changed[page] = 1;
+    }
+
+    // then walk the deltas from the base, or from the closest keyframe
+    u32 from = rw->base;
+    u32 dist = from > target ? from - target : target - from;
+    for (u32 i = 0; i < rw->count; i++) {
+        u32 d = i > target ? i - target : target - i;
+        if (cpu_rewind_entry(rw, i)->keyframe && d < dist) {
+            from = i;
+            dist = d;
+        }
+    }
+    if (from != rw->base) {
+        const u8 *p = rw->ring + cpu_rewind_entry(rw, from)->off;
+        memset(rw->mem, 0, 0x10000);
+        for (int page = 0; page < 256; page++)
+            p += cpu_rewind_decode(p, rw->mem + page * 256);
+        memset(changed, 1, 256);
+    }
+    for (; from > target; from--) cpu_rewind_apply(rw, from, changed);
+    for (; from < target; from++) cpu_rewind_apply(rw, from + 1, changed);
+
+    for (int page = 0; page < 256; page++) {
+        if (!changed[page]) continue;
+        memcpy(rw->shadow + page * 256, rw->mem + page * 256, 256);
+        // memory changed behind the caches' back
+        cpu_invalidate(st, page << 8, 256);
+    }
+    cpu_rewind_arm(st);
+
+    cpu_rewind_entry_t *e = cpu_rewind_entry(rw, target);
+    st->A = e->A;
+    st->X = e->X;
+    st->Y = e->Y;
+    st->S = e->S;
+    cpu_set_p(st, e->P);
+    st->IRQ = e->IRQ;
+    st->NMI = e->NMI;
+    st->RST = e->RST;
+    st->PC = e->PC;
+    st->cycles = e->cycles;
+    st->idle_state = 0;
+    st->cyc_step = 0;
+    st->dma_stall = e->dma_stall;
+    st->dma_src = e->dma_src;
+    st->dma_dst = e->dma_dst;
+    st->dma_len = e->dma_len;
+    st->DMA = e->DMA;
+    st->dma_flags = e->dma_flags;
+    st->dma_val = e->dma_val;
+    st->dma_put = e->dma_put;
+    rw->base = target;
+}
+
+// replays one instruction, without skipping idle loops so replays stop at
+// exactly the cycle or instruction asked for
+static int cpu_rewind_exec(cpu_state_t *st) {
+    u64 next_event = st->next_event;
+    st->next_event = 0;
+    int res = cpu_exec(st);
+    st->next_event = next_event;
+    return res;
+}
+
+int cpu_rewind_seek(cpu_rewind_t *rw, u32 index) {
+    if (index >= rw->count) return CPU_REWIND_ERANGE;
+    cpu_rewind_restore(rw, index);
+    return 0;
+}
+
+int cpu_rewind_cycles(cpu_rewind_t *rw, u64 n) {
+    cpu_state_t *st = rw->st;
+    if (n > st->cycles) return CPU_REWIND_ERANGE;
+    u64 target = st->cycles - n;
+
+    // checkpoints past the base aren't on the current timeline
+    u32 i = rw->base + 1;
+    while (i > 0 && cpu_rewind_entry(rw, i - 1)->cycles > target) i--;
+    if (i == 0) return CPU_REWIND_ERANGE;
+    cpu_rewind_restore(rw, i - 1);
+    while (st->cycles < target)
+        if (cpu_rewind_exec(st) < 0) return CPU_REWIND_EEXEC;
+    return 0;
+}
+
+// instruction counts aren't recorded, so each interval back from now is
+// replayed once to count its instructions until the target is covered
+int cpu_rewind_instrs(cpu_rewind_t *rw, u64 n) {
+    cpu_state_t *st = rw->st;
+    if (n == 0) return 0;
+
+    u64 end = st->cycles, total = 0;
+    for (u32 i = rw->base + 1; i-- > 0; ) {
+        cpu_rewind_restore(rw, i);
+        u64 k = 0;
+        for (; st->cycles < end; k++)
+            if (cpu_rewind_exec(st) < 0) return CPU_REWIND_EEXEC;
+        cpu_rewind_restore(rw, i);
+        if (total + k >= n) {
+            for (u64 skip = total + k - n; skip > 0; skip--)
+                if (cpu_rewind_exec(st) < 0) return CPU_REWIND_EEXEC;
+            return 0;
+        }
+        total += k;
+        end = st->cycles;
+    }
+    return CPU_REWIND_ERANGE;
+}
@@ -0,0 +1,96 @@
+#ifndef __CPU_REWIND_H__
+#define __CPU_REWIND_H__
+
+#include "cpu.h"
+
+// Rewind buffer.
+//
+// The embedder calls cpu_rewind_checkpoint at instruction boundaries, e.g.
+// once per frame or after every cpu_run slice. Each checkpoint stores the CPU
+// registers and, for every page written since the previous checkpoint, the XOR
+// of the page's old and new contents, run-length encoded so that untouched
+// bytes cost nothing. Every keyframe_every-th checkpoint also stores the whole
+// 64 KiB image, so a seek never applies more than about keyframe_every deltas.
+//
+// Written pages are found through the write path: while a buffer is attached,
+// every page is flagged CPU_PAGE_TRACK, and the first write to it after a
+// checkpoint (mapped or through bus_write, from any core) marks it dirty and
+// clears the flag, so further writes to it take the fast path again.
+//
+// mem is the 64 KiB the CPU sees, indexed by address: only it is saved and
+// restored. Changes to it made outside the core (DMA, loading files) must be
+// reported with cpu_rewind_touch.
+//
+// Checkpoints live in a caller-provided ring of cap bytes. When it is full the
+// oldest checkpoints are dropped, so memory use is fixed however long the
+// machine runs. Nothing allocates.
+//
+// Checkpoints are numbered from 0 (oldest) to count - 1 (newest). Seeking moves
+// mem and st to any of them, forwards or backwards, and makes it the base. The
+// checkpoints after the base are dropped by the next cpu_rewind_checkpoint.
+//
+// cpu_rewind_cycles and cpu_rewind_instrs land between checkpoints by seeking
+// to one and replaying with cpu_exec. Replay calls the bus and tick callbacks
+// again, so it is only exact when they are deterministic; interrupt lines are
+// restored as they were at the checkpoint.
+
+#define CPU_REWIND_MAX 4096     // checkpoints kept at most, must be a power of 2
+#define CPU_REWIND_PAGE_MAX 514 // worst-case encoded size of one page
+
+// error codes
+#define CPU_REWIND_ENOSPC -1 // a checkpoint doesn't fit in the ring
+#define CPU_REWIND_ERANGE -2 // the target is older than the oldest checkpoint
+#define CPU_REWIND_EEXEC  -3 // replay hit an illegal opcode
+
+typedef struct {
+    u64 cycles;
+    u32 off, size;  // where its data lives in the ring
+    u32 key_size;   // bytes of full image before the delta, 0 if none
+    u8 keyframe;
+    u8 A, X, Y, S, P, IRQ, NMI, RST;
+    u16 PC;
+    // the pending stall or DMA request
+    u32 dma_stall;
+    u16 dma_src, dma_dst, dma_len;
+    u8 DMA, dma_flags, dma_val, dma_put;
+} cpu_rewind_entry_t;
+
+typedef struct cpu_rewind {
+    cpu_state_t *st;
+    u8 *mem;
+    u8 *ring;
+    u32 cap;
+    u32 head;           // end of the newest checkpoint's data
+    u32 keyframe_every;
+    u32 since_keyframe;
+
+    cpu_rewind_entry_t entries[CPU_REWIND_MAX]; // circular, from first
+    u32 first;
+    u32 count;
+    u32 base;           // checkpoint mem and the registers were last at
+
+    u64 dropped;        // checkpoints overwritten because the ring was full
+
+    u8 dirty[256];       // pages written since the base checkpoint
+    u8 shadow[0x10000];  // mem at the base checkpoint
+    u8 scratch[2 + 256 * (1 + CPU_REWIND_PAGE_MAX) + 256 * CPU_REWIND_PAGE_MAX];
+} cpu_rewind_t;
+
+// clears rw and attaches it to st, with ring as storage. takes a first
+// checkpoint (a keyframe) of the current state. a NULL rw detaches the buffer
+int cpu_rewind_attach(cpu_state_t *st, cpu_rewind_t *rw, u8 *mem, u8 *ring, u32 cap,
+        u32 keyframe_every);
+// records the current state as the newest checkpoint, dropping the ones after
+// the base. returns 0 or CPU_REWIND_ENOSPC
+int cpu_rewind_checkpoint(cpu_rewind_t *rw);
+// moves st and mem to checkpoint index. returns 0 or CPU_REWIND_ERANGE
+int cpu_rewind_seek(cpu_rewind_t *rw, u32 index);
+// goes back to the first instruction boundary at or after st->cycles - n
+int cpu_rewind_cycles(cpu_rewind_t *rw, u64 n);
+// goes back exactly n instructions (an interrupt entry counts as one). when
+// the ring holds fewer, stops at the oldest checkpoint with CPU_REWIND_ERANGE
+int cpu_rewind_instrs(cpu_rewind_t *rw, u64 n);
+// reports that [addr, addr+len) of mem was changed outside the core
+void cpu_rewind_touch(cpu_rewind_t *rw, u16 addr, u32 len);
+
+#endif
@@ -0,0 +1,152 @@
+#include "cpu_internal.h"
+#include "cpu_sched.h"
+#include <string.h>
+
+void cpu_sched_init(cpu_sched_t *s, cpu_state_t *st) {
+    memset(s, 0, sizeof(*s));
+    s->st = st;
+    for (int i = 0; i < CPU_SCHED_MAX; i++) s->free[i] = CPU_SCHED_MAX - 1 - i;
+    s->nfree = CPU_SCHED_MAX;
+}
+
+static bool cpu_sched_before(const cpu_sched_t *s, u8 a, u8 b) {
+    const cpu_sched_event_t *x = &s->events[a], *y = &s->events[b];
+    return x->when < y->when || (x->when == y->when && x->seq < y->seq);
+}
+
+static void cpu_sched_place(cpu_sched_t *s, u8 pos, u8 slot) {
+    s->heap[pos] = slot;
+    s->events[slot].heap = pos;
+}
+
+static void cpu_sched_up(cpu_sched_t *s, u8 pos) {
+    u8 slot = s->heap[pos];
+    while (pos > 0) {
+        u8 parent = (pos - 1) / 2;
+        if (!cpu_sched_before(s, slot, s->heap[parent])) break;
+        cpu_sched_place(s, pos, s->heap[parent]);
+        pos = parent;
+    }
+    cpu_sched_place(s, pos, slot);
+}
+
+static void cpu_sched_down(cpu_sched_t *s, u8 pos) {
+    u8 slot = s->heap[pos];
+    for (;;) {
+        u32 child = 2 * pos + 1;
+        if (child >= s->n) break;
+        if (child + 1 < s->n && cpu_sched_before(s, s->heap[child + 1], s->heap[child])) child++;
+        if (!cpu_sched_before(s, s->heap[child], slot)) break;
+        cpu_sched_place(s, pos, s->heap[child]);
+        pos = child;
+    }
+    cpu_sched_place(s, pos, slot);
+}
+
+// takes the event at heap position pos out and frees its slot
+static void cpu_sched_remove(cpu_sched_t *s, u8 pos) {
+    u8 slot = s->heap[pos];
+    s->events[slot].gen++;
+    s->free[s->nfree++] = slot;
+    if (pos == --s->n) return;
+    u8 last = s->heap[s->n];
+    cpu_sched_place(s, pos, last);
+    cpu_sched_down(s, pos);
+    cpu_sched_up(s, s->events[last].heap);
+}
+
+static int cpu_sched_push(cpu_sched_t *s, u64 when, void (*fn)(void *user, u64 when),
+        void *user, u8 line, u8 level) {
+    if (!s->nfree) return CPU_SCHED_ENOSPC;
+    u8 slot = s->free[--s->nfree];
+    cpu_sched_event_t *e = &s->events[slot];
+    e->when = when;
+    e->seq = s->seq++;
+    e->fn = fn;
+    e->user = user;
+    e->line = line;
+    e->level = level;
+    s->heap[s->n] = slot;
+    cpu_sched_up(s, s->n++);
+    return e->gen * CPU_SCHED_MAX + slot;
+}
+
+// the event with this id, or NULL if it isn't pending
+static cpu_sched_event_t *cpu_sched_find(cpu_sched_t *s, int id) {
+    if (id < 0) return NULL;
+    cpu_sched_event_t *e = &s->events[id % CPU_SCHED_MAX];
+    if (e->gen != (u16)(id / CPU_SCHED_MAX) || e->heap >= s->n
+            || s->heap[e->heap] != id % CPU_SCHED_MAX)
+        return NULL;
+    return e;
+}
+
+int cpu_sched_add(cpu_sched_t *s, u64 when, void (*fn)(void *user, u64 when), void *user) {
+    return cpu_sched_push(s, when, fn, user, 0, 0);
+}
+
+int cpu_sched_line(cpu_sched_t *s, u64 when, u8 line, u8 level) {
+    return cpu_sched_push(s, when, NULL, NULL, line, level);
+}
+
+int cpu_sched_move(cpu_sched_t *s, int id, u64 when) {
+    cpu_sched_event_t *e = cpu_sched_find(s, id);
+    if (!e) return CPU_SCHED_ENOENT;
+    // a moved event goes after the others already at its new timestamp
+    e->when = when;
+    e->seq = s->seq++;
+    cpu_sched_down(s, e->heap);
+    cpu_sched_up(s, e->heap);
+    return 0;
+}
+
+int cpu_sched_cancel(cpu_sched_t *s, int id) {
+    cpu_sched_event_t *e = cpu_sched_find(s, id);
+    if (!e) return CPU_SCHED_ENOENT;
+    cpu_sched_remove(s, e->heap);
+    return 0;
+}
+
+u64 cpu_sched_next(const cpu_sched_t *s) {
+    return s->n ? s->events[s->heap[0]].when : ~0ull;
+}
+
+void cpu_sched_fire(cpu_sched_t *s) {
+    cpu_state_t *st = s->st;
+    while (s->n && s->events[s->heap[0]].when <= st->cycles) {
+        // the slot is free again before the callback runs, so it can
+        // schedule its next occurrence
+        cpu_sched_event_t e = s->events[s->heap[0]];
+        cpu_sched_remove(s, 0);
+        s->fired++;
+        if (e.fn) {
+            e.fn(e.user, e.when);
+            continue;
+        }
+        switch (e.line) {
+            case CPU_SCHED_IRQ: st->IRQ = e.level; break;
+            case CPU_SCHED_NMI: st->NMI = e.level; break;
+            case CPU_SCHED_RST: st->RST = e.level; break;
+        }
+    }
+}
+
+int cpu_sched_run(cpu_sched_t *s, u64 until) {
+    cpu_state_t *st = s->st;
+    u64 next_event = st->next_event;
+    while (st->cycles < until) {
+        cpu_sched_fire(s);
+        u64 next = cpu_sched_next(s);
+        if (next > until) next = until;
+        u64 left = next - st->cycles;
+        st->next_event = next;
+        int res = cpu_run(st, left > 0xFFFFFFFF ? 0xFFFFFFFF : (u32)left);
+        if (res < 0) {
+            st->next_event = next_event;
+            return res == CPU_BREAK ? CPU_BREAK : CPU_SCHED_EEXEC;
+        }
+    }
+    cpu_sched_fire(s);
+    st->next_event = next_event;
+    return (int)(st->cycles - until);
+}
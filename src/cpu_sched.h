@@ -0,0 +1,83 @@
+#ifndef __CPU_SCHED_H__
+#define __CPU_SCHED_H__
+
+#include "cpu.h"
+
+// Event scheduler.
+//
+// Devices schedule callbacks and interrupt line changes at absolute cycle
+// timestamps instead of counting cycles in a tick callback. cpu_sched_run
+// runs the CPU with cpu_run up to the earliest pending event, fires every
+// event that is due, and repeats. Events fire at the first instruction
+// boundary at or after their timestamp, which is also where the core would
+// first notice a line raised from a tick callback on that cycle, so
+// interrupt timing is the same as with per-cycle polling.
+//
+// Events that share a timestamp fire in the order they were scheduled.
+// Callbacks get the cycle they were scheduled for; st->cycles may be a few
+// cycles past it, by the overshoot of the instruction that crossed it.
+// They may schedule, move and cancel events, including themselves, and
+// events scheduled in the past fire before the CPU runs again.
+//
+// While running, st->next_event is the timestamp of the next event, so idle
+// loops are fast-forwarded up to it (see cpu_idle.c). Devices must then only
+// change what the CPU sees from events.
+//
+// Events live in a caller-provided cpu_sched_t of CPU_SCHED_MAX slots, kept in
+// a binary min-heap. Nothing allocates.
+
+#define CPU_SCHED_MAX 64
+
+// error codes
+#define CPU_SCHED_ENOSPC -1 // all slots are in use
+#define CPU_SCHED_ENOENT -2 // the event already fired or was cancelled
+#define CPU_SCHED_EEXEC  -3 // the CPU hit an illegal opcode
+
+// interrupt lines, for cpu_sched_line
+#define CPU_SCHED_IRQ 0
+#define CPU_SCHED_NMI 1
+#define CPU_SCHED_RST 2
+
+typedef struct {
+    u64 when;
+    u64 seq;        // scheduling order, breaks timestamp ties
+    void (*fn)(void *user, u64 when);
+    void *user;
+    u8 line, level; // when fn is NULL: the line set and its new level
+    u8 heap;        // position in the heap
+    u16 gen;        // bumped every time the slot is freed
+} cpu_sched_event_t;
+
+typedef struct cpu_sched {
+    cpu_state_t *st;
+    cpu_sched_event_t events[CPU_SCHED_MAX];
+    u8 heap[CPU_SCHED_MAX]; // slots by (when, seq), earliest first
+    u8 n;                   // events pending
+    u8 free[CPU_SCHED_MAX]; // stack of free slots
+    u8 nfree;
+    u64 seq;
+    u64 fired;              // events fired so far
+} cpu_sched_t;
+
+// clears s and ties it to st
+void cpu_sched_init(cpu_sched_t *s, cpu_state_t *st);
+// calls fn(user, when) at cycle when. returns an event id (>= 0) or
+// CPU_SCHED_ENOSPC
+int cpu_sched_add(cpu_sched_t *s, u64 when, void (*fn)(void *user, u64 when), void *user);
+// sets an interrupt line of st to level at cycle when. returns an event id or
+// CPU_SCHED_ENOSPC
+int cpu_sched_line(cpu_sched_t *s, u64 when, u8 line, u8 level);
+// moves a pending event to cycle when. returns 0 or CPU_SCHED_ENOENT
+int cpu_sched_move(cpu_sched_t *s, int id, u64 when);
+// drops a pending event. returns 0 or CPU_SCHED_ENOENT
+int cpu_sched_cancel(cpu_sched_t *s, int id);
+// timestamp of the earliest pending event, ~0 if there is none
+u64 cpu_sched_next(const cpu_sched_t *s);
+// fires the events due by st->cycles, in order
+void cpu_sched_fire(cpu_sched_t *s);
+// runs the CPU and fires events until st->cycles reaches until. returns the
+// cycles it was overshot by, CPU_SCHED_EEXEC, or CPU_BREAK when the debugger
+// stopped it
+int cpu_sched_run(cpu_sched_t *s, u64 until);
+
+#endif
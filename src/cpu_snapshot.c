@@ -0,0 +1,110 @@
+#include "cpu_internal.h"
+#include "cpu_snapshot.h"
+#include <string.h>
+
+// fixed little-endian fields, whatever the host byte order
+static void cpu_put16(u8 *p, u16 v) { p[0] = lo(v); p[1] = v >> 8; }
+static void cpu_put32(u8 *p, u32 v) { cpu_put16(p, v & 0xFFFF); cpu_put16(p + 2, v >> 16); }
+static void cpu_put64(u8 *p, u64 v) { cpu_put32(p, (u32)v); cpu_put32(p + 4, (u32)(v >> 32)); }
+static u16 cpu_get16(const u8 *p) { return p[0] | hi(p[1]); }
+static u32 cpu_get32(const u8 *p) { return cpu_get16(p) | ((u32)cpu_get16(p + 2) << 16); }
+static u64 cpu_get64(const u8 *p) { return cpu_get32(p) | ((u64)cpu_get32(p + 4) << 32); }
+
+u32 cpu_snapshot_size(const cpu_snapshot_region_t *regions, u32 nregions) {
+    u32 size = CPU_SNAPSHOT_HEADER;
+    for (u32 i = 0; i < nregions; i++) size += CPU_SNAPSHOT_CHUNK_HEADER + regions[i].len;
+    return size;
+}
+
+int cpu_snapshot_save(cpu_state_t *st, const cpu_snapshot_region_t *regions, u32 nregions,
+        u8 *buf, u32 cap) {
+    if (st->cyc_step) return CPU_SNAPSHOT_EBUSY;
+    u32 size = cpu_snapshot_size(regions, nregions);
+    if (size > cap || nregions > 0xFFFF) return CPU_SNAPSHOT_ENOSPC;
+
+    memset(buf, 0, CPU_SNAPSHOT_HEADER);
+    cpu_put32(buf, CPU_SNAPSHOT_MAGIC);
+    cpu_put16(buf + 4, CPU_SNAPSHOT_VERSION);
+    cpu_put16(buf + 6, nregions);
+    buf[8] = st->A;
+    buf[9] = st->X;
+    buf[10] = st->Y;
+    buf[11] = st->S;
+    buf[12] = cpu_get_p(st);
+    buf[13] = st->IRQ;
+    buf[14] = st->NMI;
+    buf[15] = st->RST;
+    cpu_put16(buf + 16, st->PC);
+    cpu_put64(buf + 24, st->cycles);
+    cpu_put32(buf + 32, st->dma_stall);
+    cpu_put16(buf + 36, st->dma_src);
+    cpu_put16(buf + 38, st->dma_dst);
+    cpu_put16(buf + 40, st->dma_len);
+    buf[42] = st->DMA;
+    buf[43] = st->dma_flags;
+    buf[44] = st->dma_val;
+    buf[45] = st->dma_put;
+
+    u8 *p = buf + CPU_SNAPSHOT_HEADER;
+    for (u32 i = 0; i < nregions; i++) {
+        cpu_put32(p, regions[i].id);
+        cpu_put32(p + 4, regions[i].len);
+        memcpy(p + CPU_SNAPSHOT_CHUNK_HEADER, regions[i].data, regions[i].len);
+        p += CPU_SNAPSHOT_CHUNK_HEADER + regions[i].len;
+    }
+    return (int)size;
+}
+
+// finds the chunk for region r. returns its data, or NULL
+static const u8 *cpu_snapshot_find(const cpu_snapshot_region_t *r, const u8 *buf, u32 len) {
+    u32 n = cpu_get16(buf + 6), off = CPU_SNAPSHOT_HEADER;
+    for (u32 i = 0; i < n; i++) {
+        if (len - off < CPU_SNAPSHOT_CHUNK_HEADER) return NULL;
+        u32 id = cpu_get32(buf + off), clen = cpu_get32(buf + off + 4);
+        off += CPU_SNAPSHOT_CHUNK_HEADER;
+        if (len - off < clen) return NULL;
+        if (id == r->id && clen == r->len) return buf + off;
+        off += clen;
+    }
+    return NULL;
+}
+
+int cpu_snapshot_load(cpu_state_t *st, const cpu_snapshot_region_t *regions, u32 nregions,
+        const u8 *buf, u32 len) {
+    if (st->cyc_step) return CPU_SNAPSHOT_EBUSY;
+    if (len < CPU_SNAPSHOT_HEADER
+            || cpu_get32(buf) != CPU_SNAPSHOT_MAGIC
+            || cpu_get16(buf + 4) != CPU_SNAPSHOT_VERSION)
+        return CPU_SNAPSHOT_EFORMAT;
+
+    // check every region before touching anything, so a bad snapshot
+    // leaves st and memory as they were
+    for (u32 i = 0; i < nregions; i++)
+        if (!cpu_snapshot_find(&regions[i], buf, len)) return CPU_SNAPSHOT_EREGION;
+    for (u32 i = 0; i < nregions; i++)
+        memcpy(regions[i].data, cpu_snapshot_find(&regions[i], buf, len), regions[i].len);
+
+    st->A = buf[8];
+    st->X = buf[9];
+    st->Y = buf[10];
+    st->S = buf[11];
+    cpu_set_p(st, buf[12]);
+    st->IRQ = buf[13];
+    st->NMI = buf[14];
+    st->RST = buf[15];
+    st->PC = cpu_get16(buf + 16);
+    st->cycles = cpu_get64(buf + 24);
+    st->idle_state = 0;
+    st->dma_stall = cpu_get32(buf + 32);
+    st->dma_src = cpu_get16(buf + 36);
+    st->dma_dst = cpu_get16(buf + 38);
+    st->dma_len = cpu_get16(buf + 40);
+    st->DMA = buf[42];
+    st->dma_flags = buf[43];
+    st->dma_val = buf[44];
+    st->dma_put = buf[45];
+
+    // memory changed behind the caches' back
+    cpu_invalidate(st, 0, 0x10000);
+    return 0;
+}
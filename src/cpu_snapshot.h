@@ -0,0 +1,61 @@
+#ifndef __CPU_SNAPSHOT_H__
+#define __CPU_SNAPSHOT_H__
+
+#include "cpu.h"
+
+// Save states.
+//
+// A snapshot is a fixed 48-byte header followed by memory chunks, all little
+// endian:
+//
+//   0  u32 magic "I65S"       16 u16 PC
+//   4  u16 version            18 6 bytes reserved, 0
+//   6  u16 number of chunks   24 u64 cycles
+//   8  u8  A, X, Y, S         32 u32 stall cycles left, see cpu_dma.h
+//   12 u8  P (NV-BDIZC, as cpu_get_p), IRQ, NMI, RST
+//   36 u16 DMA src, dst, bytes left
+//   42 u8  DMA pending, flags, value read, write pending
+//   46 2 bytes reserved, 0
+//
+// then per chunk: u32 id, u32 length, length bytes of data.
+//
+// Memory is described by the embedder as a list of regions, each a tagged
+// host buffer (RAM, VRAM, mapper registers...). Saving writes one chunk per
+// region. Loading fills every region from the chunk with the same id and
+// length and skips chunks it wasn't given a region for. Callbacks, the page
+// table and attached caches are not saved: they belong to the host process,
+// and loading invalidates all cached and translated code. Both calls fail
+// with CPU_SNAPSHOT_EBUSY between two cpu_step_cycle calls of the same
+// instruction, as the state it latched isn't saved.
+//
+// Neither call allocates. Both only copy the header and the chunk data.
+
+#define CPU_SNAPSHOT_MAGIC 0x53353649 // "I65S"
+#define CPU_SNAPSHOT_VERSION 2
+#define CPU_SNAPSHOT_HEADER 48
+#define CPU_SNAPSHOT_CHUNK_HEADER 8
+
+// error codes returned by cpu_snapshot_save/load
+#define CPU_SNAPSHOT_ENOSPC  -1 // buffer too small
+#define CPU_SNAPSHOT_EFORMAT -2 // bad magic, unknown version or truncated
+#define CPU_SNAPSHOT_EREGION -3 // a region has no chunk of the same id and length
+#define CPU_SNAPSHOT_EBUSY   -4 // st is midway through a cpu_step_cycle instruction
+
+typedef struct {
+    u32 id;   // caller-chosen tag, e.g. a fourcc
+    u8 *data;
+    u32 len;
+} cpu_snapshot_region_t;
+
+// bytes needed to save st with these regions
+u32 cpu_snapshot_size(const cpu_snapshot_region_t *regions, u32 nregions);
+// writes a snapshot to buf. returns its size, CPU_SNAPSHOT_ENOSPC or
+// CPU_SNAPSHOT_EBUSY
+int cpu_snapshot_save(cpu_state_t *st, const cpu_snapshot_region_t *regions, u32 nregions,
+        u8 *buf, u32 cap);
+// restores st and the regions from the snapshot in buf. st is only changed
+// when 0 is returned
+int cpu_snapshot_load(cpu_state_t *st, const cpu_snapshot_region_t *regions, u32 nregions,
+        const u8 *buf, u32 len);
+
+#endif
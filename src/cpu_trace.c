@@ -0,0 +1,229 @@
+#include "cpu_internal.h"
+#include "cpu_trace.h"
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define CPU_TRACE_MMAP
+#endif
+
+static void cpu_trace_header(u8 buf[CPU_TRACE_HEADER], u32 flags) {
+    u32 magic = CPU_TRACE_MAGIC;
+    u16 version = CPU_TRACE_VERSION, size = sizeof(cpu_trace_rec_t);
+    memset(buf, 0, CPU_TRACE_HEADER);
+    memcpy(buf, &magic, 4);
+    memcpy(buf + 4, &version, 2);
+    memcpy(buf + 6, &size, 2);
+    memcpy(buf + 8, &flags, 4);
+}
+
+_Static_assert(sizeof(cpu_trace_rec_t) == 16, "cpu_trace_rec_t layout");
+
+int cpu_trace_open(cpu_trace_t *tr, FILE *out, cpu_trace_rec_t *recs, u32 nrecs, u32 flags) {
+    memset(tr, 0, sizeof(*tr));
+    tr->recs = recs;
+    tr->mask = nrecs - 1;
+    tr->flags = flags;
+    tr->out = out;
+    tr->fd = -1;
+    u8 header[CPU_TRACE_HEADER];
+    cpu_trace_header(header, flags & CPU_TRACE_BUS);
+    return fwrite(header, CPU_TRACE_HEADER, 1, out) == 1 ? 0 : -1;
+}
+
+int cpu_trace_map(cpu_trace_t *tr, const char *path, u64 nrecs, u32 flags) {
+#ifdef CPU_TRACE_MMAP
+    memset(tr, 0, sizeof(*tr));
+    u64 len = CPU_TRACE_HEADER + nrecs * sizeof(cpu_trace_rec_t);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    void *map = ftruncate(fd, len) == 0
+        ? mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    tr->map = map;
+    tr->map_cap = nrecs;
+    tr->fd = fd;
+    tr->recs = (cpu_trace_rec_t *)(tr->map + CPU_TRACE_HEADER);
+    tr->mask = ~(u64)0;
+    tr->flags = flags & ~CPU_TRACE_ASYNC;
+    cpu_trace_header(tr->map, flags & CPU_TRACE_BUS);
+    return 0;
+#else
+    (void)tr; (void)path; (void)nrecs; (void)flags;
+    return -1;
+#endif
+}
+
+int64_t cpu_trace_flush(cpu_trace_t *tr) {
+    // mapped records are already in the file
+    if (tr->map) return 0;
+    u64 head = atomic_load_explicit(&tr->head, memory_order_acquire);
+    u64 tail = atomic_load_explicit(&tr->tail, memory_order_relaxed);
+    u64 n = head - tail;
+    while (tail != head) {
+        u64 i = tail & tr->mask, len = head - tail;
+        if (len > tr->mask + 1 - i) len = tr->mask + 1 - i;
+        if (fwrite(tr->recs + i, sizeof(cpu_trace_rec_t), len, tr->out) != len) {
+            // don't let the CPU thread wait forever on a dead file
+            tr->dropped += head - tail;
+            atomic_store_explicit(&tr->tail, head, memory_order_release);
+            return -1;
+        }
+        tail += len;
+        atomic_store_explicit(&tr->tail, tail, memory_order_release);
+    }
+    return n;
+}
+
+int cpu_trace_close(cpu_trace_t *tr) {
+#ifdef CPU_TRACE_MMAP
+    if (tr->map) {
+        u64 n = atomic_load_explicit(&tr->head, memory_order_relaxed);
+        if (n > tr->map_cap) n = tr->map_cap;
+        u64 cap = CPU_TRACE_HEADER + tr->map_cap * sizeof(cpu_trace_rec_t);
+        int res = munmap(tr->map, cap);
+        if (ftruncate(tr->fd, CPU_TRACE_HEADER + n * sizeof(cpu_trace_rec_t)) != 0) res = -1;
+        if (close(tr->fd) != 0) res = -1;
+        tr->map = NULL;
+        return res ? -1 : 0;
+    }
+#endif
+    if (cpu_trace_flush(tr) < 0) return -1;
+    return fflush(tr->out) == 0 ? 0 : -1;
+}
+
+static void cpu_trace_push(cpu_trace_t *tr, const cpu_trace_rec_t *r) {
+    u64 head = atomic_load_explicit(&tr->head, memory_order_relaxed);
+    if (tr->map) {
+        if (head >= tr->map_cap) {
+            tr->dropped++;
+            return;
+        }
+    } else if (unlikely(head - tr->tail_seen > tr->mask)) {
+        for (;;) {
+            tr->tail_seen = atomic_load_explicit(&tr->tail, memory_order_acquire);
+            if (head - tr->tail_seen <= tr->mask) break;
+            if (!(tr->flags & CPU_TRACE_ASYNC)) cpu_trace_flush(tr);
+        }
+    }
+    tr->recs[head & tr->mask] = *r;
+    atomic_store_explicit(&tr->head, head + 1, memory_order_release);
+}
+
+static void cpu_trace_regs(cpu_state_t *st, cpu_trace_rec_t *r) {
+    r->a = st->A;
+    r->x = st->X;
+    r->y = st->Y;
+    r->s = st->S;
+    r->p = cpu_pack_p(st, 1);
+}
+
+static void cpu_trace_cycles(cpu_trace_rec_t *r, u64 cycles) {
+    r->cycles = (u32)cycles;
+    r->cycles_hi = (u8)(cycles >> 32);
+}
+
+// operand bytes are only peeked from mapped pages: reading I/O early could
+// have side effects
+static u8 cpu_trace_peek(cpu_state_t *st, u16 addr) {
+    cpu_trace_t *tr = st->trace;
+    u8 *page = (tr->flags & CPU_TRACE_BUS ? tr->pages : st->pages)[addr >> 8].read;
+    return page ? page[lo(addr)] : 0;
+}
+
+void cpu_trace_instr(cpu_state_t *st, u8 opc) {
+    cpu_trace_rec_t r;
+    u16 pc = st->PC - 1;
+    cpu_trace_cycles(&r, st->cycles);
+    r.kind = CPU_TRACE_INSTR;
+    r.pc = pc;
+    r.opc = opc;
+    r.op[0] = cpu_trace_peek(st, pc + 1);
+    r.op[1] = cpu_trace_peek(st, pc + 2);
+    cpu_trace_regs(st, &r);
+    cpu_trace_push(st->trace, &r);
+}
+
+void cpu_trace_irq(cpu_state_t *st, int irq) {
+    cpu_trace_rec_t r = { 0 };
+    cpu_trace_cycles(&r, st->cycles - 7);
+    r.kind = CPU_TRACE_IRQ;
+    r.pc = st->PC;
+    r.opc = irq;
+    cpu_trace_regs(st, &r);
+    cpu_trace_push(st->trace, &r);
+}
+
+static void cpu_trace_bus(cpu_trace_t *tr, u8 kind, u16 addr, u8 val) {
+    cpu_trace_rec_t r = { 0 };
+    cpu_trace_cycles(&r, tr->st->cycles);
+    r.kind = kind;
+    r.pc = addr;
+    r.opc = val;
+    cpu_trace_push(tr, &r);
+}
+
+// while bus tracing, st's page table has no host pointers, so every access
+// ends up here and is forwarded like cpu_read/cpu_write would have
+static u8 cpu_trace_bus_read(void *user, u16 addr) {
+    cpu_trace_t *tr = user;
+    u8 *page = tr->pages[addr >> 8].read;
+    u8 val = page ? page[lo(addr)] : tr->bus_read(tr->user, addr);
+    cpu_trace_bus(tr, CPU_TRACE_READ, addr, val);
+    return val;
+}
+
+static void cpu_trace_bus_write(void *user, u8 val, u16 addr) {
+    cpu_trace_t *tr = user;
+    u8 *page = tr->pages[addr >> 8].write;
+    cpu_trace_bus(tr, CPU_TRACE_WRITE, addr, val);
+    if (page) page[lo(addr)] = val;
+    else tr->bus_write(tr->user, val, addr);
+}
+
+static void cpu_trace_tick(void *user) {
+    cpu_trace_t *tr = user;
+    tr->tick(tr->user);
+}
+
+int cpu_trace_attach(cpu_state_t *st, cpu_trace_t *tr) {
+#ifdef CPU_BUS_READ
+    // the bound bus functions would get the recorder as their machine
+    if (tr && (tr->flags & CPU_TRACE_BUS)) return CPU_TRACE_EBUS;
+#endif
+    cpu_trace_t *old = st->trace;
+    if (old && (old->flags & CPU_TRACE_BUS)) {
+        // flags may have changed while attached (code pages, rewind), keep them
+        for (int page = 0; page < 256; page++) {
+            st->pages[page].read = old->pages[page].read;
+            st->pages[page].write = old->pages[page].write;
+        }
+        st->user = old->user;
+        st->bus_read = old->bus_read;
+        st->bus_write = old->bus_write;
+        st->tick = old->tick;
+    }
+    st->trace = tr;
+    if (!tr) return 0;
+
+    tr->st = st;
+    if (tr->flags & CPU_TRACE_BUS) {
+        memcpy(tr->pages, st->pages, sizeof(tr->pages));
+        for (int page = 0; page < 256; page++)
+            st->pages[page].read = st->pages[page].write = NULL;
+        tr->user = st->user;
+        tr->bus_read = st->bus_read;
+        tr->bus_write = st->bus_write;
+        tr->tick = st->tick;
+        st->user = tr;
+        st->bus_read = &cpu_trace_bus_read;
+        st->bus_write = &cpu_trace_bus_write;
+        if (st->tick) st->tick = &cpu_trace_tick;
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#ifndef __CPU_TRACE_H__
+#define __CPU_TRACE_H__
+
+#include "cpu.h"
+#include <stdatomic.h>
+#include <stdio.h>
+
+// Binary execution trace.
+//
+// While a recorder is attached, cpu_exec appends one 16-byte record per
+// instruction (and per interrupt taken) to a single-producer single-consumer
+// ring, and cpu_run steps through cpu_exec instead of its fast paths. With
+// CPU_TRACE_BUS, every memory access is recorded too, in the order the core
+// performs them, so an instruction's record comes right after its opcode
+// fetch. When detached the only cost is a NULL check per instruction.
+//
+// A trace file is a 16-byte header followed by records, in host byte order:
+//
+//   0 u32 magic "I65T"    6 u16 record size (16)
+//   4 u16 version         8 u32 flags (CPU_TRACE_BUS), 12 u32 reserved, 0
+//
+// Records reach the file in one of two ways:
+//   - streaming: cpu_trace_open takes a FILE and a ring of records.
+//     cpu_trace_flush writes everything recorded so far with at most two
+//     large writes. By default the CPU thread flushes whenever the ring
+//     fills; with CPU_TRACE_ASYNC another thread is expected to call
+//     cpu_trace_flush and the CPU thread waits for it instead
+//   - mapped: cpu_trace_map records straight into an mmap'd file of fixed
+//     capacity. Records past the capacity are dropped and counted
+//
+// tools/cpu_trace_dump.c disassembles trace files and diffs two of them.
+//
+// Bus tracing works by sending every access through the recorder's own
+// callbacks (with the recorder as user pointer), which then use the page
+// table and callbacks the state had when the recorder was attached. Don't
+// call cpu_map or change the callbacks while it is attached. The header-only
+// build (cpu_inline.h) calls its bus functions directly, with st->user as
+// the machine, so it can't record bus accesses and refuses CPU_TRACE_BUS.
+
+#define CPU_TRACE_MAGIC 0x54353649 // "I65T"
+#define CPU_TRACE_VERSION 1
+#define CPU_TRACE_HEADER 16
+
+// flags
+#define CPU_TRACE_BUS   0x01 // also record bus reads and writes
+#define CPU_TRACE_ASYNC 0x02 // a consumer thread calls cpu_trace_flush
+
+// returned by cpu_trace_attach
+#define CPU_TRACE_EBUS -1 // CPU_TRACE_BUS in the header-only build
+
+// record kinds
+#define CPU_TRACE_INSTR 0 // opc and op are the instruction bytes
+#define CPU_TRACE_IRQ   1 // opc is 1 (NMI), 2 (IRQ) or 3 (RST), pc the vector
+#define CPU_TRACE_READ  2 // pc is the address, opc the value
+#define CPU_TRACE_WRITE 3
+
+typedef struct {
+    u32 cycles;    // cycle count when the instruction or access started,
+    u8 cycles_hi;  // modulo 2^40
+    u8 kind;
+    u16 pc;
+    u8 opc;
+    u8 op[2];      // operand bytes, 0 unless they are on a mapped page
+    u8 a, x, y, s;
+    u8 p;          // as cpu_get_p
+} cpu_trace_rec_t;
+
+typedef struct cpu_trace {
+    cpu_trace_rec_t *recs;
+    u64 mask;              // ring size - 1, or ~0 when mapped
+    u32 flags;
+    _Atomic u64 head;      // records produced, written by the CPU thread
+    _Atomic u64 tail;      // records consumed, written by cpu_trace_flush
+    u64 tail_seen;         // producer's cached copy of tail
+    FILE *out;
+    u64 dropped;           // records past a mapped file's capacity or lost to write errors
+
+    // mapped file
+    u8 *map;
+    u64 map_cap;
+    int fd;
+
+    // bus tracing: what the state had before the recorder was attached
+    cpu_state_t *st;
+    void *user;
+    u8 (*bus_read)(void *user, u16 addr);
+    void (*bus_write)(void *user, u8 val, u16 addr);
+    void (*tick)(void *user);
+    cpu_page_t pages[256];
+} cpu_trace_t;
+
+// streams to out through recs, a ring of nrecs (a power of 2) records, and
+// writes the file header. returns 0, or -1 if the header can't be written
+int cpu_trace_open(cpu_trace_t *tr, FILE *out, cpu_trace_rec_t *recs, u32 nrecs, u32 flags);
+// records into a new file at path with room for nrecs records. returns 0 or
+// -1. not available on non-POSIX hosts
+int cpu_trace_map(cpu_trace_t *tr, const char *path, u64 nrecs, u32 flags);
+// attaches tr to st. a NULL tr detaches the current recorder, restoring the
+// page table and callbacks it replaced. returns 0 or CPU_TRACE_EBUS, leaving
+// st as it was
+int cpu_trace_attach(cpu_state_t *st, cpu_trace_t *tr);
+// writes out the records produced so far. safe to call from one thread other
+// than the CPU thread. returns the records written, or -1 on a write error
+int64_t cpu_trace_flush(cpu_trace_t *tr);
+// flushes and closes a detached recorder, trimming a mapped file to the
+// records actually written. the FILE passed to cpu_trace_open stays open
+int cpu_trace_close(cpu_trace_t *tr);
+
+#endif
@@ -1,49 +1,1324 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "cpu.h"
+#include "cpu_bbc.h"
+#include "cpu_jit.h"
+#include "cpu_snapshot.h"
+#include "cpu_rewind.h"
+#include "cpu_trace.h"
+#include "cpu_prof.h"
+#include "cpu_sched.h"
+#include "cpu_cycle.h"
+#include "cpu_batch.h"
+#include "cpu_image.h"
+#include "cpu_debug.h"
+#include "cpu_aot.h"
+#include "cpu_cosim.h"
+#include "cpu_dma.h"
+
+// cycles taken by the instruction-stepped run below to reach success
+#define SUCCESS_CYCLES 84024376
+// cycles recorded by the trace mode
+#define TRACE_CYCLES 200000
+// stops checked by the debug mode
+#define DEBUG_STOPS 1000
+// accesses compared by the bus log mode
+#define BUS_LOG_ACCESSES 400000
+// cycles run by the cosim mode
+#define COSIM_CYCLES 2000000
+// cycles run by the dma mode
+#define DMA_CYCLES 300000
+// lanes of the batch mode, started this many cycles apart and run this long
+#define BATCH_LANES 64
+#define BATCH_SPACING 1500000
+#define BATCH_CYCLES 1000000
+
+typedef struct {
+    u8 mem[0x10000];
+} machine_t;
+
+#ifdef FUNCTIONAL_INLINE
+// the core compiled in here with the bus bound at compile time, see
+// cpu_inline.h. the modes that install bus callbacks of their own don't
+// apply
+#define CPU_BUS_READ(user, addr) (((machine_t *)(user))->mem[addr])
+#define CPU_BUS_WRITE(user, val, addr) (((machine_t *)(user))->mem[addr] = (val))
+#ifdef FUNCTIONAL_INLINE_TICK
+// and a tick, counted to check against the cycles run
+u64 inline_ticks;
+#define CPU_TICK(user) ((void)(user), inline_ticks++)
+#endif
+#include "cpu_inline.h"
+#endif
 
-int tick_ctr = 0;
 int inst_ctr = 0;
 cpu_state_t cpu;
-u8 mem[0x10000];
+machine_t machine;
+cpu_bbc_t bbc;
+u8 snap[3][CPU_SNAPSHOT_HEADER + CPU_SNAPSHOT_CHUNK_HEADER + 0x10000];
+cpu_rewind_t rewinder;
+u8 rewind_ring[4 << 20];
+cpu_trace_t tracer;
+cpu_trace_rec_t trace_ring[1 << 14];
+cpu_prof_t prof;
+// the machine each of the checks below sets up for itself, one at a time
+machine_t test_machine;
+cpu_state_t test_cpu;
+cpu_bbc_t test_bbc;
+u64 idle_polls;
+cpu_sched_t sched;
+machine_t shadow_machine;
+cpu_state_t shadow;
+cpu_batch_t batch;
+machine_t batch_machines[BATCH_LANES];
+machine_t batch_ref;
+cpu_image_t image;
+cpu_debug_t debugger;
+cpu_aot_t aot;
+typedef struct {
+    u64 cycle;
+    u16 addr;
+    u8 val;
+    u8 write;
+} access_t;
+access_t bus_ref[BUS_LOG_ACCESSES];
+access_t bus_got[BUS_LOG_ACCESSES];
+u32 bus_nref, bus_ngot;
+u64 bus_logged;
+#ifdef FUNCTIONAL_AOT
+// the test image translated by cpu_recomp, see CMakeLists.txt
+extern const cpu_aot_prog_t functional_aot;
+cpu_aot_t restore_aot;
+cpu_aot_t mmio_aot;
+cpu_rewind_t restore_rewinder;
+u8 restore_ring[1 << 20];
+#endif
+cpu_cosim_t cosim;
+u64 dma_oam, dma_started, dma_ticks;
+u8 dma_oam_addr, dma_misaligned;
+u8 debug_stop;
+u16 debug_addr;
+u8 debug_val;
+
+u8 bus_read_fn(void *user, u16 addr) { return ((machine_t*)user)->mem[addr]; }
+void bus_write_fn(void *user, u8 val, u16 addr) { ((machine_t*)user)->mem[addr] = val; }
+
+// clears m and st, loads len bytes of prog at org and maps the whole of m as
+// RAM, with the callbacks above for what gets unmapped. st starts at org with
+// interrupts disabled
+static void machine_setup(machine_t *m, cpu_state_t *st, const u8 *prog, u32 len, u16 org) {
+    memset(m, 0, sizeof(*m));
+    memset(st, 0, sizeof(*st));
+    memcpy(m->mem + org, prog, len);
+    st->user = m;
+    st->bus_read = &bus_read_fn;
+    st->bus_write = &bus_write_fn;
+    cpu_map(st, 0, 0x10000, m->mem, 0);
+    st->PC = org;
+    st->S = 0xFF;
+    st->I = 1;
+}
+
+// copies the test's machine and CPU where they are to m and st, mapped as
+// RAM or left to the callbacks
+static void machine_copy(machine_t *m, cpu_state_t *st, int map) {
+    *m = machine;
+    *st = cpu;
+    st->user = m;
+    if (map) cpu_map(st, 0, 0x10000, m->mem, 0);
+    else memset(st->pages, 0, sizeof(st->pages));
+}
+
+// saves a snapshot, runs on, restores it and runs the same cycles again.
+// both runs must end in the same state
+static int check_snapshot(void) {
+    cpu_snapshot_region_t ram = { 0x4D415221, machine.mem, 0x10000 }; // "!RAM"
+    if (cpu_snapshot_save(&cpu, &ram, 1, snap[0], sizeof(snap[0])) < 0) return 0;
+    cpu_run(&cpu, 100000);
+    cpu_snapshot_save(&cpu, &ram, 1, snap[1], sizeof(snap[1]));
+    memset(machine.mem, 0, sizeof(machine.mem));
+    if (cpu_snapshot_load(&cpu, &ram, 1, snap[0], sizeof(snap[0])) != 0) return 0;
+    cpu_run(&cpu, 100000);
+    cpu_snapshot_save(&cpu, &ram, 1, snap[2], sizeof(snap[2]));
+    return memcmp(snap[1], snap[2], sizeof(snap[1])) == 0;
+}
+
+// steps 20000 instructions and runs 100 slices with checkpoints in between,
+// rewinding each time. both rewinds must land on the state saved before
+static int check_rewind(void) {
+    cpu_snapshot_region_t ram = { 0x4D415221, machine.mem, 0x10000 }; // "!RAM"
+    if (cpu_rewind_checkpoint(&rewinder) != 0) return 0;
+    cpu_snapshot_save(&cpu, &ram, 1, snap[0], sizeof(snap[0]));
+    u64 start = cpu.cycles;
+
+    for (int i = 1; i <= 20000; i++) {
+        cpu_exec(&cpu);
+        if (i % 1000 == 0) cpu_rewind_checkpoint(&rewinder);
+    }
+    cpu_exec(&cpu);
+    if (cpu_rewind_instrs(&rewinder, 20001) != 0) return 0;
+    cpu_snapshot_save(&cpu, &ram, 1, snap[1], sizeof(snap[1]));
+    if (memcmp(snap[0], snap[1], sizeof(snap[0])) != 0) return 0;
+
+    for (int i = 0; i < 100; i++) {
+        cpu_run(&cpu, 1000);
+        cpu_rewind_checkpoint(&rewinder);
+    }
+    cpu_run(&cpu, 500);
+    if (cpu_rewind_cycles(&rewinder, cpu.cycles - start) != 0) return 0;
+    cpu_snapshot_save(&cpu, &ram, 1, snap[1], sizeof(snap[1]));
+    return memcmp(snap[0], snap[1], sizeof(snap[0])) == 0;
+}
+
+// every instruction record must follow the bus read of its opcode
+static int check_trace(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    u8 header[CPU_TRACE_HEADER];
+    u32 magic = 0;
+    if (fread(header, CPU_TRACE_HEADER, 1, f) == 1) memcpy(&magic, header, 4);
+    cpu_trace_rec_t prev = { 0 }, r;
+    u64 instrs = 0;
+    int ok = magic == CPU_TRACE_MAGIC;
+    while (ok && fread(&r, sizeof(r), 1, f) == 1) {
+        if (r.kind == CPU_TRACE_INSTR) {
+            ok = prev.kind == CPU_TRACE_READ && prev.pc == r.pc && prev.opc == r.opc
+                && prev.cycles == r.cycles;
+            instrs++;
+        }
+        prev = r;
+    }
+    fclose(f);
+    printf("trace: %llu instructions\n", (unsigned long long)instrs);
+    return ok && instrs > 0;
+}
+
+// every cycle since the profiler was attached must show up once in each
+// histogram and in the call tree
+static int check_profile(u64 cycles) {
+    u64 ops = prof.irq_cycles, pcs = prof.irq_cycles, helpers = prof.irq_cycles, tree = 0;
+    for (int i = 0; i < 256; i++) ops += prof.op_cycles[i];
+    for (int i = 0; i < 0x10000; i++) pcs += prof.pc_cycles[i];
+    for (int i = 0; i < CPU_PROF_NHELPERS; i++) helpers += prof.helper_cycles[i];
+    for (u32 i = 0; i < prof.nnodes; i++) tree += prof.nodes[i].cycles;
+    return ops == cycles && pcs == cycles && helpers == cycles && tree == cycles;
+}
+
+// status port for check_idle: bit 7 rises at cycle 50000
+u8 idle_read_fn(void *user, u16 addr) {
+    idle_polls++;
+    return test_cpu.cycles >= 50000 ? 0x80 : 0;
+}
+
+static const u8 idle_prog[] = {
+    0x58,                   // 0200 cli
+    0xAD, 0x00, 0xD0,       // 0201 lda $d000
+    0x10, 0xFB,             // 0204 bpl $0201
+    0xE6, 0x10,             // 0206 inc $10
+    0xA5, 0x11,             // 0208 lda $11
+    0xF0, 0xFC,             // 020a beq $0208
+    0x4C, 0x0C, 0x02,       // 020c jmp $020c
+};
+
+// polls a status port until cycle 50000, waits for an IRQ raised at 120000
+// and traps until 200000, stepped (engine 0), with cpu_run (1) or with the
+// block cache (2). returns the number of polls, and the final state in buf
+static u64 run_idle(int engine, int skip, char buf[96]) {
+    machine_setup(&test_machine, &test_cpu, idle_prog, sizeof(idle_prog), 0x200);
+    memcpy(test_machine.mem + 0x300, (u8[]){ 0xE6, 0x11, 0x40 }, 3); // inc $11, rti
+    test_machine.mem[0xFFFF] = 0x03;
+    test_cpu.bus_read = &idle_read_fn;
+    cpu_map(&test_cpu, 0xD000, 0x100, NULL, CPU_PAGE_MMIO | CPU_PAGE_POLL);
+    if (engine == 2) cpu_bbc_attach(&test_cpu, &test_bbc);
+    idle_polls = 0;
+
+    while (test_cpu.cycles < 200000) {
+        u64 c = test_cpu.cycles, next = c < 50000 ? 50000 : c < 120000 ? 120000 : 200000;
+        if (skip) test_cpu.next_event = next;
+        if (engine == 0) {
+            while (test_cpu.cycles < next) cpu_exec(&test_cpu);
+        } else {
+            cpu_run(&test_cpu, next - c);
+        }
+        if (c < 120000 && test_cpu.cycles >= 120000) test_cpu.IRQ = 1;
+    }
+    char regs[64];
+    cpu_state_to_str(&test_cpu, regs);
+    snprintf(buf, 96, "%s %llu %02x %02x", regs, (unsigned long long)test_cpu.cycles,
+            test_machine.mem[0x10], test_machine.mem[0x11]);
+    return idle_polls;
+}
+
+// skipping idle loops must end in the same state, with far fewer polls
+static int check_idle(void) {
+    for (int engine = 0; engine < 3; engine++) {
+        char ran[96], skipped[96];
+        u64 ran_polls = run_idle(engine, 0, ran);
+        u64 skipped_polls = run_idle(engine, 1, skipped);
+        printf("idle: engine %d, %s, %llu polls run, %llu skipped\n", engine, skipped,
+                (unsigned long long)ran_polls, (unsigned long long)skipped_polls);
+        if (strcmp(ran, skipped) != 0 || skipped_polls * 10 > ran_polls) return 0;
+    }
+    return 1;
+}
+
+// the timer for check_sched: IRQ every 1000 cycles, one NMI at 7000
+static void sched_tick_fn(void *user) {
+    if (test_cpu.cycles % 1000 == 0) test_cpu.IRQ = 1;
+    if (test_cpu.cycles == 7000) test_cpu.NMI = 1;
+}
+
+static void sched_timer_fn(void *user, u64 when) {
+    test_cpu.IRQ = 1;
+    cpu_sched_add(&sched, when + 1000, &sched_timer_fn, user);
+}
+
+static void sched_poke_fn(void *user, u64 when) {
+    ((machine_t*)user)->mem[0x20] = 1;
+}
+
+// counts in a loop, with an IRQ handler at $0300 and an NMI handler at $0310
+static void sched_setup(void) {
+    static const u8 prog[] = {
+        0x58,                   // 0200 cli
+        0xE6, 0x10,             // 0201 inc $10
+        0x4C, 0x01, 0x02,       // 0203 jmp $0201
+    };
+    machine_setup(&test_machine, &test_cpu, prog, sizeof(prog), 0x200);
+    memcpy(test_machine.mem + 0x300, (u8[]){ 0xE6, 0x11, 0x40 }, 3); // inc $11, rti
+    memcpy(test_machine.mem + 0x310, (u8[]){ 0xE6, 0x12, 0x40 }, 3); // inc $12, rti
+    test_machine.mem[0xFFFA] = 0x10;
+    test_machine.mem[0xFFFB] = test_machine.mem[0xFFFF] = 0x03;
+}
+
+static void sched_result(char buf[96]) {
+    char regs[64];
+    cpu_state_to_str(&test_cpu, regs);
+    snprintf(buf, 96, "%s %llu %02x %02x %02x %02x", regs, (unsigned long long)test_cpu.cycles,
+            test_machine.mem[0x10], test_machine.mem[0x11], test_machine.mem[0x12],
+            test_machine.mem[0x20]);
+}
+
+// interrupts raised by scheduled events must be taken exactly where the same
+// interrupts raised from a tick callback are
+static int check_sched(void) {
+    char ticked[96], scheduled[96];
+    sched_setup();
+    test_cpu.tick = &sched_tick_fn;
+    cpu_run(&test_cpu, 100000);
+    sched_result(ticked);
+
+    sched_setup();
+    cpu_sched_init(&sched, &test_cpu);
+    cpu_sched_add(&sched, 1000, &sched_timer_fn, &test_machine);
+    int nmi = cpu_sched_line(&sched, 5000, CPU_SCHED_NMI, 1);
+    int poke = cpu_sched_add(&sched, 3000, &sched_poke_fn, &test_machine);
+    if (cpu_sched_move(&sched, nmi, 7000) != 0 || cpu_sched_cancel(&sched, poke) != 0
+            || cpu_sched_cancel(&sched, poke) != CPU_SCHED_ENOENT)
+        return 0;
+    int res = cpu_sched_run(&sched, 100000);
+    sched_result(scheduled);
+    printf("sched: %s, %llu events fired\n", scheduled, (unsigned long long)sched.fired);
+    return res >= 0 && strcmp(ticked, scheduled) == 0;
+}
+
+// a flat loop raising the same interrupts as sched_tick_fn between cycles
+// must end where cpu_run with the tick callback does
+static int check_cycle_irq(void) {
+    char ticked[96], stepped[96];
+    sched_setup();
+    test_cpu.tick = &sched_tick_fn;
+    cpu_run(&test_cpu, 100000);
+    sched_result(ticked);
+
+    sched_setup();
+    while (test_cpu.cycles < 100000 || test_cpu.cyc_step) {
+        if (cpu_step_cycle(&test_cpu) < 0) return 0;
+        sched_tick_fn(&test_machine);
+    }
+    sched_result(stepped);
+    printf("cycle: %s\n", stepped);
+    return strcmp(ticked, stepped) == 0;
+}
 
-void tick_fn() {
-    tick_ctr++;
+// steps the counting loop for calls cycles, holding HALT during calls
+// [from, to). returns the cycles halted, and the state in buf
+static u64 run_halt(u64 calls, u64 from, u64 to, char buf[96]) {
+    u64 halted = 0;
+    sched_setup();
+    for (u64 i = 0; i < calls + halted; i++) {
+        test_cpu.HALT = i >= from && i < to;
+        if (cpu_step_cycle(&test_cpu) == CPU_CYCLE_HALTED) halted++;
+    }
+    char regs[64];
+    cpu_state_to_str(&test_cpu, regs);
+    snprintf(buf, 96, "%s %02x %u %04x", regs, test_machine.mem[0x10],
+            test_cpu.cyc_step, test_cpu.cyc_addr);
+    return halted;
 }
 
-u8 bus_read_fn(u16 addr) { return mem[addr]; }
-void bus_write_fn(u8 val, u16 addr) { mem[addr] = val; }
+// HALT only delays the CPU, by the cycles it reports as halted. raised on
+// each cycle of the 8-cycle loop in turn, it lets the NMOS 6502 finish INC's
+// writes first
+static int check_cycle_halt(void) {
+    char ran[96], halted[96];
+    run_halt(20000, 0, 0, ran);
+    int writes = 0;
+    for (u64 from = 5000; from < 5008; from++) {
+        u64 n = run_halt(20000, from, from + 300, halted);
+        if (strcmp(ran, halted) != 0 || test_cpu.cycles != 20000 + n) return 0;
+        writes += n < 300;
+    }
+    printf("cycle: HALT raised on each loop cycle, %d times on writes\n", writes);
+#ifdef CPU_VARIANT_65C02
+    return writes == 0;
+#else
+    return writes == 2;
+#endif
+}
+
+// runs one instruction with cpu_step_cycle, and the same one with cpu_exec
+// on a copy of the machine. both must end in the same state
+static int step_cycle_checked(void) {
+    int res;
+    while ((res = cpu_step_cycle(&cpu)) == CPU_CYCLE_BUSY) {
+        // nothing latched midway through an instruction is saved
+        if (inst_ctr == 0x10000 && (cpu_snapshot_save(&cpu, NULL, 0, snap[0], sizeof(snap[0]))
+                != CPU_SNAPSHOT_EBUSY || cpu_snapshot_load(&cpu, NULL, 0, snap[0], sizeof(snap[0]))
+                != CPU_SNAPSHOT_EBUSY)) {
+            printf("Snapshot taken midway through an instruction\n");
+            return -2;
+        }
+    }
+    int ref = cpu_exec(&shadow);
+    char a[64], b[64];
+    cpu_state_to_str(&cpu, a);
+    cpu_state_to_str(&shadow, b);
+    if (strcmp(a, b) != 0 || cpu.cycles != shadow.cycles || (res < 0) != (ref < 0)
+            || (inst_ctr % 0x10000 == 0 && memcmp(machine.mem, shadow_machine.mem, 0x10000) != 0)) {
+        printf("cpu_step_cycle diverged from cpu_exec: %s %llu, expected %s %llu\n", a,
+                (unsigned long long)cpu.cycles, b, (unsigned long long)shadow.cycles);
+        return -2;
+    }
+    return res < 0 ? res : 0;
+}
+
+// starts a lane every BATCH_SPACING cycles into the test, runs them all for
+// BATCH_CYCLES in a batch, then each one again with cpu_exec from the same
+// start. every lane must end in the same state, with the same memory
+static int check_batch(void) {
+    cpu_batch_init(&batch);
+    for (int pass = 0; pass < 2; pass++) {
+        shadow_machine = machine;
+        shadow = cpu;
+        shadow.user = &shadow_machine;
+        memset(shadow.pages, 0, sizeof(shadow.pages));
+        for (int i = 0; i < BATCH_LANES; i++) {
+            if (cpu_run(&shadow, BATCH_SPACING) < 0) return 0;
+            if (pass == 0) {
+                batch_machines[i] = shadow_machine;
+                cpu_batch_add(&batch, &shadow, batch_machines[i].mem);
+                continue;
+            }
+            if (i == 0 && cpu_batch_run(&batch, BATCH_CYCLES) != 0) return 0;
+            cpu_state_t ref = shadow, lane = shadow;
+            ref.user = &batch_ref;
+            batch_ref = shadow_machine;
+            u64 target = ref.cycles + BATCH_CYCLES;
+            while (ref.cycles < target)
+                if (cpu_exec(&ref) < 0) return 0;
+            cpu_batch_get(&batch, i, &lane);
+            char a[64], b[64];
+            cpu_state_to_str(&lane, a);
+            cpu_state_to_str(&ref, b);
+            if (strcmp(a, b) != 0 || lane.cycles != ref.cycles
+                    || memcmp(batch_machines[i].mem, batch_ref.mem, 0x10000) != 0) {
+                printf("batch lane %d diverged from cpu_exec: %s %llu, expected %s %llu\n", i, a,
+                        (unsigned long long)lane.cycles, b, (unsigned long long)ref.cycles);
+                return 0;
+            }
+        }
+    }
+    printf("batch: %llu instructions vectorized, %llu run by cpu_exec\n",
+            (unsigned long long)batch.vector, (unsigned long long)batch.scalar);
+    return 1;
+}
+
+// two instances get copy-on-write RAM from the image and map its last page
+// as ROM. a write to one instance's RAM must not show in the other's or in
+// the image, and both must read the ROM from the image's own pages
+static int check_image(void) {
+    cpu_state_t a = { 0 }, b = { 0 };
+    u8 *ram_a = cpu_image_ram(&image, 0, 0x10000), *ram_b = cpu_image_ram(&image, 0, 0x10000);
+    int ok = ram_a && ram_b && memcmp(ram_a, image.data, 0x10000) == 0
+        && memcmp(ram_b, image.data, 0x10000) == 0;
+    if (ok) {
+        ram_a[0x200] ^= 0xFF;
+        ok = ram_b[0x200] == image.data[0x200] && ram_a[0x200] != image.data[0x200];
+    }
+    ok = ok && cpu_image_map_rom(&a, &image, 0xFF00, 0xFF00, 0x100) == 0
+        && cpu_image_map_rom(&b, &image, 0xFF00, 0xFF00, 0x100) == 0
+        && a.pages[0xFF].read == image.data + 0xFF00 && b.pages[0xFF].read == a.pages[0xFF].read
+        && !a.pages[0xFF].write && cpu_image_map_rom(&a, &image, 0xFF00, 0xFF80, 0x100) != 0;
+    cpu_image_ram_free(ram_a, 0x10000);
+    cpu_image_ram_free(ram_b, 0x10000);
+    return ok;
+}
+
+// the accesses the debug mode's watchpoints cover, logged by the reference
+u8 debug_read_fn(void *user, u16 addr) {
+    u8 val = ((machine_t*)user)->mem[addr];
+    if (!debug_stop && addr >= 0x1F0 && addr <= 0x210 && (val & 0xF0) == 0x30) {
+        debug_stop = CPU_STOP_READ;
+        debug_addr = addr;
+        debug_val = val;
+    }
+    return val;
+}
+
+void debug_write_fn(void *user, u8 val, u16 addr) {
+    ((machine_t*)user)->mem[addr] = val;
+    if (!debug_stop && addr < 0x100 && (val & 0x80)) {
+        debug_stop = CPU_STOP_WRITE;
+        debug_addr = addr;
+        debug_val = val;
+    }
+}
+
+// arms a PC breakpoint, a JSR breakpoint, a read watchpoint for values $3x
+// across the top of the stack and the page above, and a write watchpoint on
+// negative values in the zero page, on a mapped copy of the machine. a reference copy steps
+// with cpu_exec and logs those accesses through its callbacks. cpu_run must
+// stop where the reference says, every time, remapping half way through
+static int check_debug(void) {
+    machine_copy(&test_machine, &test_cpu, 1);
+    machine_copy(&shadow_machine, &shadow, 0);
+    shadow.bus_read = debug_read_fn;
+    shadow.bus_write = debug_write_fn;
+
+    cpu_debug_init(&debugger, &test_cpu);
+    if (test_cpu.debug) return 0;
+    u16 bp = 0x0864;
+    cpu_debug_break(&debugger, bp, 1);
+    cpu_debug_break_opcode(&debugger, 0x20, 1);
+    if (cpu_debug_watch(&debugger, 0x1F0, 0x210, CPU_WATCH_READ, 0x30, 0xF0) < 0
+            || cpu_debug_watch(&debugger, 0x00, 0xFF, CPU_WATCH_WRITE, 0x80, 0x80) < 0
+            || test_cpu.debug != &debugger || !(test_cpu.pages[0x02].flags & CPU_PAGE_WATCH)
+            || test_cpu.pages[0x02].read || !test_cpu.pages[0x02].write)
+        return 0;
+
+    int resume = 0;
+    for (int n = 0; n < DEBUG_STOPS; n++) {
+        if (n == DEBUG_STOPS / 2) cpu_map(&test_cpu, 0, 0x10000, test_machine.mem, 0);
+        // step the reference to where the debugger should stop
+        u16 addr;
+        u8 stop, val;
+        for (;;) {
+            u16 pc = shadow.PC;
+            u8 opc = shadow_machine.mem[pc];
+            if (!resume && (pc == bp || opc == 0x20)) {
+                stop = pc == bp ? CPU_STOP_PC : CPU_STOP_OPCODE;
+                addr = pc;
+                val = opc;
+                resume = 1;
+                break;
+            }
+            resume = 0;
+            debug_stop = 0;
+            if (cpu_exec(&shadow) < 0) return 0;
+            if (debug_stop) {
+                stop = debug_stop;
+                addr = debug_addr;
+                val = debug_val;
+                break;
+            }
+        }
+        int res = cpu_run(&test_cpu, 1000000);
+        char a[64], b[64];
+        cpu_state_to_str(&test_cpu, a);
+        cpu_state_to_str(&shadow, b);
+        if (res != CPU_BREAK || strcmp(a, b) != 0 || test_cpu.cycles != shadow.cycles
+                || debugger.stop != stop || debugger.stop_addr != addr
+                || (stop != CPU_STOP_PC && debugger.stop_val != val)) {
+            printf("debugger stop %d: %d at %s %llu, reason %d %x, expected %s %llu, reason %d %x\n",
+                    n, res, a, (unsigned long long)test_cpu.cycles, debugger.stop,
+                    debugger.stop_addr, b, (unsigned long long)shadow.cycles, stop, addr);
+            return 0;
+        }
+    }
+    if (memcmp(test_machine.mem, shadow_machine.mem, 0x10000) != 0) return 0;
+
+    // disarmed, the page table must be as it was
+    cpu_debug_clear(&debugger);
+    if (test_cpu.debug) return 0;
+    for (int page = 0; page < 256; page++) {
+        cpu_page_t *pg = &test_cpu.pages[page];
+        if (pg->read != test_machine.mem + page * 0x100 || pg->write != pg->read
+                || (pg->flags & CPU_PAGE_WATCH))
+            return 0;
+    }
+    return 1;
+}
+
+// the bus log mode's reference goes through the callbacks for every access.
+// the logged copy maps everything but one page, whose accesses still come
+// synchronously, merged in order with the batches
+static void bus_add(access_t *log, u32 *n, u64 cycle, u16 addr, u8 val, u8 write) {
+    if (*n < BUS_LOG_ACCESSES) log[(*n)++] = (access_t){ cycle, addr, val, write };
+}
+
+u8 bus_ref_read(void *user, u16 addr) {
+    u8 val = ((machine_t*)user)->mem[addr];
+    bus_add(bus_ref, &bus_nref, shadow.cycles, addr, val, 0);
+    return val;
+}
+
+void bus_ref_write(void *user, u8 val, u16 addr) {
+    ((machine_t*)user)->mem[addr] = val;
+    bus_add(bus_ref, &bus_nref, shadow.cycles, addr, val, 1);
+}
+
+u8 bus_got_read(void *user, u16 addr) {
+    u8 val = ((machine_t*)user)->mem[addr];
+    bus_add(bus_got, &bus_ngot, test_cpu.cycles, addr, val, 0);
+    return val;
+}
+
+void bus_got_write(void *user, u8 val, u16 addr) {
+    ((machine_t*)user)->mem[addr] = val;
+    bus_add(bus_got, &bus_ngot, test_cpu.cycles, addr, val, 1);
+}
+
+void bus_got_log(void *user, const cpu_bus_rec_t *recs, u32 n) {
+    for (u32 i = 0; i < n; i++)
+        bus_add(bus_got, &bus_ngot, test_cpu.log_cycles + recs[i].cycle, recs[i].addr, recs[i].val,
+                recs[i].write);
+}
+
+static int check_bus_log(void) {
+    machine_copy(&shadow_machine, &shadow, 0);
+    shadow.bus_read = bus_ref_read;
+    shadow.bus_write = bus_ref_write;
+    machine_copy(&test_machine, &test_cpu, 1);
+    test_cpu.bus_read = bus_got_read;
+    test_cpu.bus_write = bus_got_write;
+    test_cpu.bus_log = bus_got_log;
+    cpu_map(&test_cpu, 0x0200, 0x100, NULL, CPU_PAGE_MMIO);
+    bus_nref = bus_ngot = 0;
+    while (bus_nref < BUS_LOG_ACCESSES)
+        if (cpu_run(&shadow, 1000) < 0) return 0;
+    while (test_cpu.cycles < shadow.cycles)
+        if (cpu_run(&test_cpu, 1000) < 0) return 0;
+    if (bus_ngot != BUS_LOG_ACCESSES || test_cpu.log_n != 0) return 0;
+    for (u32 i = 0; i < BUS_LOG_ACCESSES; i++) {
+        access_t *a = &bus_got[i], *b = &bus_ref[i];
+        if (a->cycle != b->cycle || a->addr != b->addr || a->val != b->val || a->write != b->write) {
+            printf("bus access %u: %s %04x=%02x at %llu, expected %s %04x=%02x at %llu\n", i,
+                    a->write ? "write" : "read", a->addr, a->val, (unsigned long long)a->cycle,
+                    b->write ? "write" : "read", b->addr, b->val, (unsigned long long)b->cycle);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// counts what the whole run logs
+void bus_count_log(void *user, const cpu_bus_rec_t *recs, u32 n) {
+    (void)user;
+    (void)recs;
+    bus_logged += n;
+}
+
+// the devices of check_cosim. a timer raising IRQ every period cycles,
+// started by writing the period to $D000 and acknowledged by reading the
+// count of expiries from $D001
+typedef struct {
+    u64 time, next;
+    u32 period;
+    u8 irq, fires;
+    u64 hash;
+} cosim_timer_t;
+
+// and a sink for writes to $D100, hashing them with their cycle, that
+// pulses NMI 100 cycles after every 64th
+typedef struct {
+    u64 time, raise, drop;
+    u32 count;
+    u8 nmi;
+    u64 hash;
+} cosim_sink_t;
+
+cosim_timer_t cosim_timer;
+cosim_sink_t cosim_sink;
+
+static void cosim_timer_run(void *user, u64 until) {
+    cosim_timer_t *t = user;
+    for (; t->next <= until; t->next += t->period) {
+        t->irq = 1;
+        t->fires++;
+        t->hash = t->hash * 31 + t->next;
+    }
+    t->time = until;
+}
+
+static void cosim_timer_write(void *user, u16 addr, u8 val) {
+    cosim_timer_t *t = user;
+    if (addr != 0xD000) return;
+    t->period = val < 16 ? 16 : val;
+    t->next = t->time + t->period;
+}
+
+static u8 cosim_timer_read(void *user, u16 addr) {
+    cosim_timer_t *t = user;
+    if (addr != 0xD001) return 0;
+    t->irq = 0;
+    return t->fires;
+}
+
+static u8 cosim_timer_level(void *user) { return ((cosim_timer_t *)user)->irq; }
+static u64 cosim_timer_next(void *user) { return ((cosim_timer_t *)user)->next; }
+
+static void cosim_sink_run(void *user, u64 until) {
+    cosim_sink_t *k = user;
+    if (k->raise <= until) {
+        k->nmi = 1;
+        k->raise = ~0ull;
+    }
+    if (k->drop <= until) {
+        k->nmi = 0;
+        k->drop = ~0ull;
+    }
+    k->time = until;
+}
+
+static void cosim_sink_write(void *user, u16 addr, u8 val) {
+    cosim_sink_t *k = user;
+    k->hash = k->hash * 31 + val + k->time;
+    if (++k->count % 64 == 0) {
+        k->raise = k->time + 100;
+        k->drop = k->time + 110;
+    }
+}
+
+static u8 cosim_sink_read(void *user, u16 addr) { return ((cosim_sink_t *)user)->count; }
+static u8 cosim_sink_level(void *user) { return ((cosim_sink_t *)user)->nmi; }
+
+static u64 cosim_sink_next(void *user) {
+    cosim_sink_t *k = user;
+    return k->raise < k->drop ? k->raise : k->drop;
+}
+
+// counts in a loop, writing the count to the sink and to RAM, with the
+// timer's IRQ handler at $0418 and the NMI handler at $0428. runs it for
+// COSIM_CYCLES in steps of step, and describes the end state
+static int run_cosim(u32 window, u32 flags, u64 step, char buf[160]) {
+    static const u8 prog[] = {
+        0x58,                   // 0400 cli
+        0xA2, 0x00,             // 0401 ldx #0
+        0xA9, 0x40,             // 0403 lda #$40
+        0x8D, 0x00, 0xD0,       // 0405 sta $d000
+        0xE6, 0x10,             // 0408 inc $10
+        0xA5, 0x10,             // 040a lda $10
+        0x8D, 0x00, 0xD1,       // 040c sta $d100
+        0x9D, 0x00, 0x03,       // 040f sta $0300,x
+        0xE8,                   // 0412 inx
+        0x4C, 0x08, 0x04,       // 0413 jmp $0408
+    };
+    static const u8 irq[] = {
+        0x48,                   // 0418 pha
+        0xAD, 0x01, 0xD0,       // 0419 lda $d001
+        0x85, 0x11,             // 041c sta $11
+        0xE6, 0x12,             // 041e inc $12
+        0x68,                   // 0420 pla
+        0x40,                   // 0421 rti
+    };
+    machine_setup(&test_machine, &test_cpu, prog, sizeof(prog), 0x400);
+    memcpy(test_machine.mem + 0x418, irq, sizeof(irq));
+    memcpy(test_machine.mem + 0x428, (u8[]){ 0xE6, 0x13, 0x40 }, 3); // inc $13, rti
+    test_machine.mem[0xFFFA] = 0x28;
+    test_machine.mem[0xFFFE] = 0x18;
+    test_machine.mem[0xFFFB] = test_machine.mem[0xFFFF] = 0x04;
+
+    cosim_timer = (cosim_timer_t){ .next = ~0ull };
+    cosim_sink = (cosim_sink_t){ .raise = ~0ull, .drop = ~0ull };
+    cpu_cosim_init(&cosim, &test_cpu, window, flags);
+    cpu_cosim_add(&cosim, &(cpu_cosim_dev_t){ &cosim_timer, 0xD000, 0xD001, CPU_COSIM_IRQ, 16,
+            cosim_timer_run, cosim_timer_write, cosim_timer_read, cosim_timer_level,
+            cosim_timer_next });
+    cpu_cosim_add(&cosim, &(cpu_cosim_dev_t){ &cosim_sink, 0xD100, 0xD100, CPU_COSIM_NMI, 100,
+            cosim_sink_run, cosim_sink_write, cosim_sink_read, cosim_sink_level,
+            cosim_sink_next });
+    if (cpu_cosim_start(&cosim) != 0) return 0;
+    int res = 0;
+    for (u64 until = step; res >= 0 && test_cpu.cycles < COSIM_CYCLES; until += step)
+        res = cpu_cosim_run(&cosim, until < COSIM_CYCLES ? until : COSIM_CYCLES);
+    cpu_cosim_stop(&cosim);
+    if (res < 0) return 0;
+
+    char regs[64];
+    cpu_state_to_str(&test_cpu, regs);
+    u64 ram = 0;
+    for (u32 i = 0; i < 0x400; i++) ram = ram * 31 + test_machine.mem[i];
+    snprintf(buf, 160, "%s %llu %016llx %llu/%u %016llx %u %016llx", regs,
+            (unsigned long long)test_cpu.cycles, (unsigned long long)ram,
+            (unsigned long long)cosim_timer.time, cosim_timer.fires,
+            (unsigned long long)cosim_timer.hash, cosim_sink.count,
+            (unsigned long long)cosim_sink.hash);
+    printf("cosim: window %u%s, %llu reads, %llu writes, %llu syncs, %llu stalls\n", window,
+            flags & CPU_COSIM_INLINE ? " inline" : "", (unsigned long long)cosim.reads,
+            (unsigned long long)cosim.writes, (unsigned long long)cosim.syncs,
+            (unsigned long long)cosim.stalls);
+    // the devices must have been left where the CPU is, and both handlers run
+    return cosim_timer.time == test_cpu.cycles && cosim_sink.time == test_cpu.cycles
+        && test_machine.mem[0x12] && test_machine.mem[0x13];
+}
+
+// the devices on threads of their own, whatever the window and however the
+// run is split, must end where they do on the CPU's thread
+static int check_cosim(void) {
+    char single[160], threaded[160], split[160];
+    if (!run_cosim(1000, CPU_COSIM_INLINE, COSIM_CYCLES, single)
+            || !run_cosim(1000, 0, COSIM_CYCLES, threaded)
+            || !run_cosim(64, 0, 77777, split))
+        return 0;
+    printf("cosim: %s\n", single);
+    return strcmp(single, threaded) == 0 && strcmp(single, split) == 0;
+}
+
+// the registers of check_dma: $2004 takes OAM bytes, hashed with the cycle
+// they are written on, $4014 starts a 256-byte OAM DMA from a page, $4015
+// copies $0300-$047F to $0500, $4016 stalls for the value written, and
+// $4017 copies $0310 to $2010, whose write chains a copy of $0310-$0313 to
+// $0700
+static void dma_write(void *user, u8 val, u16 addr) {
+    switch (addr) {
+        case 0x2004:
+            // the first read of an OAM DMA is on the even cycle 2 or 3
+            // cycles after the write that started it
+            if (dma_oam_addr == 0 && (!((test_cpu.cycles - 1 - dma_started) == 2
+                    || (test_cpu.cycles - 1 - dma_started) == 3) || (test_cpu.cycles - 1) % 2))
+                dma_misaligned = 1;
+            dma_oam = dma_oam * 31 + val + test_cpu.cycles;
+            dma_oam_addr++;
+            break;
+        case 0x4014:
+            dma_started = test_cpu.cycles;
+            cpu_dma(&test_cpu, 1, val << 8, 0x2004, 256, CPU_DMA_ALIGN);
+            break;
+        case 0x4015: cpu_dma(&test_cpu, 0, 0x0300, 0x0500, 0x180, CPU_DMA_INC); break;
+        case 0x4016: cpu_stall(&test_cpu, val); break;
+        case 0x4017: cpu_dma(&test_cpu, 0, 0x0310, 0x2010, 1, 0); break;
+        // written by the copy $4017 starts, chaining the next one
+        case 0x2010: cpu_dma(&test_cpu, 2, 0x0310, 0x0700, 4, CPU_DMA_INC); break;
+        default: ((machine_t *)user)->mem[addr] = val;
+    }
+}
+
+static void dma_tick(void *user) { dma_ticks++; }
+
+// the registers, cycles, memory and OAM run_dma ends with
+static void dma_describe(char buf[160]) {
+    char regs[64];
+    cpu_state_to_str(&test_cpu, regs);
+    u64 ram = 0;
+    for (u32 i = 0; i < 0x800; i++) ram = ram * 31 + test_machine.mem[i];
+    snprintf(buf, 160, "%s %llu %016llx %016llx %u/%u", regs, (unsigned long long)test_cpu.cycles,
+            (unsigned long long)ram, (unsigned long long)dma_oam, test_cpu.DMA, test_cpu.dma_len);
+}
+
+// fills page 3, then keeps starting both copies and a stall, changing the
+// source in between. engine 0 is cpu_run, 1 cpu_exec, 2 cpu_run with a tick
+// callback, 3 the block cache and 4 cpu_step_cycle
+static int run_dma(int engine, char buf[160]) {
+    static const u8 prog[] = {
+        0xA2, 0x00,             // 0200 ldx #0
+        0x8A,                   // 0202 txa
+        0x9D, 0x00, 0x03,       // 0203 sta $0300,x
+        0xE8,                   // 0206 inx
+        0xD0, 0xF9,             // 0207 bne $0202
+        0xA9, 0x03,             // 0209 lda #$03
+        0x8D, 0x14, 0x40,       // 020b sta $4014
+        0x8D, 0x15, 0x40,       // 020e sta $4015
+        0xA9, 0x07,             // 0211 lda #7
+        0x8D, 0x16, 0x40,       // 0213 sta $4016
+        0x8D, 0x17, 0x40,       // 0216 sta $4017
+        0xE6, 0x10,             // 0219 inc $10
+        0xEE, 0x00, 0x03,       // 021b inc $0300
+        0xEE, 0x7F, 0x04,       // 021e inc $047f
+        0x4C, 0x09, 0x02,       // 0221 jmp $0209
+    };
+    machine_setup(&test_machine, &test_cpu, prog, sizeof(prog), 0x200);
+    test_cpu.bus_write = &dma_write;
+    cpu_map(&test_cpu, 0x2000, 0x100, NULL, CPU_PAGE_MMIO);
+    cpu_map(&test_cpu, 0x4000, 0x100, NULL, CPU_PAGE_MMIO);
+    dma_oam = dma_started = dma_ticks = 0;
+    dma_oam_addr = dma_misaligned = 0;
+    if (engine == 2) test_cpu.tick = &dma_tick;
+    if (engine == 3) cpu_bbc_attach(&test_cpu, &test_bbc);
+    while (test_cpu.cycles < DMA_CYCLES) {
+        int res = engine == 1 ? cpu_exec(&test_cpu)
+            : engine == 4 ? cpu_step_cycle(&test_cpu)
+            : cpu_run(&test_cpu, DMA_CYCLES - test_cpu.cycles < 1000 ? DMA_CYCLES - test_cpu.cycles : 1000);
+        if (res < 0) return 0;
+        // cpu_step_cycle stops where the others do, between instructions
+        while (engine == 4 && test_cpu.cycles >= DMA_CYCLES && res != CPU_CYCLE_DONE)
+            if ((res = cpu_step_cycle(&test_cpu)) < 0) return 0;
+    }
+    cpu_bbc_attach(&test_cpu, NULL);
+    dma_describe(buf);
+    return !dma_misaligned && test_machine.mem[0x10]
+        && memcmp(test_machine.mem + 0x700, test_machine.mem + 0x310, 4) == 0
+        && (engine != 2 || dma_ticks == test_cpu.cycles);
+}
+
+// stalls and copies, taken in one step, must end where they do cycle by
+// cycle, on every engine
+static int check_dma(void) {
+    char ref[160], got[160];
+    if (!run_dma(4, ref)) return 0;
+    printf("dma: %s\n", ref);
+    for (int engine = 0; engine < 4; engine++) {
+        if (!run_dma(engine, got)) return 0;
+        if (strcmp(ref, got) != 0) {
+            printf("dma: engine %d ended at %s\n", engine, got);
+            return 0;
+        }
+    }
+    // the OAM DMA pending right after the write to $4014 is saved with the
+    // rest: running on, after loading the snapshot or after seeking back to
+    // the checkpoint, ends in the same state
+    static cpu_rewind_t rw;
+    static u8 ring[1 << 20];
+    cpu_snapshot_region_t ram = { 0x4D415221, test_machine.mem, 0x10000 }; // "!RAM"
+    while (test_cpu.dma_len != 256)
+        if (cpu_exec(&test_cpu) < 0) return 0;
+    u64 oam = dma_oam, started = dma_started;
+    u8 oam_addr = dma_oam_addr;
+    if (cpu_snapshot_save(&test_cpu, &ram, 1, snap[0], sizeof(snap[0])) < 0
+            || cpu_rewind_attach(&test_cpu, &rw, test_machine.mem, ring, sizeof(ring), 16) != 0)
+        return 0;
+    char after[3][160];
+    for (int i = 0; i < 3; i++) {
+        if (i == 1 && cpu_snapshot_load(&test_cpu, &ram, 1, snap[0], sizeof(snap[0])) != 0) return 0;
+        if (i == 2 && cpu_rewind_seek(&rw, 0) != 0) return 0;
+        dma_oam = oam;
+        dma_started = started;
+        dma_oam_addr = oam_addr;
+        u64 target = test_cpu.cycles + 2000;
+        while (test_cpu.cycles < target)
+            if (cpu_exec(&test_cpu) < 0) return 0;
+        dma_describe(after[i]);
+    }
+    cpu_rewind_attach(&test_cpu, NULL, NULL, NULL, 0, 0);
+    if (strcmp(after[0], after[1]) != 0 || strcmp(after[0], after[2]) != 0) {
+        printf("dma: %s after a snapshot load, %s after a rewind, expected %s\n", after[1],
+                after[2], after[0]);
+        return 0;
+    }
+    return 1;
+}
+
+#ifdef FUNCTIONAL_AOT
+// runs the start of the test on a copy, then loads a snapshot and seeks a
+// checkpoint that both have a JMP to itself at the start of a translated
+// block the run checked. neither may run the block again
+static int check_aot_restore(void) {
+    cpu_snapshot_region_t ram = { 0x4D415221, shadow_machine.mem, 0x10000 }; // "!RAM"
+    machine_setup(&shadow_machine, &shadow, machine.mem, 0x10000, 0);
+    shadow.PC = 0x400;
+    cpu_set_p(&shadow, 0x30);
+    if (cpu_snapshot_save(&shadow, &ram, 1, snap[1], sizeof(snap[1])) < 0) return 0;
+    cpu_aot_attach(&shadow, &restore_aot, &functional_aot);
+    if (cpu_run(&shadow, 1000) < 0) return 0;
+
+    const cpu_aot_block_t *b = NULL;
+    for (u32 i = 0; i < functional_aot.nblocks && !b; i++) {
+        b = &functional_aot.blocks[i];
+        if (b->pages[0] != b->pages[1] || (b->pc & 0xFF) > 0xFD
+                || restore_aot.state[b->pages[0]] != CPU_AOT_MATCH) b = NULL;
+    }
+    if (!b) return 0;
+    u8 *code = shadow_machine.mem + b->pc, saved[3];
+    memcpy(saved, code, 3);
+    code[0] = 0x4C; // jmp to itself
+    code[1] = b->pc & 0xFF;
+    code[2] = b->pc >> 8;
+    shadow.PC = b->pc;
+    if (cpu_snapshot_save(&shadow, &ram, 1, snap[0], sizeof(snap[0])) < 0) return 0;
+    memcpy(code, saved, 3);
+
+    if (cpu_snapshot_load(&shadow, &ram, 1, snap[0], sizeof(snap[0])) != 0
+            || cpu_run(&shadow, 1000) < 0 || shadow.PC != b->pc) {
+        printf("aot: ran stale code after a snapshot load, PC:%x\n", shadow.PC);
+        return 0;
+    }
+
+    // the same start again, checkpointed after the loop
+    if (cpu_rewind_attach(&shadow, &restore_rewinder, shadow_machine.mem, restore_ring,
+            sizeof(restore_ring), 16) != 0
+            || cpu_snapshot_load(&shadow, &ram, 1, snap[1], sizeof(snap[1])) != 0) return 0;
+    cpu_rewind_touch(&restore_rewinder, 0, 0x10000);
+    if (cpu_run(&shadow, 1000) < 0 || restore_aot.state[b->pages[0]] != CPU_AOT_MATCH
+            || cpu_rewind_checkpoint(&restore_rewinder) != 0) return 0;
+    if (cpu_rewind_seek(&restore_rewinder, 0) != 0 || cpu_run(&shadow, 1000) < 0
+            || shadow.PC != b->pc) {
+        printf("aot: ran stale code after a rewind, PC:%x\n", shadow.PC);
+        return 0;
+    }
+    cpu_rewind_attach(&shadow, NULL, NULL, NULL, 0, 0);
+    cpu_aot_attach(&shadow, NULL, NULL);
+    return 1;
+}
+
+// runs the start of the test translated, with the zero page's writes and
+// all of page 2 left to the callbacks, and through the callbacks alone on
+// cpu_exec. the translated run must make the same accesses to those pages,
+// on the same cycles
+static int check_aot_mmio(void) {
+    machine_setup(&shadow_machine, &shadow, machine.mem, 0x10000, 0);
+    memset(shadow.pages, 0, sizeof(shadow.pages));
+    shadow.bus_read = bus_ref_read;
+    shadow.bus_write = bus_ref_write;
+    shadow.PC = 0x400;
+    cpu_set_p(&shadow, 0x30);
+    machine_setup(&test_machine, &test_cpu, machine.mem, 0x10000, 0);
+    test_cpu.bus_read = bus_got_read;
+    test_cpu.bus_write = bus_got_write;
+    test_cpu.PC = 0x400;
+    cpu_set_p(&test_cpu, 0x30);
+    cpu_map(&test_cpu, 0x0000, 0x100, test_machine.mem, CPU_PAGE_READONLY);
+    cpu_map(&test_cpu, 0x0200, 0x100, NULL, CPU_PAGE_MMIO);
+    cpu_aot_attach(&test_cpu, &mmio_aot, &functional_aot);
+    bus_nref = bus_ngot = 0;
+    while (bus_nref < BUS_LOG_ACCESSES)
+        if (cpu_run(&shadow, 1000) < 0) return 0;
+    while (test_cpu.cycles < shadow.cycles)
+        if (cpu_run(&test_cpu, 1000) < 0) return 0;
+    cpu_aot_attach(&test_cpu, NULL, NULL);
+    if (mmio_aot.hits == 0) return 0;
+    // the translated run may go on past the last access logged for cpu_exec
+    u32 n = 0;
+    for (u32 i = 0; i < bus_nref; i++) {
+        access_t *a = &bus_got[n], *b = &bus_ref[i];
+        if (b->addr >> 8 != 2 && (b->addr >> 8 != 0 || !b->write)) continue;
+        if (n++ >= bus_ngot || a->cycle != b->cycle || a->addr != b->addr || a->val != b->val
+                || a->write != b->write) {
+            printf("aot: bus access %u: %s %04x=%02x at %llu, expected %s %04x=%02x at %llu\n", n - 1,
+                    a->write ? "write" : "read", a->addr, a->val, (unsigned long long)a->cycle,
+                    b->write ? "write" : "read", b->addr, b->val, (unsigned long long)b->cycle);
+            return 0;
+        }
+    }
+    return n > 0;
+}
+#endif
+
+#ifdef FUNCTIONAL_INLINE
+// the bound bus functions take st->user as the machine, so bus tracing and
+// co-simulation must refuse to swap it
+static int check_inline_bus(void) {
+    cpu_page_t pages[256];
+    memcpy(pages, cpu.pages, sizeof(pages));
+    FILE *out = tmpfile();
+    if (!out || cpu_trace_open(&tracer, out, trace_ring, 1 << 14, CPU_TRACE_BUS) != 0) return 0;
+    int traced = cpu_trace_attach(&cpu, &tracer);
+    fclose(out);
+    cpu_cosim_init(&cosim, &cpu, 1, 0);
+    int started = cpu_cosim_start(&cosim);
+    return traced == CPU_TRACE_EBUS && started == CPU_COSIM_EBUS && !cpu.trace
+        && cpu.user == &machine && cpu.bus_read == &bus_read_fn
+        && memcmp(pages, cpu.pages, sizeof(pages)) == 0;
+}
+#endif
+
+static int has_arg(int argc, char** argv, const char *arg) {
+    for (int i = 2; i < argc; i++)
+        if (strcmp(argv[i], arg) == 0) return 1;
+    return 0;
+}
+
+// success=<hex>: run until the PC traps, and pass if it traps there instead
+// of stopping at SUCCESS_CYCLES. returns -1 without it
+static int success_arg(int argc, char** argv) {
+    for (int i = 2; i < argc; i++)
+        if (strncmp(argv[i], "success=", 8) == 0) return (int)strtol(argv[i] + 8, NULL, 16);
+    return -1;
+}
 
 int main(int argc, char** argv) {
 
-    cpu.tick = &tick_fn;
+    u8 *mem = machine.mem;
+    cpu.user = &machine;
     cpu.bus_read = &bus_read_fn;
     cpu.bus_write = &bus_write_fn;
     
-    FILE *f = fopen(argv[1], "rb");
     printf("%s\n", argv[1]);
-    fread(mem, 0x10000, 1, f);
-    fclose(f);
+    if (has_arg(argc, argv, "image")) {
+        // run on a copy-on-write view of the mapped file instead of a copy
+        if (cpu_image_open(&image, argv[1]) != 0 || image.len != 0x10000 || !check_image()
+                || !(mem = cpu_image_ram(&image, 0, 0x10000))) {
+            printf("Can't map %s\n", argv[1]);
+            return 0;
+        }
+        cpu.user = (machine_t *)mem;
+    } else {
+        FILE *f = fopen(argv[1], "rb");
+        fread(mem, 0x10000, 1, f);
+        fclose(f);
+    }
 
     printf("Read bytes from memory\n");
 
+    // map the whole image as RAM so accesses bypass the callbacks
+    if (has_arg(argc, argv, "map")) cpu_map(&cpu, 0, 0x10000, mem, 0);
+    // cache decoded blocks in cpu_run
+    if (has_arg(argc, argv, "bbc")) cpu_bbc_attach(&cpu, &bbc);
+    // translate hot code to native code in cpu_run
+    cpu_jit_t *jit = NULL;
+    if (has_arg(argc, argv, "jit")) {
+        jit = cpu_jit_create(16 << 20, 8);
+        if (!jit) {
+            printf("JIT not supported on this host\n");
+            return 0;
+        }
+        cpu_jit_attach(&cpu, jit);
+    }
+    // run the translated test image in cpu_run
+    if (has_arg(argc, argv, "aot")) {
+#ifdef FUNCTIONAL_AOT
+        cpu_aot_attach(&cpu, &aot, &functional_aot);
+        // restored memory that differs from the image
+        if (has_arg(argc, argv, "restore") && !check_aot_restore()) {
+            printf("Translated code outlived a restore\n");
+            return 0;
+        }
+        // pages left to the bus callbacks
+        if (has_arg(argc, argv, "mmio") && !check_aot_mmio()) {
+            printf("Translated code diverged on the bus callbacks\n");
+            return 0;
+        }
+#else
+        printf("Built without translated code\n");
+        return 0;
+#endif
+    }
+
+    // the status register is stored unpacked, check it round-trips
+    for (int p = 0; p < 0x100; p++) {
+        cpu_set_p(&cpu, p);
+        if (cpu_get_p(&cpu) != (p | 0x30)) {
+            printf("P read back as %x after setting %x\n", cpu_get_p(&cpu), p);
+            return 0;
+        }
+    }
+
     // cpu_reset(&cpu, mem);
     cpu.PC = 0x400;
     cpu.S = 0xFF;
-    cpu.P.B = 1;
-    cpu.P.u = 1;
+    cpu_set_p(&cpu, 0x30);
+    int success = success_arg(argc, argv);
+
+    if (has_arg(argc, argv, "run")) {
+        // cycle-budgeted mode: run in slices, checking for traps in between
+        int snapshot = has_arg(argc, argv, "snapshot");
+        // keep a rewind history of the slices
+        int rewinding = has_arg(argc, argv, "rewind");
+        if (rewinding) cpu_rewind_attach(&cpu, &rewinder, mem, rewind_ring, sizeof(rewind_ring), 16);
+#ifdef FUNCTIONAL_INLINE
+        if (!check_inline_bus()) {
+            printf("Bus tracing or co-simulation took over the bound bus\n");
+            return 0;
+        }
+#endif
+        // fast-forward idle loops: the test never idles, so nothing may be skipped
+        if (has_arg(argc, argv, "idle")) {
+            if (!check_idle()) {
+                printf("Idle skipping diverged\n");
+                return 0;
+            }
+            cpu.next_event = SUCCESS_CYCLES;
+        }
+        // breakpoints and watchpoints on a copy, then the whole run with
+        // some armed that never hit
+        if (has_arg(argc, argv, "debug")) {
+            if (!check_debug()) {
+                printf("Debugger stops diverged\n");
+                return 0;
+            }
+            cpu_debug_init(&debugger, &cpu);
+            cpu_debug_break(&debugger, 0xFFF0, 1);
+            cpu_debug_watch(&debugger, 0xFF00, 0xFFEF, CPU_WATCH_WRITE, 0, 0);
+        }
+        // batched bus accesses on a copy, then logged for the whole run
+        if (has_arg(argc, argv, "buslog")) {
+            if (!check_bus_log()) {
+                printf("Bus log diverged from the callbacks\n");
+                return 0;
+            }
+            cpu.bus_log = bus_count_log;
+        }
+        // devices on threads of their own, against the same on one thread
+        if (has_arg(argc, argv, "cosim") && !check_cosim()) {
+            printf("Co-simulation diverged from the single-threaded run\n");
+            return 0;
+        }
+        // stalls and DMA copies, in one step and cycle by cycle
+        if (has_arg(argc, argv, "dma") && !check_dma()) {
+            printf("DMA diverged between engines\n");
+            return 0;
+        }
+        if (has_arg(argc, argv, "sched") && !check_sched()) {
+            printf("Scheduled interrupts diverged from ticked ones\n");
+            return 0;
+        }
+        // profile the whole run, labelled from the listing next to the binary
+        if (has_arg(argc, argv, "profile")) {
+            char lst[512];
+            snprintf(lst, sizeof(lst), "%.*s.lst", (int)(strlen(argv[1]) - 4), argv[1]);
+            if (cpu_prof_load_symbols(&prof, lst) <= 0 || cpu_prof_attach(&cpu, &prof) != 0) {
+                printf("Can't profile with labels from %s\n", lst);
+                return 0;
+            }
+        }
+        // record the start of the run with bus accesses, streamed or mapped
+        const char *trace_path = NULL;
+        if (has_arg(argc, argv, "trace")) {
+            int res;
+            if (has_arg(argc, argv, "mapped")) {
+                trace_path = "functional_mapped.trace";
+                res = cpu_trace_map(&tracer, trace_path, 1 << 20, CPU_TRACE_BUS);
+            } else {
+                trace_path = "functional.trace";
+                FILE *out = fopen(trace_path, "wb");
+                res = out ? cpu_trace_open(&tracer, out, trace_ring, 1 << 14, CPU_TRACE_BUS) : -1;
+            }
+            if (res != 0) {
+                printf("Can't record a trace to %s\n", trace_path);
+                return 0;
+            }
+            if (cpu_trace_attach(&cpu, &tracer) != 0) {
+                printf("Can't record bus accesses in this build\n");
+                return 0;
+            }
+        }
+        while (success >= 0 || cpu.cycles < SUCCESS_CYCLES) {
+            if (snapshot && cpu.cycles >= SUCCESS_CYCLES / 2) {
+                snapshot = 0;
+                if (!check_snapshot()) {
+                    printf("Snapshot restore diverged at PC:%x\n", cpu.PC);
+                    return 0;
+                }
+            }
+            if (rewinding && cpu.cycles >= SUCCESS_CYCLES / 2) {
+                rewinding = 0;
+                if (!check_rewind()) {
+                    printf("Rewind diverged at PC:%x\n", cpu.PC);
+                    return 0;
+                }
+            }
+            if (cpu.trace && cpu.cycles >= TRACE_CYCLES) {
+                cpu_trace_attach(&cpu, NULL);
+                if (cpu_trace_close(&tracer) != 0 || (tracer.out && fclose(tracer.out) != 0)
+                        || !check_trace(trace_path)) {
+                    printf("Bad trace in %s\n", trace_path);
+                    return 0;
+                }
+            }
+            u64 left = success >= 0 ? 1000 : SUCCESS_CYCLES - cpu.cycles;
+            int res = cpu_run(&cpu, left < 1000 ? (u32)left : 1000);
+            if (res < 0) {
+                printf("Error at PC:%x, ret with code %d\n", cpu.PC, res);
+                return 0;
+            }
+            if (cpu.rewind) cpu_rewind_checkpoint(&rewinder);
+            if (success < 0 && cpu.cycles >= SUCCESS_CYCLES) break;
+            u16 prev_pc = cpu.PC;
+            cpu_exec(&cpu);
+            if (cpu.PC == prev_pc) {
+                if (prev_pc == success) break;
+                printf("PC trapped at %x\n", prev_pc);
+                return 0;
+            }
+        }
+        if (cpu.bus_log) printf("bus log: %llu accesses\n", (unsigned long long)bus_logged);
+        if (cpu.aot)
+            printf("aot: %llu blocks run, %llu instructions interpreted, %llu page checks\n",
+                    (unsigned long long)aot.hits, (unsigned long long)aot.misses,
+                    (unsigned long long)aot.checks);
+        if (cpu.prof) {
+            cpu_prof_report(&prof, stdout, 10);
+            FILE *folded = fopen("functional.folded", "w");
+            if (folded) {
+                cpu_prof_folded(&prof, folded);
+                fclose(folded);
+            }
+            // the trap check after each slice runs outside cpu_run
+            if (!check_profile(cpu.cycles)) {
+                printf("Profile doesn't add up to %llu cycles\n", (unsigned long long)cpu.cycles);
+                return 0;
+            }
+        }
+#ifdef FUNCTIONAL_INLINE_TICK
+        if (inline_ticks != cpu.cycles) {
+            printf("%llu ticks in %llu cycles\n", (unsigned long long)inline_ticks,
+                    (unsigned long long)cpu.cycles);
+            return 0;
+        }
+#endif
+        printf("Success\n");
+        printf("DONE executed %llu cycles\n", (unsigned long long)cpu.cycles);
+        if (cpu.bbc)
+            printf("block cache: %llu hits, %llu misses, %llu invalidations\n",
+                    (unsigned long long)bbc.hits, (unsigned long long)bbc.misses,
+                    (unsigned long long)bbc.invalidations);
+        if (cpu.rewind)
+            printf("rewind: %u checkpoints kept, %llu dropped\n", rewinder.count,
+                    (unsigned long long)rewinder.dropped);
+        if (jit) {
+            cpu_jit_stats_t js = cpu_jit_stats(jit);
+            printf("jit: %llu entries, %llu blocks, %llu untranslatable, %llu invalidations, %llu flushes\n",
+                    (unsigned long long)js.entries, (unsigned long long)js.compiled,
+                    (unsigned long long)js.failed, (unsigned long long)js.invalidations,
+                    (unsigned long long)js.flushes);
+            cpu_jit_destroy(jit);
+        }
+        return 0;
+    }
+
+    // run checkpoints of the test side by side in a batch
+    if (has_arg(argc, argv, "batch") && !check_batch()) {
+        printf("Batch lanes diverged\n");
+        return 0;
+    }
+
+    // step single cycles, checked against cpu_exec on a copy of the machine
+    int cycle = has_arg(argc, argv, "cycle");
+    if (cycle) {
+        if (!check_cycle_irq() || !check_cycle_halt()) {
+            printf("Cycle stepping diverged\n");
+            return 0;
+        }
+        shadow_machine = machine;
+        shadow = cpu;
+        shadow.user = &shadow_machine;
+        if (has_arg(argc, argv, "map")) cpu_map(&shadow, 0, 0x10000, shadow_machine.mem, 0);
+    }
+
     printf("i\tPC\tinst\tX\tY\tA\tS\tP\n");
     for (; ; inst_ctr++) {
         u16 prev_pc = cpu.PC;
-        int res = cpu_exec(&cpu);
-        if (inst_ctr > 26764000) {
+        int res = cycle ? step_cycle_checked() : cpu_exec(&cpu);
+        if (success < 0 && inst_ctr > 26764000) {
             printf("Success\n");
             break;
             // use to debug:
             // if (inst_ctr == 158258) printf("%x\n", mem[0x11]);
-            // printf("%x\t%x\t%x\t%d\t%d\t%d\t%u\t%x\n", inst_ctr, prev_pc, mem[prev_pc], (int8_t)(cpu.X), (int8_t)(cpu.Y), (int8_t)(cpu.A), cpu.S, *(u8*)(&cpu.P));
+            // printf("%x\t%x\t%x\t%d\t%d\t%d\t%u\t%x\n", inst_ctr, prev_pc, mem[prev_pc], (int8_t)(cpu.X), (int8_t)(cpu.Y), (int8_t)(cpu.A), cpu.S, cpu_get_p(&cpu));
         }
         if (cpu.PC == prev_pc) {
-            printf("PC trapped at %x\n", prev_pc);
+            if (prev_pc == success) printf("Success\n");
+            else printf("PC trapped at %x\n", prev_pc);
             break;
         }
         if (res != 0) {
@@ -51,7 +1326,7 @@ int main(int argc, char** argv) {
             break;
         }
     }
-    printf("DONE executed %d instrs taking %d cycles\n", inst_ctr, tick_ctr);
+    printf("DONE executed %d instrs taking %llu cycles\n", inst_ctr, (unsigned long long)cpu.cycles);
 
     return 0;
 }
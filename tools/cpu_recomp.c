@@ -0,0 +1,218 @@
+// Ahead-of-time translator from a ROM image to C, for cpu_aot.h.
+//
+//   cpu_recomp [-b base] [-e entry]... [-n name] image.bin out.c
+//
+// loads the image at base (hex, by default so that it ends at $FFFF),
+// traces the code reachable from the NMI, reset and IRQ vectors and from
+// each -e entry (hex), and writes out.c: one C function per basic block and
+// the cpu_aot_prog_t name (cpu_aot_prog by default) describing them.
+//
+// Tracing follows branches, JMP, JSR (and the return after it), BRK (and
+// the return after it) and JMP (ptr) through the pointer in the image. Code
+// only reached through RTS tricks, JMP (ptr,X) or pointers built at run time
+// isn't found; the interpreter runs it, and extra -e entries bring it in.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu_internal.h"
+#include "cpu_aot.h"
+
+// built for the CPU variant the output is for, see cpu_opcodes.h
+#if defined(CPU_VARIANT_65C02)
+#define VARIANT "65C02"
+#elif defined(CPU_VARIANT_2A03)
+#define VARIANT "2A03"
+#else
+#define VARIANT "NMOS"
+#endif
+
+enum { K_all, K_read, K_rmw, K_write, K_branch, K_jmp, K_jsr, K_wait };
+
+static const struct {
+    const char *instr, *kind, *mode, *idx;
+    u8 k, len, cycles, max_cycles;
+} ops[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = { #instr, #kind, #mode, #idx, K_##kind, \
+        CPU_OPLEN_##mode, cyc, cyc + CPU_PENALTY_##kind##_##mode },
+    CPU_OPCODES(OP)
+#undef OP
+};
+
+static u8 mem[0x10000];
+static u32 base, len;
+static u8 insn[0x10000];   // an instruction starts here
+static u8 leader[0x10000]; // a block starts here
+static u8 mask[0x10000 / 8];
+
+static int in_image(u32 addr, u32 n) {
+    return addr >= base && addr + n <= base + len;
+}
+
+// branches, jumps, BRK, RTI and RTS end a block, like in the block cache
+static int ends_block(u8 opc) {
+    u8 k = ops[opc].k;
+    return k == K_branch || k == K_jmp || k == K_jsr || opc == 0x00 || opc == 0x40 || opc == 0x60;
+}
+
+static void trace(u16 *entries, int nentries) {
+    static u16 work[0x10000 * 2];
+    int n = 0;
+    for (int i = 0; i < nentries; i++) {
+        leader[entries[i]] = 1;
+        work[n++] = entries[i];
+    }
+    while (n > 0) {
+        u16 pc = work[--n];
+        u8 opc = mem[pc];
+        if (insn[pc] || !ops[opc].len || !in_image(pc, ops[opc].len)) continue;
+        insn[pc] = 1;
+        u16 op = mem[(u16)(pc + 1)] | hi(mem[(u16)(pc + 2)]);
+        u16 next = pc + ops[opc].len;
+        u16 targets[2];
+        int ntargets = 0;
+        if (ops[opc].k == K_branch) {
+            s8 off = strcmp(ops[opc].mode, "zpr") == 0 ? (s8)(op >> 8) : (s8)op;
+            targets[ntargets++] = next + off;
+            targets[ntargets++] = next;
+        } else if (ops[opc].k == K_jmp) {
+            // JMP (ptr) goes where the image's pointer does, most likely.
+            // a wrong guess only costs an unused block
+            if (strcmp(ops[opc].mode, "abs") == 0) targets[ntargets++] = op;
+            if (strcmp(ops[opc].mode, "ind") == 0 && in_image(op, 2))
+                targets[ntargets++] = mem[op] | hi(mem[cpu_ind_next(op)]);
+        } else if (ops[opc].k == K_jsr) {
+            targets[ntargets++] = op;
+            targets[ntargets++] = next;
+        } else if (opc == 0x00) {
+            targets[ntargets++] = pc + 2; // RTI returns past the signature byte
+        } else if (opc != 0x40 && opc != 0x60) {
+            work[n++] = next;
+        }
+        for (int i = 0; i < ntargets; i++) {
+            leader[targets[i]] = 1;
+            work[n++] = targets[i];
+        }
+    }
+}
+
+// the number of instructions in the block at pc: up to the first one that
+// ends a block or is followed by another block, at most CPU_AOT_BLOCK_MAX,
+// so at most two pages
+static int block_len(u16 pc) {
+    for (int n = 1; ; n++) {
+        u8 opc = mem[pc];
+        u16 next = pc + ops[opc].len;
+        if (n == CPU_AOT_BLOCK_MAX || ends_block(opc) || leader[next] || !insn[next] || next < pc)
+            return n;
+        pc = next;
+    }
+}
+
+// writes the function for the block at pc and fills in its entry
+static void emit_block(FILE *out, u16 pc, cpu_aot_block_t *b) {
+    fprintf(out, "static void cpu_aot_%04X(cpu_state_t *st) {\n    u16 op;\n", pc);
+    b->pc = pc;
+    b->max_cycles = 0;
+    int n = block_len(pc);
+    for (int i = 0; i < n; i++) {
+        u8 opc = mem[pc], l = ops[opc].len;
+        for (u8 j = 0; j < l; j++) mask[(u16)(pc + j) >> 3] |= 1 << ((pc + j) & 7);
+        u16 op = l > 1 ? mem[(u16)(pc + 1)] | (l > 2 ? hi(mem[(u16)(pc + 2)]) : 0) : 0;
+        // the block cache's per-instruction stop: an interrupt, or a write
+        // to translated code
+        if (i > 0) fprintf(out, "    if (unlikely(st->aot->stale | st->NMI | st->IRQ | st->RST | st->DMA)) return;\n");
+        fprintf(out, "    // $%04X %s\n", pc, ops[opc].instr);
+        // left to cpu_exec when it would reach a bus callback
+        fprintf(out, "    op = 0x%04X; if (unlikely(!CPU_BB_DIRECT_%s_%s(%s))) return;\n",
+                op, ops[opc].kind, ops[opc].mode, ops[opc].idx);
+        fprintf(out, "    st->PC = 0x%04X; st->cycles += %d; CPU_BB_%s_%s(%s, %s);\n",
+                (u16)(pc + l), l == 1 ? 1 : ops[opc].cycles, ops[opc].kind, ops[opc].mode,
+                ops[opc].instr, ops[opc].idx);
+        b->max_cycles += ops[opc].max_cycles;
+        b->pages[0] = b->pc >> 8;
+        b->pages[1] = (pc + l - 1) >> 8;
+        pc += l;
+    }
+    fprintf(out, "    (void)op;\n}\n\n");
+}
+
+static void usage(const char *argv0) {
+    printf("usage: %s [-b base] [-e entry]... [-n name] image.bin out.c\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static u16 entries[0x10000 + 3];
+    int nentries = 0, have_base = 0;
+    const char *name = "cpu_aot_prog";
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (strcmp(argv[i], "-b") == 0) {
+            base = strtoul(argv[i + 1], NULL, 16);
+            have_base = 1;
+        } else if (strcmp(argv[i], "-e") == 0) {
+            entries[nentries++] = strtoul(argv[i + 1], NULL, 16);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            name = argv[i + 1];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - i != 2) usage(argv[0]);
+
+    FILE *in = fopen(argv[i], "rb");
+    static u8 image[0x10001];
+    len = in ? fread(image, 1, sizeof(image), in) : 0;
+    if (in) fclose(in);
+    if (len == 0 || len > 0x10000) {
+        printf("%s: can't read, or bigger than 64 KiB\n", argv[i]);
+        return 2;
+    }
+    if (!have_base) base = 0x10000 - len;
+    if (base + len > 0x10000) {
+        printf("%s doesn't fit at $%04X\n", argv[i], base);
+        return 2;
+    }
+    memcpy(mem + base, image, len);
+    for (u32 v = 0xFFFA; v < 0x10000; v += 2)
+        if (in_image(v, 2)) entries[nentries++] = mem[v] | hi(mem[v + 1]);
+    trace(entries, nentries);
+
+    FILE *out = fopen(argv[i + 1], "w");
+    if (!out) {
+        printf("%s: can't write\n", argv[i + 1]);
+        return 2;
+    }
+    fprintf(out, "// translated from %s by cpu_recomp, don't edit\n\n", argv[i]);
+    fprintf(out, "#include \"cpu_internal.h\"\n#include \"cpu_bb.h\"\n#include \"cpu_aot.h\"\n\n");
+    fprintf(out, "#ifndef CPU_VARIANT_%s\n#error \"translated for the %s variant\"\n#endif\n\n",
+            VARIANT, VARIANT);
+
+    static cpu_aot_block_t blocks[0x10000];
+    u32 nblocks = 0;
+    for (u32 pc = 0; pc < 0x10000; pc++)
+        if (leader[pc] && insn[pc]) emit_block(out, pc, &blocks[nblocks++]);
+    if (nblocks > 0xFFFF) {
+        printf("%s: too many blocks\n", argv[i]);
+        return 2;
+    }
+    fprintf(out, "static const cpu_aot_block_t blocks[] = {\n");
+    for (u32 j = 0; j < nblocks; j++) {
+        cpu_aot_block_t *b = &blocks[j];
+        fprintf(out, "    { 0x%04X, { 0x%02X, 0x%02X }, %u, cpu_aot_%04X },\n", b->pc, b->pages[0],
+                b->pages[1], b->max_cycles, b->pc);
+    }
+    fprintf(out, "};\n\nstatic const u8 image[] = {");
+    for (u32 a = 0; a < len; a++) fprintf(out, "%s0x%02X,", a % 16 ? " " : "\n    ", image[a]);
+    fprintf(out, "\n};\n\nstatic const u8 mask[] = {");
+    for (u32 a = 0; a < sizeof(mask); a++) fprintf(out, "%s0x%02X,", a % 16 ? " " : "\n    ", mask[a]);
+    fprintf(out, "\n};\n\nconst cpu_aot_prog_t %s = {\n"
+            "    image, 0x%04X, 0x%X, mask, blocks, %u,\n};\n", name, base, len, nblocks);
+    if (fclose(out) != 0) {
+        printf("%s: can't write\n", argv[i + 1]);
+        return 2;
+    }
+    printf("%s: %u blocks\n", argv[i + 1], nblocks);
+    return 0;
+}
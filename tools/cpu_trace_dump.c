@@ -0,0 +1,160 @@
+// Offline decoder for cpu_trace.h trace files.
+//
+//   cpu_trace_dump a.trace           disassembles every record
+//   cpu_trace_dump a.trace b.trace   finds the first record where the two
+//                                    traces differ and prints it with the
+//                                    records leading up to it
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "cpu_opcodes.h"
+#include "cpu_trace.h"
+
+#define CONTEXT 8
+
+// built for the CPU variant that wrote the trace, see cpu_opcodes.h
+enum { M_imp, M_acc, M_imm, M_abs, M_abi, M_ind, M_zpg, M_zpi, M_zpx, M_zpy, M_rel,
+    M_one, M_abp, M_iax, M_izp, M_zpr };
+#define IDX_X 'X'
+#define IDX_Y 'Y'
+#define IDX__ 0
+
+static const struct { const char *name; u8 mode; char idx; } ops[256] = {
+#define OP(opc, instr, kind, mode, idx, cyc) [opc] = { #instr, M_##mode, IDX_##idx },
+    CPU_OPCODES(OP)
+#undef OP
+};
+static const u8 oplen[] = { 1, 1, 2, 3, 3, 3, 2, 2, 2, 2, 2, 1, 3, 3, 2, 3 };
+
+static FILE *open_trace(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        printf("%s: can't open\n", path);
+        return NULL;
+    }
+    u8 header[CPU_TRACE_HEADER];
+    u32 magic;
+    u16 size;
+    if (fread(header, CPU_TRACE_HEADER, 1, f) != 1) magic = 0;
+    else memcpy(&magic, header, 4);
+    memcpy(&size, header + 6, 2);
+    if (magic != CPU_TRACE_MAGIC || size != sizeof(cpu_trace_rec_t)) {
+        printf("%s: not a trace file, or written on a host of the other byte order\n", path);
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+static void format(const cpu_trace_rec_t *r, char *buf, size_t len) {
+    unsigned long long cycles = r->cycles | ((unsigned long long)r->cycles_hi << 32);
+    if (r->kind == CPU_TRACE_READ || r->kind == CPU_TRACE_WRITE) {
+        snprintf(buf, len, "%12llu        %s $%04X %s %02X", cycles,
+                r->kind == CPU_TRACE_READ ? "read " : "write", r->pc,
+                r->kind == CPU_TRACE_READ ? "->" : "<-", r->opc);
+        return;
+    }
+    if (r->kind == CPU_TRACE_IRQ) {
+        static const char *names[] = { "?", "NMI", "IRQ", "RST" };
+        snprintf(buf, len, "%12llu  %s -> %04X", cycles, names[r->opc & 3], r->pc);
+        return;
+    }
+
+    char text[16] = "???", bytes[12];
+    if (ops[r->opc].name) {
+        u8 mode = ops[r->opc].mode;
+        u16 w = r->op[0] | (r->op[1] << 8);
+        char idx[3] = { ',', ops[r->opc].idx, 0 };
+        if (!idx[1]) idx[0] = 0;
+        char m[5] = { 0 };
+        for (int i = 0; i < 4; i++) m[i] = toupper((unsigned char)ops[r->opc].name[i]);
+        switch (mode) {
+            case M_imp: case M_one: snprintf(text, sizeof(text), "%s", m); break;
+            case M_acc: snprintf(text, sizeof(text), "%s A", m); break;
+            case M_imm: snprintf(text, sizeof(text), "%s #$%02X", m, r->op[0]); break;
+            case M_abs: snprintf(text, sizeof(text), "%s $%04X", m, w); break;
+            case M_abi: case M_abp: snprintf(text, sizeof(text), "%s $%04X%s", m, w, idx); break;
+            case M_ind: snprintf(text, sizeof(text), "%s ($%04X)", m, w); break;
+            case M_zpg: snprintf(text, sizeof(text), "%s $%02X", m, r->op[0]); break;
+            case M_zpi: snprintf(text, sizeof(text), "%s $%02X%s", m, r->op[0], idx); break;
+            case M_zpx: snprintf(text, sizeof(text), "%s ($%02X,X)", m, r->op[0]); break;
+            case M_zpy: snprintf(text, sizeof(text), "%s ($%02X),Y", m, r->op[0]); break;
+            case M_rel: snprintf(text, sizeof(text), "%s $%04X", m,
+                                (u16)(r->pc + 2 + (s8)r->op[0])); break;
+            case M_iax: snprintf(text, sizeof(text), "%s ($%04X,X)", m, w); break;
+            case M_izp: snprintf(text, sizeof(text), "%s ($%02X)", m, r->op[0]); break;
+            case M_zpr: snprintf(text, sizeof(text), "%s $%02X,$%04X", m, r->op[0],
+                                (u16)(r->pc + 3 + (s8)r->op[1])); break;
+        }
+        switch (oplen[mode]) {
+            case 1: snprintf(bytes, sizeof(bytes), "%02X", r->opc); break;
+            case 2: snprintf(bytes, sizeof(bytes), "%02X %02X", r->opc, r->op[0]); break;
+            default: snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r->opc, r->op[0], r->op[1]);
+        }
+    } else {
+        snprintf(bytes, sizeof(bytes), "%02X", r->opc);
+    }
+    snprintf(buf, len, "%12llu  %04X  %-8s  %-14s  A:%02X X:%02X Y:%02X S:%02X P:%02X",
+            cycles, r->pc, bytes, text, r->a, r->x, r->y, r->s, r->p);
+}
+
+static int dump(FILE *f) {
+    cpu_trace_rec_t recs[4096];
+    char line[128];
+    size_t n;
+    while ((n = fread(recs, sizeof(recs[0]), 4096, f)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            format(&recs[i], line, sizeof(line));
+            puts(line);
+        }
+    }
+    return 0;
+}
+
+static int diff(FILE *a, FILE *b) {
+    // the last CONTEXT records of each, as a ring
+    cpu_trace_rec_t ra[CONTEXT], rb[CONTEXT];
+    unsigned long long i = 0;
+    char line[128];
+    for (;; i++) {
+        cpu_trace_rec_t *x = &ra[i % CONTEXT], *y = &rb[i % CONTEXT];
+        int ea = fread(x, sizeof(*x), 1, a) != 1, eb = fread(y, sizeof(*y), 1, b) != 1;
+        if (ea && eb) {
+            printf("traces are identical, %llu records\n", i);
+            return 0;
+        }
+        if (!ea && !eb && memcmp(x, y, sizeof(*x)) == 0) continue;
+
+        printf("traces diverge at record %llu", i);
+        if (ea || eb) printf(": %s ends there", ea ? "first" : "second");
+        printf("\n");
+        unsigned long long first = i >= CONTEXT - 1 ? i - (CONTEXT - 1) : 0;
+        for (unsigned long long j = first; j < i; j++) {
+            format(&ra[j % CONTEXT], line, sizeof(line));
+            printf("  %s\n", line);
+        }
+        if (!ea) {
+            format(x, line, sizeof(line));
+            printf("< %s\n", line);
+        }
+        if (!eb) {
+            format(y, line, sizeof(line));
+            printf("> %s\n", line);
+        }
+        return 1;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        printf("usage: %s trace [other-trace]\n", argv[0]);
+        return 2;
+    }
+    FILE *a = open_trace(argv[1]);
+    if (!a) return 2;
+    if (argc == 2) return dump(a);
+    FILE *b = open_trace(argv[2]);
+    if (!b) return 2;
+    return diff(a, b);
+}